@@ -0,0 +1,60 @@
+#!/bin/bash
+
+# Usage: ./bench.sh [-f] [-c baseline.json] [benchmark flags...]
+#   -f                rebuild before running
+#   -c baseline.json  compare the results against a stored baseline and fail on regressions
+# Results are written as JSON to build-release/bench_output.json; copy that file to keep a baseline.
+
+# Get the directory path of the script
+SCRIPT_DIR="$(dirname "$0")"
+
+# Benchmarks are built in release mode in their own build directory
+BUILD_DIR="$SCRIPT_DIR/build-release"
+BENCH_BIN="$BUILD_DIR/BenchChromaEdit"
+BENCH_OUT="$BUILD_DIR/bench_output.json"
+MAKE_FILE="$BUILD_DIR/Makefile"
+
+# Define build and make functions
+function build {
+  mkdir -p "$BUILD_DIR"
+  cmake -S "$SCRIPT_DIR" -B "$BUILD_DIR" -DCMAKE_BUILD_TYPE=Release
+}
+
+function makefile {
+  make -C "$BUILD_DIR" BenchChromaEdit
+}
+
+FORCE=0
+BASELINE=""
+BENCH_ARGS=()
+while [[ $# -gt 0 ]]; do
+  case "$1" in
+    -f) FORCE=1 ;;
+    -c) BASELINE="$2"; shift ;;
+    *) BENCH_ARGS+=("$1") ;;
+  esac
+  shift
+done
+
+if [[ $FORCE -eq 1 ]]; then
+  build
+  makefile
+fi
+
+# Check if Makefile exists
+if ! [ -f "$MAKE_FILE" ]; then
+  build
+fi
+
+# Check if BenchChromaEdit exists
+if ! [ -f "$BENCH_BIN" ]; then
+  makefile
+fi
+
+# Run the benchmarks
+"$BENCH_BIN" --benchmark_out="$BENCH_OUT" --benchmark_out_format=json "${BENCH_ARGS[@]}" || exit 1
+
+# Compare against the baseline
+if [ -n "$BASELINE" ]; then
+  python3 "$SCRIPT_DIR/compare_bench.py" "$BASELINE" "$BENCH_OUT"
+fi
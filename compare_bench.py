@@ -0,0 +1,60 @@
+#!/usr/bin/env python3
+"""Compare two Google Benchmark JSON outputs and fail on regressions.
+
+Usage: compare_bench.py BASELINE CURRENT [--threshold PERCENT]
+
+Benchmarks are matched by name. Exits with status 1 if any benchmark got slower
+than the threshold (default 10%), so it can gate a deploy.
+"""
+import argparse
+import json
+import sys
+
+
+def load(path):
+    with open(path) as file:
+        benchmarks = json.load(file)["benchmarks"]
+    # Skip aggregates (mean/median/stddev) when repetitions are used, except the mean
+    return {
+        b["name"]: b for b in benchmarks
+        if b.get("run_type") != "aggregate" or b.get("aggregate_name") == "mean"
+    }
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("baseline")
+    parser.add_argument("current")
+    parser.add_argument("--threshold", type=float, default=10.0, help="allowed slowdown in percent")
+    args = parser.parse_args()
+
+    baseline = load(args.baseline)
+    current = load(args.current)
+
+    regressions = 0
+    print(f"{'benchmark':<60} {'baseline':>12} {'current':>12} {'change':>8}")
+    for name, result in current.items():
+        if name not in baseline or "error_occurred" in result:
+            continue
+        before = baseline[name]["real_time"]
+        after = result["real_time"]
+        change = (after - before) / before * 100 if before else 0.0
+        flag = ""
+        if change > args.threshold:
+            flag = "  REGRESSION"
+            regressions += 1
+        unit = result.get("time_unit", "ns")
+        print(f"{name:<60} {before:>10.2f}{unit:>2} {after:>10.2f}{unit:>2} {change:>+7.1f}%{flag}")
+
+    missing = sorted(set(baseline) - set(current))
+    for name in missing:
+        print(f"{name:<60} missing from current run")
+
+    if regressions:
+        print(f"{regressions} benchmark(s) regressed by more than {args.threshold}%")
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,39 @@
+#include "bench/bench_utils.hpp"
+#include "include/batch.hpp"
+
+using namespace Bench;
+
+// Crop the same set of 1920x1080 images through the pipeline, once per format
+static void BM_BatchRun(benchmark::State& state) {
+  const std::string& format = FORMATS[state.range(0)];
+  unsigned cores = unsigned(state.range(1));
+  std::vector<fs::path> files;
+  for (int i = 0; i < 16; i++) {
+    fs::path source = image_file(format, SHAPES[1]);
+    if (source.empty()) {
+      state.SkipWithError("format not supported by this OpenCV build");
+      return;
+    }
+    fs::path copy = dist_dir() / "batch" / (std::to_string(i) + "." + format);
+    fs::create_directories(copy.parent_path());
+    fs::copy_file(source, copy, fs::copy_options::overwrite_existing);
+    files.push_back(copy);
+  }
+  std::vector<Batch::Job> jobs = Batch::make_jobs(files, dist_dir() / "batch" / "output");
+
+  // One pool across iterations, like a long-running process handling batch after batch
+  ImageEditor::MatPool pool;
+  Batch::Options options = Batch::default_options(cores);
+  options.pool = &pool;
+  ImageEditor::MatPool::Stats before = pool.stats();
+  for (auto _ : state)
+    Batch::run(jobs, options);
+  state.SetItemsProcessed(state.iterations() * jobs.size());
+  state.SetLabel(format);
+  pool_counters(state, before, pool.stats());
+}
+BENCHMARK(BM_BatchRun)
+  ->ArgNames({ "format", "cores" })
+  ->ArgsProduct({ benchmark::CreateDenseRange(0, int(FORMATS.size()) - 1, 1), { 1, 4, 16 } })
+  ->Unit(benchmark::kMillisecond)
+  ->UseRealTime();
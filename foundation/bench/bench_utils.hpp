@@ -0,0 +1,100 @@
+#ifndef BENCH_UTILS_HPP
+#define BENCH_UTILS_HPP
+
+#include "include/mat_pool.hpp"
+#include <benchmark/benchmark.h>
+#include <filesystem>
+#include <map>
+#include <opencv2/opencv.hpp>
+#include <string>
+#include <sys/resource.h>
+#include <vector>
+
+namespace Bench {
+  namespace fs = std::filesystem;
+
+  // An image size to benchmark, covering common resolutions and aspect ratios
+  struct Shape {
+    int width;
+    int height;
+  };
+
+  inline const std::vector<Shape> SHAPES = {
+    { 640, 480 },    // VGA
+    { 1920, 1080 },  // Full HD landscape
+    { 1080, 1920 },  // Full HD portrait
+    { 3840, 2160 },  // 4K
+    { 6000, 1500 },  // Panorama
+  };
+
+  // One extension for every Reader::ImageType
+  inline const std::vector<std::string> FORMATS = { "bmp", "gif", "jpg", "png", "tiff", "webp" };
+
+  // Scratch directory for generated images, removed when the benchmark exits
+  struct Dist {
+    const fs::path path = fs::temp_directory_path() / "chromaedit_bench";
+    Dist() { fs::create_directories(path); }
+    ~Dist() { fs::remove_all(path); }
+  };
+
+  inline const fs::path& dist_dir() {
+    static Dist dist;
+    return dist.path;
+  }
+
+  // A screenshot-like image: a flat background like make_image in image_editor.test.cpp, covered
+  // with solid blocks so codecs see edges and flat regions rather than a single color
+  inline cv::Mat make_image(int width, int height, int type = CV_8UC3) {
+    cv::RNG rng(width * 31 + height);
+    cv::Mat image(height, width, type, cv::Scalar(rng.uniform(0, 256), rng.uniform(0, 256), rng.uniform(0, 256)));
+    for (int i = 0; i < 64; i++) {
+      cv::Point top_left(rng.uniform(0, width), rng.uniform(0, height));
+      cv::Point bottom_right(rng.uniform(0, width), rng.uniform(0, height));
+      cv::rectangle(image, top_left, bottom_right, cv::Scalar(rng.uniform(0, 256), rng.uniform(0, 256), rng.uniform(0, 256)), cv::FILLED);
+    }
+    return image;
+  }
+
+  // Get the path of a generated image with the given format and shape, writing it on first use.
+  // Returns an empty path if OpenCV can't encode the format.
+  inline fs::path image_file(const std::string& format, const Shape& shape) {
+    static std::map<fs::path, bool> written;
+    fs::path file_path = dist_dir() / (std::to_string(shape.width) + "x" + std::to_string(shape.height) + "." + format);
+    auto iter = written.find(file_path);
+    if (iter == written.end()) {
+      bool success = cv::haveImageWriter(file_path.string()) && cv::imwrite(file_path.string(), make_image(shape.width, shape.height));
+      iter = written.emplace(file_path, success).first;
+    }
+    return iter->second ? file_path : fs::path();
+  }
+
+  // Label a run "<format> <width>x<height>" and count the pixels it processes
+  inline void describe(benchmark::State& state, const std::string& format, const Shape& shape) {
+    state.SetLabel(format + " " + std::to_string(shape.width) + "x" + std::to_string(shape.height));
+    state.SetItemsProcessed(state.iterations() * int64_t(shape.width) * shape.height);
+    state.counters["pixels"] = double(shape.width) * shape.height;
+  }
+
+  // Report how many image buffers a run had to allocate rather than take from the pool, per
+  // iteration, and the peak resident set size of the process. A steady state shows ~0 allocations.
+  inline void pool_counters(benchmark::State& state, const ImageEditor::MatPool::Stats& before, const ImageEditor::MatPool::Stats& after) {
+    double fresh = double((after.allocations - after.reused) - (before.allocations - before.reused));
+    state.counters["pool_allocs"] = benchmark::Counter(fresh, benchmark::Counter::kAvgIterations);
+    state.counters["pool_reused"] = benchmark::Counter(double(after.reused - before.reused), benchmark::Counter::kAvgIterations);
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    state.counters["max_rss_mb"] = double(usage.ru_maxrss) / 1024;
+  }
+
+  // Apply every (format, shape) combination as benchmark arguments
+  inline void formats_and_shapes(benchmark::internal::Benchmark* benchmark) {
+    benchmark->ArgNames({ "format", "shape" });
+    for (int format = 0; format < int(FORMATS.size()); format++)
+      for (int shape = 0; shape < int(SHAPES.size()); shape++)
+        benchmark->Args({ format, shape });
+    benchmark->Unit(benchmark::kMillisecond);
+  }
+
+} // namespace Bench
+
+#endif // BENCH_UTILS_HPP
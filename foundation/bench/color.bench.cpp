@@ -0,0 +1,123 @@
+#include "bench/bench_utils.hpp"
+#include "include/color.hpp"
+#include "include/pipeline.hpp"
+#include <cmath>
+
+using namespace ImageEditor;
+using namespace Bench;
+
+namespace {
+  const char* const LEVEL_NAMES[] = { "scalar", "sse", "avx2" };
+
+  // Brightness, contrast and gamma only, which 8-bit images grade through a table
+  const ColorAdjustment TONE{ 0.05, 1.2, 1, 1.1 };
+
+  // The same with a saturation boost, which needs the float kernels
+  const ColorAdjustment VIVID{ 0.05, 1.2, 1.3, 1.1 };
+
+  // A 33-point 3D LUT that slightly warms the image, the size most grading tools export
+  std::shared_ptr<const CubeLut> warm_lut() {
+    static std::shared_ptr<const CubeLut> lut = [] {
+      auto lut = std::make_shared<CubeLut>();
+      lut->size = 33;
+      for (int b = 0; b < lut->size; b++) {
+        for (int g = 0; g < lut->size; g++) {
+          for (int r = 0; r < lut->size; r++) {
+            float scale = 1.0f / float(lut->size - 1);
+            lut->table.insert(lut->table.end(), { std::min(1.0f, r * scale * 1.05f), g * scale, b * scale * 0.95f });
+          }
+        }
+      }
+      return lut;
+    }();
+    return lut;
+  }
+
+  // The grades benchmarked, by argument
+  ColorGrade make_grade(int kind) {
+    switch (kind) {
+    case 0: return ColorGrade(TONE);
+    case 1: return ColorGrade(VIVID);
+    default: return ColorGrade(VIVID, warm_lut());
+    }
+  }
+
+  const char* const GRADE_NAMES[] = { "tone", "vivid", "vivid+cube" };
+
+  void grades_levels_and_shapes(benchmark::internal::Benchmark* benchmark) {
+    benchmark->ArgNames({ "grade", "level", "shape" });
+    for (int kind = 0; kind < 3; kind++)
+      for (int level = 0; level <= int(supported_simd_level()); level++)
+        for (int shape = 0; shape < int(SHAPES.size()); shape++)
+          benchmark->Args({ kind, level, shape });
+    benchmark->Unit(benchmark::kMillisecond);
+  }
+} // namespace
+
+static void BM_ColorGrade(benchmark::State& state) {
+  ColorGrade grade = make_grade(int(state.range(0)));
+  SimdLevel level = SimdLevel(state.range(1));
+  const Shape& shape = SHAPES[state.range(2)];
+  cv::Mat image = make_image(shape.width, shape.height);
+  set_simd_level(level);
+  // Graded in place over and over, which costs the same every time since no kernel branches on values
+  for (auto _ : state) {
+    grade.apply(image);
+    benchmark::DoNotOptimize(image.data);
+  }
+  set_simd_level(supported_simd_level());
+  describe(state, std::string(GRADE_NAMES[state.range(0)]) + " " + LEVEL_NAMES[state.range(1)], shape);
+}
+BENCHMARK(BM_ColorGrade)->Apply(grades_levels_and_shapes);
+
+// The VIVID grade as a plain per-pixel OpenCV loop, the baseline for BM_ColorGrade
+static void BM_ColorNaive(benchmark::State& state) {
+  const Shape& shape = SHAPES[state.range(0)];
+  cv::Mat image = make_image(shape.width, shape.height);
+  for (auto _ : state) {
+    for (int y = 0; y < image.rows; y++) {
+      for (int x = 0; x < image.cols; x++) {
+        cv::Vec3b& pixel = image.at<cv::Vec3b>(y, x);
+        double values[3];
+        for (int c = 0; c < 3; c++)
+          values[c] = std::clamp((pixel[c] / 255.0 + VIVID.brightness - 0.5) * VIVID.contrast + 0.5, 0.0, 1.0);
+        double luma = 0.114 * values[0] + 0.587 * values[1] + 0.299 * values[2];
+        for (int c = 0; c < 3; c++) {
+          double value = std::clamp(luma + VIVID.saturation * (values[c] - luma), 0.0, 1.0);
+          pixel[c] = cv::saturate_cast<uchar>(std::pow(value, 1 / VIVID.gamma) * 255);
+        }
+      }
+    }
+    benchmark::DoNotOptimize(image.data);
+  }
+  describe(state, "naive", shape);
+}
+BENCHMARK(BM_ColorNaive)->DenseRange(0, int(SHAPES.size()) - 1)->ArgName("shape")->Unit(benchmark::kMillisecond);
+
+// Grade the whole decoded image, then crop the square, as separate passes
+static void BM_GradeThenCrop(benchmark::State& state) {
+  const Shape& shape = SHAPES[state.range(0)];
+  fs::path input = image_file("png", shape);
+  ColorGrade grade(VIVID);
+  for (auto _ : state) {
+    Result<cv::Mat> image = read_image(input, ReadMode::UNCHANGED);
+    grade.apply(image.data);
+    Result<cv::Mat> square = crop_square(image.data, PivotRect());
+    benchmark::DoNotOptimize(square.data.data);
+  }
+  describe(state, "png", shape);
+}
+BENCHMARK(BM_GradeThenCrop)->DenseRange(0, int(SHAPES.size()) - 1)->ArgName("shape")->Unit(benchmark::kMillisecond);
+
+// Read only the square and grade it in the same pass, as crop_square with a grade does
+static void BM_GradedCropSquare(benchmark::State& state) {
+  const Shape& shape = SHAPES[state.range(0)];
+  fs::path input = image_file("png", shape);
+  ColorGrade grade(VIVID);
+  for (auto _ : state) {
+    Result<cv::Mat> square = Pipeline(input).crop_square(PivotRect()).color(grade).run();
+    benchmark::DoNotOptimize(square.data.data);
+  }
+  describe(state, "png", shape);
+}
+BENCHMARK(BM_GradedCropSquare)->DenseRange(0, int(SHAPES.size()) - 1)->ArgName("shape")->Unit(benchmark::kMillisecond);
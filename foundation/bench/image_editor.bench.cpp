@@ -0,0 +1,242 @@
+#include "bench/bench_utils.hpp"
+#include "include/auto_pivot.hpp"
+#include "include/image_editor.hpp"
+#include "include/multi_crop.hpp"
+#include "include/region_reader.hpp"
+
+using namespace ImageEditor;
+using namespace Bench;
+
+static void BM_ReadImage(benchmark::State& state) {
+  const std::string& format = FORMATS[state.range(0)];
+  const Shape& shape = SHAPES[state.range(1)];
+  fs::path input = image_file(format, shape);
+  if (input.empty()) {
+    state.SkipWithError("format not supported by this OpenCV build");
+    return;
+  }
+  for (auto _ : state) {
+    Result<cv::Mat> image = read_image(input);
+    benchmark::DoNotOptimize(image.data.data);
+  }
+  describe(state, format, shape);
+  state.SetBytesProcessed(state.iterations() * int64_t(fs::file_size(input)));
+}
+BENCHMARK(BM_ReadImage)->Apply(formats_and_shapes);
+
+// Same as BM_ReadImage, but through a workspace with a pool, as the batch workers read
+static void BM_ReadImagePooled(benchmark::State& state) {
+  const std::string& format = FORMATS[state.range(0)];
+  const Shape& shape = SHAPES[state.range(1)];
+  fs::path input = image_file(format, shape);
+  if (input.empty()) {
+    state.SkipWithError("format not supported by this OpenCV build");
+    return;
+  }
+  MatPool pool;
+  Workspace workspace{ &pool };
+  MatPool::Stats before = pool.stats();
+  for (auto _ : state) {
+    Result<cv::Mat> image = read_image(input, workspace);
+    benchmark::DoNotOptimize(image.data.data);
+  }
+  describe(state, format, shape);
+  state.SetBytesProcessed(state.iterations() * int64_t(fs::file_size(input)));
+  pool_counters(state, before, pool.stats());
+}
+BENCHMARK(BM_ReadImagePooled)->Apply(formats_and_shapes);
+
+static void BM_ReadSquare(benchmark::State& state) {
+  const std::string& format = FORMATS[state.range(0)];
+  const Shape& shape = SHAPES[state.range(1)];
+  fs::path input = image_file(format, shape);
+  if (input.empty()) {
+    state.SkipWithError("format not supported by this OpenCV build");
+    return;
+  }
+  for (auto _ : state) {
+    Result<cv::Mat> image = read_square(input, PivotRect());
+    benchmark::DoNotOptimize(image.data.data);
+  }
+  describe(state, format, shape);
+}
+BENCHMARK(BM_ReadSquare)->Apply(formats_and_shapes);
+
+// Same as BM_ReadSquare, with the square placed by the content of the image
+static void BM_ReadSquareAuto(benchmark::State& state) {
+  const std::string& format = FORMATS[state.range(0)];
+  const Shape& shape = SHAPES[state.range(1)];
+  fs::path input = image_file(format, shape);
+  if (input.empty()) {
+    state.SkipWithError("format not supported by this OpenCV build");
+    return;
+  }
+  for (auto _ : state) {
+    Result<cv::Mat> image = read_square(input, PivotRect(HorizontalPivot::AUTO, VerticalPivot::AUTO));
+    benchmark::DoNotOptimize(image.data.data);
+  }
+  describe(state, format, shape);
+}
+BENCHMARK(BM_ReadSquareAuto)->Apply(formats_and_shapes);
+
+// Placing an AUTO square from the file alone, as the lossless JPEG crop does: a 1/8 scale decode
+// and the scoring, compared with BM_ReadImage for the same image
+static void BM_ResolveAutoPivot(benchmark::State& state) {
+  const std::string& format = FORMATS[state.range(0)];
+  const Shape& shape = SHAPES[state.range(1)];
+  fs::path input = image_file(format, shape);
+  if (input.empty()) {
+    state.SkipWithError("format not supported by this OpenCV build");
+    return;
+  }
+  for (auto _ : state) {
+    PivotRect pivot_rect = resolve_auto_pivot(input, PivotRect(HorizontalPivot::AUTO, VerticalPivot::AUTO));
+    benchmark::DoNotOptimize(pivot_rect.auto_origin);
+  }
+  describe(state, format, shape);
+}
+BENCHMARK(BM_ResolveAutoPivot)->Apply(formats_and_shapes);
+
+static void BM_SaveImage(benchmark::State& state) {
+  const std::string& format = FORMATS[state.range(0)];
+  const Shape& shape = SHAPES[state.range(1)];
+  fs::path output = dist_dir() / "save" / ("image." + format);
+  if (!cv::haveImageWriter(output.string())) {
+    state.SkipWithError("format not supported by this OpenCV build");
+    return;
+  }
+  cv::Mat image = make_image(shape.width, shape.height);
+  for (auto _ : state) {
+    if (!save_image(image, output)) {
+      state.SkipWithError("save_image failed");
+      break;
+    }
+  }
+  describe(state, format, shape);
+  if (fs::exists(output))
+    state.counters["output_bytes"] = double(fs::file_size(output));
+}
+BENCHMARK(BM_SaveImage)->Apply(formats_and_shapes);
+
+// Same as BM_SaveImage, but encoding into the reused buffer of a workspace
+static void BM_SaveImageWorkspace(benchmark::State& state) {
+  const std::string& format = FORMATS[state.range(0)];
+  const Shape& shape = SHAPES[state.range(1)];
+  fs::path output = dist_dir() / "save" / ("workspace." + format);
+  if (!cv::haveImageWriter(output.string())) {
+    state.SkipWithError("format not supported by this OpenCV build");
+    return;
+  }
+  cv::Mat image = make_image(shape.width, shape.height);
+  Workspace workspace;
+  for (auto _ : state) {
+    if (!save_image(image, output, workspace)) {
+      state.SkipWithError("save_image failed");
+      break;
+    }
+  }
+  describe(state, format, shape);
+  state.counters["output_bytes"] = double(workspace.buffer.size());
+}
+BENCHMARK(BM_SaveImageWorkspace)->Apply(formats_and_shapes);
+
+// Encode one image in memory per format and profile, to weigh encode throughput against output
+// size. bytes_per_pixel is the size of the encoded image over its pixels.
+static void BM_EncodeProfile(benchmark::State& state) {
+  const std::string& format = FORMATS[state.range(0)];
+  const EncodeProfile profile = EncodeProfile(state.range(1));
+  const Shape shape{ 1920, 1080 };
+  if (!cv::haveImageWriter("image." + format)) {
+    state.SkipWithError("format not supported by this OpenCV build");
+    return;
+  }
+  cv::Mat image = make_image(shape.width, shape.height);
+  std::size_t encoded_size = 0;
+  for (auto _ : state) {
+    Result<std::vector<uchar>> encoded = encode_image(image, format, profile);
+    if (encoded.status == Status::FAILURE) {
+      state.SkipWithError("encode_image failed");
+      break;
+    }
+    encoded_size = encoded.data.size();
+  }
+  describe(state, format, shape);
+  state.SetLabel(format + " " + get_encode_profile_name(profile));
+  state.counters["output_bytes"] = double(encoded_size);
+  state.counters["bytes_per_pixel"] = double(encoded_size) / (double(shape.width) * shape.height);
+}
+BENCHMARK(BM_EncodeProfile)->ArgNames({ "format", "profile" })
+  ->ArgsProduct({ benchmark::CreateDenseRange(0, int64_t(FORMATS.size()) - 1, 1), { 0, 1, 2 } })->Unit(benchmark::kMillisecond);
+
+static void BM_CropSquare(benchmark::State& state) {
+  const std::string& format = FORMATS[state.range(0)];
+  const Shape& shape = SHAPES[state.range(1)];
+  fs::path input = image_file(format, shape);
+  if (input.empty()) {
+    state.SkipWithError("format not supported by this OpenCV build");
+    return;
+  }
+  fs::path output = dist_dir() / "crop" / input.filename();
+  for (auto _ : state)
+    crop_square(input, PivotRect(HorizontalPivot::RIGHT, VerticalPivot::BOTTOM), output);
+  describe(state, format, shape);
+}
+BENCHMARK(BM_CropSquare)->Apply(formats_and_shapes);
+
+// A thumbnail set: three pivots at full size and three thumbnail sizes
+static std::vector<OutputSpec> thumbnail_specs(const fs::path& input) {
+  fs::path directory = dist_dir() / "thumbnails";
+  std::string extension = input.extension().string();
+  return {
+    OutputSpec(PivotRect(HorizontalPivot::LEFT, VerticalPivot::TOP), 0, directory / ("left" + extension)),
+    OutputSpec(PivotRect(), 0, directory / ("center" + extension)),
+    OutputSpec(PivotRect(HorizontalPivot::RIGHT, VerticalPivot::BOTTOM), 0, directory / ("right" + extension)),
+    OutputSpec(PivotRect(), 512, directory / ("512" + extension)),
+    OutputSpec(PivotRect(), 256, directory / ("256" + extension)),
+    OutputSpec(PivotRect(), 64, directory / ("64" + extension)),
+  };
+}
+
+// The thumbnail set made the old way: one crop_square per output and a resize pass per thumbnail
+static void BM_ThumbnailsSeparate(benchmark::State& state) {
+  const std::string& format = FORMATS[state.range(0)];
+  const Shape& shape = SHAPES[state.range(1)];
+  fs::path input = image_file(format, shape);
+  if (input.empty()) {
+    state.SkipWithError("format not supported by this OpenCV build");
+    return;
+  }
+  std::vector<OutputSpec> specs = thumbnail_specs(input);
+  for (auto _ : state) {
+    for (const auto& spec : specs) {
+      if (spec.size == 0) {
+        crop_square(input, spec.pivot_rect, spec.output);
+        continue;
+      }
+      Result<cv::Mat> square = read_square(input, spec.pivot_rect, ReadMode::UNCHANGED);
+      cv::Mat thumbnail;
+      cv::resize(square.data, thumbnail, cv::Size(spec.size, spec.size), 0, 0, cv::INTER_AREA);
+      save_image(thumbnail, spec.output);
+    }
+  }
+  describe(state, format, shape);
+}
+BENCHMARK(BM_ThumbnailsSeparate)->Apply(formats_and_shapes);
+
+// The same thumbnail set from one decode and a shared pyramid
+static void BM_ThumbnailsCropSquares(benchmark::State& state) {
+  const std::string& format = FORMATS[state.range(0)];
+  const Shape& shape = SHAPES[state.range(1)];
+  fs::path input = image_file(format, shape);
+  if (input.empty()) {
+    state.SkipWithError("format not supported by this OpenCV build");
+    return;
+  }
+  std::vector<OutputSpec> specs = thumbnail_specs(input);
+  for (auto _ : state) {
+    std::vector<Status> statuses = crop_squares(input, specs);
+    benchmark::DoNotOptimize(statuses.data());
+  }
+  describe(state, format, shape);
+}
+BENCHMARK(BM_ThumbnailsCropSquares)->Apply(formats_and_shapes);
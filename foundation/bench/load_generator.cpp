@@ -0,0 +1,156 @@
+#include "include/reader.hpp"
+#include "include/server.hpp"
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Sends crop requests to a running crop server (ChromaEdit --serve SOCKET) from several clients
+// and reports the latency the clients saw, the throughput and the server's cache stats.
+//
+// Usage: ChromaEditLoad SOCKET DIRECTORY [--clients N] [--requests N] [--format EXT] [--bytes]
+//  --clients   Concurrent connections (default: 8)
+//  --requests  Requests per connection (default: 500)
+//  --format    Output format (default: jpg)
+//  --bytes     Send the encoded images instead of their paths
+//
+// Requests pick an image from DIRECTORY with a skew, 80% of them going to a fifth of the images,
+// and one of 9 pivots and 3 sizes, so both caches see a mix of hits and misses.
+
+namespace fs = std::filesystem;
+using Clock = std::chrono::steady_clock;
+
+namespace {
+  struct Settings {
+    fs::path socket_path;
+    fs::path directory;
+    int clients = 8;
+    int requests = 500;
+    std::string format = "jpg";
+    bool send_bytes = false;
+  };
+
+  bool parse_settings(int argc, char** argv, Settings& settings) {
+    if (argc < 3)
+      return false;
+    settings.socket_path = argv[1];
+    settings.directory = argv[2];
+    try {
+      for (int i = 3; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--clients" && i + 1 < argc)
+          settings.clients = std::max(1, std::stoi(argv[++i]));
+        else if (arg == "--requests" && i + 1 < argc)
+          settings.requests = std::max(1, std::stoi(argv[++i]));
+        else if (arg == "--format" && i + 1 < argc)
+          settings.format = argv[++i];
+        else if (arg == "--bytes")
+          settings.send_bytes = true;
+        else
+          return false;
+      }
+    }
+    catch (const std::exception&) {
+      return false;
+    }
+    return true;
+  }
+
+  // The latency at quantile q of sorted latencies, in milliseconds
+  double quantile_ms(const std::vector<Clock::duration>& sorted, double q) {
+    std::size_t index = std::min(sorted.size() - 1, std::size_t(q * double(sorted.size())));
+    return std::chrono::duration<double, std::milli>(sorted[index]).count();
+  }
+
+  std::vector<uchar> read_bytes(const fs::path& path) {
+    std::ifstream file(path, std::ios::binary);
+    return std::vector<uchar>(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+  }
+} // namespace
+
+int main(int argc, char** argv) {
+  Settings settings;
+  if (!parse_settings(argc, argv, settings)) {
+    std::cerr << "Usage: " << argv[0] << " SOCKET DIRECTORY [--clients N] [--requests N] [--format EXT] [--bytes]" << std::endl;
+    return 2;
+  }
+  std::vector<fs::path> images = Reader::find_image_files(settings.directory.string());
+  if (images.empty()) {
+    std::cerr << "No images in " << settings.directory << std::endl;
+    return 1;
+  }
+  std::sort(images.begin(), images.end());
+  std::vector<std::vector<uchar>> contents;
+  if (settings.send_bytes) {
+    for (const auto& image : images)
+      contents.push_back(read_bytes(image));
+  }
+
+  const char HORIZONTAL[] = { 'l', 'c', 'r' };
+  const char VERTICAL[] = { 't', 'c', 'b' };
+  const int SIZES[] = { 0, 256, 64 };
+  std::vector<std::vector<Clock::duration>> latencies(settings.clients);
+  std::vector<int> failures(settings.clients, 0);
+
+  Clock::time_point start = Clock::now();
+  std::vector<std::thread> clients;
+  for (int c = 0; c < settings.clients; c++) {
+    clients.emplace_back([&, c] {
+      Server::Client client(settings.socket_path);
+      if (!client.is_open()) {
+        failures[c] = settings.requests;
+        return;
+      }
+      std::mt19937 random(unsigned(c) * 7919u + 1);
+      std::size_t hot = std::max<std::size_t>(1, images.size() / 5);
+      for (int r = 0; r < settings.requests; r++) {
+        std::size_t index = random() % 10 < 8 ? random() % hot : random() % images.size();
+        Server::Request request;
+        if (settings.send_bytes)
+          request.bytes = contents[index];
+        else
+          request.path = fs::absolute(images[index]);
+        request.pivot_rect = ImageEditor::PivotRect(ImageEditor::char_to_horizontal_pivot(HORIZONTAL[random() % 3]),
+          ImageEditor::char_to_vertical_pivot(VERTICAL[random() % 3]));
+        request.size = SIZES[random() % 3];
+        request.format = settings.format;
+
+        Clock::time_point sent = Clock::now();
+        ImageEditor::Result<std::vector<uchar>> reply = client.crop(request);
+        latencies[c].push_back(Clock::now() - sent);
+        if (reply.status == ImageEditor::Status::FAILURE)
+          failures[c]++;
+      }
+    });
+  }
+  for (auto& client : clients)
+    client.join();
+  double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+  std::vector<Clock::duration> all;
+  for (const auto& client_latencies : latencies)
+    all.insert(all.end(), client_latencies.begin(), client_latencies.end());
+  int failed = 0;
+  for (int count : failures)
+    failed += count;
+  if (all.empty()) {
+    std::cerr << "Failed to connect to " << settings.socket_path << std::endl;
+    return 1;
+  }
+  std::sort(all.begin(), all.end());
+
+  std::cout << "requests: " << all.size() << " (" << failed << " failed) in " << seconds << " s, "
+    << double(all.size()) / seconds << " requests/s" << std::endl
+    << "latency ms: p50 " << quantile_ms(all, 0.5) << ", p90 " << quantile_ms(all, 0.9) << ", p99 "
+    << quantile_ms(all, 0.99) << ", max " << quantile_ms(all, 1.0) << std::endl;
+  Server::Client client(settings.socket_path);
+  ImageEditor::Result<std::string> stats = client.stats();
+  if (stats.status == ImageEditor::Status::SUCCESS)
+    std::cout << "server: " << stats.data << std::endl;
+  return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,57 @@
+#include "bench/bench_utils.hpp"
+#include "include/probe.hpp"
+#include "include/reader.hpp"
+#include <atomic>
+#include <fstream>
+
+using namespace Bench;
+
+// A directory with the given number of empty files, a third of them not images,
+// spread over 16 subdirectories
+static fs::path make_tree(int files) {
+  fs::path root = dist_dir() / ("tree" + std::to_string(files));
+  if (fs::exists(root))
+    return root;
+  const char* extensions[] = { "png", "jpg", "txt" };
+  for (int i = 0; i < files; i++) {
+    fs::path directory = root / ("dir" + std::to_string(i % 16));
+    fs::create_directories(directory);
+    std::ofstream(directory / ("file" + std::to_string(i) + "." + extensions[i % 3]));
+  }
+  return root;
+}
+
+static void BM_FindImageFiles(benchmark::State& state) {
+  fs::path root = make_tree(int(state.range(0))) / "dir0";
+  std::size_t found = 0;
+  for (auto _ : state)
+    found = Reader::find_image_files(root).size();
+  state.SetItemsProcessed(state.iterations() * found);
+}
+BENCHMARK(BM_FindImageFiles)->Arg(1600)->Arg(16000);
+
+static void BM_ScanImageFiles(benchmark::State& state) {
+  fs::path root = make_tree(int(state.range(0)));
+  Reader::ScanOptions options{ true, unsigned(state.range(1)) };
+  std::size_t found = 0;
+  for (auto _ : state) {
+    found = 0;
+    Reader::scan_image_files(root, [&](const fs::path&) { found++; }, options);
+  }
+  state.SetItemsProcessed(state.iterations() * found);
+}
+BENCHMARK(BM_ScanImageFiles)->ArgNames({ "files", "threads" })->ArgsProduct({ { 1600, 16000 }, { 1, 4 } })->UseRealTime();
+
+// The cost of identifying files by their headers: every file is opened and its head read, and
+// here every one of them is rejected, since the files are empty
+static void BM_ProbeImageFiles(benchmark::State& state) {
+  fs::path root = make_tree(int(state.range(0)));
+  Reader::ScanOptions options{ true, unsigned(state.range(1)) };
+  std::atomic<std::size_t> probed = 0;
+  for (auto _ : state) {
+    probed = 0;
+    Reader::walk_files(root, [&](const std::vector<fs::path>& files) { probed += Reader::probe_images(files).size(); }, options);
+  }
+  state.SetItemsProcessed(state.iterations() * probed);
+}
+BENCHMARK(BM_ProbeImageFiles)->ArgNames({ "files", "threads" })->ArgsProduct({ { 1600, 16000 }, { 1, 4 } })->UseRealTime();
@@ -0,0 +1,148 @@
+#ifndef ARCHIVE_HPP
+#define ARCHIVE_HPP
+
+#include "include/image_editor.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <functional>
+#include <optional>
+#include <span>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace Archive {
+  namespace fs = std::filesystem;
+
+  // The archive formats that can be read and written
+  enum class Format { TAR, ZIP };
+
+  // Given a file path as an argument, return its archive format by extension (.tar or .zip),
+  // std::nullopt for any other file
+  std::optional<Format> format_of(const fs::path& path);
+
+  // A regular file stored in an archive
+  struct Member {
+    std::string name;           // Path inside the archive
+    std::uint64_t size;         // Bytes once extracted
+    std::uint64_t offset;       // Where the stored bytes start in the archive file
+    std::uint64_t stored_size;  // Bytes in the archive, fewer than size when the member is deflated
+    bool deflated;              // Zip members only
+    std::uint32_t crc;          // CRC-32 of the extracted bytes, zip members only
+  };
+
+  // A tar (ustar, with GNU and pax long names) or zip (with zip64) archive opened for reading,
+  // in the format selected by the extension of path. The file is memory-mapped and only its
+  // headers are parsed up front, so members are not extracted to disk: members stored as they are,
+  // which is every tar member and most zipped images, are read in place without a copy, and
+  // deflated zip members are inflated into a caller buffer. All member functions are thread-safe.
+  // Example usage: Source source("/path/to/screenshots.tar"); for (const Member* member : source.image_members()) ...
+  class Source {
+  public:
+    explicit Source(const fs::path& path);
+    ~Source();
+
+    Source(const Source&) = delete;
+    Source& operator=(const Source&) = delete;
+
+    // Returns true if the archive was mapped and its headers could be read
+    bool is_open() const;
+
+    Format format() const;
+
+    // The regular files of the archive, in archive order
+    const std::vector<Member>& members() const;
+
+    // The members with an image extension (see Reader::image_type_map), in archive order
+    std::vector<const Member*> image_members() const;
+
+    // Get the bytes of a member. Members stored as they are come back as a view into the mapping,
+    // valid while the source lives; deflated members are inflated into buffer, whose capacity is
+    // reused. Returns std::nullopt if the member is damaged.
+    std::optional<std::span<const std::byte>> read(const Member& member, std::vector<std::byte>& buffer) const;
+
+  private:
+    bool index_tar();
+    bool index_zip();
+
+    fs::path path;
+    Format archive_format = Format::TAR;
+    const std::byte* data = nullptr;
+    std::size_t size = 0;
+    std::vector<Member> entries;
+    bool open = false;
+  };
+
+  // An archive written sequentially, in the format selected by the extension of path. Every member
+  // is written as soon as it is added, so only the bytes of one member are held at a time. Zip
+  // members are stored, or deflated when that makes them smaller (BMP and TIFF), and zip64 records
+  // are written when the archive outgrows the 32-bit fields.
+  // Example usage: Sink sink("/path/to/cropped.zip"); sink.add("shot.png", bytes); sink.close();
+  class Sink {
+  public:
+    explicit Sink(const fs::path& path);
+    ~Sink();
+
+    Sink(const Sink&) = delete;
+    Sink& operator=(const Sink&) = delete;
+
+    bool is_open() const;
+
+    // Append a member. Returns false on write errors.
+    bool add(const std::string& name, std::span<const std::byte> bytes);
+
+    // Write the end of the archive and close the file. Returns true on success, false otherwise.
+    // On failure no output file is left behind. Called by the destructor if needed.
+    bool close();
+
+  private:
+    // What the zip central directory needs to know about a member already written
+    struct Entry {
+      std::string name;
+      std::uint32_t crc;
+      std::uint64_t size;
+      std::uint64_t stored_size;
+      std::uint64_t offset;
+      std::uint16_t method;
+    };
+
+    bool write(const void* bytes, std::size_t count);
+    bool add_tar(const std::string& name, std::span<const std::byte> bytes);
+    bool add_zip(const std::string& name, std::span<const std::byte> bytes);
+    bool finish_zip();
+
+    fs::path path;
+    Format archive_format = Format::TAR;
+    std::FILE* file = nullptr;
+    std::uint64_t written = 0;
+    std::vector<Entry> zip_entries;
+    std::uint16_t dos_time = 0;
+    std::uint16_t dos_date = 0;
+    bool failed = false;
+  };
+
+  // The outcome of one image member of crop_archive
+  struct MemberStatus {
+    std::string name;
+    ImageEditor::Status status;
+  };
+
+  // Called once per image member, in archive order, after the output was closed. A member reported as
+  // SUCCESS is in the output.
+  using StatusCallback = std::function<void(const MemberStatus&)>;
+
+  // Crop the square of every image member of input, with the pivots of its name suffix (see
+  // ImageEditor::parse_pivot_suffix), and write it to the output archive under the same name and in
+  // the same order. Members are decoded straight from the mapped input on threads workers, JPEGs are
+  // cropped losslessly (see crop_square_jpeg), and nothing is extracted to disk. Input and output may
+  // be of different formats. Members that fail are left out of the output.
+  // Returns the status of every image member in archive order.
+  // Example usage: crop_archive("/path/to/screenshots.zip", "/path/to/cropped.tar");
+  std::vector<MemberStatus> crop_archive(const fs::path& input, const fs::path& output,
+    unsigned threads = std::thread::hardware_concurrency(), StatusCallback on_status = nullptr);
+
+} // namespace Archive
+
+#endif // ARCHIVE_HPP
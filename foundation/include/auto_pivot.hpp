@@ -0,0 +1,52 @@
+#ifndef AUTO_PIVOT_HPP
+#define AUTO_PIVOT_HPP
+
+#include "include/image_editor.hpp"
+#include "include/probe.hpp"
+#include <cstddef>
+#include <filesystem>
+#include <span>
+
+namespace ImageEditor {
+  namespace fs = std::filesystem;
+
+  // Previews for AUTO pivots are scored at this fraction of the image size, per side
+  constexpr int AUTO_PIVOT_SCALE = 8;
+
+  // Returns true if either pivot of pivot_rect is AUTO
+  bool is_auto_pivot(const PivotRect& pivot_rect);
+
+  // Place the square of a width x height image by its content. Every window along the long side is
+  // scored by the gradient energy of preview, a picture of the image at any size, and the window
+  // with the most edges wins; ties go to the one closest to the center, and a flat image stays
+  // centered. The square spans the whole short side, so the integral image of the energy collapses
+  // to a prefix sum along the long side and each window is scored in constant time. Previews much
+  // bigger than 1/AUTO_PIVOT_SCALE of the image are reduced first.
+  // Returns pivot_rect with auto_origin set when the pivot along the long side is AUTO, otherwise
+  // pivot_rect as it is (AUTO then falls back to CENTER, see get_square_region).
+  PivotRect resolve_auto_pivot(const cv::Mat& preview, int width, int height, const PivotRect& pivot_rect);
+
+  // Same as above, for the stored frame of an image shown with an EXIF orientation (see
+  // orientation.hpp): preview and width x height are stored, pivot_rect and the auto_origin it
+  // returns are oriented. Gradient energy doesn't change when the image turns, so the square is
+  // scored in the stored frame and only its corner is mapped.
+  PivotRect resolve_auto_pivot(const cv::Mat& preview, int width, int height, int orientation, const PivotRect& pivot_rect);
+
+  // Same as above, scoring a grayscale preview decoded at 1/AUTO_PIVOT_SCALE scale. JPEG decoders
+  // scale the DCT, so the preview costs a small fraction of a full decode; other formats are
+  // decoded whole and reduced. The preview is decoded in the stored frame and the EXIF orientation
+  // of the header is accounted for, like the crops that read the stored frame.
+  PivotRect resolve_auto_pivot(const fs::path& image_path, const PivotRect& pivot_rect);
+
+  // Same as above, with the header of image_path already probed
+  PivotRect resolve_auto_pivot(const fs::path& image_path, const Reader::ImageInfo& info, const PivotRect& pivot_rect);
+
+  // Same as above, for an encoded image held in memory
+  PivotRect resolve_auto_pivot(std::span<const std::byte> image, const PivotRect& pivot_rect);
+
+  // Same as above, with the header of image already probed
+  PivotRect resolve_auto_pivot(std::span<const std::byte> image, const Reader::ImageInfo& info, const PivotRect& pivot_rect);
+
+} // namespace ImageEditor
+
+#endif // AUTO_PIVOT_HPP
@@ -0,0 +1,172 @@
+#ifndef BATCH_HPP
+#define BATCH_HPP
+
+#include "include/bounded_queue.hpp"
+#include "include/color.hpp"
+#include "include/image_editor.hpp"
+#include "include/mat_pool.hpp"
+#include "include/memory_scheduler.hpp"
+#include "include/probe.hpp"
+#include "include/stream_crop.hpp"
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+namespace Batch {
+  namespace fs = std::filesystem;
+  using ImageEditor::PivotRect;
+  using ImageEditor::Status;
+
+  // A single unit of work: crop the square of input selected by pivot_rect and write it to output
+  struct Job {
+    fs::path input;
+    PivotRect pivot_rect;
+    fs::path output;
+    // The header of input when the caller already probed it (see Reader::probe_image_files). The
+    // decoder then routes the job by its true type without reading the header again.
+    std::optional<Reader::ImageInfo> info;
+    // Encoder settings for this output, instead of Options::encode_profile
+    std::optional<ImageEditor::EncodeProfile> profile;
+
+    Job(fs::path input = {}, PivotRect pivot_rect = PivotRect(), fs::path output = {},
+      std::optional<Reader::ImageInfo> info = std::nullopt, std::optional<ImageEditor::EncodeProfile> profile = std::nullopt)
+      : input(std::move(input)), pivot_rect(pivot_rect), output(std::move(output)), info(info), profile(profile) {
+    }
+  };
+
+  // The pipeline stages a job passes through. A finished job reports DONE on success,
+  // otherwise the stage that failed.
+  enum class Stage {
+    DECODE,
+    TRANSFORM,
+    ENCODE,
+    DONE
+  };
+
+  // The outcome of one job
+  struct FileStatus {
+    std::size_t index;  // The order in which the job was submitted
+    fs::path input;
+    PivotRect pivot_rect;
+    fs::path output;
+    Status status;
+    Stage stage;
+    std::uint64_t input_hash;  // Manifest::hash_file of input when Options::hash_inputs, otherwise 0
+  };
+
+  // Worker and queue sizing for the pipeline
+  struct Options {
+    unsigned decode_workers;
+    unsigned transform_workers;
+    unsigned encode_workers;
+    std::size_t queue_capacity;  // Maximum number of jobs waiting between two stages
+    ImageEditor::MatPool* pool = nullptr;  // Pixel buffers shared by the workers, the engine makes its own when null
+    ImageEditor::ReadMode read_mode = ImageEditor::ReadMode::UNCHANGED;  // Channels and depth kept by the decoder
+    std::size_t tile_budget = ImageEditor::DEFAULT_TILE_BUDGET;  // Memory of one streamed crop, per decode worker
+    std::optional<ImageEditor::ColorGrade> grade;  // Applied to every square after the crop. Graded jobs always decode.
+    std::size_t memory_budget = 0;  // Estimated bytes of the jobs in flight, see MemoryScheduler. 0 for no limit.
+    std::size_t schedule_window = 256;  // Submitted jobs the scheduler picks from, largest first
+    ImageEditor::EncodeProfile encode_profile = ImageEditor::EncodeProfile::FAST;  // For jobs without a profile of their own
+    bool hash_inputs = false;  // Hash every input on its decode worker, see FileStatus::input_hash
+  };
+
+  // Split the available cores between the stages. Decode and encode dominate the cost, so they
+  // share most of the cores and the transform stage gets an eighth.
+  Options default_options(unsigned cores = std::thread::hardware_concurrency());
+
+  // Called once per job when it leaves the pipeline. Calls are serialized by the engine.
+  using StatusCallback = std::function<void(const FileStatus&)>;
+
+  // A staged decode -> transform -> encode pipeline. Every stage runs its own worker threads and
+  // the stages are connected by bounded queues, so reading, cropping and writing of different
+  // files overlap while the number of decoded images in memory stays bounded. Decoded pixels come
+  // from a MatPool and every worker keeps its own encoded-bytes buffer, so a batch of same-sized
+  // images stops allocating image memory once the pipeline is full.
+  //
+  // Jobs enter the decode stage through a MemoryScheduler: a job is admitted once its estimated
+  // bytes fit the memory budget next to the jobs still in flight, and the largest waiting job
+  // goes first, so the run does not end on one straggling big image. Jobs without a header are
+  // probed on submit only when there is a budget; otherwise they count as 0 bytes and their header
+  // is read by the decode worker.
+  class Engine {
+  public:
+    explicit Engine(const Options& options = default_options(), StatusCallback on_status = nullptr);
+    ~Engine();
+
+    Engine(const Engine&) = delete;
+    Engine& operator=(const Engine&) = delete;
+
+    // Queue a job, waiting while the decode stage is full. Returns false after close().
+    bool submit(Job job);
+
+    // Stop accepting jobs, wait for all queued jobs to finish and join the workers
+    void close();
+
+    // How much of the memory budget the jobs in flight used so far
+    MemoryStats memory_stats() const;
+
+  private:
+    struct Task {
+      std::size_t index;
+      Job job;
+      cv::Mat image;
+      std::size_t bytes;  // Admitted by the scheduler, released when the job finishes
+      std::uint64_t input_hash = 0;
+    };
+
+    void decode_worker();
+    void transform_worker();
+    void encode_worker();
+    void finish(const Task& task, Status status, Stage stage);
+
+    // Declared before the queues, so the pool outlives every image
+    std::unique_ptr<ImageEditor::MatPool> owned_pool;
+    ImageEditor::MatPool* pool;
+    ImageEditor::ReadMode read_mode;
+    std::size_t tile_budget;
+    std::optional<ImageEditor::ColorGrade> grade;
+    ImageEditor::EncodeProfile encode_profile;
+    bool hash_inputs;
+    std::size_t memory_budget;
+
+    MemoryScheduler<Task> decode_queue;
+    BoundedQueue<Task> transform_queue;
+    BoundedQueue<Task> encode_queue;
+
+    std::atomic<unsigned> decode_running;
+    std::atomic<unsigned> transform_running;
+
+    std::size_t next_index = 0;
+    std::mutex submit_mutex;
+    std::mutex callback_mutex;
+    StatusCallback on_status;
+    std::vector<std::thread> workers;
+    bool closed = false;
+  };
+
+  // Run all jobs through a pipeline and return their statuses in submission order
+  std::vector<FileStatus> run(const std::vector<Job>& jobs, const Options& options = default_options(),
+    StatusCallback on_status = nullptr);
+
+  // Build the job for one file: the pivots come from the file name suffix (see ImageEditor::parse_pivot_suffix)
+  // and the output keeps the file name inside output_dir.
+  Job make_job(const fs::path& file, const fs::path& output_dir);
+
+  // Same as above for a file whose header was probed. A file without an image extension gets the
+  // extension of its true type appended to the output name, e.g. "shot_lt" => "shot_lt.png".
+  // With an output_type, the output is transcoded to that format, e.g. "shot_lt.bmp" => "shot_lt.png".
+  Job make_job(const fs::path& file, const Reader::ImageInfo& info, const fs::path& output_dir,
+    std::optional<Reader::ImageType> output_type = std::nullopt);
+
+  // Build one job per file, see make_job
+  std::vector<Job> make_jobs(const std::vector<fs::path>& files, const fs::path& output_dir);
+
+} // namespace Batch
+
+#endif // BATCH_HPP
@@ -0,0 +1,67 @@
+#ifndef BOUNDED_QUEUE_HPP
+#define BOUNDED_QUEUE_HPP
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <optional>
+
+namespace Batch {
+
+  // A thread-safe FIFO queue with a fixed capacity. Producers block while the queue is full
+  // and consumers block while it is empty, so a slow stage pushes back on the stage before it.
+  template <typename T>
+  class BoundedQueue {
+  public:
+    explicit BoundedQueue(std::size_t capacity): capacity(capacity == 0 ? 1 : capacity) {}
+
+    // Push an item, waiting for free space. Returns false if the queue was closed.
+    bool push(T item) {
+      std::unique_lock<std::mutex> lock(mutex);
+      not_full.wait(lock, [this] { return closed || items.size() < capacity; });
+      if (closed)
+        return false;
+      items.push_back(std::move(item));
+      not_empty.notify_one();
+      return true;
+    }
+
+    // Pop the oldest item, waiting for one to arrive.
+    // Returns std::nullopt once the queue is closed and drained.
+    std::optional<T> pop() {
+      std::unique_lock<std::mutex> lock(mutex);
+      not_empty.wait(lock, [this] { return closed || !items.empty(); });
+      if (items.empty())
+        return std::nullopt;
+      T item = std::move(items.front());
+      items.pop_front();
+      not_full.notify_one();
+      return item;
+    }
+
+    // Stop accepting new items. Items already queued can still be popped.
+    void close() {
+      std::lock_guard<std::mutex> lock(mutex);
+      closed = true;
+      not_empty.notify_all();
+      not_full.notify_all();
+    }
+
+    std::size_t size() const {
+      std::lock_guard<std::mutex> lock(mutex);
+      return items.size();
+    }
+
+  private:
+    const std::size_t capacity;
+    std::deque<T> items;
+    bool closed = false;
+    mutable std::mutex mutex;
+    std::condition_variable not_empty;
+    std::condition_variable not_full;
+  };
+
+} // namespace Batch
+
+#endif // BOUNDED_QUEUE_HPP
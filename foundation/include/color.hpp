@@ -0,0 +1,90 @@
+#ifndef COLOR_HPP
+#define COLOR_HPP
+
+#include "include/image_editor.hpp"
+#include <array>
+#include <filesystem>
+#include <memory>
+#include <opencv2/opencv.hpp>
+#include <vector>
+
+namespace ImageEditor {
+  namespace fs = std::filesystem;
+
+  // Global color adjustments, applied in this order to values normalized to [0, 1]
+  struct ColorAdjustment {
+    double brightness = 0;  // Added to every channel, e.g. 0.1 lifts everything by a tenth of full scale
+    double contrast = 1;    // Scale around mid-gray, 1 keeps the image as it is
+    double saturation = 1;  // 0 turns the image gray, 1 keeps it, larger values boost the colors
+    double gamma = 1;       // Output is input^(1 / gamma), values above 1 brighten the midtones
+  };
+
+  // A color lookup table read from an Adobe/Resolve .cube file
+  struct CubeLut {
+    bool is_3d = true;
+    int size = 0;                                   // Entries per axis (3D) or in total (1D)
+    std::array<float, 3> domain_min{ 0, 0, 0 };     // Input range per channel, in RGB order
+    std::array<float, 3> domain_max{ 1, 1, 1 };
+    std::vector<float> table;                       // RGB triples, red changing fastest
+  };
+
+  // Read a .cube file. Both LUT_3D_SIZE and LUT_1D_SIZE tables are supported, along with
+  // DOMAIN_MIN/DOMAIN_MAX and the LUT_*_INPUT_RANGE forms of them.
+  // Example usage: load_cube("/path/to/film.cube")
+  Result<CubeLut> load_cube(const fs::path& cube_path);
+
+  // The instruction sets the color kernels can use, from slowest to fastest
+  enum class SimdLevel {
+    SCALAR,
+    SSE,
+    AVX2
+  };
+
+  // The fastest level this CPU runs
+  SimdLevel supported_simd_level();
+
+  // The level the color kernels use, supported_simd_level() unless lowered with set_simd_level.
+  // Levels above what the CPU supports are clamped to it.
+  SimdLevel simd_level();
+  void set_simd_level(SimdLevel level);
+
+  // Adjustments followed by an optional LUT, prepared once and applied to any number of images.
+  // 8-bit images without cross-channel work (no saturation change, no 3D LUT) go through a
+  // precomputed per-channel table. Everything else runs in float on planar runs of pixels, with the
+  // adjustments vectorized for SSE or AVX2 (see simd_level). Copies are cheap, the LUT is shared.
+  class ColorGrade {
+  public:
+    explicit ColorGrade(const ColorAdjustment& adjustment = ColorAdjustment(), std::shared_ptr<const CubeLut> lut = nullptr);
+
+    // Returns true when applying the grade changes nothing
+    bool is_identity() const;
+
+    // Grade an 8 or 16-bit image with 1 to 4 channels in place. Channels are in BGR(A) order,
+    // alpha is kept. Row bands are graded in parallel. Returns false for other image types.
+    bool apply(cv::Mat& image) const;
+
+    // Grade one run of pixels, see RowKernel. src and dst may be the same.
+    void apply_row(const uchar* src, uchar* dst, int pixels, int channels) const;
+    void apply_row(const ushort* src, ushort* dst, int pixels, int channels) const;
+
+  private:
+    template <typename T>
+    void apply_run(const T* src, T* dst, int pixels, int channels) const;
+
+    // Grade planar values in [0, 1]; gray images pass the same plane three times
+    void grade_planes(float* blue, float* green, float* red, int count, bool gray) const;
+
+    float scale;
+    float offset;
+    float saturation;
+    bool identity;
+    bool table_8bit;                            // The 8-bit tables below are exact for color images
+    std::array<std::array<uchar, 256>, 3> color_table;  // Per channel, in BGR order
+    std::array<uchar, 256> gray_table;
+    std::shared_ptr<const std::vector<float>> gamma_table;
+    std::shared_ptr<const CubeLut> lut;
+  };
+
+} // namespace ImageEditor
+
+#endif // COLOR_HPP
@@ -0,0 +1,45 @@
+#ifndef ENCODE_PROFILE_HPP
+#define ENCODE_PROFILE_HPP
+
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace ImageEditor {
+
+  // How much CPU the encoders spend on making outputs smaller
+  enum class EncodeProfile {
+    FAST,      // What cv::imwrite does by default: fast PNG and TIFF compression, JPEG quality 95, lossless WebP
+    BALANCED,  // Harder PNG compression and optimized JPEG Huffman tables, no loss of quality
+    SMALL,     // The smallest PNG and TIFF, progressive JPEG, and lower quality for the lossy formats
+  };
+
+  // The codec settings behind a profile
+  struct EncodeSettings {
+    int png_compression;   // zlib level, 0 to 9
+    int png_strategy;      // zlib strategy, the same values as cv::IMWRITE_PNG_STRATEGY_*
+    int jpeg_quality;      // 0 to 100
+    bool jpeg_optimize;    // Compute optimal Huffman tables, a second pass over the coefficients
+    bool jpeg_progressive;
+    int webp_quality;      // 1 to 100, above 100 for lossless
+    int tiff_compression;  // libtiff COMPRESSION_* scheme
+  };
+
+  // Get the codec settings of profile
+  EncodeSettings get_encode_settings(EncodeProfile profile);
+
+  // Get the cv::imwrite parameters of profile for the format selected by extension, with or
+  // without the dot. Empty for formats without settings (BMP, GIF) and for the FAST profile of PNG,
+  // which leaves OpenCV its own speed tuning.
+  // Example: get_encode_params(".jpg", EncodeProfile::SMALL) => { IMWRITE_JPEG_QUALITY, 85, IMWRITE_JPEG_OPTIMIZE, 1, ... }
+  std::vector<int> get_encode_params(const std::string& extension, EncodeProfile profile);
+
+  // Parse a profile name: "fast", "balanced" or "small". Returns std::nullopt for anything else.
+  std::optional<EncodeProfile> parse_encode_profile(const std::string& name);
+
+  // The name of a profile, as parse_encode_profile reads it
+  std::string get_encode_profile_name(EncodeProfile profile);
+
+} // namespace ImageEditor
+
+#endif // ENCODE_PROFILE_HPP
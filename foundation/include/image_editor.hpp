@@ -1,8 +1,14 @@
 #ifndef IMAGE_EDITOR_HPP
 #define IMAGE_EDITOR_HPP
 
+#include "include/encode_profile.hpp"
+#include <cstddef>
 #include <filesystem>
 #include <opencv2/opencv.hpp>
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
 
 namespace ImageEditor {
   namespace fs = std::filesystem;
@@ -12,6 +18,7 @@ namespace ImageEditor {
     TOP = 't',
     CENTER = 'c',
     BOTTOM = 'b',
+    AUTO = 'a',  // Placed by the content of the image, see resolve_auto_pivot
   };
 
   // An enum to represent horizontal pivot options
@@ -19,19 +26,22 @@ namespace ImageEditor {
     LEFT = 'l',
     CENTER = 'c',
     RIGHT = 'r',
+    AUTO = 'a',  // Placed by the content of the image, see resolve_auto_pivot
   };
 
 
   static std::map<char, VerticalPivot> vertical_pivot_map = {
         {'t', VerticalPivot::TOP},
         {'c', VerticalPivot::CENTER},
-        {'b', VerticalPivot::BOTTOM}
+        {'b', VerticalPivot::BOTTOM},
+        {'a', VerticalPivot::AUTO}
   };
 
   static std::map<char, HorizontalPivot> horizontal_pivot_map = {
        {'l', HorizontalPivot::LEFT},
        {'c', HorizontalPivot::CENTER},
-       {'r', HorizontalPivot::RIGHT}
+       {'r', HorizontalPivot::RIGHT},
+       {'a', HorizontalPivot::AUTO}
   };
 
   enum class Status {
@@ -39,13 +49,19 @@ namespace ImageEditor {
     FAILURE
   };
 
+  // The channels and depth of decoded images
+  enum class ReadMode {
+    COLOR,      // Always 8-bit BGR, like cv::IMREAD_COLOR
+    UNCHANGED,  // As stored: gray, BGR or BGRA, 8 or 16-bit. JPEG EXIF orientation is still applied (see read_stored_image).
+  };
+
   template <typename T>
   struct Result {
     T data;
     Status status;
 
     Result(T data, Status status)
-      : data(data), status(status) {
+      : data(std::move(data)), status(status) {
     }
   };
 
@@ -53,6 +69,9 @@ namespace ImageEditor {
   struct PivotRect {
     HorizontalPivot horizontal_pivot;
     VerticalPivot vertical_pivot;
+    // Top-left corner of the square chosen for AUTO pivots by resolve_auto_pivot. Without it AUTO
+    // pivots are centered.
+    std::optional<cv::Point> auto_origin;
 
     PivotRect(HorizontalPivot horizontal_pivot = HorizontalPivot::CENTER,
       VerticalPivot vertical_pivot = VerticalPivot::CENTER)
@@ -76,26 +95,109 @@ namespace ImageEditor {
     RectVertical(int y = 0, int height = 0): y(y), height(height) {}
   };
 
+  class ColorGrade;  // See color.hpp
+
+  // Buffers a worker keeps from one image to the next, so reading and writing images of the same
+  // size stops allocating after the first one. A workspace is not thread-safe; give each thread its own.
+  struct Workspace {
+    cv::MatAllocator* allocator = nullptr;  // Allocates decoded pixels (e.g. a MatPool), the default allocator when null
+    std::vector<uchar> buffer;              // Encoded bytes read or written, or rows while decoding
+  };
+
   // Read image by specific path if can't read it exit with code 1
-  Result<cv::Mat> read_image(const fs::path& image_path);
+  Result<cv::Mat> read_image(const fs::path& image_path, ReadMode mode = ReadMode::COLOR);
+
+  // Same as above, but the file is read into workspace.buffer and the pixels come from workspace.allocator
+  Result<cv::Mat> read_image(const fs::path& image_path, Workspace& workspace, ReadMode mode = ReadMode::COLOR);
 
-  // Save image by specific filename and path. If the path directory does not exist, it is created.
+  // Same as read_image, but the EXIF orientation of JPEGs is not applied: the pixels come in the
+  // frame they are stored in, without the copy that turns them upright. Crops map their square into
+  // this frame and turn only the square (see orientation.hpp). Other formats are read like read_image.
+  Result<cv::Mat> read_stored_image(const fs::path& image_path, ReadMode mode = ReadMode::COLOR);
+
+  // Same as above, with the buffers of workspace
+  Result<cv::Mat> read_stored_image(const fs::path& image_path, Workspace& workspace, ReadMode mode = ReadMode::COLOR);
+
+  // Save image by specific filename and path. If the path directory (or any parent) does not exist, it is created.
   // If an image with the same name already exists, it is overwritten.
+  // The format is selected by the extension of output and encoded with the settings of profile.
   // Example arg output: /home/user/picture/image.jpg
   // Returns true on success, false otherwise.
-  bool save_image(const cv::Mat& image, const fs::path& output);
+  bool save_image(const cv::Mat& image, const fs::path& output, EncodeProfile profile = EncodeProfile::FAST);
+
+  // Same as above, but the image is encoded into workspace.buffer, which keeps its capacity
+  bool save_image(const cv::Mat& image, const fs::path& output, Workspace& workspace, EncodeProfile profile = EncodeProfile::FAST);
+
+  // Get a path in the directory of output that no other call returns, for writers that stream into
+  // a file while still reading their input. Written there and renamed over output on success, a
+  // failed crop never touches output, and an output that is also the input is not truncated early.
+  // Example: get_temporary_path("/out/image.jpg") => "/out/image.jpg.4242.7.tmp"
+  fs::path get_temporary_path(const fs::path& output);
+
+  // Convert an image to what the format selected by extension can store. 16-bit and float images are
+  // scaled to 8 bits for formats other than PNG and TIFF, and alpha is dropped for JPEG and BMP.
+  // Images the format can store as they are are returned without copying.
+  // save_image and encode_image do this before encoding.
+  cv::Mat fit_to_format(const cv::Mat& image, const std::string& extension);
 
   // Crop an image square at the specified path using the given horizontal and vertical pivots
   // The cropped image is saved to the specified path with the given file name.
+  // Channels, alpha and depth are kept as far as the output format can store them (see fit_to_format).
+  // JPEG to JPEG crops are lossless and snapped to the MCU grid (see crop_square_jpeg).
+  // Images too big to decode at once are streamed in bands (see crop_square_streaming).
   // Example usage: crop_square("/path/to/image.jpg", PivotRect(HorizontalPivot::CENTER, VerticalPivot::BOTTOM), "/path/to/cropped_image.jpg");
   void crop_square(const fs::path& image_path, const PivotRect& pivot_rect, const fs::path& output_path);
 
+  // Same as above, but the square is color graded on its way to the encoder, in the same pass that
+  // keeps it (see color.hpp). Grading needs the pixels, so JPEG crops are not lossless.
+  // Example usage: crop_square("/path/to/image.jpg", PivotRect(), "/path/to/graded.jpg", ColorGrade(ColorAdjustment{ .saturation = 1.2 }));
+  void crop_square(const fs::path& image_path, const PivotRect& pivot_rect, const fs::path& output_path, const ColorGrade& grade);
+
+  // Decode an image held in memory, with the same channels and depth as read_image.
+  // The encoded bytes are read in place, they are not copied.
+  Result<cv::Mat> decode_image(std::span<const std::byte> data, ReadMode mode = ReadMode::COLOR);
+
+  // Same as above, in the stored frame like read_stored_image
+  Result<cv::Mat> decode_stored_image(std::span<const std::byte> data, ReadMode mode = ReadMode::COLOR);
+
+  // Encode an image in the format selected by extension, with or without the dot (".png", "jpg", ...),
+  // with the settings of profile
+  Result<std::vector<uchar>> encode_image(const cv::Mat& image, const std::string& extension,
+    EncodeProfile profile = EncodeProfile::FAST);
+
+  // Get the square of an image selected by pivot_rect. The result is a view into image, no pixels are copied.
+  // Chains of edits that start with this crop go through ImageEditor::Pipeline (see pipeline.hpp).
+  Result<cv::Mat> crop_square(const cv::Mat& image, const PivotRect& pivot_rect);
+
+  // Crop the square of an image and encode it in the format selected by extension
+  Result<std::vector<uchar>> crop_square(const cv::Mat& image, const PivotRect& pivot_rect, const std::string& extension);
+
+  // Crop the square of an encoded image held in memory and encode it in the format selected by extension.
+  // Nothing touches the filesystem. Channels and depth are kept and JPEG to JPEG crops are lossless,
+  // like the file version.
+  // Example usage: crop_square(std::as_bytes(std::span(upload)), PivotRect(), ".png");
+  Result<std::vector<uchar>> crop_square(std::span<const std::byte> image, const PivotRect& pivot_rect, const std::string& extension);
+
+  // Same as above, but the encoded square is written to the start of output and data is the number of
+  // bytes written. If output is too small, the status is FAILURE and data is the number of bytes needed.
+  // Lossless JPEG crops are written straight into output; other formats are encoded by OpenCV into a
+  // buffer of its own and copied once.
+  Result<std::size_t> crop_square(std::span<const std::byte> image, const PivotRect& pivot_rect, const std::string& extension,
+    std::span<std::byte> output);
+
   // Get the horizontal crop region based on the given pivot and crop size
   RectHorizontal get_horizontal_crop_region(int width, HorizontalPivot pivot, int crop_size);
 
   // Get the vertical crop region based on the given pivot and crop size
   RectVertical get_vertical_crop_region(int height, VerticalPivot pivot, int crop_size);
 
+  // Get the largest square region of a width x height image positioned by the given pivots
+  // Example: get_square_region(1920, 1080, PivotRect(HorizontalPivot::LEFT)) => Rect(0, 0, 1080, 1080)
+  cv::Rect get_square_region(int width, int height, const PivotRect& pivot_rect);
+
+  // Same as above for the pixels of image, which place AUTO pivots (see resolve_auto_pivot)
+  cv::Rect get_square_region(const cv::Mat& image, const PivotRect& pivot_rect);
+
   // Converts a character to a HorizontalPivot enum value. If the character is not a valid option,
   // it returns the default_pivot.
   HorizontalPivot char_to_horizontal_pivot(char c, HorizontalPivot default_pivot = HorizontalPivot::CENTER);
@@ -104,6 +206,11 @@ namespace ImageEditor {
   // it returns the default_pivot.
   VerticalPivot char_to_vertical_pivot(char c, VerticalPivot default_pivot = VerticalPivot::CENTER);
 
+  // Parse the pivots from a file name suffix of the form <name>_<horizontal><vertical>
+  // For example, screenshot_lt => PivotRect(LEFT, TOP), screenshot_r => PivotRect(RIGHT, CENTER)
+  // Missing or unknown characters fall back to CENTER, except after AUTO: screenshot_a => PivotRect(AUTO, AUTO)
+  PivotRect parse_pivot_suffix(const std::string& file_name);
+
 } // namespace ImageEditor
 
 #endif // IMAGE_EDITOR_HPP
@@ -0,0 +1,63 @@
+#ifndef JPEG_CROP_HPP
+#define JPEG_CROP_HPP
+
+#include "include/image_editor.hpp"
+#include "include/probe.hpp"
+#include <cstddef>
+#include <filesystem>
+#include <span>
+#include <vector>
+
+namespace ImageEditor {
+  namespace fs = std::filesystem;
+
+  // Returns true when both the input and the output are JPEG files (by extension, see
+  // Reader::image_type_map), which is when crop_square_jpeg can be used.
+  bool is_jpeg_crop(const fs::path& image_path, const fs::path& output_path);
+
+  // Same as above, but the input type comes from its probed header, whatever the file is named
+  bool is_jpeg_crop(const Reader::ImageInfo& info, const fs::path& output_path);
+
+  // Get the square region of a width x height JPEG with its top-left corner snapped down to the
+  // MCU grid. The size of the square is the same as get_square_region, only the offset moves by
+  // less than one MCU towards the top-left corner. The square is selected in the frame of the EXIF
+  // orientation and returned in the stored frame (see to_stored_region), which is where the MCUs are.
+  // Example: get_jpeg_square_region(1920, 1080, 16, 16, PivotRect()) => Rect(416, 0, 1080, 1080)
+  cv::Rect get_jpeg_square_region(int width, int height, int mcu_width, int mcu_height, const PivotRect& pivot_rect,
+    int orientation = 1);
+
+  // Crop a JPEG square losslessly by copying its DCT coefficients. Only the header is parsed to get
+  // the dimensions; the pixels are never decoded or re-encoded, so the output keeps the exact
+  // quality of the input. The square is snapped to the MCU grid (see get_jpeg_square_region).
+  // Profiles other than FAST optimize the Huffman tables, and SMALL writes a progressive JPEG,
+  // both without touching the coefficients. Pivots follow the EXIF orientation of the input: the
+  // square is copied in the stored frame and tagged with the same orientation, so nothing is ever
+  // rotated. AUTO pivots are placed by a 1/8 scale decode (see resolve_auto_pivot), the only
+  // pixels this crop ever decodes.
+  // Returns true on success, false otherwise. The output is written to a temporary file and renamed
+  // into place, so output_path may be image_path, and on failure output_path is left as it was.
+  bool crop_square_jpeg(const fs::path& image_path, const PivotRect& pivot_rect, const fs::path& output_path,
+    EncodeProfile profile = EncodeProfile::FAST);
+
+  // Same as above, with the header of image_path already probed, so it is not read again for the
+  // orientation or the AUTO pivots
+  bool crop_square_jpeg(const fs::path& image_path, const Reader::ImageInfo& info, const PivotRect& pivot_rect,
+    const fs::path& output_path, EncodeProfile profile = EncodeProfile::FAST);
+
+  // Crop a JPEG held in memory losslessly, see above. The cropped JPEG is returned.
+  Result<std::vector<uchar>> crop_square_jpeg(std::span<const std::byte> image, const PivotRect& pivot_rect,
+    EncodeProfile profile = EncodeProfile::FAST);
+
+  // Same as above, with the header of image already probed
+  Result<std::vector<uchar>> crop_square_jpeg(std::span<const std::byte> image, const Reader::ImageInfo& info,
+    const PivotRect& pivot_rect, EncodeProfile profile = EncodeProfile::FAST);
+
+  // Same as above, but libjpeg writes the cropped JPEG straight to the start of output and data is
+  // the number of bytes written. If output is too small, the status is FAILURE and data is the
+  // number of bytes needed; data is 0 when the crop itself failed.
+  Result<std::size_t> crop_square_jpeg(std::span<const std::byte> image, const Reader::ImageInfo& info,
+    const PivotRect& pivot_rect, std::span<std::byte> output, EncodeProfile profile = EncodeProfile::FAST);
+
+} // namespace ImageEditor
+
+#endif // JPEG_CROP_HPP
@@ -0,0 +1,94 @@
+#ifndef LRU_CACHE_HPP
+#define LRU_CACHE_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+#include <utility>
+
+namespace Server {
+
+  // A thread-safe least-recently-used cache bounded by the total size of its values, as given to
+  // put(). Values are returned by copy, so large ones should be cheap to copy (cv::Mat,
+  // std::shared_ptr, ...).
+  template <typename Key, typename Value, typename Hash = std::hash<Key>>
+  class LruCache {
+  public:
+    // Counts since the cache was made
+    struct Stats {
+      std::uint64_t hits = 0;
+      std::uint64_t misses = 0;
+      std::uint64_t evictions = 0;
+      std::size_t entries = 0;
+      std::size_t bytes = 0;
+    };
+
+    explicit LruCache(std::size_t capacity_bytes): capacity(capacity_bytes) {}
+
+    // Get the value of key and mark it as the most recently used
+    std::optional<Value> get(const Key& key) {
+      std::lock_guard<std::mutex> lock(mutex);
+      auto iter = index.find(key);
+      if (iter == index.end()) {
+        counts.misses++;
+        return std::nullopt;
+      }
+      counts.hits++;
+      entries.splice(entries.begin(), entries, iter->second);
+      return iter->second->value;
+    }
+
+    // Insert or replace the value of key, evicting the least recently used entries until the cache
+    // fits. A value larger than the whole cache is not stored.
+    void put(const Key& key, Value value, std::size_t bytes) {
+      std::lock_guard<std::mutex> lock(mutex);
+      auto iter = index.find(key);
+      if (iter != index.end()) {
+        counts.bytes -= iter->second->bytes;
+        entries.erase(iter->second);
+        index.erase(iter);
+      }
+      if (bytes > capacity)
+        return;
+      while (counts.bytes + bytes > capacity)
+        evict();
+      entries.push_front(Entry{ key, std::move(value), bytes });
+      index.emplace(key, entries.begin());
+      counts.bytes += bytes;
+    }
+
+    Stats stats() const {
+      std::lock_guard<std::mutex> lock(mutex);
+      Stats stats = counts;
+      stats.entries = entries.size();
+      return stats;
+    }
+
+  private:
+    struct Entry {
+      Key key;
+      Value value;
+      std::size_t bytes;
+    };
+
+    void evict() {
+      const Entry& oldest = entries.back();
+      counts.bytes -= oldest.bytes;
+      counts.evictions++;
+      index.erase(oldest.key);
+      entries.pop_back();
+    }
+
+    const std::size_t capacity;
+    mutable std::mutex mutex;
+    std::list<Entry> entries;  // Most recently used first
+    std::unordered_map<Key, typename std::list<Entry>::iterator, Hash> index;
+    Stats counts;
+  };
+
+} // namespace Server
+
+#endif // LRU_CACHE_HPP
@@ -0,0 +1,102 @@
+#ifndef MANIFEST_HPP
+#define MANIFEST_HPP
+
+#include "include/image_editor.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+
+namespace Manifest {
+  namespace fs = std::filesystem;
+  using ImageEditor::EncodeProfile;
+  using ImageEditor::PivotRect;
+
+  // What was known about an input file when its output was written
+  struct Entry {
+    fs::path input;
+    std::uint64_t size;
+    std::int64_t mtime;  // fs::last_write_time ticks
+    std::uint64_t hash;  // See hash_file
+    PivotRect pivot_rect;
+    EncodeProfile profile;
+    fs::path output;
+  };
+
+  // Hash the content of a file with 64-bit FNV-1a. Returns 0 if the file can't be read.
+  std::uint64_t hash_file(const fs::path& path);
+
+  // Hash bytes held in memory. Equal to hash_file of a file with the same content.
+  std::uint64_t hash_bytes(std::span<const std::byte> bytes);
+
+  // A persistent record of processed files, so re-runs only process new or changed ones.
+  //
+  // The file is a header, a table of fixed-size records sorted by input path and a string table.
+  // load() memory-maps it and lookups binary-search the mapping directly, so startup cost does not
+  // grow with the number of entries. Entries recorded during a run are kept in memory and merged
+  // into a new file by save(). All member functions are thread-safe.
+  class Index {
+  public:
+    Index() = default;
+    ~Index();
+
+    Index(const Index&) = delete;
+    Index& operator=(const Index&) = delete;
+
+    // Map the manifest at path. A missing file is an empty manifest. Returns false if the file
+    // exists but is not a valid manifest, in which case the index starts empty.
+    bool load(const fs::path& path);
+
+    // Write all entries to path, replacing it atomically. Returns true on success, false otherwise.
+    bool save(const fs::path& path);
+
+    // Get the entry recorded for input, if any
+    std::optional<Entry> find(const fs::path& input) const;
+
+    // Returns true if output exists and was written from the current content of input with the same
+    // pivots and encode profile. Size and mtime are compared first; the content is hashed only when
+    // they changed, and an unchanged hash refreshes the entry so the next run skips hashing.
+    bool is_up_to_date(const fs::path& input, const PivotRect& pivot_rect, const fs::path& output,
+      EncodeProfile profile = EncodeProfile::FAST);
+
+    // Record that output was written from input with the given pivots and encode profile. Returns
+    // false if input can't be read.
+    bool record(const fs::path& input, const PivotRect& pivot_rect, const fs::path& output,
+      EncodeProfile profile = EncodeProfile::FAST);
+
+    // Record like above with the hash_file of input the caller already computed, when it read the
+    // file anyway. Returns false if input can't be read or hash is 0.
+    bool record(const fs::path& input, const PivotRect& pivot_rect, const fs::path& output, EncodeProfile profile,
+      std::uint64_t hash);
+
+    // Number of distinct inputs in the manifest, mapped and recorded
+    std::size_t size() const;
+
+  private:
+    struct Record;
+
+    std::string_view string_at(std::uint64_t offset, std::uint32_t length) const;
+    Entry entry_at(std::size_t index) const;
+    std::optional<Entry> find_mapped(std::string_view input) const;
+    std::optional<Entry> find_locked(const std::string& input) const;
+    void unmap();
+
+    const std::byte* mapping = nullptr;
+    std::size_t mapping_size = 0;
+    const Record* records = nullptr;
+    std::size_t record_count = 0;
+    const char* strings = nullptr;
+    std::size_t strings_size = 0;
+
+    std::map<std::string, Entry> updates;  // Recorded this run, sorted like the mapped records
+    mutable std::mutex mutex;
+  };
+
+} // namespace Manifest
+
+#endif // MANIFEST_HPP
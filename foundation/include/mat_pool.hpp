@@ -0,0 +1,60 @@
+#ifndef MAT_POOL_HPP
+#define MAT_POOL_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <opencv2/opencv.hpp>
+#include <vector>
+
+namespace ImageEditor {
+
+  // A cv::MatAllocator that keeps the pixel buffers of released Mats and hands them out again.
+  // Buffers are grouped by their size rounded up to a page, so a batch of same-sized images
+  // reuses the same few buffers and stops allocating once every worker has seen one image.
+  // Mats with user-provided data are passed on to OpenCV's standard allocator.
+  //
+  // Use it by setting cv::Mat::allocator before the Mat is created, e.g. through
+  // ImageEditor::Workspace. Every Mat allocated from a pool must be released before the pool is
+  // destroyed. All member functions are thread-safe.
+  class MatPool : public cv::MatAllocator {
+  public:
+    // Counters since the pool was created
+    struct Stats {
+      std::uint64_t allocations;    // Buffers requested
+      std::uint64_t reused;         // Requests served from a cached buffer
+      std::size_t cached_bytes;     // Bytes held by cached buffers
+      std::size_t in_use_bytes;     // Bytes held by Mats that are still alive
+    };
+
+    // Released buffers are cached until they add up to max_cached_bytes, larger ones are freed
+    explicit MatPool(std::size_t max_cached_bytes = std::size_t(512) << 20);
+    ~MatPool() override;
+
+    MatPool(const MatPool&) = delete;
+    MatPool& operator=(const MatPool&) = delete;
+
+    cv::UMatData* allocate(int dims, const int* sizes, int type, void* data, size_t* step,
+      cv::AccessFlag flags, cv::UMatUsageFlags usage_flags) const override;
+    bool allocate(cv::UMatData* data, cv::AccessFlag access_flags, cv::UMatUsageFlags usage_flags) const override;
+    void deallocate(cv::UMatData* data) const override;
+
+    Stats stats() const;
+
+    // Free every cached buffer
+    void trim();
+
+  private:
+    static std::size_t capacity_for(std::size_t size);
+
+    std::size_t max_cached_bytes;
+    mutable std::map<std::size_t, std::vector<void*>> buffers;  // Cached buffers by capacity
+    mutable std::vector<void*> headers;                        // Storage for cv::UMatData
+    mutable Stats counters{};
+    mutable std::mutex mutex;
+  };
+
+} // namespace ImageEditor
+
+#endif // MAT_POOL_HPP
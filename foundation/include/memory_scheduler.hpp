@@ -0,0 +1,182 @@
+#ifndef MEMORY_SCHEDULER_HPP
+#define MEMORY_SCHEDULER_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <optional>
+
+namespace Batch {
+
+  // How well a MemoryScheduler used its budget
+  struct MemoryStats {
+    std::size_t budget_bytes = 0;  // 0 when there is no budget
+    std::size_t peak_bytes = 0;    // Most bytes admitted at once
+    double mean_bytes = 0;         // Admitted bytes averaged over the time since the first push
+    std::uint64_t admitted = 0;
+    std::uint64_t waits = 0;       // Pops that had to wait for bytes to be released
+    double wait_seconds = 0;
+
+    // Peak and mean admitted bytes over the budget, 0 without a budget
+    double peak_utilization() const { return budget_bytes == 0 ? 0 : double(peak_bytes) / double(budget_bytes); }
+    double mean_utilization() const { return budget_bytes == 0 ? 0 : mean_bytes / double(budget_bytes); }
+  };
+
+  // A thread-safe queue that admits items by the memory they will hold. Every item is pushed with
+  // an estimate of its bytes and pop() only hands it out while everything admitted fits the budget;
+  // the bytes come back with release(). Of the waiting items the largest that fits goes first, so
+  // big images start early instead of straggling at the end of a run and small ones fill the slack
+  // they leave. An item bigger than the whole budget is admitted once nothing else is. A budget of
+  // 0 admits everything, still largest first.
+  //
+  // The largest waiting item is passed over for smaller ones at most max_skips times in a row,
+  // then nothing else is admitted until it fits, so a stream of small items can't starve it.
+  // Producers block while capacity items are waiting.
+  template <typename T>
+  class MemoryScheduler {
+  public:
+    MemoryScheduler(std::size_t budget_bytes, std::size_t capacity)
+      : budget_bytes(budget_bytes), capacity(capacity == 0 ? 1 : capacity), max_skips(this->capacity) {
+    }
+
+    // Push an item that will hold bytes once admitted, waiting for free space.
+    // Returns false if the scheduler was closed.
+    bool push(T item, std::size_t bytes) {
+      std::unique_lock<std::mutex> lock(mutex);
+      not_full.wait(lock, [this] { return closed || waiting.size() < capacity; });
+      if (closed)
+        return false;
+      if (!started) {
+        started = true;
+        last_change = Clock::now();
+        start = last_change;
+      }
+      waiting.emplace(bytes, std::move(item));
+      can_admit.notify_one();
+      return true;
+    }
+
+    // Pop the next item to run, waiting until one fits the budget. The caller must release() its
+    // bytes when it is done. Returns std::nullopt once the scheduler is closed and drained.
+    std::optional<T> pop() {
+      std::unique_lock<std::mutex> lock(mutex);
+      bool waited = false;
+      Clock::time_point wait_start;
+      while (true) {
+        if (waiting.empty() && closed)
+          return std::nullopt;
+        if (auto next = select(); next != waiting.end()) {
+          if (waited)
+            counters.wait_seconds += std::chrono::duration<double>(Clock::now() - wait_start).count();
+          return admit(next);
+        }
+        // Only waiting on memory counts, not waiting for work
+        if (!waited && !waiting.empty()) {
+          waited = true;
+          wait_start = Clock::now();
+          counters.waits++;
+        }
+        can_admit.wait(lock);
+      }
+    }
+
+    // Give back the bytes of an admitted item
+    void release(std::size_t bytes) {
+      std::lock_guard<std::mutex> lock(mutex);
+      account();
+      admitted_bytes -= std::min(bytes, admitted_bytes);
+      can_admit.notify_all();
+    }
+
+    // Stop accepting new items. Items already waiting can still be popped.
+    void close() {
+      std::lock_guard<std::mutex> lock(mutex);
+      closed = true;
+      can_admit.notify_all();
+      not_full.notify_all();
+    }
+
+    MemoryStats stats() const {
+      std::lock_guard<std::mutex> lock(mutex);
+      MemoryStats stats = counters;
+      stats.budget_bytes = budget_bytes;
+      if (started) {
+        Clock::time_point now = Clock::now();
+        double elapsed = std::chrono::duration<double>(now - start).count();
+        double area = byte_seconds + double(admitted_bytes) * std::chrono::duration<double>(now - last_change).count();
+        stats.mean_bytes = elapsed > 0 ? area / elapsed : 0;
+      }
+      return stats;
+    }
+
+  private:
+    using Clock = std::chrono::steady_clock;
+    using Waiting = std::multimap<std::size_t, T>;
+
+    bool fits(std::size_t bytes) const {
+      return budget_bytes == 0 || admitted_bytes == 0 || admitted_bytes + bytes <= budget_bytes;
+    }
+
+    // The waiting item to admit next, or end() when none may go yet. Equal sizes go in push order.
+    typename Waiting::iterator select() {
+      if (waiting.empty())
+        return waiting.end();
+      auto largest = waiting.lower_bound(std::prev(waiting.end())->first);
+      if (fits(largest->first)) {
+        skips = 0;
+        return largest;
+      }
+      if (skips >= max_skips || admitted_bytes >= budget_bytes)
+        return waiting.end();
+      auto smaller = waiting.upper_bound(budget_bytes - admitted_bytes);
+      if (smaller == waiting.begin())
+        return waiting.end();
+      skips++;
+      return waiting.lower_bound(std::prev(smaller)->first);
+    }
+
+    T admit(typename Waiting::iterator next) {
+      account();
+      admitted_bytes += next->first;
+      counters.peak_bytes = std::max(counters.peak_bytes, admitted_bytes);
+      counters.admitted++;
+      T item = std::move(next->second);
+      waiting.erase(next);
+      not_full.notify_one();
+      return item;
+    }
+
+    // Add the admitted bytes since the last change to the time integral behind mean_bytes
+    void account() {
+      Clock::time_point now = Clock::now();
+      byte_seconds += double(admitted_bytes) * std::chrono::duration<double>(now - last_change).count();
+      last_change = now;
+    }
+
+    const std::size_t budget_bytes;
+    const std::size_t capacity;
+    const std::size_t max_skips;
+    Waiting waiting;
+    std::size_t admitted_bytes = 0;
+    std::size_t skips = 0;
+    bool closed = false;
+
+    bool started = false;
+    Clock::time_point start;
+    Clock::time_point last_change;
+    double byte_seconds = 0;
+    MemoryStats counters;
+
+    mutable std::mutex mutex;
+    std::condition_variable can_admit;
+    std::condition_variable not_full;
+  };
+
+} // namespace Batch
+
+#endif // MEMORY_SCHEDULER_HPP
@@ -0,0 +1,106 @@
+#ifndef METRICS_HPP
+#define METRICS_HPP
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+
+namespace Metrics {
+  namespace fs = std::filesystem;
+
+  // The stages whose latency is measured
+  enum class Stage {
+    SCAN,         // Listing one directory
+    DECODE,       // Reading and decoding one image (or the decoded region of it)
+    CROP,         // Cutting the square out of a decoded image
+    ENCODE,       // Encoding and writing one image
+    JPEG_CROP,    // One lossless JPEG crop, read to write
+    STREAM_CROP,  // One crop streamed in bands, read to write
+    COLOR,        // Color grading one decoded image
+    SERVE,        // One crop request answered by the crop server, cached or not
+    COUNT
+  };
+
+  // Totals counted across a run
+  enum class Counter {
+    BYTES_READ,
+    BYTES_WRITTEN,
+    PIXELS_PROCESSED,  // Decoded pixels
+    FILES_SCANNED,     // Directory entries looked at
+    COUNT
+  };
+
+  // Returns the name used for a stage in the summaries, e.g. "decode"
+  const char* stage_name(Stage stage);
+
+  // A latency histogram with power-of-two buckets: bucket i counts durations of at most 2^i
+  // microseconds and the last bucket counts everything longer. Recording is lock-free.
+  class Histogram {
+  public:
+    static constexpr int BUCKETS = 27;
+
+    void record(std::chrono::nanoseconds duration);
+    void reset();
+
+    std::uint64_t count() const;
+    std::uint64_t bucket(int index) const;
+    double sum_seconds() const;
+
+    // Estimate the q-quantile (0 <= q <= 1) as the upper bound of the bucket that contains it
+    double quantile_seconds(double q) const;
+
+    // The upper bound of a bucket in seconds, infinity for the last one
+    static double upper_bound_seconds(int index);
+
+  private:
+    std::array<std::atomic<std::uint64_t>, BUCKETS> buckets{};
+    std::atomic<std::uint64_t> total{ 0 };
+    std::atomic<std::uint64_t> sum_nanoseconds{ 0 };
+  };
+
+  // Metrics are on by default. When off, every recording call returns right away.
+  bool enabled();
+  void set_enabled(bool enabled);
+
+  void record(Stage stage, std::chrono::nanoseconds duration);
+  void add(Counter counter, std::uint64_t amount);
+
+  // Count a failure for the format of path, by extension (see Reader::image_type_map)
+  void add_failure(const fs::path& path);
+
+  const Histogram& histogram(Stage stage);
+  std::uint64_t value(Counter counter);
+
+  // Failures counted for a format name: "bmp", "gif", "jpeg", "png", "tiff", "webp" or "other"
+  std::uint64_t failures(const std::string& format);
+
+  // Clear every histogram and counter
+  void reset();
+
+  // A summary of all metrics as a JSON object
+  std::string to_json();
+
+  // A summary of all metrics in the Prometheus text exposition format
+  std::string to_prometheus();
+
+  // Measures the lifetime of the timer and records it for a stage
+  class ScopedTimer {
+  public:
+    explicit ScopedTimer(Stage stage);
+    ~ScopedTimer();
+
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+  private:
+    Stage stage;
+    bool active;
+    std::chrono::steady_clock::time_point start;
+  };
+
+} // namespace Metrics
+
+#endif // METRICS_HPP
@@ -0,0 +1,55 @@
+#ifndef MULTI_CROP_HPP
+#define MULTI_CROP_HPP
+
+#include "include/image_editor.hpp"
+#include <filesystem>
+#include <opencv2/opencv.hpp>
+#include <vector>
+
+namespace ImageEditor {
+  namespace fs = std::filesystem;
+
+  // One output of crop_squares: the square selected by pivot_rect, scaled to size x size pixels
+  // and written to output in the format of its extension
+  struct OutputSpec {
+    PivotRect pivot_rect;
+    int size;  // Side of the output in pixels, 0 keeps the size of the square
+    fs::path output;
+
+    OutputSpec(PivotRect pivot_rect = PivotRect(), int size = 0, fs::path output = {})
+      : pivot_rect(pivot_rect), size(size), output(std::move(output)) {
+    }
+  };
+
+  // Successive half-resolution copies of an image, built on first use. Level 0 is the image itself
+  // and level i + 1 is level i halved with area averaging, so a downscale can start from the
+  // smallest level that still has at least as many pixels as its target instead of from full
+  // resolution, and every output of the same image shares the levels.
+  class ImagePyramid {
+  public:
+    explicit ImagePyramid(cv::Mat image);
+
+    // Level index, building the levels before it when needed. Levels stop at 1 x 1.
+    const cv::Mat& level(int index);
+
+    // The region of level 0 scaled to size x size pixels (region.size() when size is 0). Downscales
+    // are taken from the smallest level at least size pixels across the region and finished with
+    // area averaging; a region that needs no scaling is returned as a view.
+    cv::Mat scaled(const cv::Rect& region, int size);
+
+    // How many levels exist, level 0 included
+    int built_levels() const;
+
+  private:
+    std::vector<cv::Mat> levels;
+  };
+
+  // Decode image_path once and write one output per spec, all taken from the same decoded pixels
+  // and pyramid (see ImagePyramid). Returns the status of every spec, in order. When the image
+  // can't be read every status is FAILURE.
+  // Example usage: crop_squares("/path/to/image.png", { OutputSpec(PivotRect(), 0, "/out/full.png"), OutputSpec(PivotRect(), 256, "/out/thumb.jpg") });
+  std::vector<Status> crop_squares(const fs::path& image_path, const std::vector<OutputSpec>& specs);
+
+} // namespace ImageEditor
+
+#endif // MULTI_CROP_HPP
@@ -0,0 +1,37 @@
+#ifndef ORIENTATION_HPP
+#define ORIENTATION_HPP
+
+#include "include/image_editor.hpp"
+#include <opencv2/opencv.hpp>
+
+namespace ImageEditor {
+
+  // EXIF orientations (see Reader::ImageInfo::orientation) tell how the stored pixels of an image
+  // are turned to be shown upright: 1 is as stored, 2 to 4 flip or rotate by 180 degrees, and 5 to 8
+  // also swap the width and the height. Pivots always refer to the upright, oriented frame. Unknown
+  // values are treated as 1.
+
+  // Get the size of a width x height stored image once it is oriented
+  // Example: get_oriented_size(4032, 3024, 6) => Size(3024, 4032)
+  cv::Size get_oriented_size(int width, int height, int orientation);
+
+  // Map a region of the oriented frame of a width x height stored image into the stored frame
+  // Example: to_stored_region(Rect(0, 0, 10, 10), 40, 30, 6) => Rect(0, 20, 10, 10)
+  cv::Rect to_stored_region(const cv::Rect& region, int width, int height, int orientation);
+
+  // Map a region of the stored frame of a width x height image into the oriented frame, the inverse
+  // of to_stored_region
+  cv::Rect to_oriented_region(const cv::Rect& region, int width, int height, int orientation);
+
+  // Turn stored pixels upright. Returns image itself, without a copy, for orientation 1.
+  cv::Mat apply_orientation(const cv::Mat& image, int orientation);
+
+  // Get the region of stored, in the stored frame, that holds the square get_square_region selects
+  // in the oriented frame. AUTO pivots are placed by the pixels of stored. Cropping it and turning
+  // only the square with apply_orientation gives the square of the oriented image, without
+  // orienting the whole image first.
+  cv::Rect get_stored_square_region(const cv::Mat& stored, int orientation, const PivotRect& pivot_rect);
+
+} // namespace ImageEditor
+
+#endif // ORIENTATION_HPP
@@ -0,0 +1,85 @@
+#ifndef PIPELINE_HPP
+#define PIPELINE_HPP
+
+#include "include/color.hpp"
+#include "include/image_editor.hpp"
+#include <array>
+#include <filesystem>
+#include <functional>
+#include <opencv2/opencv.hpp>
+#include <vector>
+
+namespace ImageEditor {
+  namespace fs = std::filesystem;
+
+  // A per-pixel operation on a run of interleaved 8-bit pixels: reads pixels * channels samples from
+  // src and writes as many to dst. src and dst are either the same or don't overlap. Kernels are
+  // called concurrently on different runs, so they must not modify shared state.
+  using RowKernel = std::function<void(const uchar* src, uchar* dst, int pixels, int channels)>;
+
+  // The same for 16-bit pixels
+  using RowKernel16 = std::function<void(const ushort* src, ushort* dst, int pixels, int channels)>;
+
+  // A chain of edits recorded now and evaluated by run() in as few passes over the pixels as possible.
+  //  - Crops are views. They are moved ahead of per-pixel operations, so those only see the pixels
+  //    that are kept, and a leading crop of a file source narrows what the decoder reads (see
+  //    read_square and read_image_region).
+  //  - Consecutive per-pixel operations are fused into one pass that applies all of them to a
+  //    cache-sized run of a row before moving on. Row bands are processed in parallel.
+  //  - Consecutive resizes collapse into the last one.
+  // Example usage: Pipeline("/path/to/image.png").crop_square(PivotRect()).resize(cv::Size(256, 256)).run();
+  class Pipeline {
+  public:
+    // Edit a decoded image. The image is never modified.
+    explicit Pipeline(cv::Mat image);
+
+    // Edit an image file, decoded by run() with mode
+    explicit Pipeline(fs::path image_path, ReadMode mode = ReadMode::UNCHANGED);
+
+    Pipeline& crop(const cv::Rect& region);
+    Pipeline& crop_square(const PivotRect& pivot_rect);
+    Pipeline& resize(cv::Size size, int interpolation = cv::INTER_AREA);
+
+    // Apply kernel to every pixel of an 8-bit image, or kernel16 to every pixel of a 16-bit one.
+    // run() fails when there is no kernel for the depth of the image.
+    Pipeline& map(RowKernel kernel, RowKernel16 kernel16 = nullptr);
+
+    // Replace every sample value v with table[v]
+    Pipeline& lut(const std::array<uchar, 256>& table);
+
+    // Grade 8 or 16-bit pixels, see ColorGrade
+    Pipeline& color(const ColorGrade& grade);
+
+    // Evaluate the chain. Returns a view of the source when only crops were recorded, so the
+    // result must not be written to unless it is cloned.
+    Result<cv::Mat> run() const;
+
+  private:
+    enum class Kind {
+      CROP,
+      CROP_SQUARE,
+      RESIZE,
+      MAP
+    };
+
+    struct Node {
+      Kind kind;
+      cv::Rect region;
+      PivotRect pivot_rect;
+      cv::Size size;
+      int interpolation;
+      RowKernel kernel;
+      RowKernel16 kernel16;
+    };
+
+    Result<cv::Mat> read_source(std::size_t& first_node) const;
+
+    cv::Mat image;
+    fs::path image_path;
+    ReadMode mode = ReadMode::UNCHANGED;
+    std::vector<Node> nodes;
+  };
+
+} // namespace ImageEditor
+
+#endif // PIPELINE_HPP
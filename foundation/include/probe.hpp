@@ -0,0 +1,50 @@
+#ifndef PROBE_HPP
+#define PROBE_HPP
+
+#include "include/reader.hpp"
+#include <cstddef>
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
+
+namespace Reader {
+
+  // What an image header says about the pixels, read without decoding them
+  struct ImageInfo {
+    ImageType type;
+    int width;
+    int height;
+    int channels;  // Samples per pixel as stored, e.g. 1 for grayscale, 4 for RGBA
+    int depth;     // Bits per sample, e.g. 8 or 16
+    // EXIF orientation, 1 to 8: how the stored pixels are turned to be shown upright (1 is as
+    // stored). Read from JPEG headers, whose decoders apply it; 1 for the other formats.
+    int orientation = 1;
+  };
+
+  // Given a file path as an argument, read the image header and return its type and dimensions.
+  // The type comes from the header bytes, not from the extension.
+  // Only the header is read, usually a single small read. Returns std::nullopt if the
+  // file can't be read or the header is not a supported BMP, GIF, JPEG, PNG, TIFF or WebP header.
+  std::optional<ImageInfo> probe_image(const string& path);
+
+  // Same as probe_image, but for an encoded image that is already in memory
+  std::optional<ImageInfo> probe_image(std::span<const std::byte> data);
+
+  // Probe many files at once, see probe_image. Consecutive files of the same directory are opened
+  // relative to it and every header is read into the same buffer. The result has one entry per
+  // path, std::nullopt where the file is missing or not an image.
+  vector<std::optional<ImageInfo>> probe_images(const vector<fs::path>& paths);
+
+  // Called once for every image found by probe_image_files, with its header. Calls are serialized.
+  using ProbedImageCallback = std::function<void(const fs::path&, const ImageInfo&)>;
+
+  // Given a directory path as an argument, walk it like scan_image_files, but identify every regular
+  // file by its header instead of its extension: extensionless and mislabeled images are found with
+  // their true type and dimensions, and files that are not images are skipped without a decode
+  // attempt. Headers are read in batches per directory by the walking threads (see walk_files).
+  void probe_image_files(const string& path, const ProbedImageCallback& on_image, const ScanOptions& options = ScanOptions());
+
+} // namespace Reader
+
+#endif // PROBE_HPP
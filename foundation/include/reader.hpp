@@ -2,7 +2,9 @@
 #define READER_H
 
 #include <filesystem>
+#include <functional>
 #include <iostream>
+#include <thread>
 #include <vector>
 #include <map>
 
@@ -26,10 +28,43 @@ namespace Reader {
         {"webp", ImageType::WEBP}
     };
 
+    // Given an image type as an argument, return the extension it is usually saved with, without the dot
+    // For example, ImageType::JPEG => jpg
+    string get_type_extension(ImageType type);
+
     // Given a directory path as an argument, return the paths of all image files
     // supported formats include BMP, GIF, JPEG, PNG, TIFF, and WebP
     vector<fs::path> find_image_files(string path);
 
+    // Options for scan_image_files
+    struct ScanOptions {
+        bool recursive = true;  // Descend into subdirectories (symlinked directories are not followed)
+        unsigned threads = std::thread::hardware_concurrency();  // Directories walked in parallel
+    };
+
+    // Called once for every image file found by scan_image_files. Calls are serialized.
+    using ImageCallback = std::function<void(const fs::path&)>;
+
+    // Given a directory path as an argument, walk it and call on_image for every image file as soon
+    // as it is found, so processing can start before the walk finishes. Subdirectories are walked
+    // in parallel, and file types come from the cached directory entries, so no extra stat
+    // call is made per file.
+    // supported formats include BMP, GIF, JPEG, PNG, TIFF, and WebP
+    void scan_image_files(const string& path, const ImageCallback& on_image, const ScanOptions& options = ScanOptions());
+
+    // Called by walk_files with a batch of regular files from one directory. Calls come from the
+    // walking threads and may run concurrently.
+    using FilesCallback = std::function<void(const vector<fs::path>&)>;
+
+    // Given a directory path as an argument, walk it like scan_image_files, but call on_files with
+    // every regular file, whatever its name, in batches of files from the same directory. Batches
+    // are handed over while the directory is still being read.
+    void walk_files(const string& path, const FilesCallback& on_files, const ScanOptions& options = ScanOptions());
+
+    // Given a directory entry as an argument, return true if it is a regular file with an image
+    // extension. Uses the entry's cached status instead of querying the file system again.
+    bool is_image_entry(const fs::directory_entry& entry);
+
     // Given a file path as an argument, return true if the file is an image
     // supported formats include BMP, GIF, JPEG, PNG, TIFF, and WebP
     bool is_file_image(const string& path);
@@ -0,0 +1,34 @@
+#ifndef REGION_READER_HPP
+#define REGION_READER_HPP
+
+#include "include/image_editor.hpp"
+#include "include/probe.hpp"
+#include <filesystem>
+
+namespace ImageEditor {
+  namespace fs = std::filesystem;
+
+  // Returns true when region lies inside a width x height image and is not empty
+  bool is_region_inside(const cv::Rect& region, int width, int height);
+
+  // Read only the given region of an image, with the same channels and depth as read_image.
+  // Non-interlaced PNGs stop decoding after the last row of the region and 8-bit TIFFs decode only
+  // the strips or tiles that intersect it. Other formats are fully decoded and a view of the region
+  // is returned.
+  Result<cv::Mat> read_image_region(const fs::path& image_path, const cv::Rect& region, ReadMode mode = ReadMode::COLOR);
+
+  // Read the square of an image selected by pivot_rect. The dimensions come from the header
+  // (see Reader::probe_image), so only the square is decoded where the format allows it.
+  Result<cv::Mat> read_square(const fs::path& image_path, const PivotRect& pivot_rect, ReadMode mode = ReadMode::COLOR);
+
+  // Same as above, reusing the buffers of workspace (see read_image)
+  Result<cv::Mat> read_square(const fs::path& image_path, const PivotRect& pivot_rect, Workspace& workspace,
+    ReadMode mode = ReadMode::COLOR);
+
+  // Same as above, with the header already probed from the file, so it is not read again
+  Result<cv::Mat> read_square(const fs::path& image_path, const Reader::ImageInfo& info, const PivotRect& pivot_rect,
+    Workspace& workspace, ReadMode mode = ReadMode::COLOR);
+
+} // namespace ImageEditor
+
+#endif // REGION_READER_HPP
@@ -0,0 +1,157 @@
+#ifndef SERVER_HPP
+#define SERVER_HPP
+
+#include "include/image_editor.hpp"
+#include "include/lru_cache.hpp"
+#include "include/metrics.hpp"
+#include <atomic>
+#include <cstdint>
+#include <filesystem>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <opencv2/opencv.hpp>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace Server {
+  namespace fs = std::filesystem;
+  using ImageEditor::PivotRect;
+  using ImageEditor::Result;
+  using ImageEditor::Status;
+
+  // One crop: the square of an image selected by pivot_rect, scaled to size x size and encoded
+  // in format
+  struct Request {
+    fs::path path;             // The image file, or empty when bytes hold the image
+    std::vector<uchar> bytes;  // The encoded image when path is empty
+    PivotRect pivot_rect;
+    int size = 0;              // Side of the output in pixels, 0 keeps the size of the square
+    std::string format = "png";  // Output format by extension, with or without the dot
+  };
+
+  // An encoded crop, shared between the result cache and the replies that use it
+  using Encoded = std::shared_ptr<const std::vector<uchar>>;
+
+  // Cache sizes for CropService
+  struct Options {
+    std::size_t result_cache_bytes = std::size_t(256) << 20;  // Encoded crops
+    std::size_t image_cache_bytes = std::size_t(1) << 30;     // Decoded images, before cropping
+  };
+
+  // Counts since the service was made
+  struct Stats {
+    std::uint64_t requests = 0;
+    std::uint64_t failures = 0;
+    LruCache<std::string, Encoded>::Stats results;
+    LruCache<std::uint64_t, cv::Mat>::Stats images;
+    double p50_seconds = 0;  // Request latency, see Metrics::Histogram::quantile_seconds
+    double p99_seconds = 0;
+
+    // Hits over lookups, 0 before the first lookup
+    double result_hit_ratio() const;
+    double image_hit_ratio() const;
+  };
+
+  // Stats as a JSON object
+  std::string to_json(const Stats& stats);
+
+  // Answers crop requests from two caches: encoded results keyed by the content hash of the image
+  // and the request parameters, and, for new parameters on a recently seen image, the decoded
+  // image keyed by its content hash. Files are only hashed again when their size or modification
+  // time changed. Requests are served concurrently.
+  // Example usage: service.crop(Request{ "/path/to/image.png", {}, PivotRect(), 256, "webp" });
+  class CropService {
+  public:
+    explicit CropService(const Options& options = Options());
+
+    Result<Encoded> crop(const Request& request);
+
+    Stats stats() const;
+
+  private:
+    // What a file looked like when it was hashed
+    struct FileHash {
+      std::uintmax_t size;
+      fs::file_time_type mtime;
+      std::uint64_t hash;
+    };
+
+    bool hash_file(const fs::path& path, std::vector<uchar>& bytes, std::uint64_t& hash);
+
+    LruCache<std::string, Encoded> results;
+    LruCache<std::uint64_t, cv::Mat> images;
+    LruCache<std::string, FileHash> file_hashes;
+    Metrics::Histogram latency;
+    std::atomic<std::uint64_t> requests{ 0 };
+    std::atomic<std::uint64_t> failures{ 0 };
+  };
+
+  // Serves a CropService on a Unix domain socket. A connection carries any number of requests,
+  // each answered before the next one is read. Every connection is served on its own thread.
+  //
+  // Requests are a text line, followed by a body for CROP:
+  //   CROP <path|bytes> <pivots> <size> <format> <length>\n<length bytes: the path or the encoded image>
+  //   STATS\n
+  // where pivots are the two letters of a file name suffix, e.g. "cc" or "lt" (see
+  // ImageEditor::parse_pivot_suffix). Replies are
+  //   OK <length>\n<length bytes: the encoded crop, or the stats as JSON>
+  //   ERROR <message>\n
+  class SocketServer {
+  public:
+    SocketServer(const fs::path& socket_path, CropService& service);
+    ~SocketServer();
+
+    SocketServer(const SocketServer&) = delete;
+    SocketServer& operator=(const SocketServer&) = delete;
+
+    // Returns true if the socket is listening
+    bool is_open() const;
+
+    // Accept connections until stop(). Requests being answered are finished before it returns.
+    void run();
+
+    // Make run() return. Safe to call from a signal handler or another thread.
+    void stop();
+
+  private:
+    void serve(int connection_fd);
+
+    fs::path socket_path;
+    CropService& service;
+    int listen_fd = -1;
+    int wake_fd = -1;
+
+    std::mutex connections_mutex;
+    std::vector<int> connection_fds;
+    std::list<std::pair<std::thread, std::shared_ptr<std::atomic<bool>>>> connections;  // Threads and whether they finished
+  };
+
+  // A connection to a SocketServer
+  class Client {
+  public:
+    explicit Client(const fs::path& socket_path);
+    ~Client();
+
+    Client(const Client&) = delete;
+    Client& operator=(const Client&) = delete;
+
+    bool is_open() const;
+
+    // Get an encoded crop
+    Result<std::vector<uchar>> crop(const Request& request);
+
+    // Get the server's stats as JSON
+    Result<std::string> stats();
+
+  private:
+    Result<std::vector<uchar>> call(const std::string& header, std::span<const uchar> body);
+
+    int fd = -1;
+    std::vector<char> buffer;  // Read ahead of the reply being parsed
+  };
+
+} // namespace Server
+
+#endif // SERVER_HPP
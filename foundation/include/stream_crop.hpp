@@ -0,0 +1,45 @@
+#ifndef STREAM_CROP_HPP
+#define STREAM_CROP_HPP
+
+#include "include/image_editor.hpp"
+#include "include/probe.hpp"
+#include <cstddef>
+#include <filesystem>
+
+namespace ImageEditor {
+  namespace fs = std::filesystem;
+
+  // Default memory budget of a streaming crop, see crop_square_streaming
+  constexpr std::size_t DEFAULT_TILE_BUDGET = std::size_t(64) << 20;
+
+  // crop_square streams images whose decoded pixels would take more than this many bytes
+  constexpr std::size_t STREAMING_THRESHOLD = std::size_t(256) << 20;
+
+  // Returns true when image_path is a PNG (or, with libtiff, a TIFF) whose decoded pixels take more
+  // than STREAMING_THRESHOLD bytes according to its header, and output_path is a PNG, JPEG or TIFF
+  // file (by extension). Those crops should go through crop_square_streaming.
+  bool should_stream_crop(const fs::path& image_path, const fs::path& output_path);
+
+  // Same as above, with the header already probed from the image
+  bool should_stream_crop(const Reader::ImageInfo& info, const fs::path& output_path);
+
+  // Crop the square of image_path selected by pivot_rect into output_path without holding the image
+  // in memory. Source rows are decoded in bands, only the columns inside the square are kept and
+  // every band is handed to a streaming encoder before the next one is read, so peak memory is
+  // bounded by tile_budget instead of by the size of the image. The budget must fit one source row
+  // (one row of tiles for tiled TIFFs) plus one band row of the square.
+  //
+  // Inputs: non-interlaced PNGs and, with libtiff, 8 or 16-bit gray or RGB TIFFs. Outputs: PNG, JPEG
+  // and, with libtiff, TIFF. Channels and bit depth are kept where the output format can store them,
+  // otherwise alpha is dropped and 16-bit samples are scaled to 8 bits like fit_to_format does.
+  // The output is encoded with the settings of profile, like save_image. AUTO pivots are centered:
+  // placing them would take a second pass over an image that is too big to decode.
+  // Returns true on success, false otherwise. The output is streamed to a temporary file and renamed
+  // into place, so output_path may be image_path, and on failure output_path is left as it was.
+  // Example usage: crop_square_streaming("/path/to/scan.png", PivotRect(), "/path/to/cropped.png", std::size_t(16) << 20);
+  bool crop_square_streaming(const fs::path& image_path, const PivotRect& pivot_rect, const fs::path& output_path,
+    std::size_t tile_budget = DEFAULT_TILE_BUDGET, EncodeProfile profile = EncodeProfile::FAST);
+
+} // namespace ImageEditor
+
+#endif // STREAM_CROP_HPP
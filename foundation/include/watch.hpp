@@ -0,0 +1,71 @@
+#ifndef WATCH_HPP
+#define WATCH_HPP
+
+#include <chrono>
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <unordered_map>
+#include <vector>
+
+namespace Watch {
+  namespace fs = std::filesystem;
+  using Clock = std::chrono::steady_clock;
+
+  // Options for Watcher
+  struct Options {
+    std::chrono::milliseconds settle{ 100 };  // Quiet time after the last write before a file is handed over
+    bool recursive = true;                    // Watch subdirectories, including ones created later
+  };
+
+  // Called once for every image file that is ready. Calls are made from the thread running Watcher::run.
+  using FileCallback = std::function<void(const fs::path&)>;
+
+  // Watches directories with inotify and reports image files once they are completely written.
+  // A file is ready when its writer closed it (or it was moved in) and nothing wrote to it for
+  // options.settle since, so files written in several passes are reported once. Files that are
+  // already in a directory when it starts being watched are not reported, except in directories
+  // created while watching, which are scanned as they are added.
+  class Watcher {
+  public:
+    explicit Watcher(const std::vector<fs::path>& directories, const Options& options = Options());
+    ~Watcher();
+
+    Watcher(const Watcher&) = delete;
+    Watcher& operator=(const Watcher&) = delete;
+
+    // Returns true if inotify is set up and every directory is watched
+    bool is_open() const;
+
+    // Report ready files to on_file until stop() is called
+    void run(const FileCallback& on_file);
+
+    // Make run() return after the current callback. Safe to call from a signal handler or another
+    // thread, before or during run().
+    void stop();
+
+  private:
+    // A file with write activity that was not reported yet
+    struct Pending {
+      Clock::time_point last_event;
+      bool closed;  // The last writer closed the file
+    };
+
+    bool add_watch(const fs::path& directory, bool scan);
+    void rescan();
+    void read_events();
+    void touch(const fs::path& path, bool closed);
+    int next_timeout() const;
+
+    Options options;
+    int inotify_fd = -1;
+    int wake_fd = -1;
+    bool open = false;
+    std::vector<fs::path> roots;  // The directories given to the constructor
+    std::unordered_map<int, fs::path> directories;  // Watched directories by watch descriptor
+    std::map<fs::path, Pending> pending;
+  };
+
+} // namespace Watch
+
+#endif // WATCH_HPP
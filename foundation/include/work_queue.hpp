@@ -0,0 +1,134 @@
+#ifndef WORK_QUEUE_HPP
+#define WORK_QUEUE_HPP
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace Shard {
+  namespace fs = std::filesystem;
+
+  // Sizing and timing of a WorkQueue
+  struct Options {
+    std::size_t chunk_size = 64;  // Files per chunk, the unit workers claim
+    // A claim whose owner has not renewed it for this long is taken over. Owners on the same host
+    // are checked directly, so this only matters for workers on other hosts.
+    std::chrono::milliseconds lease{ 60000 };
+  };
+
+  // A claimed chunk of the plan
+  struct Chunk {
+    std::size_t index;
+    std::vector<std::size_t> pending;  // Plan indices of the files not completed by an earlier owner
+  };
+
+  // How far the queue got, as seen by one worker
+  struct Progress {
+    std::size_t chunks;
+    std::size_t done_chunks;
+    std::size_t files;
+  };
+
+  // A crash-safe work queue on a directory shared by worker processes, on one host or on several
+  // hosts sharing a filesystem. No worker is in charge and nothing is locked:
+  //  plan          The list of files, written once by the first worker and linked into place, so
+  //                every worker sees the same list. Chunk i is files [i * chunk_size, (i + 1) * chunk_size).
+  //  claims/I.G    Chunk I is held by the worker named in the file. Claims are created exclusively
+  //                (O_EXCL) and kept alive by touching them. A claim whose owner died, or stopped
+  //                renewing it for a lease, is taken over by creating generation G + 1.
+  //  progress/I    One line per completed file of chunk I, each appended with a single write, so a
+  //                new owner of the chunk skips what was already done. Torn lines are ignored.
+  //  done/I        Chunk I is finished.
+  // A restarted run resumes where the last one stopped. Delete the directory to start over.
+  // All member functions are thread-safe.
+  class WorkQueue {
+  public:
+    // Called by the worker that writes the plan, to list the files to process
+    using FileLister = std::function<std::vector<fs::path>()>;
+
+    // Open the queue in directory, writing the plan from list_files if no worker did yet. Only the
+    // first plan is kept, later workers use it as it is.
+    WorkQueue(const fs::path& directory, const FileLister& list_files, const Options& options = Options());
+
+    // Held chunks that were not finished are given up, so other workers can take them at once
+    ~WorkQueue();
+
+    WorkQueue(const WorkQueue&) = delete;
+    WorkQueue& operator=(const WorkQueue&) = delete;
+
+    // Returns true if the plan could be written or read
+    bool is_open() const;
+
+    // The files of the plan
+    const std::vector<fs::path>& files() const;
+
+    std::size_t chunk_count() const;
+
+    // Claim a chunk that is neither done nor held by a live worker. While every remaining chunk is
+    // held by others, waits for them to finish or for their owners to die. Returns std::nullopt
+    // once every chunk is done, or when stop() was called.
+    std::optional<Chunk> claim();
+
+    // Record that a file of a held chunk was processed, successfully or not. Failed files are not
+    // retried by the next owner. Returns false on write errors.
+    bool complete(std::size_t chunk, std::size_t file, bool success);
+
+    // Mark a held chunk as done and give up its claim. Returns false on write errors.
+    bool finish(std::size_t chunk);
+
+    // Make claim() return std::nullopt, now and from then on. Safe to call from a signal handler.
+    void stop();
+
+    // Count the done chunks. Looks at every chunk that was not seen done before.
+    Progress progress();
+
+  private:
+    // What this worker holds of a chunk it claimed
+    struct Held {
+      int claim_fd;
+      int progress_fd;
+      fs::path claim_path;
+    };
+
+    enum class ClaimResult { CLAIMED, HELD, DONE, ERROR };
+
+    bool open_plan(const FileLister& list_files);
+    bool is_done(std::size_t chunk);
+    ClaimResult try_claim(std::size_t chunk);
+    bool is_stale(const fs::path& claim_path) const;
+    std::vector<std::size_t> pending_files(std::size_t chunk) const;
+    void release(std::size_t chunk, bool remove_claim);
+    void renew_claims();
+
+    fs::path directory;
+    Options options;
+    std::string owner;  // "host pid", written into claims
+    std::string host;
+    std::vector<fs::path> plan;
+    bool open = false;
+
+    std::vector<bool> known_done;  // Chunks seen done, which stay done
+    std::size_t cursor = 0;        // Where the next claim() starts looking
+
+    std::mutex claim_mutex;  // Serializes claim() and progress()
+
+    std::map<std::size_t, Held> held;
+    std::atomic<bool> stopped{ false };
+    bool closing = false;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::thread renewer;
+  };
+
+} // namespace Shard
+
+#endif // WORK_QUEUE_HPP
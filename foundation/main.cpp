@@ -1,34 +1,406 @@
-#include "include/image_editor.hpp"
+#include "include/archive.hpp"
+#include "include/batch.hpp"
+#include "include/manifest.hpp"
+#include "include/metrics.hpp"
+#include "include/probe.hpp"
 #include "include/reader.hpp"
+#include "include/server.hpp"
+#include "include/watch.hpp"
+#include "include/work_queue.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdlib>
 #include <filesystem>
 #include <iostream>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
 
-using ImageEditor::PivotRect;
 namespace fs = std::filesystem;
-int main() {
-  std::string path = "/home/Bagheri/Pictures/Screenshots";
-  const auto files = Reader::find_image_files(path);
-  // std::cout << "in path: " << files[0] << std::endl;
-
-  for (const auto& file : files) {
-    const std::string file_name = Reader::get_file_name(file);
-    std::size_t index = file_name.rfind('_');
-    char ch_pivot;
-    char cv_pivot;
-    bool has_prefix = std::string::npos != index;
-    if (has_prefix && file_name.length() >= index + 2) {
-      ch_pivot = file_name.substr(index + 1, index + 2)[0];
-    }
-
-    if (has_prefix && file_name.length() >= index + 3) {
-      cv_pivot = file_name.substr(index + 2, index + 3)[0];
-    }
-    auto horizontal_pivot = ImageEditor::char_to_horizontal_pivot(ch_pivot);
-    auto vertical_pivot = ImageEditor::char_to_vertical_pivot(cv_pivot);
-    fs::path output = "./output" / fs::path(file).filename();
-    std::cout << "crop: " << file_name << std::endl;
-    ImageEditor::crop_square(file, PivotRect(horizontal_pivot, vertical_pivot), output);
+
+// Set by SIGUSR1, the metrics summary is printed at the next finished or found file
+static std::atomic<bool> metrics_requested{ false };
+
+// The watcher of --watch mode, the server of --serve mode and the queue of --queue mode, stopped
+// by SIGTERM and SIGINT
+static std::atomic<Watch::Watcher*> active_watcher{ nullptr };
+static std::atomic<Server::SocketServer*> active_server{ nullptr };
+static std::atomic<Shard::WorkQueue*> active_queue{ nullptr };
+// Set by SIGTERM and SIGINT, batch runs stop submitting files and drain what is queued
+static std::atomic<bool> stop_requested{ false };
+
+static void stop_on_signal(int) {
+  stop_requested = true;
+  if (Watch::Watcher* watcher = active_watcher.load())
+    watcher->stop();
+  if (Server::SocketServer* server = active_server.load())
+    server->stop();
+  if (Shard::WorkQueue* queue = active_queue.load())
+    queue->stop();
+}
+
+// CHROMAEDIT_METRICS selects the summary format: "json", "prometheus" or "off". Unset prints nothing.
+static std::string metrics_format() {
+  const char* format = std::getenv("CHROMAEDIT_METRICS");
+  return format == nullptr ? "" : format;
+}
+
+static void print_metrics(const std::string& format) {
+  if (format == "prometheus")
+    std::cerr << Metrics::to_prometheus();
+  else if (format == "json")
+    std::cerr << Metrics::to_json() << std::endl;
+}
+
+// Usage: ChromaEdit [--watch] [--jobs N] [--memory-mb MB] [--settle MS] [--profile NAME] [--format EXT] [directory|archive...]
+//        ChromaEdit --queue DIR [--chunk N] [--jobs N] [--memory-mb MB] [--profile NAME] [--format EXT] [directory...]
+//        ChromaEdit --serve SOCKET [--cache-mb MB]
+//  --watch     After cropping what is there, keep cropping files as they land until SIGTERM or SIGINT
+//  --jobs      Worker threads shared by the decode, crop and encode stages (default: one per core)
+//  --memory-mb Budget for the decoded images in flight, see Batch::MemoryScheduler (default: no limit)
+//  --settle    Milliseconds a new file must go unwritten before it is cropped in watch mode (default: 100)
+//  --profile   Encoder settings: fast, balanced or small (see ImageEditor::EncodeProfile, default: fast)
+//  --format    Write every output in this format (bmp, jpg, png, tiff, webp, ...) instead of the input's
+//  --serve     Answer crop requests on a Unix domain socket until SIGTERM or SIGINT (see Server::SocketServer)
+//  --cache-mb  Memory of the server's caches, split between encoded crops and decoded images (default: 1280)
+//  --queue     Share the directories with every worker started with the same queue directory, on this
+//              host or others sharing the filesystem, and resume an interrupted run (see Shard::WorkQueue)
+//  --chunk     Files per chunk of the queue, set by the worker that starts it (default: 64)
+// Tar and zip archives are cropped into an archive of the same name in the output directory,
+// without extracting them (see Archive::crop_archive).
+struct CommandLine {
+  bool watch = false;
+  fs::path socket_path;
+  std::size_t cache_mb = 1280;
+  unsigned jobs = std::thread::hardware_concurrency();
+  std::size_t memory_mb = 0;
+  std::chrono::milliseconds settle{ 100 };
+  fs::path queue_path;
+  std::size_t chunk_size = 64;
+  ImageEditor::EncodeProfile profile = ImageEditor::EncodeProfile::FAST;
+  std::optional<Reader::ImageType> output_type;
+  std::vector<fs::path> directories;
+};
+
+// Returns false and prints the usage on unknown or malformed arguments
+static bool parse_command_line(int argc, char** argv, CommandLine& command_line) {
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    try {
+      if (arg == "--watch")
+        command_line.watch = true;
+      else if (arg == "--jobs" && i + 1 < argc)
+        command_line.jobs = unsigned(std::stoul(argv[++i]));
+      else if (arg == "--memory-mb" && i + 1 < argc)
+        command_line.memory_mb = std::stoul(argv[++i]);
+      else if (arg == "--settle" && i + 1 < argc)
+        command_line.settle = std::chrono::milliseconds(std::stoul(argv[++i]));
+      else if (arg == "--serve" && i + 1 < argc)
+        command_line.socket_path = argv[++i];
+      else if (arg == "--cache-mb" && i + 1 < argc)
+        command_line.cache_mb = std::stoul(argv[++i]);
+      else if (arg == "--queue" && i + 1 < argc)
+        command_line.queue_path = fs::absolute(argv[++i]).lexically_normal();
+      else if (arg == "--chunk" && i + 1 < argc)
+        command_line.chunk_size = std::max<std::size_t>(1, std::stoul(argv[++i]));
+      else if (arg == "--profile" && i + 1 < argc)
+        command_line.profile = ImageEditor::parse_encode_profile(argv[++i]).value();
+      else if (arg == "--format" && i + 1 < argc)
+        command_line.output_type = Reader::image_type_map.at(Reader::get_file_type(std::string(".") + argv[++i]));
+      else if (arg.rfind("--", 0) == 0)
+        throw std::invalid_argument(arg);
+      else
+        command_line.directories.push_back(fs::absolute(arg).lexically_normal());
+    }
+    catch (const std::exception&) {
+      std::cerr << "Usage: " << argv[0] << " [--watch] [--jobs N] [--memory-mb MB] [--settle MS] [--profile NAME] [--format EXT] [directory|archive...]" << std::endl
+        << "       " << argv[0] << " --queue DIR [--chunk N] [--jobs N] [--memory-mb MB] [--profile NAME] [--format EXT] [directory...]" << std::endl
+        << "       " << argv[0] << " --serve SOCKET [--cache-mb MB]" << std::endl;
+      return false;
+    }
   }
+  if (command_line.directories.empty())
+    command_line.directories.push_back("/home/Bagheri/Pictures/Screenshots");
+  return true;
+}
 
+// Serve crops on a Unix domain socket until SIGTERM or SIGINT
+static int serve(const CommandLine& command_line, const std::string& format) {
+  // A fifth for encoded crops, which are small, the rest for decoded images
+  std::size_t cache_bytes = command_line.cache_mb << 20;
+  Server::CropService service(Server::Options{ cache_bytes / 5, cache_bytes - cache_bytes / 5 });
+  Server::SocketServer server(command_line.socket_path, service);
+  if (!server.is_open())
+    return 1;
+  active_server = &server;
+  std::signal(SIGTERM, stop_on_signal);
+  std::signal(SIGINT, stop_on_signal);
+  std::cout << "serving on " << command_line.socket_path.string() << std::endl;
+  server.run();
+  active_server = nullptr;
+  std::cout << Server::to_json(service.stats()) << std::endl;
+  print_metrics(format);
   return 0;
 }
+
+// Returns true if path is directory or inside it. Both must be absolute and normal.
+static bool is_inside(const fs::path& path, const fs::path& directory) {
+  fs::path relative = path.lexically_relative(directory);
+  return !relative.empty() && *relative.begin() != "..";
+}
+
+// Crop the files of the queue's plan chunk by chunk, next to the workers of other processes, until
+// every chunk is done or SIGTERM or SIGINT. The first worker lists the directories into the plan.
+// Completed files are recorded in the queue instead of the manifest, which only skips unchanged
+// files here: workers can't safely replace one manifest file side by side.
+static int run_queue(const CommandLine& command_line, const fs::path& output_dir, const std::string& format) {
+  Manifest::Index manifest;
+  manifest.load(output_dir / ".chromaedit_manifest");
+  Shard::WorkQueue queue(command_line.queue_path, [&]() {
+    std::vector<fs::path> files;
+    for (const auto& directory : command_line.directories) {
+      Reader::probe_image_files(directory, [&](const fs::path& file, const Reader::ImageInfo&) {
+        if (!is_inside(file, output_dir) && !is_inside(file, command_line.queue_path))
+          files.push_back(file);
+      });
+    }
+    std::sort(files.begin(), files.end());
+    return files;
+  }, Shard::Options{ command_line.chunk_size });
+  if (!queue.is_open())
+    return 1;
+  active_queue = &queue;
+  std::signal(SIGTERM, stop_on_signal);
+  std::signal(SIGINT, stop_on_signal);
+
+  // The chunk and plan index of every submitted job, by submission order, and the files each
+  // chunk still waits for, plus one until all of them are submitted. A chunk is finished by
+  // whoever brings its count to zero.
+  std::mutex mutex;
+  std::vector<std::pair<std::size_t, std::size_t>> submitted;
+  std::map<std::size_t, std::size_t> remaining;
+  std::size_t failures = 0;
+  auto settle = [&](std::size_t chunk) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (--remaining[chunk] == 0) {
+      remaining.erase(chunk);
+      queue.finish(chunk);
+    }
+  };
+  auto complete = [&](std::size_t chunk, std::size_t file, bool success) {
+    queue.complete(chunk, file, success);
+    if (!success) {
+      std::lock_guard<std::mutex> lock(mutex);
+      failures++;
+    }
+    settle(chunk);
+  };
+
+  Batch::Options options = Batch::default_options(std::max(1u, command_line.jobs));
+  options.memory_budget = command_line.memory_mb << 20;
+  options.encode_profile = command_line.profile;
+  Batch::Engine engine(options, [&](const Batch::FileStatus& file_status) {
+    bool success = file_status.status == ImageEditor::Status::SUCCESS;
+    std::cout << (success ? "crop: " : "failed: ") << file_status.input.stem().string() << std::endl;
+    std::pair<std::size_t, std::size_t> origin;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      origin = submitted[file_status.index];
+    }
+    complete(origin.first, origin.second, success);
+  });
+
+  std::size_t skipped = 0;
+  while (std::optional<Shard::Chunk> chunk = queue.claim()) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      remaining[chunk->index] = chunk->pending.size() + 1;
+    }
+    std::vector<fs::path> paths;
+    for (std::size_t file : chunk->pending)
+      paths.push_back(queue.files()[file]);
+    std::vector<std::optional<Reader::ImageInfo>> infos = Reader::probe_images(paths);
+    for (std::size_t i = 0; i < paths.size(); i++) {
+      auto directory = std::find_if(command_line.directories.begin(), command_line.directories.end(),
+        [&](const fs::path& directory) { return is_inside(paths[i], directory); });
+      // Gone since the plan was written, or listed from other directories by another worker
+      if (!infos[i] || directory == command_line.directories.end()) {
+        std::cout << "failed: " << paths[i].stem().string() << std::endl;
+        complete(chunk->index, chunk->pending[i], false);
+        continue;
+      }
+      Batch::Job job = Batch::make_job(paths[i], *infos[i], output_dir / paths[i].parent_path().lexically_relative(*directory),
+        command_line.output_type);
+      if (manifest.is_up_to_date(job.input, job.pivot_rect, job.output, command_line.profile)) {
+        skipped++;
+        complete(chunk->index, chunk->pending[i], true);
+        continue;
+      }
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        submitted.emplace_back(chunk->index, chunk->pending[i]);
+      }
+      engine.submit(std::move(job));
+    }
+    settle(chunk->index);
+  }
+  engine.close();
+  active_queue = nullptr;
+
+  Shard::Progress progress = queue.progress();
+  if (skipped > 0)
+    std::cout << "skipped " << skipped << " unchanged files" << std::endl;
+  std::cout << "queue: " << progress.done_chunks << " of " << progress.chunks << " chunks of "
+    << progress.files << " files done" << std::endl;
+  print_metrics(format);
+  return failures == 0 ? 0 : 1;
+}
+
+int main(int argc, char** argv) {
+  CommandLine command_line;
+  if (!parse_command_line(argc, argv, command_line))
+    return 2;
+  const fs::path output_dir = fs::absolute("./output").lexically_normal();
+  const fs::path manifest_path = output_dir / ".chromaedit_manifest";
+
+  std::string format = metrics_format();
+  Metrics::set_enabled(format != "off");
+  std::signal(SIGUSR1, [](int) { metrics_requested = true; });
+  if (!command_line.socket_path.empty())
+    return serve(command_line, format);
+  if (!command_line.queue_path.empty())
+    return run_queue(command_line, output_dir, format);
+  auto poll_metrics = [&]() {
+    if (metrics_requested.exchange(false)) {
+      print_metrics(format.empty() || format == "off" ? "json" : format);
+    }
+  };
+
+  // Files whose output is still up to date from an earlier run are skipped
+  Manifest::Index manifest;
+  manifest.load(manifest_path);
+
+  std::size_t failures = 0;
+  std::size_t skipped = 0;
+  // One engine for the whole run, so in watch mode every file lands on warm workers whose
+  // buffers are already allocated
+  Batch::Options options = Batch::default_options(std::max(1u, command_line.jobs));
+  options.memory_budget = command_line.memory_mb << 20;
+  options.encode_profile = command_line.profile;
+  options.hash_inputs = true;
+  Batch::Engine engine(options, [&](const Batch::FileStatus& file_status) {
+    poll_metrics();
+    if (file_status.status == ImageEditor::Status::SUCCESS) {
+      std::cout << "crop: " << file_status.input.stem().string() << std::endl;
+      manifest.record(file_status.input, file_status.pivot_rect, file_status.output, command_line.profile,
+        file_status.input_hash);
+    }
+    else {
+      failures++;
+      std::cout << "failed: " << file_status.input.stem().string() << std::endl;
+    }
+  });
+
+  // Subdirectories are mirrored in the output. Outputs written inside a watched directory are not
+  // cropped again.
+  auto submit = [&](const fs::path& file, const Reader::ImageInfo& info, const fs::path& directory) {
+    poll_metrics();
+    if (stop_requested || is_inside(file, output_dir))
+      return;
+    Batch::Job job = Batch::make_job(file, info, output_dir / file.parent_path().lexically_relative(directory),
+      command_line.output_type);
+    if (manifest.is_up_to_date(job.input, job.pivot_rect, job.output, command_line.profile)) {
+      skipped++;
+      return;
+    }
+    engine.submit(std::move(job));
+  };
+
+  // A signal during the catch-up scan stops it like it stops watching, and the queued files are
+  // still drained and recorded in the manifest below
+  std::signal(SIGTERM, stop_on_signal);
+  std::signal(SIGINT, stop_on_signal);
+
+  // Archives are read and written in place of the directories, member by member
+  std::erase_if(command_line.directories, [&](const fs::path& archive) {
+    if (!Archive::format_of(archive) || !fs::is_regular_file(archive))
+      return false;
+    if (stop_requested)
+      return true;
+    Archive::crop_archive(archive, output_dir / archive.filename(), std::max(1u, command_line.jobs),
+      [&](const Archive::MemberStatus& member_status) {
+        poll_metrics();
+        if (member_status.status == ImageEditor::Status::SUCCESS)
+          std::cout << "crop: " << member_status.name << std::endl;
+        else {
+          failures++;
+          std::cout << "failed: " << member_status.name << std::endl;
+        }
+      });
+    return true;
+  });
+
+  // The watcher is armed before the catch-up scan, so files created while it runs are reported
+  // even when the walk already passed their directory. Files both scanned and reported are
+  // skipped by the manifest or cropped again to the same output.
+  std::optional<Watch::Watcher> watcher;
+  if (command_line.watch) {
+    watcher.emplace(command_line.directories, Watch::Options{ command_line.settle, true });
+    if (!watcher->is_open())
+      failures++;
+    // Stop taking new files; what is already queued is drained by engine.close() below
+    active_watcher = &*watcher;
+    if (stop_requested)
+      watcher->stop();
+  }
+
+  // Files are cropped while the walk is still going. They are found by their headers, so files
+  // without an image extension are cropped too and files that are not images never reach a decoder.
+  for (const auto& directory : command_line.directories) {
+    if (stop_requested)
+      break;
+    Reader::probe_image_files(directory, [&](const fs::path& file, const Reader::ImageInfo& info) {
+      submit(file, info, directory);
+    });
+  }
+
+  if (watcher) {
+    std::cout << "watching " << command_line.directories.size() << " directories" << std::endl;
+    watcher->run([&](const fs::path& file) {
+      std::optional<Reader::ImageInfo> info = Reader::probe_image(file.string());
+      if (!info) {
+        std::cout << "not an image: " << file.filename().string() << std::endl;
+        return;
+      }
+      for (const auto& directory : command_line.directories) {
+        if (is_inside(file, directory)) {
+          submit(file, *info, directory);
+          return;
+        }
+      }
+    });
+    active_watcher = nullptr;
+  }
+  engine.close();
+
+  fs::create_directories(output_dir);
+  manifest.save(manifest_path);
+  if (skipped > 0)
+    std::cout << "skipped " << skipped << " unchanged files" << std::endl;
+  // How much of the budget the run used, to size the memory of the machine or container it runs in
+  Batch::MemoryStats memory = engine.memory_stats();
+  if (memory.budget_bytes > 0) {
+    std::cout << "memory: peak " << (memory.peak_bytes >> 20) << " MiB (" << int(100 * memory.peak_utilization())
+      << "%), mean " << std::size_t(memory.mean_bytes) / (1 << 20) << " MiB (" << int(100 * memory.mean_utilization())
+      << "%) of " << (memory.budget_bytes >> 20) << " MiB, " << memory.waits << " waits for "
+      << memory.wait_seconds << " s" << std::endl;
+  }
+  print_metrics(format);
+
+  return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,721 @@
+#include "include/archive.hpp"
+#include "include/reader.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <limits>
+#include <string_view>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+namespace Archive {
+  namespace fs = std::filesystem;
+  using std::uint16_t;
+  using std::uint32_t;
+  using std::uint64_t;
+
+  namespace {
+    constexpr std::size_t TAR_BLOCK = 512;
+
+    // Zip record signatures
+    constexpr uint32_t ZIP_LOCAL_HEADER = 0x04034B50;
+    constexpr uint32_t ZIP_CENTRAL_HEADER = 0x02014B50;
+    constexpr uint32_t ZIP_END = 0x06054B50;
+    constexpr uint32_t ZIP64_END = 0x06064B50;
+    constexpr uint32_t ZIP64_LOCATOR = 0x07064B50;
+    constexpr uint16_t ZIP64_EXTRA = 0x0001;
+    constexpr uint32_t ZIP32_MAX = 0xFFFFFFFF;
+    constexpr uint16_t ZIP16_MAX = 0xFFFF;
+    constexpr uint16_t ZIP_UTF8_NAMES = 1 << 11;
+
+    // Deflate never expands its input more than this, so bigger sizes are lies of a damaged archive
+    constexpr uint64_t DEFLATE_MAX_RATIO = 1032;
+
+    // Members written in one go by crop_archive, per worker
+    constexpr std::size_t MEMBERS_PER_WORKER = 4;
+
+    uint16_t u16le(const std::byte* p) { return uint16_t(uint16_t(p[0]) | uint16_t(p[1]) << 8); }
+    uint32_t u32le(const std::byte* p) { return uint32_t(u16le(p)) | uint32_t(u16le(p + 2)) << 16; }
+    uint64_t u64le(const std::byte* p) { return uint64_t(u32le(p)) | uint64_t(u32le(p + 4)) << 32; }
+
+    void put16(std::vector<std::byte>& out, uint16_t value) {
+      for (int i = 0; i < 2; i++)
+        out.push_back(std::byte(value >> (8 * i)));
+    }
+    void put32(std::vector<std::byte>& out, uint32_t value) {
+      for (int i = 0; i < 4; i++)
+        out.push_back(std::byte(value >> (8 * i)));
+    }
+    void put64(std::vector<std::byte>& out, uint64_t value) {
+      for (int i = 0; i < 8; i++)
+        out.push_back(std::byte(value >> (8 * i)));
+    }
+    void put_bytes(std::vector<std::byte>& out, const std::string& text) {
+      const std::byte* bytes = reinterpret_cast<const std::byte*>(text.data());
+      out.insert(out.end(), bytes, bytes + text.size());
+    }
+
+    // A tar number field: octal digits, or base-256 big-endian when the top bit of the first byte is set
+    std::optional<uint64_t> tar_number(const std::byte* field, std::size_t length) {
+      if ((std::to_integer<unsigned>(field[0]) & 0x80) != 0) {
+        uint64_t value = std::to_integer<unsigned>(field[0]) & 0x7F;
+        for (std::size_t i = 1; i < length; i++)
+          value = value << 8 | std::to_integer<unsigned>(field[i]);
+        return value;
+      }
+      uint64_t value = 0;
+      std::size_t i = 0;
+      while (i < length && (field[i] == std::byte(' ') || field[i] == std::byte(0)))
+        i++;
+      for (; i < length && field[i] != std::byte(' ') && field[i] != std::byte(0); i++) {
+        unsigned digit = std::to_integer<unsigned>(field[i]) - '0';
+        if (digit > 7)
+          return std::nullopt;
+        value = value * 8 + digit;
+      }
+      return value;
+    }
+
+    // A NUL-terminated string field of at most length bytes
+    std::string tar_string(const std::byte* field, std::size_t length) {
+      const char* text = reinterpret_cast<const char*>(field);
+      return std::string(text, strnlen(text, length));
+    }
+
+    // The checksum is the sum of the header bytes, with its own field counted as spaces
+    bool has_valid_checksum(const std::byte* header) {
+      std::optional<uint64_t> expected = tar_number(header + 148, 8);
+      uint64_t sum = 0;
+      for (std::size_t i = 0; i < TAR_BLOCK; i++)
+        sum += i >= 148 && i < 156 ? ' ' : std::to_integer<unsigned>(header[i]);
+      return expected && *expected == sum;
+    }
+
+    bool is_zero_block(const std::byte* block) {
+      return std::all_of(block, block + TAR_BLOCK, [](std::byte b) { return b == std::byte(0); });
+    }
+
+    // The path and size records of a pax extended header, "<length> <key>=<value>\n" each
+    void parse_pax(std::string_view records, std::string& name, std::optional<uint64_t>& size) {
+      while (!records.empty()) {
+        std::size_t space = records.find(' ');
+        if (space == std::string_view::npos)
+          return;
+        std::size_t length = 0;
+        for (char c : records.substr(0, space)) {
+          if (c < '0' || c > '9')
+            return;
+          length = length * 10 + std::size_t(c - '0');
+        }
+        if (length <= space + 1 || length > records.size())
+          return;
+        std::string_view record = records.substr(space + 1, length - space - 2);  // Without the newline
+        std::size_t equals = record.find('=');
+        if (equals != std::string_view::npos) {
+          std::string_view key = record.substr(0, equals);
+          std::string_view value = record.substr(equals + 1);
+          if (key == "path")
+            name = value;
+          else if (key == "size") {
+            uint64_t parsed = 0;
+            for (char c : value)
+              parsed = parsed * 10 + uint64_t(c - '0');
+            size = parsed;
+          }
+        }
+        records.remove_prefix(length);
+      }
+    }
+
+    bool is_image_name(const std::string& name) {
+      return Reader::image_type_map.count(Reader::get_file_type(fs::path(name).filename().string())) > 0;
+    }
+
+    // Images that are not compressed already are worth deflating in a zip
+    bool is_worth_deflating(const std::string& name) {
+      auto iter = Reader::image_type_map.find(Reader::get_file_type(fs::path(name).filename().string()));
+      return iter == Reader::image_type_map.end() || iter->second == Reader::ImageType::BMP || iter->second == Reader::ImageType::TIFF;
+    }
+
+    // Raw deflate, without a zlib header, as zip stores it. Returns false on failure and for inputs
+    // too big for one pass, which are then stored.
+    bool deflate_raw(std::span<const std::byte> input, std::vector<std::byte>& out) {
+      z_stream stream{};
+      if (input.size() > UINT_MAX / 2 || deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        return false;
+      out.resize(deflateBound(&stream, uLong(input.size())));
+      stream.next_in = reinterpret_cast<Bytef*>(const_cast<std::byte*>(input.data()));
+      stream.avail_in = uInt(input.size());
+      stream.next_out = reinterpret_cast<Bytef*>(out.data());
+      stream.avail_out = uInt(out.size());
+      bool success = deflate(&stream, Z_FINISH) == Z_STREAM_END;
+      out.resize(stream.total_out);
+      deflateEnd(&stream);
+      return success;
+    }
+
+    uint32_t crc_of(std::span<const std::byte> bytes) {
+      uLong crc = crc32(0, nullptr, 0);
+      // crc32 takes at most a uInt at a time
+      while (!bytes.empty()) {
+        std::size_t chunk = std::min<std::size_t>(bytes.size(), UINT_MAX);
+        crc = crc32(crc, reinterpret_cast<const Bytef*>(bytes.data()), uInt(chunk));
+        bytes = bytes.subspan(chunk);
+      }
+      return uint32_t(crc);
+    }
+  } // namespace
+
+  std::optional<Format> format_of(const fs::path& path) {
+    std::string type = Reader::get_file_type(path.filename().string());
+    if (type == "tar")
+      return Format::TAR;
+    if (type == "zip")
+      return Format::ZIP;
+    return std::nullopt;
+  }
+
+  Source::Source(const fs::path& path): path(path) {
+    std::optional<Format> format = format_of(path);
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat status;
+    if (!format || fd < 0 || fstat(fd, &status) != 0 || status.st_size <= 0) {
+      std::cerr << "Failed to open archive: " << path << std::endl;
+      if (fd >= 0)
+        ::close(fd);
+      return;
+    }
+    archive_format = *format;
+    size = std::size_t(status.st_size);
+    void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // The mapping keeps the file alive on its own
+    ::close(fd);
+    if (mapping == MAP_FAILED) {
+      std::cerr << "Failed to map archive: " << path << ": " << std::strerror(errno) << std::endl;
+      size = 0;
+      return;
+    }
+    data = static_cast<const std::byte*>(mapping);
+    // Members are mostly read front to back
+    madvise(mapping, size, MADV_SEQUENTIAL);
+    open = archive_format == Format::TAR ? index_tar() : index_zip();
+    if (!open)
+      std::cerr << "Failed to read archive: " << path << std::endl;
+  }
+
+  Source::~Source() {
+    if (data != nullptr)
+      munmap(const_cast<std::byte*>(data), size);
+  }
+
+  bool Source::is_open() const {
+    return open;
+  }
+
+  Format Source::format() const {
+    return archive_format;
+  }
+
+  const std::vector<Member>& Source::members() const {
+    return entries;
+  }
+
+  std::vector<const Member*> Source::image_members() const {
+    std::vector<const Member*> images;
+    for (const auto& member : entries) {
+      if (is_image_name(member.name))
+        images.push_back(&member);
+    }
+    return images;
+  }
+
+  // Walk the 512-byte headers. GNU long names ('L') and pax headers ('x') apply to the next member.
+  bool Source::index_tar() {
+    std::string long_name;
+    std::optional<uint64_t> pax_size;
+    uint64_t offset = 0;
+    while (offset + TAR_BLOCK <= size) {
+      const std::byte* header = data + offset;
+      if (is_zero_block(header))
+        return true;
+      std::optional<uint64_t> member_size = tar_number(header + 124, 12);
+      if (!has_valid_checksum(header) || !member_size)
+        return false;
+      char type = char(header[156]);
+      uint64_t start = offset + TAR_BLOCK;
+      if (pax_size && (type == '0' || type == '\0' || type == '7'))
+        member_size = pax_size;
+      if (*member_size > size - start)
+        return false;
+      offset = start + (*member_size + TAR_BLOCK - 1) / TAR_BLOCK * TAR_BLOCK;
+
+      std::string_view body(reinterpret_cast<const char*>(data + start), std::size_t(*member_size));
+      if (type == 'L') {
+        long_name = std::string(body.substr(0, body.find('\0')));
+        continue;
+      }
+      if (type == 'x') {
+        parse_pax(body, long_name, pax_size);
+        continue;
+      }
+      if (type == '0' || type == '\0' || type == '7') {
+        std::string name = long_name;
+        if (name.empty()) {
+          // ustar splits long paths into a prefix and a name
+          std::string prefix = std::memcmp(header + 257, "ustar", 5) == 0 ? tar_string(header + 345, 155) : "";
+          name = tar_string(header, 100);
+          if (!prefix.empty())
+            name = prefix + "/" + name;
+        }
+        entries.push_back(Member{ name, *member_size, start, *member_size, false, 0 });
+      }
+      // Directories, links and global pax headers ('g') are skipped
+      long_name.clear();
+      pax_size.reset();
+    }
+    // A tar without its end-of-archive blocks is still read up to the last whole member
+    return true;
+  }
+
+  // Find the end of central directory record, then read the central directory it points to
+  bool Source::index_zip() {
+    if (size < 22)
+      return false;
+    // The record is the last thing in the file, followed by a comment of at most 64 KiB
+    uint64_t end = size - 22;
+    uint64_t lowest = size > 22 + ZIP16_MAX ? size - 22 - ZIP16_MAX : 0;
+    while (u32le(data + end) != ZIP_END) {
+      if (end == lowest)
+        return false;
+      end--;
+    }
+    uint64_t count = u16le(data + end + 10);
+    uint64_t directory_size = u32le(data + end + 12);
+    uint64_t directory_offset = u32le(data + end + 16);
+    // Zip64 archives keep the real values in a record found through the locator right before
+    if ((count == ZIP16_MAX || directory_size == ZIP32_MAX || directory_offset == ZIP32_MAX) && end >= 20
+      && u32le(data + end - 20) == ZIP64_LOCATOR) {
+      uint64_t record = u64le(data + end - 20 + 8);
+      if (size < 56 || record > size - 56 || u32le(data + record) != ZIP64_END)
+        return false;
+      count = u64le(data + record + 32);
+      directory_size = u64le(data + record + 40);
+      directory_offset = u64le(data + record + 48);
+    }
+    if (directory_offset > size || directory_size > size - directory_offset)
+      return false;
+
+    uint64_t cursor = directory_offset;
+    uint64_t directory_end = directory_offset + directory_size;
+    for (uint64_t i = 0; i < count; i++) {
+      if (cursor + 46 > directory_end || u32le(data + cursor) != ZIP_CENTRAL_HEADER)
+        return false;
+      const std::byte* header = data + cursor;
+      uint16_t flags = u16le(header + 8);
+      uint16_t method = u16le(header + 10);
+      uint32_t crc = u32le(header + 16);
+      uint64_t stored_size = u32le(header + 20);
+      uint64_t member_size = u32le(header + 24);
+      uint16_t name_length = u16le(header + 28);
+      uint16_t extra_length = u16le(header + 30);
+      uint16_t comment_length = u16le(header + 32);
+      uint64_t local_offset = u32le(header + 42);
+      if (cursor + 46 + name_length + extra_length + comment_length > directory_end)
+        return false;
+      std::string name(reinterpret_cast<const char*>(header + 46), name_length);
+
+      // Fields that overflowed are in the zip64 extra field, in this order
+      const std::byte* extra = header + 46 + name_length;
+      for (uint32_t at = 0; at + 4 <= extra_length;) {
+        uint16_t id = u16le(extra + at);
+        uint16_t length = u16le(extra + at + 2);
+        if (id == ZIP64_EXTRA) {
+          uint32_t field = at + 4;
+          uint32_t field_end = std::min<uint32_t>(at + 4 + length, extra_length);
+          for (uint64_t* value : { &member_size, &stored_size, &local_offset }) {
+            if (*value == ZIP32_MAX && field + 8 <= field_end) {
+              *value = u64le(extra + field);
+              field += 8;
+            }
+          }
+        }
+        at += 4 + length;
+      }
+      cursor += 46 + name_length + extra_length + comment_length;
+
+      // Directories, encrypted members and compression methods other than deflate are skipped
+      bool is_directory = !name.empty() && name.back() == '/';
+      if (is_directory || (flags & 1) != 0 || (method != 0 && method != 8))
+        continue;
+      if (local_offset + 30 > size || u32le(data + local_offset) != ZIP_LOCAL_HEADER)
+        return false;
+      uint64_t start = local_offset + 30 + u16le(data + local_offset + 26) + u16le(data + local_offset + 28);
+      if (start > size || stored_size > size - start)
+        return false;
+      entries.push_back(Member{ name, member_size, start, stored_size, method == 8, crc });
+    }
+    return true;
+  }
+
+  // Get the bytes of a member, in place when they are stored as they are
+  std::optional<std::span<const std::byte>> Source::read(const Member& member, std::vector<std::byte>& buffer) const {
+    if (!open || member.offset > size || member.stored_size > size - member.offset)
+      return std::nullopt;
+    std::span<const std::byte> stored(data + member.offset, std::size_t(member.stored_size));
+    if (!member.deflated) {
+      if (archive_format == Format::ZIP && crc_of(stored) != member.crc) {
+        std::cerr << "Damaged archive member: " << member.name << std::endl;
+        return std::nullopt;
+      }
+      return stored;
+    }
+
+    // The size comes from the archive, so it is checked before it allocates anything
+    if (member.size > member.stored_size * DEFLATE_MAX_RATIO || member.size > std::numeric_limits<std::size_t>::max()) {
+      std::cerr << "Damaged archive member: " << member.name << std::endl;
+      return std::nullopt;
+    }
+    buffer.resize(std::size_t(member.size));
+    z_stream stream{};
+    if (inflateInit2(&stream, -MAX_WBITS) != Z_OK)
+      return std::nullopt;
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<std::byte*>(stored.data()));
+    stream.next_out = reinterpret_cast<Bytef*>(buffer.data());
+    int result = Z_OK;
+    // The stream counters are 32-bit, so big members are fed in pieces
+    std::size_t in_left = stored.size();
+    std::size_t out_left = buffer.size();
+    while (result == Z_OK) {
+      stream.avail_in = uInt(std::min<std::size_t>(in_left, UINT_MAX));
+      stream.avail_out = uInt(std::min<std::size_t>(out_left, UINT_MAX));
+      uInt in_before = stream.avail_in;
+      uInt out_before = stream.avail_out;
+      result = inflate(&stream, Z_NO_FLUSH);
+      in_left -= in_before - stream.avail_in;
+      out_left -= out_before - stream.avail_out;
+      if (result == Z_OK && in_before == stream.avail_in && out_before == stream.avail_out)
+        break;
+    }
+    inflateEnd(&stream);
+    std::span<const std::byte> inflated(buffer.data(), buffer.size());
+    if (result != Z_STREAM_END || out_left != 0 || crc_of(inflated) != member.crc) {
+      std::cerr << "Damaged archive member: " << member.name << std::endl;
+      return std::nullopt;
+    }
+    return inflated;
+  }
+
+  Sink::Sink(const fs::path& path): path(path) {
+    std::optional<Format> format = format_of(path);
+    if (!format) {
+      std::cerr << "Not an archive name: " << path << std::endl;
+      return;
+    }
+    archive_format = *format;
+    if (!path.parent_path().empty())
+      fs::create_directories(path.parent_path());
+    file = std::fopen(path.c_str(), "wb");
+    if (file == nullptr) {
+      std::cerr << "Failed to write archive: " << path << std::endl;
+      return;
+    }
+    // Members are written in large sequential chunks
+    std::setvbuf(file, nullptr, _IOFBF, std::size_t(1) << 20);
+
+    // Zip stores local time in MS-DOS format, every member gets the time the archive was started
+    std::time_t now = std::time(nullptr);
+    std::tm local{};
+    localtime_r(&now, &local);
+    dos_time = uint16_t(local.tm_hour << 11 | local.tm_min << 5 | local.tm_sec / 2);
+    dos_date = uint16_t(std::max(local.tm_year - 80, 0) << 9 | (local.tm_mon + 1) << 5 | local.tm_mday);
+  }
+
+  Sink::~Sink() {
+    close();
+  }
+
+  bool Sink::is_open() const {
+    return file != nullptr;
+  }
+
+  bool Sink::write(const void* bytes, std::size_t count) {
+    if (failed || std::fwrite(bytes, 1, count, file) != count)
+      failed = true;
+    written += count;
+    return !failed;
+  }
+
+  bool Sink::add(const std::string& name, std::span<const std::byte> bytes) {
+    if (file == nullptr || failed)
+      return false;
+    return archive_format == Format::TAR ? add_tar(name, bytes) : add_zip(name, bytes);
+  }
+
+  bool Sink::add_tar(const std::string& name, std::span<const std::byte> bytes) {
+    auto header_for = [&](const std::string& header_name, uint64_t member_size, char type) {
+      std::vector<std::byte> header(TAR_BLOCK, std::byte(0));
+      char* fields = reinterpret_cast<char*>(header.data());
+      std::string short_name = header_name;
+      // ustar fits paths up to 255 bytes split at a slash into a prefix and a name
+      if (short_name.size() > 100) {
+        std::size_t slash = short_name.rfind('/', 155);
+        if (slash != std::string::npos && short_name.size() - slash - 1 <= 100) {
+          std::memcpy(fields + 345, short_name.data(), slash);
+          short_name = short_name.substr(slash + 1);
+        }
+        else
+          short_name.resize(100);
+      }
+      std::memcpy(fields, short_name.data(), short_name.size());
+      std::snprintf(fields + 100, 8, "%07o", 0644);
+      std::snprintf(fields + 108, 8, "%07o", 0);
+      std::snprintf(fields + 116, 8, "%07o", 0);
+      // Octal fits sizes below 8 GiB, bigger ones are stored in base-256
+      if (member_size < (uint64_t(1) << 33))
+        std::snprintf(fields + 124, 12, "%011llo", static_cast<unsigned long long>(member_size));
+      else {
+        header[124] = std::byte(0x80);
+        for (int i = 0; i < 8; i++)
+          header[135 - i] = std::byte(member_size >> (8 * i));
+      }
+      std::snprintf(fields + 136, 12, "%011llo", static_cast<unsigned long long>(std::time(nullptr)));
+      fields[156] = type;
+      std::memcpy(fields + 257, "ustar", 6);
+      std::memcpy(fields + 263, "00", 2);
+      std::memset(fields + 148, ' ', 8);
+      unsigned sum = 0;
+      for (std::byte b : header)
+        sum += std::to_integer<unsigned>(b);
+      std::snprintf(fields + 148, 8, "%06o", sum);
+      return header;
+    };
+    auto write_padded = [&](std::span<const std::byte> body) {
+      static const std::byte zeros[TAR_BLOCK] = {};
+      return write(body.data(), body.size()) && write(zeros, (TAR_BLOCK - body.size() % TAR_BLOCK) % TAR_BLOCK);
+    };
+
+    // Names that don't fit ustar go first in a GNU long name record
+    bool fits_ustar = name.size() <= 100
+      || (name.rfind('/', 155) != std::string::npos && name.size() - name.rfind('/', 155) - 1 <= 100);
+    if (!fits_ustar) {
+      std::string long_name = name + '\0';
+      std::vector<std::byte> header = header_for("././@LongLink", long_name.size(), 'L');
+      if (!write(header.data(), header.size()) || !write_padded(std::as_bytes(std::span(long_name))))
+        return false;
+    }
+    std::vector<std::byte> header = header_for(name, bytes.size(), '0');
+    return write(header.data(), header.size()) && write_padded(bytes);
+  }
+
+  bool Sink::add_zip(const std::string& name, std::span<const std::byte> bytes) {
+    Entry entry{ name, crc_of(bytes), bytes.size(), bytes.size(), written, 0 };
+    std::vector<std::byte> deflated;
+    std::span<const std::byte> stored = bytes;
+    if (is_worth_deflating(name) && deflate_raw(bytes, deflated) && deflated.size() < bytes.size()) {
+      entry.method = 8;
+      entry.stored_size = deflated.size();
+      stored = deflated;
+    }
+
+    // The sizes go to the zip64 extra field when they don't fit 32 bits
+    bool zip64 = entry.size >= ZIP32_MAX || entry.stored_size >= ZIP32_MAX;
+    std::vector<std::byte> header;
+    put32(header, ZIP_LOCAL_HEADER);
+    put16(header, zip64 ? 45 : 20);
+    put16(header, ZIP_UTF8_NAMES);
+    put16(header, entry.method);
+    put16(header, dos_time);
+    put16(header, dos_date);
+    put32(header, entry.crc);
+    put32(header, zip64 ? ZIP32_MAX : uint32_t(entry.stored_size));
+    put32(header, zip64 ? ZIP32_MAX : uint32_t(entry.size));
+    put16(header, uint16_t(name.size()));
+    put16(header, zip64 ? 20 : 0);
+    put_bytes(header, name);
+    if (zip64) {
+      put16(header, ZIP64_EXTRA);
+      put16(header, 16);
+      put64(header, entry.size);
+      put64(header, entry.stored_size);
+    }
+    if (!write(header.data(), header.size()) || !write(stored.data(), stored.size()))
+      return false;
+    zip_entries.push_back(std::move(entry));
+    return true;
+  }
+
+  // Write the central directory and the end records, with zip64 ones when a count, size or offset overflows
+  bool Sink::finish_zip() {
+    uint64_t directory_offset = written;
+    std::vector<std::byte> directory;
+    for (const auto& entry : zip_entries) {
+      std::vector<std::byte> extra;
+      if (entry.size >= ZIP32_MAX)
+        put64(extra, entry.size);
+      if (entry.stored_size >= ZIP32_MAX)
+        put64(extra, entry.stored_size);
+      if (entry.offset >= ZIP32_MAX)
+        put64(extra, entry.offset);
+      directory.clear();
+      put32(directory, ZIP_CENTRAL_HEADER);
+      put16(directory, 0x0300 | 45);  // Made by Unix, zip 4.5
+      put16(directory, extra.empty() ? 20 : 45);
+      put16(directory, ZIP_UTF8_NAMES);
+      put16(directory, entry.method);
+      put16(directory, dos_time);
+      put16(directory, dos_date);
+      put32(directory, entry.crc);
+      put32(directory, uint32_t(std::min<uint64_t>(entry.stored_size, ZIP32_MAX)));
+      put32(directory, uint32_t(std::min<uint64_t>(entry.size, ZIP32_MAX)));
+      put16(directory, uint16_t(entry.name.size()));
+      put16(directory, uint16_t(extra.empty() ? 0 : extra.size() + 4));
+      put16(directory, 0);  // Comment
+      put16(directory, 0);  // Disk
+      put16(directory, 0);  // Internal attributes
+      put32(directory, 0100644u << 16);  // Unix mode
+      put32(directory, uint32_t(std::min<uint64_t>(entry.offset, ZIP32_MAX)));
+      put_bytes(directory, entry.name);
+      if (!extra.empty()) {
+        put16(directory, ZIP64_EXTRA);
+        put16(directory, uint16_t(extra.size()));
+        directory.insert(directory.end(), extra.begin(), extra.end());
+      }
+      if (!write(directory.data(), directory.size()))
+        return false;
+    }
+    uint64_t directory_size = written - directory_offset;
+    uint64_t count = zip_entries.size();
+
+    std::vector<std::byte> end;
+    if (count >= ZIP16_MAX || directory_size >= ZIP32_MAX || directory_offset >= ZIP32_MAX) {
+      uint64_t record = written;
+      put32(end, ZIP64_END);
+      put64(end, 44);  // Size of the rest of the record
+      put16(end, 0x0300 | 45);
+      put16(end, 45);
+      put32(end, 0);
+      put32(end, 0);
+      put64(end, count);
+      put64(end, count);
+      put64(end, directory_size);
+      put64(end, directory_offset);
+      put32(end, ZIP64_LOCATOR);
+      put32(end, 0);
+      put64(end, record);
+      put32(end, 1);  // Disks
+    }
+    put32(end, ZIP_END);
+    put16(end, 0);
+    put16(end, 0);
+    put16(end, uint16_t(std::min<uint64_t>(count, ZIP16_MAX)));
+    put16(end, uint16_t(std::min<uint64_t>(count, ZIP16_MAX)));
+    put32(end, uint32_t(std::min<uint64_t>(directory_size, ZIP32_MAX)));
+    put32(end, uint32_t(std::min<uint64_t>(directory_offset, ZIP32_MAX)));
+    put16(end, 0);  // Comment
+    return write(end.data(), end.size());
+  }
+
+  bool Sink::close() {
+    if (file == nullptr)
+      return false;
+    if (archive_format == Format::ZIP)
+      finish_zip();
+    else {
+      // Two zero blocks end a tar
+      static const std::byte zeros[2 * TAR_BLOCK] = {};
+      write(zeros, sizeof(zeros));
+    }
+    bool success = std::fclose(file) == 0 && !failed;
+    file = nullptr;
+    if (!success) {
+      std::cerr << "Failed to write archive: " << path << std::endl;
+      std::error_code ignored;
+      fs::remove(path, ignored);
+    }
+    return success;
+  }
+
+  // Crop every image member of input into output, decoding in parallel and writing in archive order
+  std::vector<MemberStatus> crop_archive(const fs::path& input, const fs::path& output, unsigned threads,
+    StatusCallback on_status) {
+    Source source(input);
+    if (!source.is_open())
+      return {};
+    std::vector<const Member*> images = source.image_members();
+    std::vector<MemberStatus> statuses;
+    statuses.reserve(images.size());
+    Sink sink(output);
+    auto report = [&](const Member& member, ImageEditor::Status status) {
+      statuses.push_back(MemberStatus{ member.name, status });
+    };
+    // A member is only written once the output is closed, so the statuses are reported after that
+    auto finish = [&]() {
+      if (on_status)
+        for (const MemberStatus& status : statuses)
+          on_status(status);
+      return statuses;
+    };
+    if (!sink.is_open()) {
+      for (const Member* member : images)
+        report(*member, ImageEditor::Status::FAILURE);
+      return finish();
+    }
+
+    // Workers crop a window of members, then the window is written in order while nothing else runs,
+    // so at most one window of encoded crops is held at a time
+    threads = std::max(1u, threads);
+    std::size_t window = threads * MEMBERS_PER_WORKER;
+    std::vector<std::optional<std::vector<uchar>>> crops(window);  // Empty where the member failed
+    for (std::size_t first = 0; first < images.size(); first += window) {
+      std::size_t count = std::min(window, images.size() - first);
+      std::atomic<std::size_t> next{ 0 };
+      auto work = [&]() {
+        std::vector<std::byte> buffer;
+        for (std::size_t i = next++; i < count; i = next++) {
+          const Member& member = *images[first + i];
+          crops[i].reset();
+          fs::path name(member.name);
+          // Exceptions must not leave a worker thread, so inflating is inside the try too
+          try {
+            std::optional<std::span<const std::byte>> bytes = source.read(member, buffer);
+            if (!bytes)
+              continue;
+            ImageEditor::Result<std::vector<uchar>> cropped = ImageEditor::crop_square(*bytes,
+              ImageEditor::parse_pivot_suffix(name.stem().string()), name.extension().string());
+            if (cropped.status == ImageEditor::Status::SUCCESS)
+              crops[i] = std::move(cropped.data);
+          }
+          catch (const std::exception& e) {
+            std::cerr << "Failed to crop archive member: " << member.name << ": " << e.what() << std::endl;
+          }
+        }
+      };
+      std::vector<std::thread> workers;
+      for (unsigned i = 1; i < std::min<std::size_t>(threads, count); i++)
+        workers.emplace_back(work);
+      work();
+      for (auto& worker : workers)
+        worker.join();
+
+      for (std::size_t i = 0; i < count; i++) {
+        const Member& member = *images[first + i];
+        bool written = crops[i] && sink.add(member.name, std::as_bytes(std::span(*crops[i])));
+        report(member, written ? ImageEditor::Status::SUCCESS : ImageEditor::Status::FAILURE);
+        crops[i].reset();
+      }
+    }
+    if (!sink.close()) {
+      for (auto& status : statuses)
+        status.status = ImageEditor::Status::FAILURE;
+    }
+    return finish();
+  }
+
+} // namespace Archive
@@ -0,0 +1,179 @@
+#include "include/auto_pivot.hpp"
+#include "include/orientation.hpp"
+#include "include/probe.hpp"
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <opencv2/opencv.hpp>
+#include <vector>
+
+namespace ImageEditor {
+
+  namespace {
+    // The decode flags of a preview: 1/8 scale, one channel, the stored frame
+    constexpr int PREVIEW_FLAGS = cv::IMREAD_REDUCED_GRAYSCALE_8 | cv::IMREAD_IGNORE_ORIENTATION;
+
+    // An 8-bit grayscale preview of image, reduced to about 1/AUTO_PIVOT_SCALE of width x height
+    cv::Mat make_gray_preview(const cv::Mat& image, int width, int height) {
+      cv::Mat preview = image;
+      int target_width = std::max(1, width / AUTO_PIVOT_SCALE);
+      int target_height = std::max(1, height / AUTO_PIVOT_SCALE);
+      // Reduce before converting, so the conversions run over the small picture
+      if (preview.cols > 2 * target_width && preview.rows > 2 * target_height) {
+        cv::Mat reduced;
+        cv::resize(preview, reduced, cv::Size(target_width, target_height), 0, 0, cv::INTER_AREA);
+        preview = reduced;
+      }
+      if (preview.channels() != 1) {
+        cv::Mat gray;
+        if (preview.channels() == 3)
+          cv::cvtColor(preview, gray, cv::COLOR_BGR2GRAY);
+        else if (preview.channels() == 4)
+          cv::cvtColor(preview, gray, cv::COLOR_BGRA2GRAY);
+        else
+          cv::extractChannel(preview, gray, 0);
+        preview = gray;
+      }
+      if (preview.depth() != CV_8U) {
+        // The same scaling as fit_to_format: 16-bit by 1/257, float from [0, 1]
+        double scale = preview.depth() == CV_16U ? 1.0 / 257 : (preview.depth() == CV_32F || preview.depth() == CV_64F) ? 255.0 : 1.0;
+        cv::Mat narrowed;
+        preview.convertTo(narrowed, CV_8U, scale);
+        preview = narrowed;
+      }
+      return preview;
+    }
+
+    // The offset of the window of length window along profile with the most energy, closest to
+    // the center on ties
+    int best_window(const std::vector<double>& profile, int window) {
+      int last = int(profile.size()) - window;
+      std::vector<double> prefix(profile.size() + 1, 0.0);
+      for (std::size_t i = 0; i < profile.size(); i++)
+        prefix[i + 1] = prefix[i] + profile[i];
+
+      double center = last / 2.0;
+      int best = int(std::lround(center));
+      double best_score = prefix[best + window] - prefix[best];
+      for (int offset = 0; offset <= last; offset++) {
+        double score = prefix[offset + window] - prefix[offset];
+        bool closer = std::abs(offset - center) < std::abs(best - center);
+        if (score > best_score || (score == best_score && closer)) {
+          best = offset;
+          best_score = score;
+        }
+      }
+      return best;
+    }
+  } // namespace
+
+  bool is_auto_pivot(const PivotRect& pivot_rect) {
+    return pivot_rect.horizontal_pivot == HorizontalPivot::AUTO || pivot_rect.vertical_pivot == VerticalPivot::AUTO;
+  }
+
+  // Place the square of a width x height image by the gradient energy of preview
+  PivotRect resolve_auto_pivot(const cv::Mat& preview, int width, int height, const PivotRect& pivot_rect) {
+    bool landscape = width > height;
+    bool is_auto = landscape ? pivot_rect.horizontal_pivot == HorizontalPivot::AUTO
+      : pivot_rect.vertical_pivot == VerticalPivot::AUTO;
+    // A preview turned against the image (e.g. by EXIF orientation) can't place the square
+    if (!is_auto || width == height || preview.empty() || (preview.cols > preview.rows) != landscape)
+      return pivot_rect;
+
+    cv::Mat gray = make_gray_preview(preview, width, height);
+    int preview_long = landscape ? gray.cols : gray.rows;
+    int preview_short = landscape ? gray.rows : gray.cols;
+    if (preview_long <= preview_short || preview_short < 3)
+      return pivot_rect;
+
+    cv::Mat gradient_x, gradient_y;
+    cv::Sobel(gray, gradient_x, CV_16S, 1, 0);
+    cv::Sobel(gray, gradient_y, CV_16S, 0, 1);
+    cv::Mat energy = cv::abs(gradient_x) + cv::abs(gradient_y);
+    // Sum the energy across the short side, leaving one value per position along the long side
+    cv::Mat sums;
+    cv::reduce(energy, sums, landscape ? 0 : 1, cv::REDUCE_SUM, CV_64F);
+    std::vector<double> profile(sums.begin<double>(), sums.end<double>());
+    // A flat image has nothing to place the square by, so it stays centered
+    if (std::all_of(profile.begin(), profile.end(), [](double energy) { return energy == 0; }))
+      return pivot_rect;
+
+    int offset = best_window(profile, preview_short);
+    // Map the offset back by the share of the slack it leaves, which absorbs the rounding of the preview size
+    int slack = std::abs(width - height);
+    int full_offset = int(std::lround(double(offset) * slack / double(preview_long - preview_short)));
+    full_offset = std::clamp(full_offset, 0, slack);
+
+    PivotRect resolved = pivot_rect;
+    resolved.auto_origin = landscape ? cv::Point(full_offset, 0) : cv::Point(0, full_offset);
+    return resolved;
+  }
+
+  // Place the square of an oriented image by the gradient energy of its stored frame
+  PivotRect resolve_auto_pivot(const cv::Mat& preview, int width, int height, int orientation, const PivotRect& pivot_rect) {
+    if (orientation == 1)
+      return resolve_auto_pivot(preview, width, height, pivot_rect);
+    cv::Size size = get_oriented_size(width, height, orientation);
+    bool landscape = size.width > size.height;
+    bool is_auto = landscape ? pivot_rect.horizontal_pivot == HorizontalPivot::AUTO
+      : pivot_rect.vertical_pivot == VerticalPivot::AUTO;
+    if (!is_auto)
+      return pivot_rect;
+    PivotRect stored = resolve_auto_pivot(preview, width, height, PivotRect(HorizontalPivot::AUTO, VerticalPivot::AUTO));
+    if (!stored.auto_origin)
+      return pivot_rect;
+
+    PivotRect resolved = pivot_rect;
+    resolved.auto_origin = to_oriented_region(get_square_region(width, height, stored), width, height, orientation).tl();
+    return resolved;
+  }
+
+  // Place the square of an image file by a 1/8 scale preview
+  PivotRect resolve_auto_pivot(const fs::path& image_path, const PivotRect& pivot_rect) {
+    if (!is_auto_pivot(pivot_rect))
+      return pivot_rect;
+    std::optional<Reader::ImageInfo> info = Reader::probe_image(image_path.string());
+    return info ? resolve_auto_pivot(image_path, *info, pivot_rect) : pivot_rect;
+  }
+
+  // Place the square of an image file with a probed header by a 1/8 scale preview
+  PivotRect resolve_auto_pivot(const fs::path& image_path, const Reader::ImageInfo& info, const PivotRect& pivot_rect) {
+    if (!is_auto_pivot(pivot_rect) || info.width == info.height)
+      return pivot_rect;
+    cv::Mat preview;
+    try {
+      preview = cv::imread(image_path, PREVIEW_FLAGS);
+    }
+    catch (const cv::Exception& e) {
+      std::cerr << e.what() << std::endl;
+    }
+    return resolve_auto_pivot(preview, info.width, info.height, info.orientation, pivot_rect);
+  }
+
+  // Place the square of an encoded image held in memory by a 1/8 scale preview
+  PivotRect resolve_auto_pivot(std::span<const std::byte> image, const PivotRect& pivot_rect) {
+    if (!is_auto_pivot(pivot_rect))
+      return pivot_rect;
+    std::optional<Reader::ImageInfo> info = Reader::probe_image(image);
+    return info ? resolve_auto_pivot(image, *info, pivot_rect) : pivot_rect;
+  }
+
+  // Place the square of an encoded image with a probed header by a 1/8 scale preview
+  PivotRect resolve_auto_pivot(std::span<const std::byte> image, const Reader::ImageInfo& info, const PivotRect& pivot_rect) {
+    if (!is_auto_pivot(pivot_rect) || info.width == info.height || image.empty() || image.size() > std::size_t(INT_MAX))
+      return pivot_rect;
+    cv::Mat preview;
+    try {
+      // A header over the caller's bytes, nothing is copied
+      const cv::Mat encoded(1, int(image.size()), CV_8U, const_cast<std::byte*>(image.data()));
+      preview = cv::imdecode(encoded, PREVIEW_FLAGS);
+    }
+    catch (const cv::Exception& e) {
+      std::cerr << e.what() << std::endl;
+    }
+    return resolve_auto_pivot(preview, info.width, info.height, info.orientation, pivot_rect);
+  }
+
+} // namespace ImageEditor
@@ -0,0 +1,247 @@
+#include "include/batch.hpp"
+#include "include/jpeg_crop.hpp"
+#include "include/manifest.hpp"
+#include "include/metrics.hpp"
+#include "include/region_reader.hpp"
+#include <algorithm>
+#include <iostream>
+
+namespace Batch {
+  namespace fs = std::filesystem;
+
+  namespace {
+    // Estimate the bytes a job holds while it is in flight from its probed header: the decoded
+    // image, or the band buffers of a streamed crop. 0 when the job has no header.
+    std::size_t estimate_job_bytes(const Job& job, ImageEditor::ReadMode read_mode, std::size_t tile_budget, bool graded) {
+      if (!job.info)
+        return 0;
+      const Reader::ImageInfo& info = *job.info;
+      // ReadMode::COLOR converts every image to 8-bit BGR
+      bool is_color = read_mode == ImageEditor::ReadMode::COLOR;
+      std::size_t decoded = std::size_t(info.width) * std::size_t(info.height)
+        * std::size_t(is_color ? 3 : std::max(info.channels, 1)) * (!is_color && info.depth > 8 ? 2 : 1);
+      if (!graded && ImageEditor::should_stream_crop(info, job.output))
+        return std::min(decoded, tile_budget);
+      return decoded;
+    }
+  } // namespace
+
+  // Split the available cores between the stages
+  Options default_options(unsigned cores) {
+    if (cores == 0)
+      cores = 1;
+    unsigned transform = std::max(1u, cores / 8);
+    unsigned decode = std::max(1u, (cores - std::min(cores, transform)) / 2);
+    unsigned encode = std::max(1u, cores - std::min(cores, transform + decode));
+    return Options{ decode, transform, encode, std::size_t(2) * cores };
+  }
+
+  Engine::Engine(const Options& options, StatusCallback on_status)
+    : owned_pool(options.pool == nullptr ? std::make_unique<ImageEditor::MatPool>() : nullptr),
+    pool(options.pool == nullptr ? owned_pool.get() : options.pool),
+    read_mode(options.read_mode),
+    tile_budget(options.tile_budget),
+    // An identity grade is no grade, so the shortcuts below stay open
+    grade(options.grade && !options.grade->is_identity() ? options.grade : std::nullopt),
+    encode_profile(options.encode_profile),
+    hash_inputs(options.hash_inputs),
+    memory_budget(options.memory_budget),
+    decode_queue(options.memory_budget, std::max(options.queue_capacity, options.schedule_window)),
+    transform_queue(options.queue_capacity),
+    encode_queue(options.queue_capacity),
+    decode_running(std::max(1u, options.decode_workers)),
+    transform_running(std::max(1u, options.transform_workers)),
+    on_status(std::move(on_status)) {
+    for (unsigned i = 0; i < std::max(1u, options.decode_workers); i++)
+      workers.emplace_back(&Engine::decode_worker, this);
+    for (unsigned i = 0; i < std::max(1u, options.transform_workers); i++)
+      workers.emplace_back(&Engine::transform_worker, this);
+    for (unsigned i = 0; i < std::max(1u, options.encode_workers); i++)
+      workers.emplace_back(&Engine::encode_worker, this);
+  }
+
+  Engine::~Engine() {
+    close();
+  }
+
+  // Queue a job, waiting while the decode stage is full
+  bool Engine::submit(Job job) {
+    // The scheduler needs the size of the image to hold it to the budget. The header is kept in the
+    // job, so the decoder does not read it again. Without a budget the decode workers read it in
+    // parallel instead of this thread reading one header per file.
+    if (!job.info && memory_budget > 0)
+      job.info = Reader::probe_image(job.input.string());
+    std::size_t bytes = estimate_job_bytes(job, read_mode, tile_budget, grade.has_value());
+    std::lock_guard<std::mutex> lock(submit_mutex);
+    if (closed)
+      return false;
+    return decode_queue.push(Task{ next_index++, std::move(job), cv::Mat(), bytes }, bytes);
+  }
+
+  // Stop accepting jobs, wait for all queued jobs to finish and join the workers
+  void Engine::close() {
+    {
+      std::lock_guard<std::mutex> lock(submit_mutex);
+      if (closed)
+        return;
+      closed = true;
+    }
+    decode_queue.close();
+    for (auto& worker : workers)
+      worker.join();
+    workers.clear();
+  }
+
+  void Engine::decode_worker() {
+    ImageEditor::Workspace workspace{ pool };
+    while (auto task = decode_queue.pop()) {
+      // A probed job is routed by the type in its header, others by their extensions
+      const Job& job = task->job;
+      ImageEditor::EncodeProfile profile = job.profile.value_or(encode_profile);
+      // Hashed before the decoder reads the file, which then comes from the page cache, and on
+      // this worker instead of in the serialized status callback
+      if (hash_inputs)
+        task->input_hash = Manifest::hash_file(job.input);
+      bool is_jpeg_crop = !grade
+        && (job.info ? ImageEditor::is_jpeg_crop(*job.info, job.output) : ImageEditor::is_jpeg_crop(job.input, job.output));
+      // JPEG to JPEG jobs never need pixels, finish them here without touching the other stages
+      bool cropped = is_jpeg_crop && (job.info
+        ? ImageEditor::crop_square_jpeg(job.input, *job.info, job.pivot_rect, job.output, profile)
+        : ImageEditor::crop_square_jpeg(job.input, job.pivot_rect, job.output, profile));
+      if (cropped) {
+        finish(*task, Status::SUCCESS, Stage::DONE);
+        continue;
+      }
+      // Images too big to decode at once are streamed straight to the output, bounded by the tile budget
+      bool should_stream = !grade
+        && (job.info ? ImageEditor::should_stream_crop(*job.info, job.output) : ImageEditor::should_stream_crop(job.input, job.output));
+      if (should_stream && ImageEditor::crop_square_streaming(job.input, job.pivot_rect, job.output, tile_budget, profile)) {
+        finish(*task, Status::SUCCESS, Stage::DONE);
+        continue;
+      }
+
+      try {
+        ImageEditor::Result<cv::Mat> image = job.info
+          ? ImageEditor::read_square(job.input, *job.info, job.pivot_rect, workspace, read_mode)
+          : ImageEditor::read_square(job.input, job.pivot_rect, workspace, read_mode);
+        if (image.status == Status::FAILURE) {
+          finish(*task, Status::FAILURE, Stage::DECODE);
+          continue;
+        }
+        task->image = std::move(image.data);
+      }
+      catch (const std::exception& e) {
+        std::cerr << "Failed to read image file: " << task->job.input << ": " << e.what() << std::endl;
+        finish(*task, Status::FAILURE, Stage::DECODE);
+        continue;
+      }
+      transform_queue.push(std::move(*task));
+    }
+    // The last decoder out closes the next stage
+    if (--decode_running == 0)
+      transform_queue.close();
+  }
+
+  void Engine::transform_worker() {
+    while (auto task = transform_queue.pop()) {
+      try {
+        cv::Mat& image = task->image;
+        {
+          Metrics::ScopedTimer timer(Metrics::Stage::CROP);
+          // The decoder already read only the square, so this crop keeps the whole image
+          image = image(ImageEditor::get_square_region(image.cols, image.rows, task->job.pivot_rect));
+        }
+        // The decoded pixels belong to the task, so the square is graded in place
+        if (grade && !grade->apply(image)) {
+          finish(*task, Status::FAILURE, Stage::TRANSFORM);
+          continue;
+        }
+      }
+      catch (const std::exception& e) {
+        std::cerr << "Failed to crop image file: " << task->job.input << ": " << e.what() << std::endl;
+        finish(*task, Status::FAILURE, Stage::TRANSFORM);
+        continue;
+      }
+      encode_queue.push(std::move(*task));
+    }
+    if (--transform_running == 0)
+      encode_queue.close();
+  }
+
+  void Engine::encode_worker() {
+    ImageEditor::Workspace workspace{ pool };
+    while (auto task = encode_queue.pop()) {
+      bool saved = false;
+      try {
+        saved = ImageEditor::save_image(task->image, task->job.output, workspace, task->job.profile.value_or(encode_profile));
+      }
+      catch (const std::exception& e) {
+        std::cerr << "Failed to write image file: " << task->job.output << ": " << e.what() << std::endl;
+      }
+      // Drop the pixels before reporting so the buffer goes back to the pool as early as possible
+      task->image.release();
+      if (saved)
+        finish(*task, Status::SUCCESS, Stage::DONE);
+      else
+        finish(*task, Status::FAILURE, Stage::ENCODE);
+    }
+  }
+
+  MemoryStats Engine::memory_stats() const {
+    return decode_queue.stats();
+  }
+
+  void Engine::finish(const Task& task, Status status, Stage stage) {
+    decode_queue.release(task.bytes);
+    if (!on_status)
+      return;
+    std::lock_guard<std::mutex> lock(callback_mutex);
+    on_status(FileStatus{ task.index, task.job.input, task.job.pivot_rect, task.job.output, status, stage, task.input_hash });
+  }
+
+  // Run all jobs through a pipeline and return their statuses in submission order
+  std::vector<FileStatus> run(const std::vector<Job>& jobs, const Options& options, StatusCallback on_status) {
+    std::vector<FileStatus> statuses(jobs.size());
+    {
+      Engine engine(options, [&](const FileStatus& file_status) {
+        statuses[file_status.index] = file_status;
+        if (on_status)
+          on_status(file_status);
+      });
+      for (const auto& job : jobs)
+        engine.submit(job);
+      engine.close();
+    }
+    return statuses;
+  }
+
+  // Build the job for one file with pivots parsed from the file name suffix
+  Job make_job(const fs::path& file, const fs::path& output_dir) {
+    PivotRect pivot_rect = ImageEditor::parse_pivot_suffix(file.stem().string());
+    return Job(file, pivot_rect, output_dir / file.filename());
+  }
+
+  // Build the job for one probed file, naming the output after its true type when the file has no image
+  // extension, or after output_type when transcoding
+  Job make_job(const fs::path& file, const Reader::ImageInfo& info, const fs::path& output_dir,
+    std::optional<Reader::ImageType> output_type) {
+    Job job = make_job(file, output_dir);
+    job.info = info;
+    bool has_extension = Reader::image_type_map.count(Reader::get_file_type(file.filename().string())) > 0;
+    if (output_type && has_extension)
+      job.output.replace_extension(Reader::get_type_extension(*output_type));
+    else if (!has_extension)
+      job.output += "." + Reader::get_type_extension(output_type.value_or(info.type));
+    return job;
+  }
+
+  // Build one job per file, see make_job
+  std::vector<Job> make_jobs(const std::vector<fs::path>& files, const fs::path& output_dir) {
+    std::vector<Job> jobs;
+    jobs.reserve(files.size());
+    for (const auto& file : files)
+      jobs.push_back(make_job(file, output_dir));
+    return jobs;
+  }
+
+} // namespace Batch
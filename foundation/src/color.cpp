@@ -0,0 +1,420 @@
+#include "include/color.hpp"
+#include "include/metrics.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <string>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define CHROMAEDIT_X86_SIMD
+#endif
+
+namespace ImageEditor {
+  namespace fs = std::filesystem;
+
+  namespace {
+    // Pixels graded per run. Three float planes of this many take 12 KiB and stay in L1.
+    constexpr int RUN_PIXELS = 1024;
+
+    // Steps of the gamma table, values in between are interpolated
+    constexpr int GAMMA_STEPS = 4096;
+
+    // Rec. 601 luma weights, the ones cv::cvtColor uses for COLOR_BGR2GRAY
+    constexpr float LUMA_B = 0.114f;
+    constexpr float LUMA_G = 0.587f;
+    constexpr float LUMA_R = 0.299f;
+
+    // -1 until set_simd_level is called, then the level to use
+    std::atomic<int> selected_level{ -1 };
+
+    // value * scale + offset, clamped to [0, 1]
+    void affine_scalar(float* values, int count, float scale, float offset) {
+      for (int i = 0; i < count; i++)
+        values[i] = std::clamp(values[i] * scale + offset, 0.0f, 1.0f);
+    }
+
+    // Move every channel away from (or towards) the luma of its pixel, clamped to [0, 1]
+    void saturate_scalar(float* blue, float* green, float* red, int count, float saturation) {
+      for (int i = 0; i < count; i++) {
+        float luma = LUMA_B * blue[i] + LUMA_G * green[i] + LUMA_R * red[i];
+        blue[i] = std::clamp(luma + saturation * (blue[i] - luma), 0.0f, 1.0f);
+        green[i] = std::clamp(luma + saturation * (green[i] - luma), 0.0f, 1.0f);
+        red[i] = std::clamp(luma + saturation * (red[i] - luma), 0.0f, 1.0f);
+      }
+    }
+
+#ifdef CHROMAEDIT_X86_SIMD
+    // The SSE and AVX2 versions do the same work 4 and 8 values at a time and leave the tail to the
+    // scalar version. They are compiled for their instruction set only and picked at run time.
+    __attribute__((target("sse2"))) void affine_sse(float* values, int count, float scale, float offset) {
+      __m128 scales = _mm_set1_ps(scale), offsets = _mm_set1_ps(offset);
+      __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f);
+      int i = 0;
+      for (; i + 4 <= count; i += 4) {
+        __m128 value = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(values + i), scales), offsets);
+        _mm_storeu_ps(values + i, _mm_min_ps(_mm_max_ps(value, zero), one));
+      }
+      affine_scalar(values + i, count - i, scale, offset);
+    }
+
+    __attribute__((target("sse2"))) void saturate_sse(float* blue, float* green, float* red, int count, float saturation) {
+      __m128 weight_b = _mm_set1_ps(LUMA_B), weight_g = _mm_set1_ps(LUMA_G), weight_r = _mm_set1_ps(LUMA_R);
+      __m128 factor = _mm_set1_ps(saturation), zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f);
+      int i = 0;
+      for (; i + 4 <= count; i += 4) {
+        __m128 b = _mm_loadu_ps(blue + i), g = _mm_loadu_ps(green + i), r = _mm_loadu_ps(red + i);
+        __m128 luma = _mm_add_ps(_mm_add_ps(_mm_mul_ps(b, weight_b), _mm_mul_ps(g, weight_g)), _mm_mul_ps(r, weight_r));
+        b = _mm_add_ps(luma, _mm_mul_ps(factor, _mm_sub_ps(b, luma)));
+        g = _mm_add_ps(luma, _mm_mul_ps(factor, _mm_sub_ps(g, luma)));
+        r = _mm_add_ps(luma, _mm_mul_ps(factor, _mm_sub_ps(r, luma)));
+        _mm_storeu_ps(blue + i, _mm_min_ps(_mm_max_ps(b, zero), one));
+        _mm_storeu_ps(green + i, _mm_min_ps(_mm_max_ps(g, zero), one));
+        _mm_storeu_ps(red + i, _mm_min_ps(_mm_max_ps(r, zero), one));
+      }
+      saturate_scalar(blue + i, green + i, red + i, count - i, saturation);
+    }
+
+    __attribute__((target("avx2,fma"))) void affine_avx2(float* values, int count, float scale, float offset) {
+      __m256 scales = _mm256_set1_ps(scale), offsets = _mm256_set1_ps(offset);
+      __m256 zero = _mm256_setzero_ps(), one = _mm256_set1_ps(1.0f);
+      int i = 0;
+      for (; i + 8 <= count; i += 8) {
+        __m256 value = _mm256_fmadd_ps(_mm256_loadu_ps(values + i), scales, offsets);
+        _mm256_storeu_ps(values + i, _mm256_min_ps(_mm256_max_ps(value, zero), one));
+      }
+      affine_scalar(values + i, count - i, scale, offset);
+    }
+
+    __attribute__((target("avx2,fma"))) void saturate_avx2(float* blue, float* green, float* red, int count, float saturation) {
+      __m256 weight_b = _mm256_set1_ps(LUMA_B), weight_g = _mm256_set1_ps(LUMA_G), weight_r = _mm256_set1_ps(LUMA_R);
+      __m256 factor = _mm256_set1_ps(saturation), zero = _mm256_setzero_ps(), one = _mm256_set1_ps(1.0f);
+      int i = 0;
+      for (; i + 8 <= count; i += 8) {
+        __m256 b = _mm256_loadu_ps(blue + i), g = _mm256_loadu_ps(green + i), r = _mm256_loadu_ps(red + i);
+        __m256 luma = _mm256_fmadd_ps(r, weight_r, _mm256_fmadd_ps(g, weight_g, _mm256_mul_ps(b, weight_b)));
+        b = _mm256_fmadd_ps(factor, _mm256_sub_ps(b, luma), luma);
+        g = _mm256_fmadd_ps(factor, _mm256_sub_ps(g, luma), luma);
+        r = _mm256_fmadd_ps(factor, _mm256_sub_ps(r, luma), luma);
+        _mm256_storeu_ps(blue + i, _mm256_min_ps(_mm256_max_ps(b, zero), one));
+        _mm256_storeu_ps(green + i, _mm256_min_ps(_mm256_max_ps(g, zero), one));
+        _mm256_storeu_ps(red + i, _mm256_min_ps(_mm256_max_ps(r, zero), one));
+      }
+      saturate_scalar(blue + i, green + i, red + i, count - i, saturation);
+    }
+#endif
+
+    void affine(SimdLevel level, float* values, int count, float scale, float offset) {
+#ifdef CHROMAEDIT_X86_SIMD
+      if (level == SimdLevel::AVX2)
+        return affine_avx2(values, count, scale, offset);
+      if (level == SimdLevel::SSE)
+        return affine_sse(values, count, scale, offset);
+#endif
+      affine_scalar(values, count, scale, offset);
+    }
+
+    void saturate(SimdLevel level, float* blue, float* green, float* red, int count, float saturation) {
+#ifdef CHROMAEDIT_X86_SIMD
+      if (level == SimdLevel::AVX2)
+        return saturate_avx2(blue, green, red, count, saturation);
+      if (level == SimdLevel::SSE)
+        return saturate_sse(blue, green, red, count, saturation);
+#endif
+      saturate_scalar(blue, green, red, count, saturation);
+    }
+
+    void apply_gamma(float* values, int count, const std::vector<float>& table) {
+      for (int i = 0; i < count; i++) {
+        float position = values[i] * GAMMA_STEPS;
+        int index = std::min(int(position), GAMMA_STEPS - 1);
+        values[i] = table[index] + (position - float(index)) * (table[index + 1] - table[index]);
+      }
+    }
+
+    float lerp(float a, float b, float t) {
+      return a + t * (b - a);
+    }
+
+    // Map one RGB value through lut with linear (1D) or trilinear (3D) interpolation
+    void lookup(const CubeLut& lut, const float (&rgb)[3], float (&out)[3]) {
+      int index[3];
+      float fraction[3];
+      for (int c = 0; c < 3; c++) {
+        float position = std::clamp((rgb[c] - lut.domain_min[c]) / (lut.domain_max[c] - lut.domain_min[c]), 0.0f, 1.0f)
+          * float(lut.size - 1);
+        index[c] = std::min(int(position), lut.size - 2);
+        fraction[c] = position - float(index[c]);
+      }
+
+      const float* table = lut.table.data();
+      if (!lut.is_3d) {
+        for (int c = 0; c < 3; c++)
+          out[c] = lerp(table[index[c] * 3 + c], table[(index[c] + 1) * 3 + c], fraction[c]);
+        return;
+      }
+
+      // Red changes fastest, then green, then blue
+      std::size_t green_step = std::size_t(lut.size) * 3;
+      std::size_t blue_step = green_step * std::size_t(lut.size);
+      const float* corner = table + index[2] * blue_step + index[1] * green_step + std::size_t(index[0]) * 3;
+      for (int c = 0; c < 3; c++) {
+        float c00 = lerp(corner[c], corner[3 + c], fraction[0]);
+        float c10 = lerp(corner[green_step + c], corner[green_step + 3 + c], fraction[0]);
+        float c01 = lerp(corner[blue_step + c], corner[blue_step + 3 + c], fraction[0]);
+        float c11 = lerp(corner[blue_step + green_step + c], corner[blue_step + green_step + 3 + c], fraction[0]);
+        out[c] = lerp(lerp(c00, c10, fraction[1]), lerp(c01, c11, fraction[1]), fraction[2]);
+      }
+    }
+
+    template <typename T>
+    T quantize(float value) {
+      constexpr float max_value = float(std::numeric_limits<T>::max());
+      return T(std::clamp(value, 0.0f, 1.0f) * max_value + 0.5f);
+    }
+  } // namespace
+
+  // Read a .cube file
+  Result<CubeLut> load_cube(const fs::path& cube_path) {
+    std::ifstream file(cube_path);
+    if (!file) {
+      std::cerr << "Failed to read LUT file: " << cube_path << std::endl;
+      return Result(CubeLut(), Status::FAILURE);
+    }
+
+    CubeLut lut;
+    std::string line;
+    int line_number = 0;
+    auto fail = [&](const std::string& reason) {
+      std::cerr << "Invalid LUT file: " << cube_path << ":" << line_number << ": " << reason << std::endl;
+      return Result(CubeLut(), Status::FAILURE);
+    };
+    while (std::getline(file, line)) {
+      line_number++;
+      std::istringstream stream(line);
+      std::string keyword;
+      if (!(stream >> keyword) || keyword[0] == '#')
+        continue;
+
+      if (keyword == "LUT_3D_SIZE" || keyword == "LUT_1D_SIZE") {
+        lut.is_3d = keyword == "LUT_3D_SIZE";
+        if (!(stream >> lut.size) || lut.size < 2 || lut.size > (lut.is_3d ? 256 : 65536))
+          return fail("unsupported table size");
+        continue;
+      }
+      if (keyword == "DOMAIN_MIN" || keyword == "DOMAIN_MAX") {
+        std::array<float, 3>& domain = keyword == "DOMAIN_MIN" ? lut.domain_min : lut.domain_max;
+        if (!(stream >> domain[0] >> domain[1] >> domain[2]))
+          return fail("expected three values");
+        continue;
+      }
+      if (keyword == "LUT_1D_INPUT_RANGE" || keyword == "LUT_3D_INPUT_RANGE") {
+        float min = 0, max = 0;
+        if (!(stream >> min >> max))
+          return fail("expected two values");
+        lut.domain_min.fill(min);
+        lut.domain_max.fill(max);
+        continue;
+      }
+      // TITLE and keywords of other tools
+      if (std::isalpha(static_cast<unsigned char>(keyword[0])))
+        continue;
+
+      std::istringstream row(line);
+      float red = 0, green = 0, blue = 0;
+      if (!(row >> red >> green >> blue))
+        return fail("expected an RGB triple");
+      if (lut.size == 0)
+        return fail("table row before the table size");
+      lut.table.insert(lut.table.end(), { red, green, blue });
+    }
+
+    std::size_t entries = lut.is_3d ? std::size_t(lut.size) * lut.size * lut.size : std::size_t(lut.size);
+    if (lut.size == 0 || lut.table.size() != entries * 3)
+      return fail("expected " + std::to_string(entries) + " table rows");
+    for (int c = 0; c < 3; c++) {
+      if (!(lut.domain_max[c] > lut.domain_min[c]))
+        return fail("empty domain");
+    }
+    return Result(std::move(lut), Status::SUCCESS);
+  }
+
+  // The fastest level this CPU runs
+  SimdLevel supported_simd_level() {
+#ifdef CHROMAEDIT_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+      return SimdLevel::AVX2;
+    if (__builtin_cpu_supports("sse2"))
+      return SimdLevel::SSE;
+#endif
+    return SimdLevel::SCALAR;
+  }
+
+  SimdLevel simd_level() {
+    int level = selected_level.load(std::memory_order_relaxed);
+    return level < 0 ? supported_simd_level() : SimdLevel(level);
+  }
+
+  // Use level for the color kernels, or the best supported one below it
+  void set_simd_level(SimdLevel level) {
+    selected_level.store(int(std::min(level, supported_simd_level())), std::memory_order_relaxed);
+  }
+
+  ColorGrade::ColorGrade(const ColorAdjustment& adjustment, std::shared_ptr<const CubeLut> lut)
+    : scale(float(adjustment.contrast)),
+    // (value + brightness - 0.5) * contrast + 0.5, as one multiply-add
+    offset(float((adjustment.brightness - 0.5) * adjustment.contrast + 0.5)),
+    saturation(float(adjustment.saturation)),
+    lut(std::move(lut)) {
+    bool has_gamma = adjustment.gamma > 0 && adjustment.gamma != 1;
+    identity = adjustment.brightness == 0 && adjustment.contrast == 1 && adjustment.saturation == 1 && !has_gamma
+      && this->lut == nullptr;
+    if (has_gamma) {
+      auto table = std::make_shared<std::vector<float>>(GAMMA_STEPS + 1);
+      for (int i = 0; i <= GAMMA_STEPS; i++)
+        (*table)[i] = float(std::pow(double(i) / GAMMA_STEPS, 1.0 / adjustment.gamma));
+      gamma_table = std::move(table);
+    }
+
+    // Without cross-channel work every output sample depends on its input sample only, so 8-bit
+    // images can be graded with a table built by running all 256 values through the float path
+    table_8bit = saturation == 1 && (this->lut == nullptr || !this->lut->is_3d);
+    float blue[256], green[256], red[256], gray[256];
+    for (int v = 0; v < 256; v++)
+      blue[v] = green[v] = red[v] = gray[v] = float(v) / 255;
+    grade_planes(blue, green, red, 256, false);
+    grade_planes(gray, gray, gray, 256, true);
+    for (int v = 0; v < 256; v++) {
+      color_table[0][v] = quantize<uchar>(blue[v]);
+      color_table[1][v] = quantize<uchar>(green[v]);
+      color_table[2][v] = quantize<uchar>(red[v]);
+      gray_table[v] = quantize<uchar>(gray[v]);
+    }
+  }
+
+  bool ColorGrade::is_identity() const {
+    return identity;
+  }
+
+  // Brightness and contrast, saturation, gamma and the LUT, in that order
+  void ColorGrade::grade_planes(float* blue, float* green, float* red, int count, bool gray) const {
+    SimdLevel level = simd_level();
+    if (scale != 1 || offset != 0) {
+      affine(level, blue, count, scale, offset);
+      if (!gray) {
+        affine(level, green, count, scale, offset);
+        affine(level, red, count, scale, offset);
+      }
+    }
+    if (!gray && saturation != 1)
+      saturate(level, blue, green, red, count, saturation);
+    if (gamma_table) {
+      apply_gamma(blue, count, *gamma_table);
+      if (!gray) {
+        apply_gamma(green, count, *gamma_table);
+        apply_gamma(red, count, *gamma_table);
+      }
+    }
+    if (lut) {
+      float out[3];
+      for (int i = 0; i < count; i++) {
+        if (gray) {
+          // A gray pixel goes through the LUT as R = G = B and comes out as the luma of the result
+          lookup(*lut, { blue[i], blue[i], blue[i] }, out);
+          blue[i] = LUMA_R * out[0] + LUMA_G * out[1] + LUMA_B * out[2];
+          continue;
+        }
+        lookup(*lut, { red[i], green[i], blue[i] }, out);
+        red[i] = out[0];
+        green[i] = out[1];
+        blue[i] = out[2];
+      }
+    }
+  }
+
+  // Spread runs of interleaved pixels into planes, grade them and interleave them back
+  template <typename T>
+  void ColorGrade::apply_run(const T* src, T* dst, int pixels, int channels) const {
+    constexpr float max_value = float(std::numeric_limits<T>::max());
+    bool gray = channels < 3;
+    int color_channels = gray ? 1 : 3;
+    float planes[3][RUN_PIXELS];
+    for (int start = 0; start < pixels; start += RUN_PIXELS) {
+      int count = std::min(RUN_PIXELS, pixels - start);
+      const T* in = src + std::size_t(start) * channels;
+      T* out = dst + std::size_t(start) * channels;
+      for (int i = 0; i < count; i++) {
+        for (int c = 0; c < color_channels; c++)
+          planes[c][i] = float(in[i * channels + c]) / max_value;
+      }
+      if (gray)
+        grade_planes(planes[0], planes[0], planes[0], count, true);
+      else
+        grade_planes(planes[0], planes[1], planes[2], count, false);
+      for (int i = 0; i < count; i++) {
+        for (int c = 0; c < color_channels; c++)
+          out[i * channels + c] = quantize<T>(planes[c][i]);
+        // Alpha is kept
+        for (int c = color_channels; c < channels; c++)
+          out[i * channels + c] = in[i * channels + c];
+      }
+    }
+  }
+
+  void ColorGrade::apply_row(const uchar* src, uchar* dst, int pixels, int channels) const {
+    if (identity) {
+      if (src != dst)
+        std::memcpy(dst, src, std::size_t(pixels) * channels);
+      return;
+    }
+    bool gray = channels < 3;
+    if (!gray && !table_8bit)
+      return apply_run(src, dst, pixels, channels);
+
+    int color_channels = gray ? 1 : 3;
+    for (std::size_t i = 0; i < std::size_t(pixels) * channels; i += channels) {
+      for (int c = 0; c < color_channels; c++)
+        dst[i + c] = gray ? gray_table[src[i]] : color_table[c][src[i + c]];
+      for (int c = color_channels; c < channels; c++)
+        dst[i + c] = src[i + c];
+    }
+  }
+
+  void ColorGrade::apply_row(const ushort* src, ushort* dst, int pixels, int channels) const {
+    if (identity) {
+      if (src != dst)
+        std::memcpy(dst, src, std::size_t(pixels) * channels * sizeof(ushort));
+      return;
+    }
+    apply_run(src, dst, pixels, channels);
+  }
+
+  // Grade an image in place, row bands in parallel
+  bool ColorGrade::apply(cv::Mat& image) const {
+    int depth = image.depth();
+    int channels = image.channels();
+    if ((depth != CV_8U && depth != CV_16U) || channels > 4) {
+      std::cerr << "Color grading needs an 8 or 16-bit image with 1 to 4 channels" << std::endl;
+      return false;
+    }
+    if (identity)
+      return true;
+    Metrics::ScopedTimer timer(Metrics::Stage::COLOR);
+    cv::parallel_for_(cv::Range(0, image.rows), [&](const cv::Range& rows) {
+      for (int y = rows.start; y < rows.end; y++) {
+        if (depth == CV_8U)
+          apply_row(image.ptr(y), image.ptr(y), image.cols, channels);
+        else
+          apply_row(image.ptr<ushort>(y), image.ptr<ushort>(y), image.cols, channels);
+      }
+    });
+    return true;
+  }
+
+} // namespace ImageEditor
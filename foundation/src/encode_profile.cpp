@@ -0,0 +1,70 @@
+#include "include/encode_profile.hpp"
+#include "include/reader.hpp"
+#include <opencv2/opencv.hpp>
+
+namespace ImageEditor {
+
+  namespace {
+    // libtiff compression schemes, without depending on its headers
+    constexpr int TIFF_COMPRESSION_LZW = 5;
+    constexpr int TIFF_COMPRESSION_ADOBE_DEFLATE = 8;
+  } // namespace
+
+  // Get the codec settings of profile
+  EncodeSettings get_encode_settings(EncodeProfile profile) {
+    switch (profile) {
+    case EncodeProfile::BALANCED:
+      return EncodeSettings{ 6, cv::IMWRITE_PNG_STRATEGY_DEFAULT, 95, true, false, 101, TIFF_COMPRESSION_LZW };
+    case EncodeProfile::SMALL:
+      return EncodeSettings{ 9, cv::IMWRITE_PNG_STRATEGY_DEFAULT, 85, true, true, 80, TIFF_COMPRESSION_ADOBE_DEFLATE };
+    default:
+      return EncodeSettings{ 1, cv::IMWRITE_PNG_STRATEGY_RLE, 95, false, false, 101, TIFF_COMPRESSION_LZW };
+    }
+  }
+
+  // Get the cv::imwrite parameters of profile for the format selected by extension
+  std::vector<int> get_encode_params(const std::string& extension, EncodeProfile profile) {
+    std::string name = !extension.empty() && extension.front() == '.' ? extension : "." + extension;
+    auto iter = Reader::image_type_map.find(Reader::get_file_type(name));
+    if (iter == Reader::image_type_map.end())
+      return {};
+    EncodeSettings settings = get_encode_settings(profile);
+    switch (iter->second) {
+    case Reader::ImageType::PNG:
+      // Without a level cv::imwrite also switches to a cheaper row filter, which an explicit level 1 would lose
+      if (profile == EncodeProfile::FAST)
+        return {};
+      return { cv::IMWRITE_PNG_COMPRESSION, settings.png_compression, cv::IMWRITE_PNG_STRATEGY, settings.png_strategy };
+    case Reader::ImageType::JPEG:
+      return { cv::IMWRITE_JPEG_QUALITY, settings.jpeg_quality, cv::IMWRITE_JPEG_OPTIMIZE, int(settings.jpeg_optimize),
+        cv::IMWRITE_JPEG_PROGRESSIVE, int(settings.jpeg_progressive) };
+    case Reader::ImageType::WEBP:
+      return { cv::IMWRITE_WEBP_QUALITY, settings.webp_quality };
+    case Reader::ImageType::TIFF:
+      return { cv::IMWRITE_TIFF_COMPRESSION, settings.tiff_compression };
+    default:
+      return {};
+    }
+  }
+
+  // Parse a profile name
+  std::optional<EncodeProfile> parse_encode_profile(const std::string& name) {
+    for (EncodeProfile profile : { EncodeProfile::FAST, EncodeProfile::BALANCED, EncodeProfile::SMALL }) {
+      if (name == get_encode_profile_name(profile))
+        return profile;
+    }
+    return std::nullopt;
+  }
+
+  std::string get_encode_profile_name(EncodeProfile profile) {
+    switch (profile) {
+    case EncodeProfile::BALANCED:
+      return "balanced";
+    case EncodeProfile::SMALL:
+      return "small";
+    default:
+      return "fast";
+    }
+  }
+
+} // namespace ImageEditor
@@ -1,56 +1,376 @@
 #include "include/image_editor.hpp"
+#include "include/auto_pivot.hpp"
+#include "include/jpeg_crop.hpp"
+#include "include/metrics.hpp"
+#include "include/orientation.hpp"
+#include "include/pipeline.hpp"
+#include "include/probe.hpp"
+#include "include/region_reader.hpp"
+#include "include/stream_crop.hpp"
 #include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cstdio>
+#include <cstring>
 #include <filesystem>
 #include <iostream>
 #include <opencv2/opencv.hpp>
+#include <unistd.h>
 
 namespace ImageEditor {
   namespace fs = std::filesystem;
 
   void DebugLog(RectHorizontal horizontal, RectVertical vertical);
 
-  Result<cv::Mat> read_image(const fs::path& image_path) {
-    cv::Mat image = cv::imread(image_path, cv::IMREAD_COLOR);
-    if (image.empty()) {
-      std::cerr << "Failed to read image file: " << image_path << std::endl;
-      return Result(cv::Mat(), Status::FAILURE);
+  namespace {
+    // cv::imencode wants the extension with its dot
+    std::string normalize_extension(const std::string& extension) {
+      return !extension.empty() && extension.front() == '.' ? extension : "." + extension;
     }
-    return Result(image, Status::SUCCESS);
+
+    std::optional<Reader::ImageType> extension_type(const std::string& extension) {
+      auto iter = Reader::image_type_map.find(Reader::get_file_type(extension));
+      if (iter == Reader::image_type_map.end())
+        return std::nullopt;
+      return iter->second;
+    }
+
+    // The cv::imread flags for a mode. IMREAD_UNCHANGED skips EXIF orientation, so JPEGs, which
+    // have no alpha or high bit depth to keep, are read with IMREAD_ANYCOLOR | IMREAD_ANYDEPTH instead.
+    // Without oriented JPEGs are read in their stored frame. Other formats are always read as the
+    // decoder orients them, Reader::probe_image reports no orientation for them.
+    int imread_flags(ReadMode mode, bool is_jpeg, bool oriented) {
+      int flags = mode == ReadMode::COLOR ? cv::IMREAD_COLOR
+        : is_jpeg ? cv::IMREAD_ANYCOLOR | cv::IMREAD_ANYDEPTH : cv::IMREAD_UNCHANGED;
+      return oriented || !is_jpeg ? flags : flags | cv::IMREAD_IGNORE_ORIENTATION;
+    }
+
+    bool is_jpeg_data(std::span<const std::byte> data) {
+      std::optional<Reader::ImageInfo> info = Reader::probe_image(data);
+      return info && info->type == Reader::ImageType::JPEG;
+    }
+
+    // Read a whole file into buffer, reusing its capacity
+    bool read_file(const fs::path& path, std::vector<uchar>& buffer) {
+      std::FILE* file = std::fopen(path.c_str(), "rb");
+      if (file == nullptr)
+        return false;
+      bool success = std::fseek(file, 0, SEEK_END) == 0;
+      long size = success ? std::ftell(file) : -1;
+      success = size >= 0 && std::fseek(file, 0, SEEK_SET) == 0;
+      if (success) {
+        buffer.resize(std::size_t(size));
+        success = std::fread(buffer.data(), 1, buffer.size(), file) == buffer.size();
+      }
+      std::fclose(file);
+      return success;
+    }
+
+    bool write_file(const fs::path& path, const std::vector<uchar>& buffer) {
+      std::FILE* file = std::fopen(path.c_str(), "wb");
+      if (file == nullptr)
+        return false;
+      bool success = std::fwrite(buffer.data(), 1, buffer.size(), file) == buffer.size();
+      return std::fclose(file) == 0 && success;
+    }
+
+    // A file name with the extension of the format in data, to count failures per format
+    fs::path format_name(std::span<const std::byte> data) {
+      std::optional<Reader::ImageInfo> info = Reader::probe_image(data);
+      for (const auto& [extension, type] : Reader::image_type_map) {
+        if (info && info->type == type)
+          return "image." + extension;
+      }
+      return fs::path();
+    }
+
+    // Read image by specific path, in its oriented or stored frame
+    Result<cv::Mat> read_file_image(const fs::path& image_path, ReadMode mode, bool oriented) {
+      Metrics::ScopedTimer timer(Metrics::Stage::DECODE);
+      // The type comes from the header like for the other readers, only the first bytes are read
+      std::optional<Reader::ImageInfo> info = Reader::probe_image(image_path.string());
+      bool is_jpeg = info && info->type == Reader::ImageType::JPEG;
+      cv::Mat image = cv::imread(image_path, imread_flags(mode, is_jpeg, oriented));
+      if (image.empty()) {
+        std::cerr << "Failed to read image file: " << image_path << std::endl;
+        Metrics::add_failure(image_path);
+        return Result(cv::Mat(), Status::FAILURE);
+      }
+      if (Metrics::enabled()) {
+        std::error_code error;
+        std::uintmax_t size = fs::file_size(image_path, error);
+        Metrics::add(Metrics::Counter::BYTES_READ, error ? 0 : size);
+        Metrics::add(Metrics::Counter::PIXELS_PROCESSED, image.total());
+      }
+      return Result(std::move(image), Status::SUCCESS);
+    }
+
+    // Same as above, reusing the buffers of workspace
+    Result<cv::Mat> read_file_image(const fs::path& image_path, Workspace& workspace, ReadMode mode, bool oriented) {
+      Metrics::ScopedTimer timer(Metrics::Stage::DECODE);
+      cv::Mat image;
+      // imdecode creates the pixels through the allocator of the Mat it decodes into
+      image.allocator = workspace.allocator;
+      if (read_file(image_path, workspace.buffer) && !workspace.buffer.empty()) {
+        bool is_jpeg = is_jpeg_data(std::as_bytes(std::span(workspace.buffer)));
+        cv::imdecode(workspace.buffer, imread_flags(mode, is_jpeg, oriented), &image);
+      }
+      if (image.empty()) {
+        std::cerr << "Failed to read image file: " << image_path << std::endl;
+        Metrics::add_failure(image_path);
+        return Result(cv::Mat(), Status::FAILURE);
+      }
+      Metrics::add(Metrics::Counter::BYTES_READ, workspace.buffer.size());
+      Metrics::add(Metrics::Counter::PIXELS_PROCESSED, image.total());
+      return Result(std::move(image), Status::SUCCESS);
+    }
+
+    // Decode an image held in memory, the encoded bytes are read in place
+    Result<cv::Mat> decode_bytes(std::span<const std::byte> data, ReadMode mode, bool oriented) {
+      Metrics::ScopedTimer timer(Metrics::Stage::DECODE);
+      cv::Mat image;
+      if (!data.empty() && data.size() <= std::size_t(INT_MAX)) {
+        // A header over the caller's bytes, nothing is copied
+        const cv::Mat encoded(1, int(data.size()), CV_8U, const_cast<std::byte*>(data.data()));
+        image = cv::imdecode(encoded, imread_flags(mode, is_jpeg_data(data), oriented));
+      }
+      if (image.empty()) {
+        std::cerr << "Failed to decode image from memory" << std::endl;
+        Metrics::add_failure(format_name(data));
+        return Result(cv::Mat(), Status::FAILURE);
+      }
+      Metrics::add(Metrics::Counter::BYTES_READ, data.size());
+      Metrics::add(Metrics::Counter::PIXELS_PROCESSED, image.total());
+      return Result(std::move(image), Status::SUCCESS);
+    }
+
+    // JPEG to JPEG crops are done on the coefficients without decoding, like the file version
+    bool is_lossless_crop(const std::optional<Reader::ImageInfo>& info, const std::string& extension) {
+      return info && info->type == Reader::ImageType::JPEG && extension_type(normalize_extension(extension)) == Reader::ImageType::JPEG;
+    }
+
+    // Decode image, crop its square and encode it. The square is cut from the stored frame, only
+    // the square is turned upright.
+    Result<std::vector<uchar>> encode_square(std::span<const std::byte> image, const std::optional<Reader::ImageInfo>& info,
+      const PivotRect& pivot_rect, const std::string& extension) {
+      int orientation = info ? info->orientation : 1;
+      Result<cv::Mat> decoded = decode_stored_image(image, ReadMode::UNCHANGED);
+      if (decoded.status == Status::FAILURE)
+        return Result(std::vector<uchar>(), Status::FAILURE);
+      cv::Mat square = decoded.data(get_stored_square_region(decoded.data, orientation, pivot_rect));
+      return encode_image(apply_orientation(square, orientation), extension);
+    }
+  } // namespace
+
+  Result<cv::Mat> read_image(const fs::path& image_path, ReadMode mode) {
+    return read_file_image(image_path, mode, true);
   }
 
-  // Save image by specific filename and path. If the path directory does not exist, it is created.
+  // Read image by specific path, reusing the buffers of workspace
+  Result<cv::Mat> read_image(const fs::path& image_path, Workspace& workspace, ReadMode mode) {
+    return read_file_image(image_path, workspace, mode, true);
+  }
+
+  // Read image in its stored frame, without applying EXIF orientation
+  Result<cv::Mat> read_stored_image(const fs::path& image_path, ReadMode mode) {
+    return read_file_image(image_path, mode, false);
+  }
+
+  // Read image in its stored frame, reusing the buffers of workspace
+  Result<cv::Mat> read_stored_image(const fs::path& image_path, Workspace& workspace, ReadMode mode) {
+    return read_file_image(image_path, workspace, mode, false);
+  }
+
+  // Save image by specific filename and path. If the path directory (or any parent) does not exist, it is created.
   // If an image with the same name already exists, it is overwritten.
   // Example arg output: /home/user/picture/image.jpg
   // Returns true on success, false otherwise.
-  bool save_image(const cv::Mat& image, const fs::path& output) {
-    fs::create_directory(output.parent_path());
-    bool success = cv::imwrite(output, image);
+  bool save_image(const cv::Mat& image, const fs::path& output, EncodeProfile profile) {
+    Metrics::ScopedTimer timer(Metrics::Stage::ENCODE);
+    fs::create_directories(output.parent_path());
+    std::string extension = output.extension().string();
+    bool success = cv::imwrite(output, fit_to_format(image, extension), get_encode_params(extension, profile));
+    if (!success) {
+      std::cerr << "Failed to write image file: " << output << std::endl;
+      Metrics::add_failure(output);
+      return false;
+    }
+    if (Metrics::enabled()) {
+      std::error_code error;
+      std::uintmax_t size = fs::file_size(output, error);
+      Metrics::add(Metrics::Counter::BYTES_WRITTEN, error ? 0 : size);
+    }
+    return true;
+  }
+
+  // Save image by specific filename and path, encoding into the buffer of workspace
+  bool save_image(const cv::Mat& image, const fs::path& output, Workspace& workspace, EncodeProfile profile) {
+    Metrics::ScopedTimer timer(Metrics::Stage::ENCODE);
+    fs::create_directories(output.parent_path());
+    bool success = false;
+    try {
+      std::string extension = output.extension().string();
+      success = cv::imencode(extension, fit_to_format(image, extension), workspace.buffer, get_encode_params(extension, profile))
+        && write_file(output, workspace.buffer);
+    }
+    catch (const cv::Exception& e) {
+      std::cerr << e.what() << std::endl;
+    }
     if (!success) {
       std::cerr << "Failed to write image file: " << output << std::endl;
+      Metrics::add_failure(output);
       return false;
     }
+    Metrics::add(Metrics::Counter::BYTES_WRITTEN, workspace.buffer.size());
     return true;
   }
 
+  // Get a path next to output that is unique to this process and call
+  fs::path get_temporary_path(const fs::path& output) {
+    static std::atomic<unsigned long> counter{ 0 };
+    fs::path temporary = output;
+    temporary += "." + std::to_string(::getpid()) + "." + std::to_string(counter++) + ".tmp";
+    return temporary;
+  }
+
+  // Convert an image to what the format selected by extension can store
+  cv::Mat fit_to_format(const cv::Mat& image, const std::string& extension) {
+    std::optional<Reader::ImageType> type = extension_type(normalize_extension(extension));
+    if (!type)
+      return image;
+
+    cv::Mat fitted = image;
+    bool keeps_alpha = type != Reader::ImageType::JPEG && type != Reader::ImageType::BMP;
+    if (!keeps_alpha && fitted.channels() == 4) {
+      cv::Mat opaque;
+      cv::cvtColor(fitted, opaque, cv::COLOR_BGRA2BGR);
+      fitted = opaque;
+    }
+
+    int depth = fitted.depth();
+    bool keeps_depth = depth == CV_8U
+      || (depth == CV_16U && (type == Reader::ImageType::PNG || type == Reader::ImageType::TIFF))
+      || ((depth == CV_32F || depth == CV_64F) && type == Reader::ImageType::TIFF);
+    if (!keeps_depth) {
+      // Scale to the 8-bit range rather than let the encoder saturate: 16-bit by 1/257, float from [0, 1]
+      double scale = depth == CV_16U ? 1.0 / 257 : (depth == CV_32F || depth == CV_64F) ? 255.0 : 1.0;
+      cv::Mat narrowed;
+      fitted.convertTo(narrowed, CV_8U, scale);
+      fitted = narrowed;
+    }
+    return fitted;
+  }
+
+  // Decode an image held in memory, the encoded bytes are read in place
+  Result<cv::Mat> decode_image(std::span<const std::byte> data, ReadMode mode) {
+    return decode_bytes(data, mode, true);
+  }
+
+  // Decode an image held in memory in its stored frame, without applying EXIF orientation
+  Result<cv::Mat> decode_stored_image(std::span<const std::byte> data, ReadMode mode) {
+    return decode_bytes(data, mode, false);
+  }
+
+  // Encode an image in the format selected by extension
+  Result<std::vector<uchar>> encode_image(const cv::Mat& image, const std::string& extension, EncodeProfile profile) {
+    Metrics::ScopedTimer timer(Metrics::Stage::ENCODE);
+    std::string format = normalize_extension(extension);
+    std::vector<uchar> buffer;
+    bool success = false;
+    try {
+      success = !image.empty() && cv::imencode(format, fit_to_format(image, format), buffer, get_encode_params(format, profile));
+    }
+    catch (const cv::Exception& e) {
+      std::cerr << e.what() << std::endl;
+    }
+    if (!success) {
+      std::cerr << "Failed to encode image as " << format << std::endl;
+      Metrics::add_failure(format);
+      return Result(std::vector<uchar>(), Status::FAILURE);
+    }
+    Metrics::add(Metrics::Counter::BYTES_WRITTEN, buffer.size());
+    return Result(std::move(buffer), Status::SUCCESS);
+  }
+
+  // Get the square of an image selected by pivot_rect as a view
+  Result<cv::Mat> crop_square(const cv::Mat& image, const PivotRect& pivot_rect) {
+    // A one-node pipeline, which evaluates to a view
+    return Pipeline(image).crop_square(pivot_rect).run();
+  }
+
+  // Crop the square of an image and encode it in the format selected by extension
+  Result<std::vector<uchar>> crop_square(const cv::Mat& image, const PivotRect& pivot_rect, const std::string& extension) {
+    Result<cv::Mat> square = crop_square(image, pivot_rect);
+    if (square.status == Status::FAILURE)
+      return Result(std::vector<uchar>(), Status::FAILURE);
+    return encode_image(square.data, extension);
+  }
+
+  // Crop the square of an encoded image held in memory and encode it in the format selected by extension
+  Result<std::vector<uchar>> crop_square(std::span<const std::byte> image, const PivotRect& pivot_rect, const std::string& extension) {
+    std::optional<Reader::ImageInfo> info = Reader::probe_image(image);
+    if (is_lossless_crop(info, extension)) {
+      Result<std::vector<uchar>> cropped = crop_square_jpeg(image, *info, pivot_rect);
+      if (cropped.status == Status::SUCCESS)
+        return cropped;
+    }
+    return encode_square(image, info, pivot_rect, extension);
+  }
+
+  // Crop the square of an encoded image held in memory into a caller-provided buffer
+  Result<std::size_t> crop_square(std::span<const std::byte> image, const PivotRect& pivot_rect, const std::string& extension,
+    std::span<std::byte> output) {
+    std::optional<Reader::ImageInfo> info = Reader::probe_image(image);
+    // Lossless crops are written straight into output
+    if (is_lossless_crop(info, extension)) {
+      Result<std::size_t> cropped = crop_square_jpeg(image, *info, pivot_rect, output);
+      if (cropped.status == Status::SUCCESS || cropped.data > 0)
+        return cropped;
+    }
+
+    // cv::imencode only writes to a vector of its own, so the others are copied once
+    Result<std::vector<uchar>> encoded = encode_square(image, info, pivot_rect, extension);
+    if (encoded.status == Status::FAILURE)
+      return Result(std::size_t(0), Status::FAILURE);
+    // Too small is not an error worth logging, the caller can retry with the size returned
+    if (encoded.data.size() > output.size())
+      return Result(encoded.data.size(), Status::FAILURE);
+    std::memcpy(output.data(), encoded.data.data(), encoded.data.size());
+    return Result(encoded.data.size(), Status::SUCCESS);
+  }
+
   // Crop an image square at the specified path using the given horizontal and vertical pivots
   // The cropped image is saved to the specified path with the given file name.
   // Example usage: crop_square("/path/to/image.jpg", PivotRect(HorizontalPivot::CENTER, VerticalPivot::BOTTOM), "/path/to/cropped_image.jpg");
   void crop_square(const fs::path& image_path, const PivotRect& pivot_rect, const fs::path& output_path) {
-    Result<cv::Mat> image = read_image(image_path);
-    if (image.status == Status::FAILURE)
+    // JPEG to JPEG crops are done on the coefficients without decoding, see crop_square_jpeg
+    if (is_jpeg_crop(image_path, output_path) && crop_square_jpeg(image_path, pivot_rect, output_path))
       return;
 
-    int width = image.data.cols;
-    int height = image.data.rows;
-    int size = std::min(height, width);
+    // Images too big to decode at once are streamed in bands, see crop_square_streaming
+    if (should_stream_crop(image_path, output_path) && crop_square_streaming(image_path, pivot_rect, output_path))
+      return;
 
-    RectHorizontal rect_horizontal = get_horizontal_crop_region(width, pivot_rect.horizontal_pivot, width - size);
-    RectVertical rect_vertical = get_vertical_crop_region(height, pivot_rect.vertical_pivot, height - size);
+    // A one-node pipeline, the decoder reads only the square where the format allows it (see read_square)
+    Result<cv::Mat> cropped_image = Pipeline(image_path).crop_square(pivot_rect).run();
+    if (cropped_image.status == Status::FAILURE)
+      return;
 
-    // DebugLog(rect_horizontal, rect_vertical);
+    if (!save_image(cropped_image.data, output_path))
+      std::cerr << "Failed to write image file: " << output_path << std::endl;
+  }
+
+  // Crop an image square and color grade it in one pass
+  void crop_square(const fs::path& image_path, const PivotRect& pivot_rect, const fs::path& output_path, const ColorGrade& grade) {
+    if (grade.is_identity())
+      return crop_square(image_path, pivot_rect, output_path);
 
-    cv::Mat cropped_image = image.data(cv::Rect(rect_horizontal.x, rect_vertical.y, rect_horizontal.width, rect_vertical.height));
-    if (!save_image(cropped_image, output_path))
+    // The decoder reads only the square and the grade runs over it in place
+    Result<cv::Mat> graded_image = Pipeline(image_path).crop_square(pivot_rect).color(grade).run();
+    if (graded_image.status == Status::FAILURE)
+      return;
+
+    if (!save_image(graded_image.data, output_path))
       std::cerr << "Failed to write image file: " << output_path << std::endl;
   }
 
@@ -82,6 +402,26 @@ namespace ImageEditor {
     }
   }
 
+  // Get the largest square region of a width x height image positioned by the given pivots
+  cv::Rect get_square_region(int width, int height, const PivotRect& pivot_rect) {
+    int size = std::min(height, width);
+
+    RectHorizontal rect_horizontal = get_horizontal_crop_region(width, pivot_rect.horizontal_pivot, width - size);
+    RectVertical rect_vertical = get_vertical_crop_region(height, pivot_rect.vertical_pivot, height - size);
+    if (pivot_rect.auto_origin && pivot_rect.horizontal_pivot == HorizontalPivot::AUTO)
+      rect_horizontal.x = std::clamp(pivot_rect.auto_origin->x, 0, width - size);
+    if (pivot_rect.auto_origin && pivot_rect.vertical_pivot == VerticalPivot::AUTO)
+      rect_vertical.y = std::clamp(pivot_rect.auto_origin->y, 0, height - size);
+
+    // DebugLog(rect_horizontal, rect_vertical);
+
+    return cv::Rect(rect_horizontal.x, rect_vertical.y, rect_horizontal.width, rect_vertical.height);
+  }
+
+  // Get the largest square region of image, placing AUTO pivots by its pixels
+  cv::Rect get_square_region(const cv::Mat& image, const PivotRect& pivot_rect) {
+    return get_square_region(image.cols, image.rows, resolve_auto_pivot(image, image.cols, image.rows, pivot_rect));
+  }
 
   // Converts a character to a HorizontalPivot enum value. If the character is not a valid option,
 // it returns the default_pivot.
@@ -105,6 +445,25 @@ namespace ImageEditor {
     return default_pivot;
   };
 
+  // Parse the pivots from a file name suffix of the form <name>_<horizontal><vertical>
+  PivotRect parse_pivot_suffix(const std::string& file_name) {
+    std::size_t index = file_name.rfind('_');
+    char ch_pivot = '\0';
+    char cv_pivot = '\0';
+    bool has_prefix = std::string::npos != index;
+    if (has_prefix && file_name.length() >= index + 2) {
+      ch_pivot = file_name[index + 1];
+    }
+
+    if (has_prefix && file_name.length() >= index + 3) {
+      cv_pivot = file_name[index + 2];
+    }
+    // A lone AUTO places the square along whichever side is longer
+    if (ch_pivot == static_cast<char>(HorizontalPivot::AUTO) && cv_pivot == '\0')
+      cv_pivot = static_cast<char>(VerticalPivot::AUTO);
+    return PivotRect(char_to_horizontal_pivot(ch_pivot), char_to_vertical_pivot(cv_pivot));
+  }
+
   void DebugLog(RectHorizontal horizontal, RectVertical vertical) {
     std::cout << "horizontal:{\n"
       << "\tx:" << horizontal.x << "\n\twidth:" << horizontal.width
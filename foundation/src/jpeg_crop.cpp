@@ -0,0 +1,388 @@
+#include "include/jpeg_crop.hpp"
+#include "include/auto_pivot.hpp"
+#include "include/metrics.hpp"
+#include "include/orientation.hpp"
+#include "include/reader.hpp"
+#include <algorithm>
+#include <csetjmp>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <jpeglib.h>
+#include <jerror.h>
+#include <new>
+
+namespace ImageEditor {
+  namespace fs = std::filesystem;
+
+  namespace {
+    // libjpeg reports fatal errors through error_exit, which must not return. Jump back to the
+    // caller instead of letting the library call exit().
+    struct ErrorManager {
+      jpeg_error_mgr pub;
+      std::jmp_buf jump;
+    };
+
+    void error_exit(j_common_ptr cinfo) {
+      char message[JMSG_LENGTH_MAX];
+      (*cinfo->err->format_message)(cinfo, message);
+      std::cerr << "libjpeg: " << message << std::endl;
+      std::longjmp(reinterpret_cast<ErrorManager*>(cinfo->err)->jump, 1);
+    }
+
+    void output_message(j_common_ptr) {
+      // Warnings are not fatal, stay quiet like cv::imread does
+    }
+
+    JDIMENSION div_round_up(JDIMENSION a, JDIMENSION b) {
+      return (a + b - 1) / b;
+    }
+
+    // Write an EXIF block that holds only the orientation tag, as a big-endian TIFF structure
+    void write_orientation_marker(j_compress_ptr dst, int orientation) {
+      const JOCTET exif[] = {
+        'E', 'x', 'i', 'f', 0, 0,
+        'M', 'M', 0, 42, 0, 0, 0, 8,         // TIFF header, the first IFD right after it
+        0, 1,                                // One entry
+        0x01, 0x12, 0, 3, 0, 0, 0, 1,        // Orientation, one SHORT
+        0, JOCTET(orientation), 0, 0,
+        0, 0, 0, 0,                          // No next IFD
+      };
+      jpeg_write_marker(dst, JPEG_APP0 + 1, exif, sizeof(exif));
+    }
+
+    // Copy the coefficients of the square selected by pivot_rect from src to dst. The square is
+    // selected in the frame of orientation and copied in the stored frame, and the output keeps the
+    // orientation, so it is turned upright by whoever shows it, like the input.
+    // Both objects must already have their source and destination managers set up.
+    void crop_coefficients(j_decompress_ptr src, j_compress_ptr dst, const PivotRect& pivot_rect, int orientation,
+      const EncodeSettings& settings) {
+      jpeg_read_header(src, TRUE);
+
+      int mcu_width = src->max_h_samp_factor * DCTSIZE;
+      int mcu_height = src->max_v_samp_factor * DCTSIZE;
+      cv::Rect region = get_jpeg_square_region(src->image_width, src->image_height, mcu_width, mcu_height, pivot_rect, orientation);
+
+      JDIMENSION width_in_imcus = div_round_up(region.width, mcu_width);
+      JDIMENSION height_in_imcus = div_round_up(region.height, mcu_height);
+      JDIMENSION x_imcus = region.x / mcu_width;
+      JDIMENSION y_imcus = region.y / mcu_height;
+
+      // The destination arrays must be requested before jpeg_read_coefficients realizes them
+      j_common_ptr common = reinterpret_cast<j_common_ptr>(src);
+      auto* dst_coefs = static_cast<jvirt_barray_ptr*>(
+        (*src->mem->alloc_small)(common, JPOOL_IMAGE, sizeof(jvirt_barray_ptr) * src->num_components));
+      for (int ci = 0; ci < src->num_components; ci++) {
+        jpeg_component_info* component = src->comp_info + ci;
+        dst_coefs[ci] = (*src->mem->request_virt_barray)(common, JPOOL_IMAGE, FALSE,
+          width_in_imcus * component->h_samp_factor, height_in_imcus * component->v_samp_factor,
+          component->v_samp_factor);
+      }
+
+      jvirt_barray_ptr* src_coefs = jpeg_read_coefficients(src);
+
+      jpeg_copy_critical_parameters(src, dst);
+      dst->image_width = region.width;
+      dst->image_height = region.height;
+      // The quality is the input's, only the entropy coding follows the profile
+      dst->optimize_coding = settings.jpeg_optimize ? TRUE : FALSE;
+      if (settings.jpeg_progressive)
+        jpeg_simple_progression(dst);
+
+      for (int ci = 0; ci < src->num_components; ci++) {
+        jpeg_component_info* component = src->comp_info + ci;
+        JDIMENSION h_samp = component->h_samp_factor;
+        JDIMENSION v_samp = component->v_samp_factor;
+        JDIMENSION dst_width = width_in_imcus * h_samp;
+        JDIMENSION dst_height = height_in_imcus * v_samp;
+        JDIMENSION x_blocks = x_imcus * h_samp;
+        JDIMENSION y_blocks = y_imcus * v_samp;
+
+        for (JDIMENSION block_y = 0; block_y < dst_height; block_y += v_samp) {
+          JBLOCKARRAY dst_rows = (*src->mem->access_virt_barray)(common, dst_coefs[ci], block_y, v_samp, TRUE);
+          JBLOCKARRAY src_rows = (*src->mem->access_virt_barray)(common, src_coefs[ci], block_y + y_blocks, v_samp, FALSE);
+          for (JDIMENSION row = 0; row < v_samp; row++)
+            std::memcpy(dst_rows[row], src_rows[row] + x_blocks, sizeof(JBLOCK) * dst_width);
+        }
+      }
+
+      jpeg_write_coefficients(dst, dst_coefs);
+      if (orientation != 1)
+        write_orientation_marker(dst, orientation);
+      jpeg_finish_compress(dst);
+      jpeg_finish_decompress(src);
+    }
+
+    // Run crop_coefficients with one error manager shared by both objects, so an error in either
+    // jumps back here. attach sets up the source and destination managers; it runs after the
+    // longjmp target, so like everything below it, it must not create objects with destructors.
+    template <typename Attach>
+    bool crop_jpeg(const PivotRect& pivot_rect, int orientation, EncodeProfile profile, Attach attach) {
+      const EncodeSettings settings = get_encode_settings(profile);
+      jpeg_decompress_struct src;
+      jpeg_compress_struct dst;
+      ErrorManager error;
+      src.err = jpeg_std_error(&error.pub);
+      dst.err = src.err;
+      error.pub.error_exit = error_exit;
+      error.pub.output_message = output_message;
+
+      bool success = false;
+      jpeg_create_decompress(&src);
+      jpeg_create_compress(&dst);
+      if (setjmp(error.jump) == 0) {
+        attach(&src, &dst);
+        crop_coefficients(&src, &dst, pivot_rect, orientation, settings);
+        success = true;
+      }
+      jpeg_destroy_compress(&dst);
+      jpeg_destroy_decompress(&src);
+      return success;
+    }
+
+    // A libjpeg destination manager that writes into a std::vector, growing it as needed
+    struct VectorDestination {
+      jpeg_destination_mgr pub;
+      std::vector<uchar>* buffer;
+      std::size_t initial_size;
+    };
+
+    void resize_vector_dest(j_compress_ptr cinfo, std::size_t size) {
+      auto* destination = reinterpret_cast<VectorDestination*>(cinfo->dest);
+      std::size_t used = destination->buffer->size() - destination->pub.free_in_buffer;
+      bool resized = true;
+      try {
+        destination->buffer->resize(size);
+      }
+      catch (const std::bad_alloc&) {
+        resized = false;
+      }
+      if (!resized) {
+        // Exceptions must not cross libjpeg, report it the libjpeg way
+        cinfo->err->msg_code = JERR_OUT_OF_MEMORY;
+        (*cinfo->err->error_exit)(reinterpret_cast<j_common_ptr>(cinfo));
+      }
+      destination->pub.next_output_byte = destination->buffer->data() + used;
+      destination->pub.free_in_buffer = destination->buffer->size() - used;
+    }
+
+    void init_vector_dest(j_compress_ptr cinfo) {
+      auto* destination = reinterpret_cast<VectorDestination*>(cinfo->dest);
+      destination->buffer->clear();
+      destination->pub.free_in_buffer = 0;
+      resize_vector_dest(cinfo, destination->initial_size);
+    }
+
+    // Called by libjpeg only when the whole buffer is full
+    boolean empty_vector_dest(j_compress_ptr cinfo) {
+      auto* destination = reinterpret_cast<VectorDestination*>(cinfo->dest);
+      destination->pub.free_in_buffer = 0;
+      resize_vector_dest(cinfo, destination->buffer->size() * 2);
+      return TRUE;
+    }
+
+    void term_vector_dest(j_compress_ptr cinfo) {
+      auto* destination = reinterpret_cast<VectorDestination*>(cinfo->dest);
+      destination->buffer->resize(destination->buffer->size() - destination->pub.free_in_buffer);
+    }
+
+    void set_vector_dest(j_compress_ptr cinfo, VectorDestination* destination) {
+      destination->pub.init_destination = init_vector_dest;
+      destination->pub.empty_output_buffer = empty_vector_dest;
+      destination->pub.term_destination = term_vector_dest;
+      cinfo->dest = &destination->pub;
+    }
+
+    // A libjpeg destination manager that writes into a caller's buffer. Once the buffer is full the
+    // rest of the output goes through spill and is only counted, so the caller learns the size it needs.
+    struct SpanDestination {
+      jpeg_destination_mgr pub;
+      std::span<std::byte> output;
+      bool spilled;
+      std::size_t overflow;  // Bytes already flushed from spill
+      JOCTET spill[4096];
+
+      // The size of the whole output so far
+      std::size_t size() const {
+        std::size_t buffered = (spilled ? sizeof(spill) : output.size()) - pub.free_in_buffer;
+        return spilled ? output.size() + overflow + buffered : buffered;
+      }
+    };
+
+    void spill_span_dest(SpanDestination* destination) {
+      destination->pub.next_output_byte = destination->spill;
+      destination->pub.free_in_buffer = sizeof(destination->spill);
+    }
+
+    void init_span_dest(j_compress_ptr cinfo) {
+      auto* destination = reinterpret_cast<SpanDestination*>(cinfo->dest);
+      destination->spilled = destination->output.empty();
+      destination->overflow = 0;
+      if (destination->spilled) {
+        spill_span_dest(destination);
+        return;
+      }
+      destination->pub.next_output_byte = reinterpret_cast<JOCTET*>(destination->output.data());
+      destination->pub.free_in_buffer = destination->output.size();
+    }
+
+    // Called by libjpeg only when the whole buffer is full
+    boolean empty_span_dest(j_compress_ptr cinfo) {
+      auto* destination = reinterpret_cast<SpanDestination*>(cinfo->dest);
+      if (destination->spilled)
+        destination->overflow += sizeof(destination->spill);
+      destination->spilled = true;
+      spill_span_dest(destination);
+      return TRUE;
+    }
+
+    void term_span_dest(j_compress_ptr) {
+    }
+
+    void set_span_dest(j_compress_ptr cinfo, SpanDestination* destination) {
+      destination->pub.init_destination = init_span_dest;
+      destination->pub.empty_output_buffer = empty_span_dest;
+      destination->pub.term_destination = term_span_dest;
+      cinfo->dest = &destination->pub;
+    }
+  } // namespace
+
+  namespace {
+    bool is_jpeg_name(const fs::path& path) {
+      auto iter = Reader::image_type_map.find(Reader::get_file_type(path.string()));
+      return iter != Reader::image_type_map.end() && iter->second == Reader::ImageType::JPEG;
+    }
+  } // namespace
+
+  bool is_jpeg_crop(const fs::path& image_path, const fs::path& output_path) {
+    return is_jpeg_name(image_path) && is_jpeg_name(output_path);
+  }
+
+  bool is_jpeg_crop(const Reader::ImageInfo& info, const fs::path& output_path) {
+    return info.type == Reader::ImageType::JPEG && is_jpeg_name(output_path);
+  }
+
+  // Get the stored-frame square region of a JPEG with its top-left corner snapped down to the MCU grid
+  cv::Rect get_jpeg_square_region(int width, int height, int mcu_width, int mcu_height, const PivotRect& pivot_rect, int orientation) {
+    cv::Size size = get_oriented_size(width, height, orientation);
+    cv::Rect region = to_stored_region(get_square_region(size.width, size.height, pivot_rect), width, height, orientation);
+    region.x -= region.x % mcu_width;
+    region.y -= region.y % mcu_height;
+    return region;
+  }
+
+  // Crop a JPEG square losslessly by copying its DCT coefficients
+  bool crop_square_jpeg(const fs::path& image_path, const PivotRect& pivot_rect, const fs::path& output_path, EncodeProfile profile) {
+    std::optional<Reader::ImageInfo> info = Reader::probe_image(image_path.string());
+    if (!info) {
+      std::cerr << "Failed to crop JPEG losslessly: " << image_path << std::endl;
+      return false;
+    }
+    return crop_square_jpeg(image_path, *info, pivot_rect, output_path, profile);
+  }
+
+  // Crop a JPEG square losslessly, with its header already probed
+  bool crop_square_jpeg(const fs::path& image_path, const Reader::ImageInfo& info, const PivotRect& pivot_rect,
+    const fs::path& output_path, EncodeProfile profile) {
+    Metrics::ScopedTimer timer(Metrics::Stage::JPEG_CROP);
+    FILE* input = std::fopen(image_path.c_str(), "rb");
+    if (input == nullptr) {
+      std::cerr << "Failed to read image file: " << image_path << std::endl;
+      return false;
+    }
+    // Written beside the output and renamed over it, so cropping a file onto itself reads it whole
+    // first and a failed crop leaves whatever was at output_path alone
+    fs::create_directories(output_path.parent_path());
+    fs::path temporary = get_temporary_path(output_path);
+    FILE* output = std::fopen(temporary.c_str(), "wb");
+    if (output == nullptr) {
+      std::fclose(input);
+      std::cerr << "Failed to write image file: " << output_path << std::endl;
+      return false;
+    }
+
+    PivotRect resolved = resolve_auto_pivot(image_path, info, pivot_rect);
+    bool success = crop_jpeg(resolved, info.orientation, profile, [&](j_decompress_ptr src, j_compress_ptr dst) {
+      jpeg_stdio_src(src, input);
+      jpeg_stdio_dest(dst, output);
+    });
+    long bytes_read = std::ftell(input);
+    long bytes_written = std::ftell(output);
+    std::fclose(input);
+    success = std::fclose(output) == 0 && success;
+    std::error_code error;
+    if (success)
+      fs::rename(temporary, output_path, error);
+
+    if (!success || error) {
+      std::cerr << "Failed to crop JPEG losslessly: " << image_path << std::endl;
+      std::error_code ignored;
+      fs::remove(temporary, ignored);
+      return false;
+    }
+    Metrics::add(Metrics::Counter::BYTES_READ, std::uint64_t(std::max(0L, bytes_read)));
+    Metrics::add(Metrics::Counter::BYTES_WRITTEN, std::uint64_t(std::max(0L, bytes_written)));
+    return true;
+  }
+
+  // Crop a JPEG held in memory losslessly
+  Result<std::vector<uchar>> crop_square_jpeg(std::span<const std::byte> image, const PivotRect& pivot_rect, EncodeProfile profile) {
+    std::optional<Reader::ImageInfo> info = Reader::probe_image(image);
+    if (!info) {
+      std::cerr << "Failed to crop JPEG losslessly from memory" << std::endl;
+      return Result(std::vector<uchar>(), Status::FAILURE);
+    }
+    return crop_square_jpeg(image, *info, pivot_rect, profile);
+  }
+
+  // Crop a JPEG held in memory losslessly, with its header already probed
+  Result<std::vector<uchar>> crop_square_jpeg(std::span<const std::byte> image, const Reader::ImageInfo& info,
+    const PivotRect& pivot_rect, EncodeProfile profile) {
+    Metrics::ScopedTimer timer(Metrics::Stage::JPEG_CROP);
+    std::vector<uchar> output;
+    VectorDestination destination;
+    destination.buffer = &output;
+    // The square is never bigger than the whole image, so this is usually the only allocation
+    destination.initial_size = std::max<std::size_t>(image.size(), 4096);
+
+    // AUTO pivots are placed by a 1/8 scale preview, which the DCT decodes for a fraction of the crop
+    PivotRect resolved = resolve_auto_pivot(image, info, pivot_rect);
+    bool success = crop_jpeg(resolved, info.orientation, profile, [&](j_decompress_ptr src, j_compress_ptr dst) {
+      jpeg_mem_src(src, reinterpret_cast<const unsigned char*>(image.data()), static_cast<unsigned long>(image.size()));
+      set_vector_dest(dst, &destination);
+    });
+    if (!success) {
+      std::cerr << "Failed to crop JPEG losslessly from memory" << std::endl;
+      return Result(std::vector<uchar>(), Status::FAILURE);
+    }
+    Metrics::add(Metrics::Counter::BYTES_READ, image.size());
+    Metrics::add(Metrics::Counter::BYTES_WRITTEN, output.size());
+    return Result(std::move(output), Status::SUCCESS);
+  }
+
+  // Crop a JPEG held in memory losslessly straight into a caller-provided buffer
+  Result<std::size_t> crop_square_jpeg(std::span<const std::byte> image, const Reader::ImageInfo& info,
+    const PivotRect& pivot_rect, std::span<std::byte> output, EncodeProfile profile) {
+    Metrics::ScopedTimer timer(Metrics::Stage::JPEG_CROP);
+    SpanDestination destination;
+    destination.output = output;
+
+    PivotRect resolved = resolve_auto_pivot(image, info, pivot_rect);
+    bool success = crop_jpeg(resolved, info.orientation, profile, [&](j_decompress_ptr src, j_compress_ptr dst) {
+      jpeg_mem_src(src, reinterpret_cast<const unsigned char*>(image.data()), static_cast<unsigned long>(image.size()));
+      set_span_dest(dst, &destination);
+    });
+    if (!success) {
+      std::cerr << "Failed to crop JPEG losslessly from memory" << std::endl;
+      return Result(std::size_t(0), Status::FAILURE);
+    }
+    // Too small is not an error worth logging, the caller can retry with the size returned. libjpeg
+    // empties a buffer as soon as it is full, so an exact fit also ends in spill, without bytes in it.
+    if (destination.size() > output.size())
+      return Result(destination.size(), Status::FAILURE);
+    Metrics::add(Metrics::Counter::BYTES_READ, image.size());
+    Metrics::add(Metrics::Counter::BYTES_WRITTEN, destination.size());
+    return Result(destination.size(), Status::SUCCESS);
+  }
+
+} // namespace ImageEditor
@@ -0,0 +1,330 @@
+#include "include/manifest.hpp"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+namespace Manifest {
+  namespace fs = std::filesystem;
+  using std::uint32_t;
+  using std::uint64_t;
+  using std::int64_t;
+
+  namespace {
+    constexpr char MAGIC[4] = { 'C', 'E', 'M', 'F' };
+    constexpr uint32_t VERSION = 2;
+    constexpr uint64_t FNV_OFFSET_BASIS = 0xcbf29ce484222325ull;
+
+    struct Header {
+      char magic[4];
+      uint32_t version;
+      uint64_t record_count;
+      uint64_t strings_size;
+    };
+
+    bool stat_file(const fs::path& path, uint64_t& size, int64_t& mtime) {
+      std::error_code error;
+      size = fs::file_size(path, error);
+      if (error)
+        return false;
+      mtime = fs::last_write_time(path, error).time_since_epoch().count();
+      return !error;
+    }
+
+    bool same_pivot(const PivotRect& a, const PivotRect& b) {
+      return a.horizontal_pivot == b.horizontal_pivot && a.vertical_pivot == b.vertical_pivot;
+    }
+
+    // Write all of data, retrying short writes and interrupted calls
+    bool write_all(int fd, const void* data, std::size_t size) {
+      const char* cursor = static_cast<const char*>(data);
+      while (size > 0) {
+        ssize_t written = ::write(fd, cursor, size);
+        if (written < 0 && errno == EINTR)
+          continue;
+        if (written <= 0)
+          return false;
+        cursor += written;
+        size -= std::size_t(written);
+      }
+      return true;
+    }
+
+    // Continue a 64-bit FNV-1a hash over size more bytes
+    uint64_t fnv1a(uint64_t hash, const unsigned char* data, std::size_t size) {
+      for (std::size_t i = 0; i < size; i++) {
+        hash ^= data[i];
+        hash *= 0x100000001b3ull;
+      }
+      return hash;
+    }
+  } // namespace
+
+  // One entry of the on-disk table. Paths live in the string table after the records.
+  struct Index::Record {
+    uint64_t input_offset;
+    uint64_t output_offset;
+    uint32_t input_length;
+    uint32_t output_length;
+    uint64_t size;
+    int64_t mtime;
+    uint64_t hash;
+    char horizontal_pivot;
+    char vertical_pivot;
+    char profile;
+    char padding[5];
+  };
+
+  // Hash the content of a file with 64-bit FNV-1a
+  uint64_t hash_file(const fs::path& path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+      return 0;
+    uint64_t hash = FNV_OFFSET_BASIS;
+    std::vector<unsigned char> buffer(1 << 16);
+    ssize_t count;
+    while ((count = ::read(fd, buffer.data(), buffer.size())) > 0)
+      hash = fnv1a(hash, buffer.data(), std::size_t(count));
+    ::close(fd);
+    return count < 0 ? 0 : hash;
+  }
+
+  // Hash bytes held in memory with 64-bit FNV-1a
+  uint64_t hash_bytes(std::span<const std::byte> bytes) {
+    return fnv1a(FNV_OFFSET_BASIS, reinterpret_cast<const unsigned char*>(bytes.data()), bytes.size());
+  }
+
+  Index::~Index() {
+    unmap();
+  }
+
+  void Index::unmap() {
+    if (mapping != nullptr)
+      ::munmap(const_cast<std::byte*>(mapping), mapping_size);
+    mapping = nullptr;
+    mapping_size = 0;
+    records = nullptr;
+    record_count = 0;
+    strings = nullptr;
+    strings_size = 0;
+  }
+
+  // Map the manifest at path
+  bool Index::load(const fs::path& path) {
+    std::lock_guard<std::mutex> lock(mutex);
+    unmap();
+    updates.clear();
+
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+      return errno == ENOENT;
+    struct stat info;
+    if (::fstat(fd, &info) != 0 || std::size_t(info.st_size) < sizeof(Header)) {
+      ::close(fd);
+      std::cerr << "Invalid manifest file: " << path << std::endl;
+      return false;
+    }
+    void* address = ::mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (address == MAP_FAILED) {
+      std::cerr << "Failed to map manifest file: " << path << std::endl;
+      return false;
+    }
+    mapping = static_cast<const std::byte*>(address);
+    mapping_size = info.st_size;
+
+    Header header;
+    std::memcpy(&header, mapping, sizeof(header));
+    bool valid = std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) == 0 && header.version == VERSION
+      && header.record_count <= (mapping_size - sizeof(Header)) / sizeof(Record)
+      && sizeof(Header) + header.record_count * sizeof(Record) + header.strings_size == mapping_size;
+    if (!valid) {
+      unmap();
+      std::cerr << "Invalid manifest file: " << path << std::endl;
+      return false;
+    }
+    records = reinterpret_cast<const Record*>(mapping + sizeof(Header));
+    record_count = header.record_count;
+    strings = reinterpret_cast<const char*>(records + record_count);
+    strings_size = header.strings_size;
+    return true;
+  }
+
+  std::string_view Index::string_at(uint64_t offset, uint32_t length) const {
+    if (offset > strings_size || strings_size - offset < length)
+      return std::string_view();
+    return std::string_view(strings + offset, length);
+  }
+
+  Entry Index::entry_at(std::size_t index) const {
+    const Record& record = records[index];
+    PivotRect pivot_rect(ImageEditor::char_to_horizontal_pivot(record.horizontal_pivot),
+      ImageEditor::char_to_vertical_pivot(record.vertical_pivot));
+    return Entry{ fs::path(string_at(record.input_offset, record.input_length)), record.size, record.mtime,
+      record.hash, pivot_rect, EncodeProfile(record.profile),
+      fs::path(string_at(record.output_offset, record.output_length)) };
+  }
+
+  // Binary search the mapped records, which are sorted by input path
+  std::optional<Entry> Index::find_mapped(std::string_view input) const {
+    std::size_t low = 0, high = record_count;
+    while (low < high) {
+      std::size_t middle = low + (high - low) / 2;
+      std::string_view key = string_at(records[middle].input_offset, records[middle].input_length);
+      if (key < input)
+        low = middle + 1;
+      else if (input < key)
+        high = middle;
+      else
+        return entry_at(middle);
+    }
+    return std::nullopt;
+  }
+
+  std::optional<Entry> Index::find_locked(const std::string& input) const {
+    auto iter = updates.find(input);
+    if (iter != updates.end())
+      return iter->second;
+    return find_mapped(input);
+  }
+
+  // Get the entry recorded for input, if any
+  std::optional<Entry> Index::find(const fs::path& input) const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return find_locked(input.string());
+  }
+
+  // Returns true if output was written from the current content of input with the same pivots and
+  // encode profile
+  bool Index::is_up_to_date(const fs::path& input, const PivotRect& pivot_rect, const fs::path& output,
+    EncodeProfile profile) {
+    std::optional<Entry> entry = find(input);
+    if (!entry || entry->output != output || !same_pivot(entry->pivot_rect, pivot_rect) || entry->profile != profile)
+      return false;
+    std::error_code error;
+    if (!fs::exists(output, error))
+      return false;
+
+    uint64_t size;
+    int64_t mtime;
+    if (!stat_file(input, size, mtime) || size != entry->size)
+      return false;
+    if (mtime == entry->mtime)
+      return true;
+
+    // Touched but maybe not modified, let the content decide
+    uint64_t hash = hash_file(input);
+    if (hash == 0 || hash != entry->hash)
+      return false;
+    entry->mtime = mtime;
+    std::lock_guard<std::mutex> lock(mutex);
+    updates[input.string()] = *entry;
+    return true;
+  }
+
+  // Record that output was written from input with the given pivots and encode profile
+  bool Index::record(const fs::path& input, const PivotRect& pivot_rect, const fs::path& output,
+    EncodeProfile profile) {
+    return record(input, pivot_rect, output, profile, hash_file(input));
+  }
+
+  // Record with a hash computed by the caller
+  bool Index::record(const fs::path& input, const PivotRect& pivot_rect, const fs::path& output,
+    EncodeProfile profile, uint64_t hash) {
+    uint64_t size;
+    int64_t mtime;
+    if (hash == 0 || !stat_file(input, size, mtime))
+      return false;
+    std::lock_guard<std::mutex> lock(mutex);
+    updates[input.string()] = Entry{ input, size, mtime, hash, pivot_rect, profile, output };
+    return true;
+  }
+
+  std::size_t Index::size() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::size_t count = record_count;
+    for (const auto& [input, entry] : updates) {
+      if (!find_mapped(input))
+        count++;
+    }
+    return count;
+  }
+
+  // Write all entries to path, replacing it atomically
+  bool Index::save(const fs::path& path) {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::vector<Record> table;
+    std::string string_table;
+
+    auto add = [&](const Entry& entry) {
+      std::string input = entry.input.string();
+      std::string output = entry.output.string();
+      Record record{};
+      record.input_offset = string_table.size();
+      record.input_length = uint32_t(input.size());
+      string_table += input;
+      record.output_offset = string_table.size();
+      record.output_length = uint32_t(output.size());
+      string_table += output;
+      record.size = entry.size;
+      record.mtime = entry.mtime;
+      record.hash = entry.hash;
+      record.horizontal_pivot = static_cast<char>(entry.pivot_rect.horizontal_pivot);
+      record.vertical_pivot = static_cast<char>(entry.pivot_rect.vertical_pivot);
+      record.profile = static_cast<char>(entry.profile);
+      table.push_back(record);
+    };
+
+    // Merge the sorted mapped records with the sorted updates, updates win on equal paths
+    std::size_t index = 0;
+    auto update = updates.begin();
+    while (index < record_count || update != updates.end()) {
+      std::string_view mapped_input;
+      if (index < record_count)
+        mapped_input = string_at(records[index].input_offset, records[index].input_length);
+      if (update != updates.end() && (index == record_count || update->first <= mapped_input)) {
+        if (index < record_count && update->first == mapped_input)
+          index++;
+        add(update->second);
+        ++update;
+      }
+      else {
+        add(entry_at(index));
+        index++;
+      }
+    }
+
+    fs::path temporary = path;
+    temporary += ".tmp";
+    Header header{};
+    std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION;
+    header.record_count = table.size();
+    header.strings_size = string_table.size();
+    // Errors of the last writes may only show at fsync or close (a full disk, NFS), and the file has
+    // to be on disk before the rename makes it the manifest
+    int fd = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    bool written = fd >= 0 && write_all(fd, &header, sizeof(header))
+      && write_all(fd, table.data(), table.size() * sizeof(Record))
+      && write_all(fd, string_table.data(), string_table.size())
+      && ::fsync(fd) == 0;
+    written = fd >= 0 && ::close(fd) == 0 && written;
+    if (!written) {
+      std::cerr << "Failed to write manifest file: " << temporary << ": " << std::strerror(errno) << std::endl;
+      ::unlink(temporary.c_str());
+      return false;
+    }
+    std::error_code error;
+    fs::rename(temporary, path, error);
+    if (error) {
+      std::cerr << "Failed to write manifest file: " << path << ": " << error.message() << std::endl;
+      return false;
+    }
+    return true;
+  }
+
+} // namespace Manifest
@@ -0,0 +1,107 @@
+#include "include/mat_pool.hpp"
+#include <new>
+
+namespace ImageEditor {
+
+  MatPool::MatPool(std::size_t max_cached_bytes): max_cached_bytes(max_cached_bytes) {}
+
+  MatPool::~MatPool() {
+    trim();
+    for (void* header : headers)
+      ::operator delete(header);
+  }
+
+  // Round up to a page so sizes that differ by a few bytes share buffers
+  std::size_t MatPool::capacity_for(std::size_t size) {
+    constexpr std::size_t PAGE = 4096;
+    return (size + PAGE - 1) / PAGE * PAGE;
+  }
+
+  // Same layout as OpenCV's standard allocator: continuous rows, steps from the innermost dimension out
+  cv::UMatData* MatPool::allocate(int dims, const int* sizes, int type, void* data, size_t* step,
+    cv::AccessFlag flags, cv::UMatUsageFlags usage_flags) const {
+    if (data != nullptr)
+      return cv::Mat::getStdAllocator()->allocate(dims, sizes, type, data, step, flags, usage_flags);
+
+    std::size_t total = CV_ELEM_SIZE(type);
+    for (int i = dims - 1; i >= 0; i--) {
+      if (step != nullptr)
+        step[i] = total;
+      total *= sizes[i];
+    }
+    std::size_t capacity = capacity_for(total);
+
+    void* buffer = nullptr;
+    void* header = nullptr;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      counters.allocations++;
+      auto iter = buffers.find(capacity);
+      // Empty lists are kept, so a steady state does not allocate map nodes either
+      if (iter != buffers.end() && !iter->second.empty()) {
+        buffer = iter->second.back();
+        iter->second.pop_back();
+        counters.reused++;
+        counters.cached_bytes -= capacity;
+      }
+      if (!headers.empty()) {
+        header = headers.back();
+        headers.pop_back();
+      }
+      counters.in_use_bytes += capacity;
+    }
+    if (buffer == nullptr)
+      buffer = cv::fastMalloc(capacity);
+    if (header == nullptr)
+      header = ::operator new(sizeof(cv::UMatData));
+
+    cv::UMatData* u = new (header) cv::UMatData(this);
+    u->data = u->origdata = static_cast<uchar*>(buffer);
+    u->size = total;
+    return u;
+  }
+
+  bool MatPool::allocate(cv::UMatData* data, cv::AccessFlag, cv::UMatUsageFlags) const {
+    return data != nullptr;
+  }
+
+  void MatPool::deallocate(cv::UMatData* data) const {
+    if (data == nullptr)
+      return;
+    void* buffer = data->origdata;
+    std::size_t capacity = capacity_for(data->size);
+    data->~UMatData();
+
+    bool cached = false;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      counters.in_use_bytes -= capacity;
+      if (counters.cached_bytes + capacity <= max_cached_bytes) {
+        buffers[capacity].push_back(buffer);
+        counters.cached_bytes += capacity;
+        cached = true;
+      }
+      headers.push_back(data);
+    }
+    if (!cached)
+      cv::fastFree(buffer);
+  }
+
+  MatPool::Stats MatPool::stats() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return counters;
+  }
+
+  // Free every cached buffer
+  void MatPool::trim() {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto& [capacity, list] : buffers) {
+      for (void* buffer : list)
+        cv::fastFree(buffer);
+      list.clear();
+    }
+    buffers.clear();
+    counters.cached_bytes = 0;
+  }
+
+} // namespace ImageEditor
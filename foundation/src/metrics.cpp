@@ -0,0 +1,223 @@
+#include "include/metrics.hpp"
+#include "include/reader.hpp"
+#include <bit>
+#include <cmath>
+#include <iomanip>
+#include <limits>
+#include <sstream>
+
+namespace Metrics {
+  namespace fs = std::filesystem;
+  using std::uint64_t;
+
+  namespace {
+    // One slot per Reader::ImageType and a last one for everything else
+    constexpr int FORMATS = 7;
+    constexpr const char* FORMAT_NAMES[FORMATS] = { "bmp", "gif", "jpeg", "png", "tiff", "webp", "other" };
+    constexpr const char* COUNTER_NAMES[] = { "bytes_read", "bytes_written", "pixels_processed", "files_scanned" };
+
+    struct Registry {
+      std::atomic<bool> enabled{ true };
+      std::array<Histogram, std::size_t(Stage::COUNT)> histograms;
+      std::array<std::atomic<uint64_t>, std::size_t(Counter::COUNT)> counters{};
+      std::array<std::atomic<uint64_t>, FORMATS> failures{};
+    };
+
+    Registry& registry() {
+      static Registry instance;
+      return instance;
+    }
+
+    int format_index(const fs::path& path) {
+      auto iter = Reader::image_type_map.find(Reader::get_file_type(path.filename().string()));
+      return iter == Reader::image_type_map.end() ? FORMATS - 1 : int(iter->second);
+    }
+
+    std::string format_number(double number) {
+      if (std::isinf(number))
+        return "+Inf";
+      std::ostringstream stream;
+      stream << std::setprecision(9) << number;
+      return stream.str();
+    }
+  } // namespace
+
+  const char* stage_name(Stage stage) {
+    switch (stage) {
+    case Stage::SCAN: return "scan";
+    case Stage::DECODE: return "decode";
+    case Stage::CROP: return "crop";
+    case Stage::ENCODE: return "encode";
+    case Stage::JPEG_CROP: return "jpeg_crop";
+    case Stage::STREAM_CROP: return "stream_crop";
+    case Stage::COLOR: return "color";
+    case Stage::SERVE: return "serve";
+    default: return "unknown";
+    }
+  }
+
+  void Histogram::record(std::chrono::nanoseconds duration) {
+    uint64_t nanoseconds = duration.count() > 0 ? uint64_t(duration.count()) : 0;
+    // Smallest i with 2^i microseconds >= the duration
+    uint64_t microseconds = (nanoseconds + 999) / 1000;
+    int index = microseconds <= 1 ? 0 : int(std::bit_width(microseconds - 1));
+    if (index >= BUCKETS)
+      index = BUCKETS - 1;
+    buckets[index].fetch_add(1, std::memory_order_relaxed);
+    total.fetch_add(1, std::memory_order_relaxed);
+    sum_nanoseconds.fetch_add(nanoseconds, std::memory_order_relaxed);
+  }
+
+  void Histogram::reset() {
+    for (auto& bucket : buckets)
+      bucket.store(0, std::memory_order_relaxed);
+    total.store(0, std::memory_order_relaxed);
+    sum_nanoseconds.store(0, std::memory_order_relaxed);
+  }
+
+  uint64_t Histogram::count() const {
+    return total.load(std::memory_order_relaxed);
+  }
+
+  uint64_t Histogram::bucket(int index) const {
+    return buckets[index].load(std::memory_order_relaxed);
+  }
+
+  double Histogram::sum_seconds() const {
+    return double(sum_nanoseconds.load(std::memory_order_relaxed)) / 1e9;
+  }
+
+  double Histogram::upper_bound_seconds(int index) {
+    if (index >= BUCKETS - 1)
+      return std::numeric_limits<double>::infinity();
+    return std::ldexp(1e-6, index);
+  }
+
+  double Histogram::quantile_seconds(double q) const {
+    uint64_t samples = count();
+    if (samples == 0)
+      return 0;
+    uint64_t rank = uint64_t(std::ceil(q * double(samples)));
+    if (rank == 0)
+      rank = 1;
+    uint64_t seen = 0;
+    for (int i = 0; i < BUCKETS; i++) {
+      seen += bucket(i);
+      if (seen >= rank)
+        return upper_bound_seconds(i);
+    }
+    return upper_bound_seconds(BUCKETS - 1);
+  }
+
+  bool enabled() {
+    return registry().enabled.load(std::memory_order_relaxed);
+  }
+
+  void set_enabled(bool enabled) {
+    registry().enabled.store(enabled, std::memory_order_relaxed);
+  }
+
+  void record(Stage stage, std::chrono::nanoseconds duration) {
+    if (enabled())
+      registry().histograms[std::size_t(stage)].record(duration);
+  }
+
+  void add(Counter counter, uint64_t amount) {
+    if (enabled())
+      registry().counters[std::size_t(counter)].fetch_add(amount, std::memory_order_relaxed);
+  }
+
+  void add_failure(const fs::path& path) {
+    if (enabled())
+      registry().failures[format_index(path)].fetch_add(1, std::memory_order_relaxed);
+  }
+
+  const Histogram& histogram(Stage stage) {
+    return registry().histograms[std::size_t(stage)];
+  }
+
+  uint64_t value(Counter counter) {
+    return registry().counters[std::size_t(counter)].load(std::memory_order_relaxed);
+  }
+
+  uint64_t failures(const std::string& format) {
+    for (int i = 0; i < FORMATS; i++) {
+      if (format == FORMAT_NAMES[i])
+        return registry().failures[i].load(std::memory_order_relaxed);
+    }
+    return 0;
+  }
+
+  void reset() {
+    Registry& metrics = registry();
+    for (auto& histogram : metrics.histograms)
+      histogram.reset();
+    for (auto& counter : metrics.counters)
+      counter.store(0, std::memory_order_relaxed);
+    for (auto& failure : metrics.failures)
+      failure.store(0, std::memory_order_relaxed);
+  }
+
+  std::string to_json() {
+    std::ostringstream json;
+    json << "{\"stages\":{";
+    for (int s = 0; s < int(Stage::COUNT); s++) {
+      const Histogram& stage = histogram(Stage(s));
+      json << (s ? "," : "") << "\"" << stage_name(Stage(s)) << "\":{"
+        << "\"count\":" << stage.count()
+        << ",\"sum_seconds\":" << format_number(stage.sum_seconds())
+        << ",\"p50_seconds\":" << format_number(stage.quantile_seconds(0.5))
+        << ",\"p90_seconds\":" << format_number(stage.quantile_seconds(0.9))
+        << ",\"p99_seconds\":" << format_number(stage.quantile_seconds(0.99))
+        << ",\"buckets\":[";
+      for (int i = 0; i < Histogram::BUCKETS; i++)
+        json << (i ? "," : "") << stage.bucket(i);
+      json << "]}";
+    }
+    json << "},\"counters\":{";
+    for (int c = 0; c < int(Counter::COUNT); c++)
+      json << (c ? "," : "") << "\"" << COUNTER_NAMES[c] << "\":" << value(Counter(c));
+    json << "},\"failures\":{";
+    for (int f = 0; f < FORMATS; f++)
+      json << (f ? "," : "") << "\"" << FORMAT_NAMES[f] << "\":" << failures(FORMAT_NAMES[f]);
+    json << "}}";
+    return json.str();
+  }
+
+  std::string to_prometheus() {
+    std::ostringstream text;
+    text << "# HELP chromaedit_stage_duration_seconds Latency of each processing stage.\n"
+      << "# TYPE chromaedit_stage_duration_seconds histogram\n";
+    for (int s = 0; s < int(Stage::COUNT); s++) {
+      const Histogram& stage = histogram(Stage(s));
+      const char* name = stage_name(Stage(s));
+      uint64_t cumulative = 0;
+      for (int i = 0; i < Histogram::BUCKETS; i++) {
+        cumulative += stage.bucket(i);
+        text << "chromaedit_stage_duration_seconds_bucket{stage=\"" << name << "\",le=\""
+          << format_number(Histogram::upper_bound_seconds(i)) << "\"} " << cumulative << "\n";
+      }
+      text << "chromaedit_stage_duration_seconds_sum{stage=\"" << name << "\"} " << format_number(stage.sum_seconds()) << "\n"
+        << "chromaedit_stage_duration_seconds_count{stage=\"" << name << "\"} " << stage.count() << "\n";
+    }
+    for (int c = 0; c < int(Counter::COUNT); c++) {
+      text << "# TYPE chromaedit_" << COUNTER_NAMES[c] << "_total counter\n"
+        << "chromaedit_" << COUNTER_NAMES[c] << "_total " << value(Counter(c)) << "\n";
+    }
+    text << "# TYPE chromaedit_failures_total counter\n";
+    for (int f = 0; f < FORMATS; f++)
+      text << "chromaedit_failures_total{format=\"" << FORMAT_NAMES[f] << "\"} " << failures(FORMAT_NAMES[f]) << "\n";
+    return text.str();
+  }
+
+  ScopedTimer::ScopedTimer(Stage stage): stage(stage), active(enabled()) {
+    if (active)
+      start = std::chrono::steady_clock::now();
+  }
+
+  ScopedTimer::~ScopedTimer() {
+    if (active)
+      record(stage, std::chrono::steady_clock::now() - start);
+  }
+
+} // namespace Metrics
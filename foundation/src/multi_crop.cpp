@@ -0,0 +1,83 @@
+#include "include/multi_crop.hpp"
+#include "include/metrics.hpp"
+#include "include/orientation.hpp"
+#include "include/probe.hpp"
+#include <algorithm>
+#include <iostream>
+
+namespace ImageEditor {
+  namespace fs = std::filesystem;
+
+  ImagePyramid::ImagePyramid(cv::Mat image) {
+    levels.push_back(std::move(image));
+  }
+
+  // Level index, halving the last built level until it exists
+  const cv::Mat& ImagePyramid::level(int index) {
+    while (int(levels.size()) <= index) {
+      const cv::Mat& last = levels.back();
+      if (last.cols <= 1 && last.rows <= 1)
+        break;
+      cv::Mat half;
+      cv::resize(last, half, cv::Size((last.cols + 1) / 2, (last.rows + 1) / 2), 0, 0, cv::INTER_AREA);
+      levels.push_back(std::move(half));
+    }
+    return levels[std::min(index, int(levels.size()) - 1)];
+  }
+
+  // The region of level 0 scaled to size x size, starting from the smallest level that is large enough
+  cv::Mat ImagePyramid::scaled(const cv::Rect& region, int size) {
+    if (size <= 0 || (size == region.width && size == region.height))
+      return levels[0](region);
+
+    // Level k holds the region in about region.width >> k pixels
+    int index = 0;
+    while ((region.width >> (index + 1)) >= size && (region.height >> (index + 1)) >= size)
+      index++;
+    const cv::Mat& source = level(index);
+    cv::Rect scaled_region(region.x >> index, region.y >> index, std::max(1, region.width >> index), std::max(1, region.height >> index));
+    scaled_region &= cv::Rect(0, 0, source.cols, source.rows);
+
+    cv::Mat output;
+    int interpolation = size < scaled_region.width ? cv::INTER_AREA : cv::INTER_LINEAR;
+    cv::resize(source(scaled_region), output, cv::Size(size, size), 0, 0, interpolation);
+    return output;
+  }
+
+  int ImagePyramid::built_levels() const {
+    return int(levels.size());
+  }
+
+  // Decode image_path once and write one output per spec
+  std::vector<Status> crop_squares(const fs::path& image_path, const std::vector<OutputSpec>& specs) {
+    std::vector<Status> statuses(specs.size(), Status::FAILURE);
+    if (specs.empty())
+      return statuses;
+    // The pyramid is built over the stored frame and only the scaled squares are turned upright
+    std::optional<Reader::ImageInfo> info = Reader::probe_image(image_path.string());
+    int orientation = info ? info->orientation : 1;
+    Result<cv::Mat> image = read_stored_image(image_path, ReadMode::UNCHANGED);
+    if (image.status == Status::FAILURE)
+      return statuses;
+
+    ImagePyramid pyramid(image.data);
+    Workspace workspace;
+    for (std::size_t i = 0; i < specs.size(); i++) {
+      const OutputSpec& spec = specs[i];
+      cv::Mat output;
+      try {
+        Metrics::ScopedTimer timer(Metrics::Stage::CROP);
+        cv::Rect region = get_stored_square_region(image.data, orientation, spec.pivot_rect);
+        output = apply_orientation(pyramid.scaled(region, spec.size), orientation);
+      }
+      catch (const cv::Exception& e) {
+        std::cerr << "Failed to scale image file: " << image_path << ": " << e.what() << std::endl;
+        continue;
+      }
+      if (save_image(output, spec.output, workspace))
+        statuses[i] = Status::SUCCESS;
+    }
+    return statuses;
+  }
+
+} // namespace ImageEditor
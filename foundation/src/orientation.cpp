@@ -0,0 +1,82 @@
+#include "include/orientation.hpp"
+#include "include/auto_pivot.hpp"
+#include <algorithm>
+
+namespace ImageEditor {
+
+  namespace {
+    bool swaps_axes(int orientation) {
+      return orientation >= 5 && orientation <= 8;
+    }
+
+    // The orientation that turns the oriented frame back into the stored one: the two quarter
+    // turns undo each other, every other orientation undoes itself
+    int inverse_orientation(int orientation) {
+      return orientation == 6 ? 8 : orientation == 8 ? 6 : orientation;
+    }
+
+    // Map a pixel of the oriented frame of a width x height stored image into the stored frame
+    cv::Point to_stored_point(int x, int y, int width, int height, int orientation) {
+      switch (orientation) {
+      case 2: return cv::Point(width - 1 - x, y);
+      case 3: return cv::Point(width - 1 - x, height - 1 - y);
+      case 4: return cv::Point(x, height - 1 - y);
+      case 5: return cv::Point(y, x);
+      case 6: return cv::Point(y, height - 1 - x);
+      case 7: return cv::Point(width - 1 - y, height - 1 - x);
+      case 8: return cv::Point(width - 1 - y, x);
+      default: return cv::Point(x, y);
+      }
+    }
+  } // namespace
+
+  cv::Size get_oriented_size(int width, int height, int orientation) {
+    return swaps_axes(orientation) ? cv::Size(height, width) : cv::Size(width, height);
+  }
+
+  // Map a region of the oriented frame into the stored frame by two of its corners
+  cv::Rect to_stored_region(const cv::Rect& region, int width, int height, int orientation) {
+    if (region.width <= 0 || region.height <= 0)
+      return region;
+    cv::Point first = to_stored_point(region.x, region.y, width, height, orientation);
+    cv::Point last = to_stored_point(region.x + region.width - 1, region.y + region.height - 1, width, height, orientation);
+    int x = std::min(first.x, last.x);
+    int y = std::min(first.y, last.y);
+    return cv::Rect(x, y, std::max(first.x, last.x) - x + 1, std::max(first.y, last.y) - y + 1);
+  }
+
+  // The stored frame is the oriented frame of the oriented image under the inverse orientation
+  cv::Rect to_oriented_region(const cv::Rect& region, int width, int height, int orientation) {
+    cv::Size size = get_oriented_size(width, height, orientation);
+    return to_stored_region(region, size.width, size.height, inverse_orientation(orientation));
+  }
+
+  // Turn stored pixels upright with one flip, rotation or transposition
+  cv::Mat apply_orientation(const cv::Mat& image, int orientation) {
+    cv::Mat oriented;
+    switch (orientation) {
+    case 2: cv::flip(image, oriented, 1); break;
+    case 3: cv::rotate(image, oriented, cv::ROTATE_180); break;
+    case 4: cv::flip(image, oriented, 0); break;
+    case 5: cv::transpose(image, oriented); break;
+    case 6: cv::rotate(image, oriented, cv::ROTATE_90_CLOCKWISE); break;
+    case 7: {
+      cv::Mat transposed;
+      cv::transpose(image, transposed);
+      cv::flip(transposed, oriented, -1);
+      break;
+    }
+    case 8: cv::rotate(image, oriented, cv::ROTATE_90_COUNTERCLOCKWISE); break;
+    default: return image;
+    }
+    return oriented;
+  }
+
+  // Get the stored-frame region of the square selected in the oriented frame of stored
+  cv::Rect get_stored_square_region(const cv::Mat& stored, int orientation, const PivotRect& pivot_rect) {
+    cv::Size size = get_oriented_size(stored.cols, stored.rows, orientation);
+    PivotRect oriented_pivot = resolve_auto_pivot(stored, stored.cols, stored.rows, orientation, pivot_rect);
+    return to_stored_region(get_square_region(size.width, size.height, oriented_pivot), stored.cols, stored.rows, orientation);
+  }
+
+} // namespace ImageEditor
@@ -0,0 +1,172 @@
+#include "include/pipeline.hpp"
+#include "include/region_reader.hpp"
+#include <algorithm>
+#include <iostream>
+
+namespace ImageEditor {
+  namespace fs = std::filesystem;
+
+  namespace {
+    // Pixels per run of a row handed to the fused kernels. 4096 BGR pixels take 12 KiB, so a run
+    // stays in L1 from the first kernel to the last.
+    constexpr int RUN_PIXELS = 4096;
+
+    // Apply every kernel to every pixel of src in one pass, writing to dst (which may be src)
+    template <typename T, typename Kernel>
+    void apply_kernels(const cv::Mat& src, cv::Mat& dst, const std::vector<const Kernel*>& kernels) {
+      int channels = src.channels();
+      cv::parallel_for_(cv::Range(0, src.rows), [&](const cv::Range& rows) {
+        for (int y = rows.start; y < rows.end; y++) {
+          const T* src_row = src.ptr<T>(y);
+          T* dst_row = dst.ptr<T>(y);
+          for (int x = 0; x < src.cols; x += RUN_PIXELS) {
+            int pixels = std::min(RUN_PIXELS, src.cols - x);
+            std::size_t offset = std::size_t(x) * channels;
+            (*kernels[0])(src_row + offset, dst_row + offset, pixels, channels);
+            for (std::size_t k = 1; k < kernels.size(); k++)
+              (*kernels[k])(dst_row + offset, dst_row + offset, pixels, channels);
+          }
+        }
+      });
+    }
+
+    // Run the pending kernels over image, the 8-bit or the 16-bit ones depending on its depth.
+    // Pixels the pipeline owns are overwritten in place, anything else is copied once on the way
+    // through the kernels.
+    bool flush(cv::Mat& image, bool& owned, std::vector<const RowKernel*>& pending, std::vector<const RowKernel16*>& pending16) {
+      if (pending.empty())
+        return true;
+      auto has_kernel = [](const auto* kernel) { return bool(*kernel); };
+      int depth = image.depth();
+      if (!(depth == CV_8U && std::all_of(pending.begin(), pending.end(), has_kernel))
+        && !(depth == CV_16U && std::all_of(pending16.begin(), pending16.end(), has_kernel))) {
+        std::cerr << "Per-pixel operations are not supported for the depth of this image" << std::endl;
+        return false;
+      }
+      cv::Mat output = owned ? image : cv::Mat(image.size(), image.type());
+      if (depth == CV_8U)
+        apply_kernels<uchar>(image, output, pending);
+      else
+        apply_kernels<ushort>(image, output, pending16);
+      image = output;
+      owned = true;
+      pending.clear();
+      pending16.clear();
+      return true;
+    }
+  } // namespace
+
+  Pipeline::Pipeline(cv::Mat image): image(std::move(image)) {}
+
+  Pipeline::Pipeline(fs::path image_path, ReadMode mode): image_path(std::move(image_path)), mode(mode) {}
+
+  Pipeline& Pipeline::crop(const cv::Rect& region) {
+    nodes.push_back(Node{ Kind::CROP, region, PivotRect(), cv::Size(), 0, nullptr, nullptr });
+    return *this;
+  }
+
+  Pipeline& Pipeline::crop_square(const PivotRect& pivot_rect) {
+    nodes.push_back(Node{ Kind::CROP_SQUARE, cv::Rect(), pivot_rect, cv::Size(), 0, nullptr, nullptr });
+    return *this;
+  }
+
+  Pipeline& Pipeline::resize(cv::Size size, int interpolation) {
+    nodes.push_back(Node{ Kind::RESIZE, cv::Rect(), PivotRect(), size, interpolation, nullptr, nullptr });
+    return *this;
+  }
+
+  Pipeline& Pipeline::map(RowKernel kernel, RowKernel16 kernel16) {
+    nodes.push_back(Node{ Kind::MAP, cv::Rect(), PivotRect(), cv::Size(), 0, std::move(kernel), std::move(kernel16) });
+    return *this;
+  }
+
+  // Replace every sample value v with table[v]
+  Pipeline& Pipeline::lut(const std::array<uchar, 256>& table) {
+    return map([table](const uchar* src, uchar* dst, int pixels, int channels) {
+      std::size_t samples = std::size_t(pixels) * channels;
+      for (std::size_t i = 0; i < samples; i++)
+        dst[i] = table[src[i]];
+    });
+  }
+
+  // Grade 8 or 16-bit pixels, see ColorGrade
+  Pipeline& Pipeline::color(const ColorGrade& grade) {
+    if (grade.is_identity())
+      return *this;
+    return map(
+      [grade](const uchar* src, uchar* dst, int pixels, int channels) { grade.apply_row(src, dst, pixels, channels); },
+      [grade](const ushort* src, ushort* dst, int pixels, int channels) { grade.apply_row(src, dst, pixels, channels); });
+  }
+
+  // Decode the source. A leading crop of a file is left to the decoder, in which case first_node
+  // is moved past it.
+  Result<cv::Mat> Pipeline::read_source(std::size_t& first_node) const {
+    first_node = 0;
+    if (image_path.empty())
+      return Result(image, image.empty() ? Status::FAILURE : Status::SUCCESS);
+    if (!nodes.empty() && nodes[0].kind == Kind::CROP_SQUARE) {
+      first_node = 1;
+      return read_square(image_path, nodes[0].pivot_rect, mode);
+    }
+    if (!nodes.empty() && nodes[0].kind == Kind::CROP) {
+      first_node = 1;
+      return read_image_region(image_path, nodes[0].region, mode);
+    }
+    return read_image(image_path, mode);
+  }
+
+  // Evaluate the chain, fusing what can be fused
+  Result<cv::Mat> Pipeline::run() const {
+    std::size_t first_node = 0;
+    Result<cv::Mat> source = read_source(first_node);
+    if (source.status == Status::FAILURE)
+      return source;
+
+    cv::Mat current = std::move(source.data);
+    // Pixels decoded here belong to the pipeline, a caller's image must not be written to
+    bool owned = !image_path.empty();
+    std::vector<const RowKernel*> pending;
+    std::vector<const RowKernel16*> pending16;
+    try {
+      for (std::size_t i = first_node; i < nodes.size(); i++) {
+        const Node& node = nodes[i];
+        switch (node.kind) {
+        case Kind::CROP:
+          // Per-pixel operations commute with crops, so the pending ones only run on what is kept
+          if (!is_region_inside(node.region, current.cols, current.rows)) {
+            std::cerr << "Crop region is outside of the image" << std::endl;
+            return Result(cv::Mat(), Status::FAILURE);
+          }
+          current = current(node.region);
+          break;
+        case Kind::CROP_SQUARE:
+          current = current(get_square_region(current, node.pivot_rect));
+          break;
+        case Kind::MAP:
+          pending.push_back(&node.kernel);
+          pending16.push_back(&node.kernel16);
+          break;
+        case Kind::RESIZE: {
+          if (i + 1 < nodes.size() && nodes[i + 1].kind == Kind::RESIZE)
+            break;
+          if (!flush(current, owned, pending, pending16))
+            return Result(cv::Mat(), Status::FAILURE);
+          cv::Mat resized;
+          cv::resize(current, resized, node.size, 0, 0, node.interpolation);
+          current = resized;
+          owned = true;
+          break;
+        }
+        }
+      }
+      if (!flush(current, owned, pending, pending16))
+        return Result(cv::Mat(), Status::FAILURE);
+    }
+    catch (const cv::Exception& e) {
+      std::cerr << "Failed to run image pipeline: " << e.what() << std::endl;
+      return Result(cv::Mat(), Status::FAILURE);
+    }
+    return Result(std::move(current), Status::SUCCESS);
+  }
+
+} // namespace ImageEditor
@@ -0,0 +1,367 @@
+#include "include/probe.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace Reader {
+  using std::uint8_t;
+  using std::uint16_t;
+  using std::uint32_t;
+  using std::uint64_t;
+
+  namespace {
+    // Most headers fit in the first few KiB, so that much is read up front in one go
+    constexpr std::size_t HEAD_SIZE = 4096;
+
+    // Random access to the bytes of an encoded image
+    class ByteSource {
+    public:
+      virtual ~ByteSource() = default;
+
+      // Copy size bytes at offset into out. Returns false if they are not all available.
+      virtual bool read(uint64_t offset, void* out, std::size_t size) = 0;
+    };
+
+    class MemorySource: public ByteSource {
+    public:
+      explicit MemorySource(std::span<const std::byte> data): data(data) {}
+
+      bool read(uint64_t offset, void* out, std::size_t size) override {
+        if (offset > data.size() || data.size() - offset < size)
+          return false;
+        std::memcpy(out, data.data() + offset, size);
+        return true;
+      }
+
+    private:
+      std::span<const std::byte> data;
+    };
+
+    // Serves reads from the head of the file, read with a single pread, and only goes back to the
+    // file for headers that point further into it, such as TIFF IFDs or JPEG frames behind a large
+    // EXIF block. The head buffer is borrowed, so a batch of probes reuses one allocation.
+    class FileSource: public ByteSource {
+    public:
+      FileSource(int fd, std::vector<uint8_t>& head): fd(fd), head(head) {
+        head.resize(HEAD_SIZE);
+        ssize_t size = fd < 0 ? -1 : pread(fd, head.data(), head.size(), 0);
+        head.resize(size < 0 ? 0 : std::size_t(size));
+      }
+
+      ~FileSource() override {
+        if (fd >= 0)
+          close(fd);
+      }
+
+      FileSource(const FileSource&) = delete;
+      FileSource& operator=(const FileSource&) = delete;
+
+      bool is_open() const { return fd >= 0; }
+
+      bool read(uint64_t offset, void* out, std::size_t size) override {
+        if (offset + size <= head.size()) {
+          std::memcpy(out, head.data() + offset, size);
+          return true;
+        }
+        return pread(fd, out, size, off_t(offset)) == ssize_t(size);
+      }
+
+    private:
+      int fd;
+      std::vector<uint8_t>& head;
+    };
+
+    uint16_t u16le(const uint8_t* p) { return uint16_t(p[0] | p[1] << 8); }
+    uint16_t u16be(const uint8_t* p) { return uint16_t(p[0] << 8 | p[1]); }
+    uint32_t u24le(const uint8_t* p) { return uint32_t(p[0] | p[1] << 8 | p[2] << 16); }
+    uint32_t u32le(const uint8_t* p) { return uint32_t(p[0]) | uint32_t(p[1]) << 8 | uint32_t(p[2]) << 16 | uint32_t(p[3]) << 24; }
+    uint32_t u32be(const uint8_t* p) { return uint32_t(p[0]) << 24 | uint32_t(p[1]) << 16 | uint32_t(p[2]) << 8 | uint32_t(p[3]); }
+
+    std::optional<ImageInfo> probe_png(ByteSource& source) {
+      uint8_t header[26];
+      if (!source.read(0, header, sizeof(header)) || std::memcmp(header + 12, "IHDR", 4) != 0)
+        return std::nullopt;
+      int depth = header[24];
+      int channels;
+      switch (header[25]) {
+      case 0: channels = 1; break;  // Gray
+      case 2: channels = 3; break;  // RGB
+      case 3: channels = 3; depth = 8; break;  // Palette
+      case 4: channels = 2; break;  // Gray + alpha
+      case 6: channels = 4; break;  // RGBA
+      default: return std::nullopt;
+      }
+      return ImageInfo{ ImageType::PNG, int(u32be(header + 16)), int(u32be(header + 20)), channels, depth };
+    }
+
+    // Read the orientation tag from the first IFD of the TIFF structure of an EXIF block, size bytes
+    // at base. Returns 1 (as stored) when there is none.
+    int probe_exif_orientation(ByteSource& source, uint64_t base, uint64_t size) {
+      uint8_t header[8];
+      if (size < sizeof(header) || !source.read(base, header, sizeof(header)))
+        return 1;
+      bool little_endian = std::memcmp(header, "II*\0", 4) == 0;
+      if (!little_endian && std::memcmp(header, "MM\0*", 4) != 0)
+        return 1;
+      auto u16 = [little_endian](const uint8_t* p) { return little_endian ? u16le(p) : u16be(p); };
+      auto u32 = [little_endian](const uint8_t* p) { return little_endian ? u32le(p) : u32be(p); };
+
+      // Offsets are relative to the TIFF header and must stay inside the block
+      uint64_t ifd = u32(header + 4);
+      uint8_t count_bytes[2];
+      if (ifd + 2 > size || !source.read(base + ifd, count_bytes, 2))
+        return 1;
+      uint16_t count = u16(count_bytes);
+      for (uint16_t i = 0; i < count && i < 1024; i++) {
+        uint64_t entry_offset = ifd + 2 + 12 * uint64_t(i);
+        uint8_t entry[12];
+        if (entry_offset + sizeof(entry) > size || !source.read(base + entry_offset, entry, sizeof(entry)))
+          return 1;
+        if (u16(entry) == 0x0112 && u16(entry + 2) == 3) {  // Orientation, a SHORT
+          int orientation = u16(entry + 8);
+          return orientation >= 1 && orientation <= 8 ? orientation : 1;
+        }
+      }
+      return 1;
+    }
+
+    // Walk the marker segments until the start-of-frame that holds the dimensions, noting the
+    // orientation of an EXIF block on the way
+    std::optional<ImageInfo> probe_jpeg(ByteSource& source) {
+      int orientation = 1;
+      bool has_exif = false;
+      uint64_t offset = 2;
+      for (int segments = 0; segments < 1024; segments++) {
+        uint8_t marker[4];
+        if (!source.read(offset, marker, 2) || marker[0] != 0xFF)
+          return std::nullopt;
+        if (marker[1] == 0xFF) {  // Fill byte
+          offset++;
+          continue;
+        }
+        if (marker[1] == 0x01 || (marker[1] >= 0xD0 && marker[1] <= 0xD8)) {  // Standalone markers
+          offset += 2;
+          continue;
+        }
+        if (marker[1] == 0xD9 || marker[1] == 0xDA)  // End of image or start of scan before any frame
+          return std::nullopt;
+        if (!source.read(offset, marker, 4))
+          return std::nullopt;
+        bool is_frame = marker[1] >= 0xC0 && marker[1] <= 0xCF && marker[1] != 0xC4 && marker[1] != 0xC8 && marker[1] != 0xCC;
+        if (is_frame) {
+          uint8_t frame[6];
+          if (!source.read(offset + 4, frame, sizeof(frame)))
+            return std::nullopt;
+          ImageInfo info{ ImageType::JPEG, u16be(frame + 3), u16be(frame + 1), frame[5], frame[0] };
+          info.orientation = orientation;
+          return info;
+        }
+        uint16_t length = u16be(marker + 2);
+        // APP1 holds EXIF as "Exif\0\0" and a TIFF structure; only the first one counts
+        uint8_t identifier[6];
+        if (marker[1] == 0xE1 && !has_exif && length >= 2 + sizeof(identifier) + 8
+          && source.read(offset + 4, identifier, sizeof(identifier)) && std::memcmp(identifier, "Exif\0\0", 6) == 0) {
+          has_exif = true;
+          orientation = probe_exif_orientation(source, offset + 4 + sizeof(identifier), length - 2 - sizeof(identifier));
+        }
+        offset += 2 + length;
+      }
+      return std::nullopt;
+    }
+
+    std::optional<ImageInfo> probe_gif(ByteSource& source) {
+      uint8_t header[10];
+      if (!source.read(0, header, sizeof(header)))
+        return std::nullopt;
+      return ImageInfo{ ImageType::GIF, u16le(header + 6), u16le(header + 8), 3, 8 };
+    }
+
+    std::optional<ImageInfo> probe_bmp(ByteSource& source) {
+      uint8_t header[54];
+      if (!source.read(0, header, 26))
+        return std::nullopt;
+      uint32_t dib_size = u32le(header + 14);
+      int width, height, bits;
+      uint32_t colors = 0;
+      if (dib_size == 12) {  // BITMAPCOREHEADER
+        width = u16le(header + 18);
+        height = u16le(header + 20);
+        bits = u16le(header + 24);
+      }
+      else {
+        if (dib_size < 40 || !source.read(0, header, sizeof(header)))
+          return std::nullopt;
+        width = int32_t(u32le(header + 18));
+        height = int32_t(u32le(header + 22));
+        bits = u16le(header + 28);
+        colors = u32le(header + 46);
+      }
+      if (height < 0)  // Top-down bitmap
+        height = -height;
+
+      int channels = bits == 32 ? 4 : 3;
+      // Palette images whose palette is all gray decode to a single channel
+      if (bits <= 8 && dib_size != 12) {
+        uint32_t entries = colors ? std::min<uint32_t>(colors, 256) : 1u << bits;
+        std::vector<uint8_t> palette(entries * 4);
+        if (source.read(14 + dib_size, palette.data(), palette.size())) {
+          bool gray = true;
+          for (uint32_t i = 0; i < entries && gray; i++)
+            gray = palette[i * 4] == palette[i * 4 + 1] && palette[i * 4 + 1] == palette[i * 4 + 2];
+          if (gray)
+            channels = 1;
+        }
+      }
+      return ImageInfo{ ImageType::BMP, width, height, channels, 8 };
+    }
+
+    std::optional<ImageInfo> probe_webp(ByteSource& source) {
+      uint8_t header[30];
+      if (!source.read(0, header, sizeof(header)) || std::memcmp(header + 8, "WEBP", 4) != 0)
+        return std::nullopt;
+      if (std::memcmp(header + 12, "VP8 ", 4) == 0) {  // Lossy
+        if (header[23] != 0x9D || header[24] != 0x01 || header[25] != 0x2A)
+          return std::nullopt;
+        return ImageInfo{ ImageType::WEBP, u16le(header + 26) & 0x3FFF, u16le(header + 28) & 0x3FFF, 3, 8 };
+      }
+      if (std::memcmp(header + 12, "VP8L", 4) == 0) {  // Lossless
+        if (header[20] != 0x2F)
+          return std::nullopt;
+        uint32_t bits = u32le(header + 21);
+        int channels = (bits >> 28) & 1 ? 4 : 3;
+        return ImageInfo{ ImageType::WEBP, int(bits & 0x3FFF) + 1, int((bits >> 14) & 0x3FFF) + 1, channels, 8 };
+      }
+      if (std::memcmp(header + 12, "VP8X", 4) == 0) {  // Extended
+        int channels = header[20] & 0x10 ? 4 : 3;
+        return ImageInfo{ ImageType::WEBP, int(u24le(header + 24)) + 1, int(u24le(header + 27)) + 1, channels, 8 };
+      }
+      return std::nullopt;
+    }
+
+    // Read the tags of the first IFD
+    std::optional<ImageInfo> probe_tiff(ByteSource& source, bool little_endian) {
+      auto u16 = [little_endian](const uint8_t* p) { return little_endian ? u16le(p) : u16be(p); };
+      auto u32 = [little_endian](const uint8_t* p) { return little_endian ? u32le(p) : u32be(p); };
+
+      uint8_t header[8];
+      uint8_t count_bytes[2];
+      if (!source.read(0, header, sizeof(header)) || !source.read(u32(header + 4), count_bytes, 2))
+        return std::nullopt;
+      uint64_t ifd = u32(header + 4);
+      uint16_t count = u16(count_bytes);
+
+      int width = 0, height = 0, channels = 1, depth = 1;
+      for (uint16_t i = 0; i < count && i < 1024; i++) {
+        uint8_t entry[12];
+        if (!source.read(ifd + 2 + 12 * uint64_t(i), entry, sizeof(entry)))
+          return std::nullopt;
+        uint16_t tag = u16(entry);
+        uint16_t type = u16(entry + 2);
+        uint32_t values = u32(entry + 4);
+        // SHORT (3) values are left-aligned in the value field, LONG (4) fill it
+        uint32_t value = type == 3 ? u16(entry + 8) : u32(entry + 8);
+        switch (tag) {
+        case 256: width = int(value); break;
+        case 257: height = int(value); break;
+        case 258:
+          // More than two SHORTs don't fit in the field, which then holds their offset
+          if (type == 3 && values > 2) {
+            uint8_t first[2];
+            if (!source.read(u32(entry + 8), first, 2))
+              return std::nullopt;
+            value = u16(first);
+          }
+          depth = int(value);
+          break;
+        case 277: channels = int(value); break;
+        }
+      }
+      if (width <= 0 || height <= 0)
+        return std::nullopt;
+      return ImageInfo{ ImageType::TIFF, width, height, channels, depth };
+    }
+
+    std::optional<ImageInfo> probe(ByteSource& source) {
+      uint8_t magic[12];
+      if (!source.read(0, magic, sizeof(magic)))
+        return std::nullopt;
+
+      std::optional<ImageInfo> info;
+      if (std::memcmp(magic, "\x89PNG\r\n\x1A\n", 8) == 0)
+        info = probe_png(source);
+      else if (magic[0] == 0xFF && magic[1] == 0xD8 && magic[2] == 0xFF)
+        info = probe_jpeg(source);
+      else if (std::memcmp(magic, "GIF87a", 6) == 0 || std::memcmp(magic, "GIF89a", 6) == 0)
+        info = probe_gif(source);
+      else if (std::memcmp(magic, "BM", 2) == 0)
+        info = probe_bmp(source);
+      else if (std::memcmp(magic, "RIFF", 4) == 0)
+        info = probe_webp(source);
+      else if (std::memcmp(magic, "II*\0", 4) == 0)
+        info = probe_tiff(source, true);
+      else if (std::memcmp(magic, "MM\0*", 4) == 0)
+        info = probe_tiff(source, false);
+
+      if (info && (info->width <= 0 || info->height <= 0 || info->channels <= 0))
+        return std::nullopt;
+      return info;
+    }
+  } // namespace
+
+  std::optional<ImageInfo> probe_image(const string& path) {
+    std::vector<uint8_t> head;
+    FileSource source(open(path.c_str(), O_RDONLY | O_CLOEXEC), head);
+    if (!source.is_open())
+      return std::nullopt;
+    return probe(source);
+  }
+
+  std::optional<ImageInfo> probe_image(std::span<const std::byte> data) {
+    MemorySource source(data);
+    return probe(source);
+  }
+
+  // Probe many files, opening each relative to its directory and reading into one buffer
+  vector<std::optional<ImageInfo>> probe_images(const vector<fs::path>& paths) {
+    vector<std::optional<ImageInfo>> infos(paths.size());
+    std::vector<uint8_t> head;
+    fs::path directory;
+    int directory_fd = -1;
+    for (std::size_t i = 0; i < paths.size(); i++) {
+      // Runs of files from one directory share its descriptor, so their paths are not resolved again
+      if (directory_fd < 0 || paths[i].parent_path() != directory) {
+        if (directory_fd >= 0)
+          close(directory_fd);
+        directory = paths[i].parent_path();
+        directory_fd = open(directory.empty() ? "." : directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+      }
+      int fd = directory_fd >= 0
+        ? openat(directory_fd, paths[i].filename().c_str(), O_RDONLY | O_CLOEXEC)
+        : open(paths[i].c_str(), O_RDONLY | O_CLOEXEC);
+      FileSource source(fd, head);
+      if (source.is_open())
+        infos[i] = probe(source);
+    }
+    if (directory_fd >= 0)
+      close(directory_fd);
+    return infos;
+  }
+
+  // Walk like scan_image_files, identifying every regular file by its header
+  void probe_image_files(const string& path, const ProbedImageCallback& on_image, const ScanOptions& options) {
+    std::mutex callback_mutex;
+    walk_files(path, [&](const vector<fs::path>& files) {
+      // Headers are read by the walking thread, only the callbacks are serialized
+      vector<std::optional<ImageInfo>> infos = probe_images(files);
+      std::lock_guard<std::mutex> lock(callback_mutex);
+      for (std::size_t i = 0; i < files.size(); i++) {
+        if (infos[i])
+          on_image(files[i], *infos[i]);
+      }
+    }, options);
+  }
+} // namespace Reader
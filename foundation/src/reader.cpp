@@ -1,6 +1,10 @@
 #include "include/reader.hpp"
+#include "include/metrics.hpp"
+#include <algorithm>
+#include <condition_variable>
 #include <filesystem>
 #include <iostream>
+#include <mutex>
 #include <vector>
 
 namespace Reader {
@@ -9,15 +13,104 @@ namespace Reader {
   using std::vector;
 
   vector<fs::path> find_image_files(string path) {
+    Metrics::ScopedTimer timer(Metrics::Stage::SCAN);
     vector<fs::path> image_paths;
+    std::uint64_t scanned = 0;
     for (const auto& entry : fs::directory_iterator(path)) {
-      if (is_file_image(entry.path())) {
+      scanned++;
+      if (is_image_entry(entry)) {
         image_paths.push_back(entry.path());
       }
     }
+    Metrics::add(Metrics::Counter::FILES_SCANNED, scanned);
     return image_paths;
   }
 
+  namespace {
+    // Files handed over per call of a FilesCallback, so long directories are processed while they are read
+    constexpr std::size_t FILE_BATCH_SIZE = 64;
+  } // namespace
+
+  void scan_image_files(const string& path, const ImageCallback& on_image, const ScanOptions& options) {
+    std::mutex callback_mutex;
+    walk_files(path, [&](const vector<fs::path>& files) {
+      std::lock_guard<std::mutex> callback_lock(callback_mutex);
+      for (const auto& file : files) {
+        if (image_type_map.count(get_file_type(file.filename().string())))
+          on_image(file);
+      }
+    }, options);
+  }
+
+  void walk_files(const string& path, const FilesCallback& on_files, const ScanOptions& options) {
+    std::mutex mutex;
+    std::condition_variable has_work;
+    vector<fs::path> directories{ path };
+    unsigned busy = 0;  // Workers currently listing a directory
+
+    auto walk = [&]() {
+      std::unique_lock<std::mutex> lock(mutex);
+      while (true) {
+        // Finished once nothing is queued and nobody can queue more
+        has_work.wait(lock, [&] { return !directories.empty() || busy == 0; });
+        if (directories.empty())
+          break;
+        fs::path directory = std::move(directories.back());
+        directories.pop_back();
+        busy++;
+        lock.unlock();
+
+        vector<fs::path> subdirectories;
+        vector<fs::path> files;
+        {
+          Metrics::ScopedTimer timer(Metrics::Stage::SCAN);
+          std::uint64_t scanned = 0;
+          std::error_code error;
+          for (fs::directory_iterator iter(directory, fs::directory_options::skip_permission_denied, error), end;
+            !error && iter != end; iter.increment(error)) {
+            const fs::directory_entry& entry = *iter;
+            scanned++;
+            std::error_code ignored;
+            if (options.recursive && entry.is_directory(ignored) && !entry.is_symlink(ignored)) {
+              subdirectories.push_back(entry.path());
+            }
+            else if (entry.is_regular_file(ignored)) {
+              files.push_back(entry.path());
+              if (files.size() == FILE_BATCH_SIZE) {
+                on_files(files);
+                files.clear();
+              }
+            }
+          }
+          if (error)
+            std::cerr << "Failed to read directory: " << directory << ": " << error.message() << std::endl;
+          Metrics::add(Metrics::Counter::FILES_SCANNED, scanned);
+        }
+        if (!files.empty())
+          on_files(files);
+
+        lock.lock();
+        busy--;
+        for (auto& subdirectory : subdirectories)
+          directories.push_back(std::move(subdirectory));
+        has_work.notify_all();
+      }
+    };
+
+    unsigned threads = std::max(1u, options.recursive ? options.threads : 1u);
+    vector<std::thread> workers;
+    for (unsigned i = 1; i < threads; i++)
+      workers.emplace_back(walk);
+    walk();
+    for (auto& worker : workers)
+      worker.join();
+  }
+
+  bool is_image_entry(const fs::directory_entry& entry) {
+    std::error_code error;
+    return entry.is_regular_file(error) && image_type_map.count(get_file_type(entry.path().filename().string()));
+  }
+
   bool is_file_image(const string& path) {
     string file_type = get_file_type(path);
     bool file_exists = fs::exists(path);
@@ -36,6 +129,18 @@ namespace Reader {
     return file_type;
   }
 
+  string get_type_extension(ImageType type) {
+    switch (type) {
+    case ImageType::BMP: return "bmp";
+    case ImageType::GIF: return "gif";
+    case ImageType::JPEG: return "jpg";
+    case ImageType::PNG: return "png";
+    case ImageType::TIFF: return "tiff";
+    case ImageType::WEBP: return "webp";
+    }
+    return "";
+  }
+
   string get_file_name(const string& path) {
     bool file_exists = fs::exists(path);
     if (!file_exists) {
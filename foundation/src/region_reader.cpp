@@ -0,0 +1,306 @@
+#include "include/region_reader.hpp"
+#include "include/auto_pivot.hpp"
+#include "include/metrics.hpp"
+#include "include/orientation.hpp"
+#include "include/probe.hpp"
+#include <algorithm>
+#include <bit>
+#include <csetjmp>
+#include <cstdio>
+#include <iostream>
+#include <png.h>
+#include <vector>
+#ifdef CHROMAEDIT_HAVE_TIFF
+#include <tiffio.h>
+#endif
+
+namespace ImageEditor {
+  namespace fs = std::filesystem;
+
+  namespace {
+    void png_warning_silent(png_structp, png_const_charp) {}
+
+    // Decode rows [0, region.y + region.height) of a non-interlaced PNG into the layout of mode,
+    // keeping only the rows and columns inside region. Everything after the last needed row is never
+    // inflated. libpng reports errors with longjmp, so only trivially destructible locals may be
+    // created in here; image and row are owned by the caller.
+    bool decode_png_region(FILE* file, const cv::Rect& region, ReadMode mode, cv::Mat& image, std::vector<png_byte>& row) {
+      png_structp png = png_create_read_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, png_warning_silent);
+      if (png == nullptr)
+        return false;
+      png_infop info = png_create_info_struct(png);
+      if (info == nullptr || setjmp(png_jmpbuf(png))) {
+        png_destroy_read_struct(&png, &info, nullptr);
+        return false;
+      }
+
+      png_init_io(png, file);
+      png_read_info(png, info);
+      int width = int(png_get_image_width(png, info));
+      int height = int(png_get_image_height(png, info));
+      int bit_depth = png_get_bit_depth(png, info);
+      int color_type = png_get_color_type(png, info);
+      if (png_get_interlace_type(png, info) != PNG_INTERLACE_NONE || !is_region_inside(region, width, height)) {
+        png_destroy_read_struct(&png, &info, nullptr);
+        return false;
+      }
+
+      bool has_transparency = png_get_valid(png, info, PNG_INFO_tRNS) != 0;
+      if (color_type == PNG_COLOR_TYPE_PALETTE)
+        png_set_palette_to_rgb(png);
+      if (color_type == PNG_COLOR_TYPE_GRAY && bit_depth < 8)
+        png_set_expand_gray_1_2_4_to_8(png);
+      if (mode == ReadMode::COLOR) {
+        // The same conversions cv::imread applies for IMREAD_COLOR
+        if (bit_depth == 16)
+          png_set_strip_16(png);
+        // png_set_palette_to_rgb also turns a tRNS chunk into alpha, which is dropped here too
+        if ((color_type & PNG_COLOR_MASK_ALPHA) || has_transparency)
+          png_set_strip_alpha(png);
+        if (color_type == PNG_COLOR_TYPE_GRAY || color_type == PNG_COLOR_TYPE_GRAY_ALPHA)
+          png_set_gray_to_rgb(png);
+      }
+      else {
+        // The same conversions cv::imread applies for IMREAD_UNCHANGED: gray stays gray, alpha or a
+        // transparent color of a color image becomes a fourth channel, 16 bits stay 16 bits
+        if (color_type != PNG_COLOR_TYPE_GRAY && has_transparency)
+          png_set_tRNS_to_alpha(png);
+        if (color_type == PNG_COLOR_TYPE_GRAY_ALPHA)
+          png_set_gray_to_rgb(png);
+        if (bit_depth == 16) {
+          // PNG samples are big-endian, cv::Mat holds them in native order
+          if (std::endian::native == std::endian::little)
+            png_set_swap(png);
+        }
+      }
+      png_set_bgr(png);
+      png_read_update_info(png, info);
+
+      // The layout libpng settled on after the transformations above, like PngReader of stream_crop
+      int channels = png_get_channels(png, info);
+      int depth = png_get_bit_depth(png, info) == 16 ? CV_16U : CV_8U;
+      if (channels != 1 && channels != 3 && channels != 4) {
+        png_destroy_read_struct(&png, &info, nullptr);
+        return false;
+      }
+      std::size_t pixel_size = std::size_t(channels) * (depth == CV_16U ? 2 : 1);
+      row.resize(png_get_rowbytes(png, info));
+      image.create(region.height, region.width, CV_MAKETYPE(depth, channels));
+      for (int y = 0; y < region.y + region.height; y++) {
+        png_read_row(png, row.data(), nullptr);
+        if (y >= region.y)
+          std::copy_n(row.data() + region.x * pixel_size, region.width * pixel_size, image.ptr(y - region.y));
+      }
+      // Stop here, the rest of the stream is never read
+      png_destroy_read_struct(&png, &info, nullptr);
+      return true;
+    }
+
+    // The pixels and the row buffer come from workspace when there is one
+    Result<cv::Mat> read_png_region(const fs::path& image_path, const cv::Rect& region, ReadMode mode, Workspace* workspace) {
+      Metrics::ScopedTimer timer(Metrics::Stage::DECODE);
+      FILE* file = std::fopen(image_path.c_str(), "rb");
+      if (file == nullptr)
+        return Result(cv::Mat(), Status::FAILURE);
+      cv::Mat image;
+      std::vector<png_byte> local_row;
+      if (workspace != nullptr)
+        image.allocator = workspace->allocator;
+      bool success = decode_png_region(file, region, mode, image, workspace != nullptr ? workspace->buffer : local_row);
+      if (success) {
+        // Only the part of the stream up to the last needed row was read
+        long position = std::ftell(file);
+        Metrics::add(Metrics::Counter::BYTES_READ, position > 0 ? std::uint64_t(position) : 0);
+        Metrics::add(Metrics::Counter::PIXELS_PROCESSED, image.total());
+      }
+      std::fclose(file);
+      return Result(std::move(image), success ? Status::SUCCESS : Status::FAILURE);
+    }
+
+#ifdef CHROMAEDIT_HAVE_TIFF
+    // Copy the rows and columns of region out of an RGBA raster into BGR or gray pixels, following
+    // the channels of image. TIFFReadRGBA* rasters are stored bottom-up, so raster row
+    // (rows - 1 - i) holds image row top + i.
+    void copy_rgba(const uint32_t* raster, int stride, int rows, int left, int top, const cv::Rect& region, cv::Mat& image) {
+      int channels = image.channels();
+      int y_begin = std::max(top, region.y);
+      int y_end = std::min(top + rows, region.y + region.height);
+      int x_begin = std::max(left, region.x);
+      int x_end = std::min(left + stride, region.x + region.width);
+      for (int y = y_begin; y < y_end; y++) {
+        const uint32_t* src = raster + std::size_t(rows - 1 - (y - top)) * stride;
+        uchar* dst = image.ptr(y - region.y);
+        for (int x = x_begin; x < x_end; x++) {
+          uint32_t pixel = src[x - left];
+          uchar* out = dst + (x - region.x) * channels;
+          if (channels == 1) {
+            // Gray samples come back with R = G = B
+            out[0] = TIFFGetR(pixel);
+            continue;
+          }
+          out[0] = TIFFGetB(pixel);
+          out[1] = TIFFGetG(pixel);
+          out[2] = TIFFGetR(pixel);
+        }
+      }
+    }
+
+    // Decode only the strips or tiles of the first directory that intersect region. The RGBA
+    // interface yields 8-bit samples, so in UNCHANGED mode only 8-bit gray and RGB images without
+    // extra samples are handled here.
+    bool decode_tiff_region(TIFF* tiff, const cv::Rect& region, ReadMode mode, cv::Mat& image) {
+      uint32_t width = 0, height = 0;
+      uint16_t orientation = ORIENTATION_TOPLEFT;
+      TIFFGetField(tiff, TIFFTAG_IMAGEWIDTH, &width);
+      TIFFGetField(tiff, TIFFTAG_IMAGELENGTH, &height);
+      TIFFGetFieldDefaulted(tiff, TIFFTAG_ORIENTATION, &orientation);
+      // cv::imread rotates oriented TIFFs, leave those to the full decode
+      if (orientation != ORIENTATION_TOPLEFT || !is_region_inside(region, int(width), int(height)))
+        return false;
+
+      int channels = 3;
+      if (mode == ReadMode::UNCHANGED) {
+        uint16_t bits_per_sample = 1, samples_per_pixel = 1, photometric = PHOTOMETRIC_MINISBLACK;
+        TIFFGetFieldDefaulted(tiff, TIFFTAG_BITSPERSAMPLE, &bits_per_sample);
+        TIFFGetFieldDefaulted(tiff, TIFFTAG_SAMPLESPERPIXEL, &samples_per_pixel);
+        TIFFGetField(tiff, TIFFTAG_PHOTOMETRIC, &photometric);
+        if (bits_per_sample == 8 && samples_per_pixel == 1 && photometric == PHOTOMETRIC_MINISBLACK)
+          channels = 1;
+        else if (!(bits_per_sample == 8 && samples_per_pixel == 3 && photometric == PHOTOMETRIC_RGB))
+          return false;
+      }
+
+      image.create(region.height, region.width, CV_MAKETYPE(CV_8U, channels));
+      if (TIFFIsTiled(tiff)) {
+        uint32_t tile_width = 0, tile_height = 0;
+        TIFFGetField(tiff, TIFFTAG_TILEWIDTH, &tile_width);
+        TIFFGetField(tiff, TIFFTAG_TILELENGTH, &tile_height);
+        if (tile_width == 0 || tile_height == 0)
+          return false;
+        std::vector<uint32_t> raster(std::size_t(tile_width) * tile_height);
+        for (uint32_t y = region.y / tile_height * tile_height; y < uint32_t(region.y + region.height); y += tile_height) {
+          for (uint32_t x = region.x / tile_width * tile_width; x < uint32_t(region.x + region.width); x += tile_width) {
+            if (!TIFFReadRGBATile(tiff, x, y, raster.data()))
+              return false;
+            copy_rgba(raster.data(), int(tile_width), int(tile_height), int(x), int(y), region, image);
+          }
+        }
+        return true;
+      }
+
+      uint32_t rows_per_strip = height;
+      TIFFGetFieldDefaulted(tiff, TIFFTAG_ROWSPERSTRIP, &rows_per_strip);
+      rows_per_strip = std::min(rows_per_strip, height);
+      if (rows_per_strip == 0)
+        return false;
+      std::vector<uint32_t> raster(std::size_t(width) * rows_per_strip);
+      for (uint32_t y = region.y / rows_per_strip * rows_per_strip; y < uint32_t(region.y + region.height); y += rows_per_strip) {
+        if (!TIFFReadRGBAStrip(tiff, y, raster.data()))
+          return false;
+        // The last strip may be short, its rows start at the beginning of the raster
+        int rows = int(std::min(rows_per_strip, height - y));
+        copy_rgba(raster.data(), int(width), rows, 0, int(y), region, image);
+      }
+      return true;
+    }
+
+    Result<cv::Mat> read_tiff_region(const fs::path& image_path, const cv::Rect& region, ReadMode mode, Workspace* workspace) {
+      Metrics::ScopedTimer timer(Metrics::Stage::DECODE);
+      TIFFSetWarningHandler(nullptr);
+      TIFF* tiff = TIFFOpen(image_path.c_str(), "r");
+      if (tiff == nullptr)
+        return Result(cv::Mat(), Status::FAILURE);
+      cv::Mat image;
+      if (workspace != nullptr)
+        image.allocator = workspace->allocator;
+      bool success = decode_tiff_region(tiff, region, mode, image);
+      TIFFClose(tiff);
+      if (success)
+        Metrics::add(Metrics::Counter::PIXELS_PROCESSED, image.total());
+      return Result(std::move(image), success ? Status::SUCCESS : Status::FAILURE);
+    }
+#endif
+  } // namespace
+
+  bool is_region_inside(const cv::Rect& region, int width, int height) {
+    return region.width > 0 && region.height > 0 && region.x >= 0 && region.y >= 0
+      && region.x + region.width <= width && region.y + region.height <= height;
+  }
+
+  // Read only the given region of an image, using the header already probed from it and the
+  // buffers of workspace when there is one
+  static Result<cv::Mat> read_region(const fs::path& image_path, const std::optional<Reader::ImageInfo>& info, const cv::Rect& region,
+    ReadMode mode, Workspace* workspace) {
+    if (info && info->type == Reader::ImageType::PNG) {
+      Result<cv::Mat> image = read_png_region(image_path, region, mode, workspace);
+      if (image.status == Status::SUCCESS)
+        return image;
+    }
+#ifdef CHROMAEDIT_HAVE_TIFF
+    if (info && info->type == Reader::ImageType::TIFF) {
+      Result<cv::Mat> image = read_tiff_region(image_path, region, mode, workspace);
+      if (image.status == Status::SUCCESS)
+        return image;
+    }
+#endif
+
+    // No partial decoder for this file, decode all of it and take a view
+    Result<cv::Mat> image = workspace != nullptr ? read_image(image_path, *workspace, mode) : read_image(image_path, mode);
+    if (image.status == Status::FAILURE)
+      return image;
+    if (!is_region_inside(region, image.data.cols, image.data.rows)) {
+      std::cerr << "Region is outside of image file: " << image_path << std::endl;
+      return Result(cv::Mat(), Status::FAILURE);
+    }
+    return Result(image.data(region), Status::SUCCESS);
+  }
+
+  // Read only the given region of an image
+  Result<cv::Mat> read_image_region(const fs::path& image_path, const cv::Rect& region, ReadMode mode) {
+    return read_region(image_path, Reader::probe_image(image_path), region, mode, nullptr);
+  }
+
+  // Read the square of an image selected by pivot_rect, with the buffers of workspace when there is one
+  static Result<cv::Mat> read_square(const fs::path& image_path, const std::optional<Reader::ImageInfo>& info,
+    const PivotRect& pivot_rect, ReadMode mode, Workspace* workspace) {
+    // AUTO pivots are placed by the pixels, so those images are decoded whole and scored on a reduced copy
+    bool has_region_decoder = info && (info->type == Reader::ImageType::PNG || info->type == Reader::ImageType::TIFF)
+      && !is_auto_pivot(pivot_rect);
+    if (has_region_decoder)
+      return read_region(image_path, info, get_square_region(info->width, info->height, pivot_rect), mode, workspace);
+
+    // Only JPEG orientations are probed. Without a JPEG header the decoder turns the image upright
+    // itself, so measure the pixels.
+    if (!info || info->type != Reader::ImageType::JPEG) {
+      Result<cv::Mat> image = workspace != nullptr ? read_image(image_path, *workspace, mode) : read_image(image_path, mode);
+      if (image.status == Status::FAILURE)
+        return image;
+      return Result(image.data(get_square_region(image.data, pivot_rect)), Status::SUCCESS);
+    }
+
+    // A JPEG square is cut from the stored frame and only the square is turned upright, which is no
+    // copy at all for orientation 1
+    Result<cv::Mat> image = workspace != nullptr ? read_stored_image(image_path, *workspace, mode) : read_stored_image(image_path, mode);
+    if (image.status == Status::FAILURE)
+      return image;
+    cv::Mat square = image.data(get_stored_square_region(image.data, info->orientation, pivot_rect));
+    return Result(apply_orientation(square, info->orientation), Status::SUCCESS);
+  }
+
+  // Read the square of an image selected by pivot_rect
+  Result<cv::Mat> read_square(const fs::path& image_path, const PivotRect& pivot_rect, ReadMode mode) {
+    return read_square(image_path, Reader::probe_image(image_path), pivot_rect, mode, nullptr);
+  }
+
+  // Read the square of an image selected by pivot_rect, reusing the buffers of workspace
+  Result<cv::Mat> read_square(const fs::path& image_path, const PivotRect& pivot_rect, Workspace& workspace, ReadMode mode) {
+    return read_square(image_path, Reader::probe_image(image_path), pivot_rect, mode, &workspace);
+  }
+
+  // Read the square of an image selected by pivot_rect, with its header already probed
+  Result<cv::Mat> read_square(const fs::path& image_path, const Reader::ImageInfo& info, const PivotRect& pivot_rect,
+    Workspace& workspace, ReadMode mode) {
+    return read_square(image_path, std::optional<Reader::ImageInfo>(info), pivot_rect, mode, &workspace);
+  }
+
+} // namespace ImageEditor
@@ -0,0 +1,447 @@
+#include "include/server.hpp"
+#include "include/manifest.hpp"
+#include "include/pipeline.hpp"
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <poll.h>
+#include <sstream>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace Server {
+  namespace fs = std::filesystem;
+
+  namespace {
+    // Limits on what a client may send
+    constexpr std::size_t MAX_LINE = 4096;
+    constexpr std::size_t MAX_BODY = std::size_t(256) << 20;
+    constexpr int MAX_SIZE = 16384;
+
+    // Files whose hash is remembered, see CropService::hash_file
+    constexpr std::size_t FILE_HASH_ENTRIES = 65536;
+
+    // The result cache key: content, pivots, size and format
+    std::string result_key(std::uint64_t hash, const Request& request) {
+      std::string format = request.format.empty() || request.format.front() != '.' ? request.format : request.format.substr(1);
+      std::transform(format.begin(), format.end(), format.begin(), [](unsigned char c) { return char(std::tolower(c)); });
+      std::ostringstream key;
+      key << std::hex << hash << std::dec << '/' << char(request.pivot_rect.horizontal_pivot)
+        << char(request.pivot_rect.vertical_pivot) << '/' << request.size << '/' << format;
+      return key.str();
+    }
+
+    bool read_file(const fs::path& path, std::vector<uchar>& bytes) {
+      std::ifstream file(path, std::ios::binary | std::ios::ate);
+      if (!file)
+        return false;
+      bytes.resize(std::size_t(file.tellg()));
+      file.seekg(0);
+      return bool(file.read(reinterpret_cast<char*>(bytes.data()), std::streamsize(bytes.size())));
+    }
+
+    bool send_all(int fd, const void* data, std::size_t size) {
+      const char* cursor = static_cast<const char*>(data);
+      while (size > 0) {
+        // MSG_NOSIGNAL: a peer that hung up is an error here, not a SIGPIPE
+        ssize_t sent = ::send(fd, cursor, size, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR)
+          continue;
+        if (sent <= 0)
+          return false;
+        cursor += sent;
+        size -= std::size_t(sent);
+      }
+      return true;
+    }
+
+    // Read into buffer, returns false on end of stream or error
+    bool receive(int fd, std::vector<char>& buffer) {
+      char chunk[64 * 1024];
+      ssize_t received;
+      do {
+        received = ::recv(fd, chunk, sizeof(chunk), 0);
+      } while (received < 0 && errno == EINTR);
+      if (received <= 0)
+        return false;
+      buffer.insert(buffer.end(), chunk, chunk + received);
+      return true;
+    }
+
+    // Read one line without its newline. Bytes read past it stay in buffer.
+    bool read_line(int fd, std::vector<char>& buffer, std::string& line) {
+      while (true) {
+        auto newline = std::find(buffer.begin(), buffer.end(), '\n');
+        if (newline != buffer.end()) {
+          line.assign(buffer.begin(), newline);
+          buffer.erase(buffer.begin(), newline + 1);
+          return true;
+        }
+        if (buffer.size() > MAX_LINE || !receive(fd, buffer))
+          return false;
+      }
+    }
+
+    // Read exactly length bytes, starting with what is left in buffer
+    bool read_body(int fd, std::vector<char>& buffer, std::size_t length, std::vector<uchar>& body) {
+      std::size_t buffered = std::min(length, buffer.size());
+      body.assign(buffer.begin(), buffer.begin() + buffered);
+      buffer.erase(buffer.begin(), buffer.begin() + buffered);
+      body.resize(length);
+      for (std::size_t offset = buffered; offset < length;) {
+        ssize_t received = ::recv(fd, body.data() + offset, length - offset, 0);
+        if (received < 0 && errno == EINTR)
+          continue;
+        if (received <= 0)
+          return false;
+        offset += std::size_t(received);
+      }
+      return true;
+    }
+
+    bool reply(int fd, std::span<const uchar> data) {
+      std::string header = "OK " + std::to_string(data.size()) + "\n";
+      return send_all(fd, header.data(), header.size()) && send_all(fd, data.data(), data.size());
+    }
+
+    bool reply_error(int fd, const std::string& message) {
+      std::string line = "ERROR " + message + "\n";
+      return send_all(fd, line.data(), line.size());
+    }
+  } // namespace
+
+  double Stats::result_hit_ratio() const {
+    std::uint64_t lookups = results.hits + results.misses;
+    return lookups == 0 ? 0 : double(results.hits) / double(lookups);
+  }
+
+  double Stats::image_hit_ratio() const {
+    std::uint64_t lookups = images.hits + images.misses;
+    return lookups == 0 ? 0 : double(images.hits) / double(lookups);
+  }
+
+  // Stats as a JSON object
+  std::string to_json(const Stats& stats) {
+    std::ostringstream json;
+    json << "{\"requests\":" << stats.requests << ",\"failures\":" << stats.failures
+      << ",\"p50_seconds\":" << stats.p50_seconds << ",\"p99_seconds\":" << stats.p99_seconds;
+    auto cache = [&](const char* name, const auto& counts, double hit_ratio) {
+      json << ",\"" << name << "\":{\"hits\":" << counts.hits << ",\"misses\":" << counts.misses
+        << ",\"hit_ratio\":" << hit_ratio << ",\"evictions\":" << counts.evictions
+        << ",\"entries\":" << counts.entries << ",\"bytes\":" << counts.bytes << "}";
+    };
+    cache("result_cache", stats.results, stats.result_hit_ratio());
+    cache("image_cache", stats.images, stats.image_hit_ratio());
+    json << "}";
+    return json.str();
+  }
+
+  CropService::CropService(const Options& options)
+    : results(options.result_cache_bytes),
+    images(options.image_cache_bytes),
+    file_hashes(FILE_HASH_ENTRIES) {}
+
+  // Hash the content of a file, reading it into bytes unless it is unchanged since it was last
+  // hashed. Returns false if the file can't be read.
+  bool CropService::hash_file(const fs::path& path, std::vector<uchar>& bytes, std::uint64_t& hash) {
+    std::error_code error;
+    std::uintmax_t size = fs::file_size(path, error);
+    fs::file_time_type mtime = error ? fs::file_time_type() : fs::last_write_time(path, error);
+    if (error) {
+      std::cerr << "Failed to read image file: " << path << ": " << error.message() << std::endl;
+      return false;
+    }
+    std::optional<FileHash> known = file_hashes.get(path.string());
+    if (known && known->size == size && known->mtime == mtime) {
+      hash = known->hash;
+      return true;
+    }
+    if (!read_file(path, bytes)) {
+      std::cerr << "Failed to read image file: " << path << std::endl;
+      return false;
+    }
+    hash = Manifest::hash_bytes(std::as_bytes(std::span(bytes)));
+    file_hashes.put(path.string(), FileHash{ size, mtime, hash }, 1);
+    return true;
+  }
+
+  Result<Encoded> CropService::crop(const Request& request) {
+    Metrics::ScopedTimer timer(Metrics::Stage::SERVE);
+    auto start = std::chrono::steady_clock::now();
+    requests++;
+    auto fail = [&]() {
+      failures++;
+      latency.record(std::chrono::steady_clock::now() - start);
+      return Result(Encoded(), Status::FAILURE);
+    };
+    auto succeed = [&](Encoded encoded) {
+      latency.record(std::chrono::steady_clock::now() - start);
+      return Result(std::move(encoded), Status::SUCCESS);
+    };
+
+    // Bytes of a file are only read when its hash is not known or the image has to be decoded
+    std::vector<uchar> file_bytes;
+    const std::vector<uchar>* bytes = &request.bytes;
+    std::uint64_t hash = 0;
+    if (!request.path.empty()) {
+      if (!hash_file(request.path, file_bytes, hash))
+        return fail();
+      bytes = &file_bytes;
+    }
+    else {
+      hash = Manifest::hash_bytes(std::as_bytes(std::span(request.bytes)));
+    }
+
+    std::string key = result_key(hash, request);
+    if (std::optional<Encoded> cached = results.get(key))
+      return succeed(*cached);
+
+    cv::Mat image;
+    if (std::optional<cv::Mat> cached = images.get(hash)) {
+      image = *cached;
+    }
+    else {
+      if (bytes->empty() && !request.path.empty() && !read_file(request.path, file_bytes)) {
+        std::cerr << "Failed to read image file: " << request.path << std::endl;
+        return fail();
+      }
+      Result<cv::Mat> decoded = ImageEditor::decode_image(std::as_bytes(std::span(*bytes)), ImageEditor::ReadMode::UNCHANGED);
+      if (decoded.status == Status::FAILURE)
+        return fail();
+      image = decoded.data;
+      images.put(hash, image, image.total() * image.elemSize());
+    }
+
+    // The cached image is shared, the pipeline only reads it
+    ImageEditor::Pipeline pipeline(image);
+    pipeline.crop_square(request.pivot_rect);
+    if (request.size > 0)
+      pipeline.resize(cv::Size(request.size, request.size));
+    Result<cv::Mat> square = pipeline.run();
+    if (square.status == Status::FAILURE)
+      return fail();
+    Result<std::vector<uchar>> encoded = ImageEditor::encode_image(square.data, request.format);
+    if (encoded.status == Status::FAILURE)
+      return fail();
+    auto result = std::make_shared<const std::vector<uchar>>(std::move(encoded.data));
+    results.put(key, result, result->size());
+    return succeed(std::move(result));
+  }
+
+  Stats CropService::stats() const {
+    Stats stats;
+    stats.requests = requests.load();
+    stats.failures = failures.load();
+    stats.results = results.stats();
+    stats.images = images.stats();
+    stats.p50_seconds = latency.quantile_seconds(0.5);
+    stats.p99_seconds = latency.quantile_seconds(0.99);
+    return stats;
+  }
+
+  SocketServer::SocketServer(const fs::path& socket_path, CropService& service)
+    : socket_path(socket_path), service(service) {
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (socket_path.native().size() >= sizeof(address.sun_path)) {
+      std::cerr << "Socket path is too long: " << socket_path << std::endl;
+      return;
+    }
+    std::strncpy(address.sun_path, socket_path.c_str(), sizeof(address.sun_path) - 1);
+
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    listen_fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    // A socket file left behind by an earlier server is replaced
+    std::error_code ignored;
+    fs::remove(socket_path, ignored);
+    if (wake_fd < 0 || listen_fd < 0 || ::bind(listen_fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0
+      || ::listen(listen_fd, SOMAXCONN) < 0) {
+      std::cerr << "Failed to listen on " << socket_path << ": " << std::strerror(errno) << std::endl;
+      if (listen_fd >= 0)
+        ::close(listen_fd);
+      listen_fd = -1;
+    }
+  }
+
+  SocketServer::~SocketServer() {
+    if (listen_fd >= 0) {
+      ::close(listen_fd);
+      std::error_code ignored;
+      fs::remove(socket_path, ignored);
+    }
+    if (wake_fd >= 0)
+      ::close(wake_fd);
+  }
+
+  bool SocketServer::is_open() const {
+    return listen_fd >= 0 && wake_fd >= 0;
+  }
+
+  // Accept connections until stop()
+  void SocketServer::run() {
+    if (!is_open())
+      return;
+    while (true) {
+      pollfd fds[2] = { { listen_fd, POLLIN, 0 }, { wake_fd, POLLIN, 0 } };
+      if (::poll(fds, 2, -1) < 0 && errno != EINTR) {
+        std::cerr << "Failed to wait for connections: " << std::strerror(errno) << std::endl;
+        break;
+      }
+      if (fds[1].revents & POLLIN)
+        break;
+      if (!(fds[0].revents & POLLIN))
+        continue;
+      int connection_fd = ::accept4(listen_fd, nullptr, nullptr, SOCK_CLOEXEC);
+      if (connection_fd < 0)
+        continue;
+
+      std::lock_guard<std::mutex> lock(connections_mutex);
+      // Threads of closed connections are joined as new ones come in
+      connections.remove_if([](auto& connection) {
+        if (!*connection.second)
+          return false;
+        connection.first.join();
+        return true;
+      });
+      connection_fds.push_back(connection_fd);
+      auto done = std::make_shared<std::atomic<bool>>(false);
+      connections.emplace_back(std::thread([this, connection_fd, done] {
+        serve(connection_fd);
+        *done = true;
+      }), done);
+    }
+
+    // Clients waiting to send their next request are hung up on, requests in progress are answered
+    {
+      std::lock_guard<std::mutex> lock(connections_mutex);
+      for (int fd : connection_fds)
+        ::shutdown(fd, SHUT_RD);
+    }
+    for (auto& connection : connections)
+      connection.first.join();
+    connections.clear();
+  }
+
+  // Make run() return
+  void SocketServer::stop() {
+    if (wake_fd < 0)
+      return;
+    // write() is async-signal-safe, so this may run in a signal handler
+    std::uint64_t one = 1;
+    ssize_t written = ::write(wake_fd, &one, sizeof(one));
+    (void)written;
+  }
+
+  // Answer the requests of one connection until the client hangs up or sends garbage
+  void SocketServer::serve(int connection_fd) {
+    std::vector<char> buffer;
+    std::string line;
+    while (read_line(connection_fd, buffer, line)) {
+      std::istringstream header(line);
+      std::string command;
+      header >> command;
+      if (command == "STATS") {
+        std::string json = to_json(service.stats());
+        if (!reply(connection_fd, std::span(reinterpret_cast<const uchar*>(json.data()), json.size())))
+          break;
+        continue;
+      }
+
+      std::string source, pivots, format;
+      int size = 0;
+      std::size_t length = 0;
+      if (command != "CROP" || !(header >> source >> pivots >> size >> format >> length)
+        || (source != "path" && source != "bytes") || pivots.size() != 2 || size < 0 || size > MAX_SIZE
+        || length > MAX_BODY) {
+        // The rest of the stream can't be framed after a malformed request
+        reply_error(connection_fd, "malformed request");
+        break;
+      }
+      std::vector<uchar> body;
+      if (!read_body(connection_fd, buffer, length, body))
+        break;
+
+      Request request;
+      request.pivot_rect = PivotRect(ImageEditor::char_to_horizontal_pivot(pivots[0]), ImageEditor::char_to_vertical_pivot(pivots[1]));
+      request.size = size;
+      request.format = format;
+      if (source == "path")
+        request.path = std::string(body.begin(), body.end());
+      else
+        request.bytes = std::move(body);
+
+      Result<Encoded> result = service.crop(request);
+      bool sent = result.status == Status::SUCCESS ? reply(connection_fd, *result.data) : reply_error(connection_fd, "crop failed");
+      if (!sent)
+        break;
+    }
+
+    std::lock_guard<std::mutex> lock(connections_mutex);
+    connection_fds.erase(std::find(connection_fds.begin(), connection_fds.end(), connection_fd));
+    ::close(connection_fd);
+  }
+
+  Client::Client(const fs::path& socket_path) {
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (socket_path.native().size() >= sizeof(address.sun_path))
+      return;
+    std::strncpy(address.sun_path, socket_path.c_str(), sizeof(address.sun_path) - 1);
+    fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd >= 0 && ::connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0) {
+      ::close(fd);
+      fd = -1;
+    }
+  }
+
+  Client::~Client() {
+    if (fd >= 0)
+      ::close(fd);
+  }
+
+  bool Client::is_open() const {
+    return fd >= 0;
+  }
+
+  // Get an encoded crop
+  Result<std::vector<uchar>> Client::crop(const Request& request) {
+    std::string path = request.path.string();
+    bool by_path = !request.path.empty();
+    std::span<const uchar> body = by_path ? std::span(reinterpret_cast<const uchar*>(path.data()), path.size())
+      : std::span<const uchar>(request.bytes);
+    std::string format = request.format.empty() || request.format.front() != '.' ? request.format : request.format.substr(1);
+    std::ostringstream header;
+    header << "CROP " << (by_path ? "path" : "bytes") << " " << char(request.pivot_rect.horizontal_pivot)
+      << char(request.pivot_rect.vertical_pivot) << " " << request.size << " " << format << " " << body.size() << "\n";
+    return call(header.str(), body);
+  }
+
+  // Get the server's stats as JSON
+  Result<std::string> Client::stats() {
+    Result<std::vector<uchar>> reply = call("STATS\n", {});
+    return Result(std::string(reply.data.begin(), reply.data.end()), reply.status);
+  }
+
+  // Send one request and read its reply
+  Result<std::vector<uchar>> Client::call(const std::string& header, std::span<const uchar> body) {
+    std::string line;
+    if (fd < 0 || !send_all(fd, header.data(), header.size()) || !send_all(fd, body.data(), body.size())
+      || !read_line(fd, buffer, line)) {
+      std::cerr << "Lost the connection to the crop server" << std::endl;
+      return Result(std::vector<uchar>(), Status::FAILURE);
+    }
+    std::istringstream reply(line);
+    std::string status;
+    std::size_t length = 0;
+    std::vector<uchar> data;
+    if (!(reply >> status >> length) || status != "OK" || length > MAX_BODY || !read_body(fd, buffer, length, data))
+      return Result(std::vector<uchar>(), Status::FAILURE);
+    return Result(std::move(data), Status::SUCCESS);
+  }
+
+} // namespace Server
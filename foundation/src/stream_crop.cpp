@@ -0,0 +1,608 @@
+#include "include/stream_crop.hpp"
+#include "include/metrics.hpp"
+#include "include/probe.hpp"
+#include "include/reader.hpp"
+#include <algorithm>
+#include <bit>
+#include <csetjmp>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <jpeglib.h>
+#include <memory>
+#include <optional>
+#include <png.h>
+#include <vector>
+#include <zlib.h>
+#ifdef CHROMAEDIT_HAVE_TIFF
+#include <tiffio.h>
+#endif
+
+namespace ImageEditor {
+  namespace fs = std::filesystem;
+
+  namespace {
+    // How the samples of a row are laid out: interleaved gray, gray + alpha, RGB or RGBA with 8 or
+    // 16 bits per sample in native byte order
+    struct Layout {
+      int channels;
+      int depth;
+
+      std::size_t pixel_size() const { return std::size_t(channels) * (depth / 8); }
+      bool operator==(const Layout&) const = default;
+    };
+
+    // Decodes the rows of an image from top to bottom
+    class RowReader {
+    public:
+      virtual ~RowReader() = default;
+
+      // Read the header and fill in width, height and layout
+      virtual bool open(const fs::path& path) = 0;
+
+      // Read rows [top, top + rows) and copy columns [left, left + columns) of each into band, one
+      // row every stride bytes. Bands must be requested from top to bottom.
+      virtual bool read(int top, int rows, int left, int columns, uchar* band, std::size_t stride) = 0;
+
+      // Bands start on a multiple of this many rows, so that no tile is decoded twice
+      virtual int row_alignment() const { return 1; }
+
+      // Bytes the reader holds beside the band
+      virtual std::size_t buffer_size() const = 0;
+
+      // Bytes read from the file, when the reader can tell
+      virtual std::uint64_t bytes_read() const { return 0; }
+
+      int width = 0;
+      int height = 0;
+      Layout layout{};
+    };
+
+    // Encodes an image one row at a time
+    class RowWriter {
+    public:
+      virtual ~RowWriter() = default;
+
+      // The layout the format stores pixels of the given layout in
+      virtual Layout output_layout(Layout layout) const { return layout; }
+
+      virtual bool open(const fs::path& path, int width, int height, Layout layout) = 0;
+      virtual bool write(uchar* row) = 0;
+      virtual bool finish() = 0;
+
+      // How hard to compress, read by open()
+      EncodeSettings settings = get_encode_settings(EncodeProfile::FAST);
+    };
+
+    // Copy width pixels from src to dst, dropping alpha and scaling 16-bit samples to 8 bits where
+    // to has fewer channels or a lower depth than from. Scaling rounds like cv::Mat::convertTo.
+    void convert_row(const uchar* src, Layout from, uchar* dst, Layout to, int width) {
+      const auto* src16 = reinterpret_cast<const std::uint16_t*>(src);
+      auto* dst16 = reinterpret_cast<std::uint16_t*>(dst);
+      for (std::size_t x = 0; x < std::size_t(width); x++) {
+        for (int c = 0; c < to.channels; c++) {
+          std::size_t i = x * from.channels + c;
+          std::size_t o = x * to.channels + c;
+          unsigned value = from.depth == 16 ? src16[i] : src[i];
+          if (to.depth == 16)
+            dst16[o] = std::uint16_t(value);
+          else
+            dst[o] = uchar(from.depth == 16 ? (value * 2 + 257) / 514 : value);
+        }
+      }
+    }
+
+    void png_warning_silent(png_structp, png_const_charp) {}
+
+    // libpng reports errors with longjmp, so every member function that calls into it sets the
+    // jump target first and creates only trivially destructible locals
+    class PngReader : public RowReader {
+    public:
+      ~PngReader() override {
+        png_destroy_read_struct(&png, &info, nullptr);
+        if (file != nullptr)
+          std::fclose(file);
+      }
+
+      bool open(const fs::path& path) override {
+        file = std::fopen(path.c_str(), "rb");
+        if (file == nullptr)
+          return false;
+        png = png_create_read_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, png_warning_silent);
+        if (png == nullptr)
+          return false;
+        info = png_create_info_struct(png);
+        if (info == nullptr || !read_header())
+          return false;
+        row.resize(std::size_t(width) * layout.pixel_size());
+        return true;
+      }
+
+      bool read(int top, int rows, int left, int columns, uchar* band, std::size_t stride) override {
+        if (setjmp(png_jmpbuf(png)))
+          return false;
+        std::size_t pixel_size = layout.pixel_size();
+        // PNG rows can't be skipped, the ones above the band are decoded and dropped
+        for (; next_row < top + rows; next_row++) {
+          png_read_row(png, row.data(), nullptr);
+          if (next_row >= top)
+            std::memcpy(band + std::size_t(next_row - top) * stride, row.data() + std::size_t(left) * pixel_size,
+              std::size_t(columns) * pixel_size);
+        }
+        return true;
+      }
+
+      std::size_t buffer_size() const override { return row.size(); }
+
+      std::uint64_t bytes_read() const override {
+        long position = std::ftell(file);
+        return position > 0 ? std::uint64_t(position) : 0;
+      }
+
+    private:
+      // Expand palettes, low bit depths and transparent colors, keep everything else as stored
+      bool read_header() {
+        if (setjmp(png_jmpbuf(png)))
+          return false;
+        png_init_io(png, file);
+        png_read_info(png, info);
+        if (png_get_interlace_type(png, info) != PNG_INTERLACE_NONE)
+          return false;
+        int bit_depth = png_get_bit_depth(png, info);
+        int color_type = png_get_color_type(png, info);
+        if (color_type == PNG_COLOR_TYPE_PALETTE)
+          png_set_palette_to_rgb(png);
+        if (color_type == PNG_COLOR_TYPE_GRAY && bit_depth < 8)
+          png_set_expand_gray_1_2_4_to_8(png);
+        if (png_get_valid(png, info, PNG_INFO_tRNS) != 0)
+          png_set_tRNS_to_alpha(png);
+        // PNG samples are big-endian
+        if (bit_depth == 16 && std::endian::native == std::endian::little)
+          png_set_swap(png);
+        png_read_update_info(png, info);
+
+        width = int(png_get_image_width(png, info));
+        height = int(png_get_image_height(png, info));
+        layout = Layout{ png_get_channels(png, info), png_get_bit_depth(png, info) };
+        return true;
+      }
+
+      FILE* file = nullptr;
+      png_structp png = nullptr;
+      png_infop info = nullptr;
+      std::vector<png_byte> row;
+      int next_row = 0;
+    };
+
+    class PngWriter : public RowWriter {
+    public:
+      ~PngWriter() override {
+        png_destroy_write_struct(&png, &info);
+        if (file != nullptr)
+          std::fclose(file);
+      }
+
+      bool open(const fs::path& path, int width, int height, Layout layout) override {
+        file = std::fopen(path.c_str(), "wb");
+        if (file == nullptr)
+          return false;
+        png = png_create_write_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, png_warning_silent);
+        if (png == nullptr)
+          return false;
+        info = png_create_info_struct(png);
+        return info != nullptr && write_header(width, height, layout);
+      }
+
+      bool write(uchar* row) override {
+        if (setjmp(png_jmpbuf(png)))
+          return false;
+        png_write_row(png, row);
+        return true;
+      }
+
+      bool finish() override {
+        if (!write_end())
+          return false;
+        bool closed = std::fclose(file) == 0;
+        file = nullptr;
+        return closed;
+      }
+
+    private:
+      bool write_header(int width, int height, Layout layout) {
+        if (setjmp(png_jmpbuf(png)))
+          return false;
+        static constexpr int COLOR_TYPES[] = { PNG_COLOR_TYPE_GRAY, PNG_COLOR_TYPE_GRAY_ALPHA, PNG_COLOR_TYPE_RGB,
+          PNG_COLOR_TYPE_RGB_ALPHA };
+        png_init_io(png, file);
+        png_set_IHDR(png, info, png_uint_32(width), png_uint_32(height), layout.depth, COLOR_TYPES[layout.channels - 1],
+          PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+        png_set_compression_level(png, settings.png_compression);
+        png_set_compression_strategy(png, settings.png_strategy);
+        png_write_info(png, info);
+        if (layout.depth == 16 && std::endian::native == std::endian::little)
+          png_set_swap(png);
+        return true;
+      }
+
+      bool write_end() {
+        if (setjmp(png_jmpbuf(png)))
+          return false;
+        png_write_end(png, info);
+        return true;
+      }
+
+      FILE* file = nullptr;
+      png_structp png = nullptr;
+      png_infop info = nullptr;
+    };
+
+    // libjpeg reports fatal errors through error_exit, which must not return. Jump back to the
+    // caller instead of letting the library call exit().
+    struct JpegErrorManager {
+      jpeg_error_mgr pub;
+      std::jmp_buf jump;
+    };
+
+    void jpeg_error_exit(j_common_ptr cinfo) {
+      char message[JMSG_LENGTH_MAX];
+      (*cinfo->err->format_message)(cinfo, message);
+      std::cerr << "libjpeg: " << message << std::endl;
+      std::longjmp(reinterpret_cast<JpegErrorManager*>(cinfo->err)->jump, 1);
+    }
+
+    void jpeg_output_message(j_common_ptr) {}
+
+    class JpegWriter : public RowWriter {
+    public:
+      ~JpegWriter() override {
+        if (created)
+          jpeg_destroy_compress(&cinfo);
+        if (file != nullptr)
+          std::fclose(file);
+      }
+
+      // JPEG stores 8-bit gray or RGB
+      Layout output_layout(Layout layout) const override {
+        return Layout{ layout.channels >= 3 ? 3 : 1, 8 };
+      }
+
+      bool open(const fs::path& path, int width, int height, Layout layout) override {
+        file = std::fopen(path.c_str(), "wb");
+        if (file == nullptr)
+          return false;
+        cinfo.err = jpeg_std_error(&error.pub);
+        error.pub.error_exit = jpeg_error_exit;
+        error.pub.output_message = jpeg_output_message;
+        if (setjmp(error.jump))
+          return false;
+        created = true;
+        jpeg_create_compress(&cinfo);
+        jpeg_stdio_dest(&cinfo, file);
+        cinfo.image_width = JDIMENSION(width);
+        cinfo.image_height = JDIMENSION(height);
+        cinfo.input_components = layout.channels;
+        cinfo.in_color_space = layout.channels == 3 ? JCS_RGB : JCS_GRAYSCALE;
+        jpeg_set_defaults(&cinfo);
+        jpeg_set_quality(&cinfo, settings.jpeg_quality, TRUE);
+        cinfo.optimize_coding = settings.jpeg_optimize ? TRUE : FALSE;
+        if (settings.jpeg_progressive)
+          jpeg_simple_progression(&cinfo);
+        jpeg_start_compress(&cinfo, TRUE);
+        return true;
+      }
+
+      bool write(uchar* row) override {
+        if (setjmp(error.jump))
+          return false;
+        JSAMPROW rows[] = { row };
+        jpeg_write_scanlines(&cinfo, rows, 1);
+        return true;
+      }
+
+      bool finish() override {
+        if (!finish_compress())
+          return false;
+        bool closed = std::fclose(file) == 0;
+        file = nullptr;
+        return closed;
+      }
+
+    private:
+      bool finish_compress() {
+        if (setjmp(error.jump))
+          return false;
+        jpeg_finish_compress(&cinfo);
+        return true;
+      }
+
+      FILE* file = nullptr;
+      jpeg_compress_struct cinfo{};
+      JpegErrorManager error{};
+      bool created = false;
+    };
+
+#ifdef CHROMAEDIT_HAVE_TIFF
+    // Reads 8 or 16-bit unsigned gray or RGB TIFFs, with or without alpha, stored in strips or tiles
+    class TiffReader : public RowReader {
+    public:
+      ~TiffReader() override {
+        if (tiff != nullptr)
+          TIFFClose(tiff);
+      }
+
+      bool open(const fs::path& path) override {
+        tiff = TIFFOpen(path.c_str(), "r");
+        if (tiff == nullptr)
+          return false;
+        uint32_t image_width = 0, image_height = 0;
+        uint16_t bits_per_sample = 1, samples_per_pixel = 1, sample_format = SAMPLEFORMAT_UINT;
+        uint16_t photometric = PHOTOMETRIC_MINISBLACK, planar_config = PLANARCONFIG_CONTIG, orientation = ORIENTATION_TOPLEFT;
+        TIFFGetField(tiff, TIFFTAG_IMAGEWIDTH, &image_width);
+        TIFFGetField(tiff, TIFFTAG_IMAGELENGTH, &image_height);
+        TIFFGetFieldDefaulted(tiff, TIFFTAG_BITSPERSAMPLE, &bits_per_sample);
+        TIFFGetFieldDefaulted(tiff, TIFFTAG_SAMPLESPERPIXEL, &samples_per_pixel);
+        TIFFGetFieldDefaulted(tiff, TIFFTAG_SAMPLEFORMAT, &sample_format);
+        TIFFGetFieldDefaulted(tiff, TIFFTAG_PLANARCONFIG, &planar_config);
+        TIFFGetFieldDefaulted(tiff, TIFFTAG_ORIENTATION, &orientation);
+        TIFFGetField(tiff, TIFFTAG_PHOTOMETRIC, &photometric);
+
+        bool gray = photometric == PHOTOMETRIC_MINISBLACK && samples_per_pixel <= 2;
+        bool rgb = photometric == PHOTOMETRIC_RGB && (samples_per_pixel == 3 || samples_per_pixel == 4);
+        if ((!gray && !rgb) || (bits_per_sample != 8 && bits_per_sample != 16) || sample_format != SAMPLEFORMAT_UINT
+          || planar_config != PLANARCONFIG_CONTIG || orientation != ORIENTATION_TOPLEFT)
+          return false;
+
+        width = int(image_width);
+        height = int(image_height);
+        layout = Layout{ samples_per_pixel, bits_per_sample };
+        tiled = TIFFIsTiled(tiff) != 0;
+        if (tiled) {
+          TIFFGetField(tiff, TIFFTAG_TILEWIDTH, &tile_width);
+          TIFFGetField(tiff, TIFFTAG_TILELENGTH, &tile_height);
+          if (tile_width == 0 || tile_height == 0)
+            return false;
+        }
+        buffer.resize(std::size_t(tiled ? TIFFTileSize(tiff) : TIFFScanlineSize(tiff)));
+        return true;
+      }
+
+      bool read(int top, int rows, int left, int columns, uchar* band, std::size_t stride) override {
+        std::size_t pixel_size = layout.pixel_size();
+        if (!tiled) {
+          // libtiff seeks to the strip holding a row, so the strips above the band are skipped. Rows
+          // above the band in its first strip are still decoded, then dropped.
+          for (int y = top; y < top + rows; y++) {
+            if (TIFFReadScanline(tiff, buffer.data(), uint32_t(y), 0) < 0)
+              return false;
+            std::memcpy(band + std::size_t(y - top) * stride, buffer.data() + std::size_t(left) * pixel_size,
+              std::size_t(columns) * pixel_size);
+          }
+          return true;
+        }
+
+        // Decode every tile that intersects the band and copy the part of it inside the band
+        int tw = int(tile_width), th = int(tile_height);
+        for (int tile_y = top / th * th; tile_y < top + rows; tile_y += th) {
+          for (int tile_x = left / tw * tw; tile_x < left + columns; tile_x += tw) {
+            if (TIFFReadTile(tiff, buffer.data(), uint32_t(tile_x), uint32_t(tile_y), 0, 0) < 0)
+              return false;
+            int x0 = std::max(left, tile_x), x1 = std::min(left + columns, tile_x + tw);
+            int y0 = std::max(top, tile_y), y1 = std::min(top + rows, tile_y + th);
+            for (int y = y0; y < y1; y++)
+              std::memcpy(band + std::size_t(y - top) * stride + std::size_t(x0 - left) * pixel_size,
+                buffer.data() + (std::size_t(y - tile_y) * tw + std::size_t(x0 - tile_x)) * pixel_size,
+                std::size_t(x1 - x0) * pixel_size);
+          }
+        }
+        return true;
+      }
+
+      int row_alignment() const override { return tiled ? int(tile_height) : 1; }
+
+      std::size_t buffer_size() const override { return buffer.size(); }
+
+    private:
+      TIFF* tiff = nullptr;
+      bool tiled = false;
+      uint32_t tile_width = 0;
+      uint32_t tile_height = 0;
+      std::vector<uchar> buffer;
+    };
+
+    class TiffWriter : public RowWriter {
+    public:
+      ~TiffWriter() override {
+        if (tiff != nullptr)
+          TIFFClose(tiff);
+      }
+
+      bool open(const fs::path& path, int width, int height, Layout layout) override {
+        tiff = TIFFOpen(path.c_str(), "w");
+        if (tiff == nullptr)
+          return false;
+        TIFFSetField(tiff, TIFFTAG_IMAGEWIDTH, uint32_t(width));
+        TIFFSetField(tiff, TIFFTAG_IMAGELENGTH, uint32_t(height));
+        TIFFSetField(tiff, TIFFTAG_BITSPERSAMPLE, uint16_t(layout.depth));
+        TIFFSetField(tiff, TIFFTAG_SAMPLESPERPIXEL, uint16_t(layout.channels));
+        TIFFSetField(tiff, TIFFTAG_PHOTOMETRIC, layout.channels >= 3 ? PHOTOMETRIC_RGB : PHOTOMETRIC_MINISBLACK);
+        TIFFSetField(tiff, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
+        TIFFSetField(tiff, TIFFTAG_COMPRESSION, uint16_t(settings.tiff_compression));
+        TIFFSetField(tiff, TIFFTAG_ROWSPERSTRIP, TIFFDefaultStripSize(tiff, 0));
+        if (layout.channels == 2 || layout.channels == 4) {
+          uint16_t extra_samples[] = { EXTRASAMPLE_UNASSALPHA };
+          TIFFSetField(tiff, TIFFTAG_EXTRASAMPLES, 1, extra_samples);
+        }
+        return true;
+      }
+
+      bool write(uchar* row) override {
+        return TIFFWriteScanline(tiff, row, next_row++, 0) >= 0;
+      }
+
+      bool finish() override {
+        bool flushed = TIFFFlush(tiff) == 1;
+        TIFFClose(tiff);
+        tiff = nullptr;
+        return flushed;
+      }
+
+    private:
+      TIFF* tiff = nullptr;
+      uint32_t next_row = 0;
+    };
+#endif
+
+    std::unique_ptr<RowReader> make_reader(Reader::ImageType type) {
+      if (type == Reader::ImageType::PNG)
+        return std::make_unique<PngReader>();
+#ifdef CHROMAEDIT_HAVE_TIFF
+      if (type == Reader::ImageType::TIFF)
+        return std::make_unique<TiffReader>();
+#endif
+      return nullptr;
+    }
+
+    // The type of output_path by extension, when there is a streaming encoder for it
+    std::optional<Reader::ImageType> output_type(const fs::path& output_path) {
+      auto iter = Reader::image_type_map.find(Reader::get_file_type(output_path.string()));
+      if (iter == Reader::image_type_map.end())
+        return std::nullopt;
+      switch (iter->second) {
+      case Reader::ImageType::PNG:
+      case Reader::ImageType::JPEG:
+#ifdef CHROMAEDIT_HAVE_TIFF
+      case Reader::ImageType::TIFF:
+#endif
+        return iter->second;
+      default:
+        return std::nullopt;
+      }
+    }
+
+    std::unique_ptr<RowWriter> make_writer(Reader::ImageType type, EncodeProfile profile) {
+      std::unique_ptr<RowWriter> writer;
+      switch (type) {
+      case Reader::ImageType::PNG:
+        writer = std::make_unique<PngWriter>();
+        break;
+      case Reader::ImageType::JPEG:
+        writer = std::make_unique<JpegWriter>();
+        break;
+#ifdef CHROMAEDIT_HAVE_TIFF
+      case Reader::ImageType::TIFF:
+        writer = std::make_unique<TiffWriter>();
+        break;
+#endif
+      default:
+        return nullptr;
+      }
+      writer->settings = get_encode_settings(profile);
+      return writer;
+    }
+
+    // Copy the square of reader into writer band by band
+    bool stream_square(RowReader& reader, RowWriter& writer, const cv::Rect& region, Layout output_layout, int band_rows,
+      const fs::path& output_path) {
+      std::size_t band_row_size = std::size_t(region.width) * reader.layout.pixel_size();
+      std::vector<uchar> band(std::size_t(band_rows) * band_row_size);
+      std::vector<uchar> converted(output_layout == reader.layout ? 0 : std::size_t(region.width) * output_layout.pixel_size());
+      if (!writer.open(output_path, region.width, region.height, output_layout))
+        return false;
+
+      int alignment = reader.row_alignment();
+      for (int top = region.y; top < region.y + region.height;) {
+        // Bands end on the alignment grid, so only the first one starts inside a tile
+        int bottom = std::min(region.y + region.height, top / alignment * alignment + band_rows);
+        if (!reader.read(top, bottom - top, region.x, region.width, band.data(), band_row_size))
+          return false;
+        for (int y = 0; y < bottom - top; y++) {
+          uchar* row = band.data() + std::size_t(y) * band_row_size;
+          if (!converted.empty()) {
+            convert_row(row, reader.layout, converted.data(), output_layout, region.width);
+            row = converted.data();
+          }
+          if (!writer.write(row))
+            return false;
+        }
+        top = bottom;
+      }
+      return writer.finish();
+    }
+  } // namespace
+
+  // Returns true when the crop is big enough to stream and both formats can be streamed
+  bool should_stream_crop(const fs::path& image_path, const fs::path& output_path) {
+    if (!output_type(output_path))
+      return false;
+    std::optional<Reader::ImageInfo> info = Reader::probe_image(image_path);
+    return info && should_stream_crop(*info, output_path);
+  }
+
+  // Same as above, with the header already probed
+  bool should_stream_crop(const Reader::ImageInfo& info, const fs::path& output_path) {
+    if (!output_type(output_path) || !make_reader(info.type))
+      return false;
+    std::uint64_t decoded_size = std::uint64_t(info.width) * std::uint64_t(info.height)
+      * std::uint64_t(std::max(info.channels, 1)) * (info.depth > 8 ? 2 : 1);
+    return decoded_size > STREAMING_THRESHOLD;
+  }
+
+  // Crop the square of an image by streaming its rows in bands that fit tile_budget
+  bool crop_square_streaming(const fs::path& image_path, const PivotRect& pivot_rect, const fs::path& output_path,
+    std::size_t tile_budget, EncodeProfile profile) {
+    Metrics::ScopedTimer timer(Metrics::Stage::STREAM_CROP);
+    std::optional<Reader::ImageInfo> info = Reader::probe_image(image_path);
+    std::unique_ptr<RowReader> reader = info ? make_reader(info->type) : nullptr;
+    std::optional<Reader::ImageType> type = output_type(output_path);
+    if (reader == nullptr || !type) {
+      std::cerr << "Can't stream a crop of " << image_path << " to " << output_path << std::endl;
+      return false;
+    }
+    if (!reader->open(image_path)) {
+      std::cerr << "Failed to read image file for streaming: " << image_path << std::endl;
+      return false;
+    }
+    std::unique_ptr<RowWriter> writer = make_writer(*type, profile);
+
+    // The band gets whatever the reader and the converted row leave of the budget, in whole tile rows
+    cv::Rect region = get_square_region(reader->width, reader->height, pivot_rect);
+    Layout output_layout = writer->output_layout(reader->layout);
+    std::size_t band_row_size = std::size_t(region.width) * reader->layout.pixel_size();
+    std::size_t fixed_size = reader->buffer_size() + std::size_t(region.width) * output_layout.pixel_size();
+    std::size_t alignment = std::size_t(reader->row_alignment());
+    std::size_t budget_rows = tile_budget > fixed_size ? (tile_budget - fixed_size) / band_row_size : 0;
+    std::size_t needed_rows = (std::size_t(region.height) + alignment - 1) / alignment * alignment + alignment;
+    int band_rows = int(std::min(budget_rows, needed_rows) / alignment * alignment);
+    if (band_rows == 0) {
+      std::cerr << "Tile budget of " << tile_budget << " bytes is too small to stream " << image_path << std::endl;
+      return false;
+    }
+
+    // Streamed beside the output and renamed over it, so the input is never truncated while it is
+    // read when both are the same file, and a failed crop leaves whatever was at output_path alone
+    fs::create_directories(output_path.parent_path());
+    fs::path temporary = get_temporary_path(output_path);
+    bool success = stream_square(*reader, *writer, region, output_layout, band_rows, temporary);
+    // Close the output before looking at, renaming or removing it
+    writer.reset();
+    std::error_code error;
+    if (success)
+      fs::rename(temporary, output_path, error);
+    // Not counted as a failure: callers fall back to the in-memory crop, which counts its own
+    if (!success || error) {
+      std::cerr << "Failed to stream crop of image file: " << image_path << std::endl;
+      std::error_code ignored;
+      fs::remove(temporary, ignored);
+      return false;
+    }
+
+    std::uintmax_t size = fs::file_size(output_path, error);
+    Metrics::add(Metrics::Counter::BYTES_READ, reader->bytes_read());
+    Metrics::add(Metrics::Counter::BYTES_WRITTEN, error ? 0 : size);
+    Metrics::add(Metrics::Counter::PIXELS_PROCESSED, std::uint64_t(region.width) * std::uint64_t(region.height));
+    return true;
+  }
+
+} // namespace ImageEditor
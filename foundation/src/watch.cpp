@@ -0,0 +1,182 @@
+#include "include/watch.hpp"
+#include "include/reader.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+namespace Watch {
+  namespace fs = std::filesystem;
+
+  namespace {
+    // Writes, closes and arrivals and departures of entries. Opens and reads are not interesting.
+    constexpr std::uint32_t WATCHED_EVENTS = IN_CREATE | IN_MODIFY | IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM
+      | IN_DELETE | IN_ONLYDIR;
+
+    // Only the name is checked, the file may not be complete yet
+    bool is_image_name(const fs::path& path) {
+      return Reader::image_type_map.count(Reader::get_file_type(path.string())) > 0;
+    }
+  } // namespace
+
+  Watcher::Watcher(const std::vector<fs::path>& directories, const Options& options): options(options) {
+    inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (inotify_fd < 0 || wake_fd < 0) {
+      std::cerr << "Failed to set up file watching: " << std::strerror(errno) << std::endl;
+      return;
+    }
+    open = true;
+    roots = directories;
+    for (const auto& directory : directories)
+      open = add_watch(directory, false) && open;
+  }
+
+  Watcher::~Watcher() {
+    if (inotify_fd >= 0)
+      close(inotify_fd);
+    if (wake_fd >= 0)
+      close(wake_fd);
+  }
+
+  bool Watcher::is_open() const {
+    return open;
+  }
+
+  // Watch directory and, when recursive, its subdirectories. With scan, image files already in
+  // them count as just written, which catches files that landed in a new directory before it
+  // was watched.
+  bool Watcher::add_watch(const fs::path& directory, bool scan) {
+    int descriptor = inotify_add_watch(inotify_fd, directory.c_str(), WATCHED_EVENTS);
+    if (descriptor < 0) {
+      std::cerr << "Failed to watch directory: " << directory << ": " << std::strerror(errno) << std::endl;
+      return false;
+    }
+    directories[descriptor] = directory;
+
+    bool success = true;
+    std::error_code error;
+    for (fs::directory_iterator iter(directory, fs::directory_options::skip_permission_denied, error), end;
+      !error && iter != end; iter.increment(error)) {
+      std::error_code ignored;
+      if (options.recursive && iter->is_directory(ignored) && !iter->is_symlink(ignored))
+        success = add_watch(iter->path(), scan) && success;
+      else if (scan && Reader::is_image_entry(*iter))
+        touch(iter->path(), true);
+    }
+    return success;
+  }
+
+  // Walk the watched trees again after the kernel dropped events. Every image file counts as just
+  // written, the caller skips the ones it already handled. Watching a directory again keeps its
+  // descriptor, so only directories that appeared unseen get new watches.
+  void Watcher::rescan() {
+    for (const auto& root : roots)
+      add_watch(root, true);
+  }
+
+  // Drain the inotify queue into pending
+  void Watcher::read_events() {
+    alignas(inotify_event) char buffer[16 * 1024];
+    while (true) {
+      ssize_t length = read(inotify_fd, buffer, sizeof(buffer));
+      if (length <= 0)
+        return;
+      for (const char* cursor = buffer; cursor < buffer + length;) {
+        const auto* event = reinterpret_cast<const inotify_event*>(cursor);
+        cursor += sizeof(inotify_event) + event->len;
+        if (event->mask & IN_Q_OVERFLOW) {
+          std::cerr << "File events were dropped, rescanning the watched directories" << std::endl;
+          rescan();
+          continue;
+        }
+        auto iter = directories.find(event->wd);
+        if (iter == directories.end())
+          continue;
+        if (event->mask & IN_IGNORED) {
+          // The directory is gone
+          directories.erase(iter);
+          continue;
+        }
+        if (event->len == 0)
+          continue;
+
+        fs::path path = iter->second / event->name;
+        if (event->mask & IN_ISDIR) {
+          if (options.recursive && (event->mask & (IN_CREATE | IN_MOVED_TO)))
+            add_watch(path, true);
+          continue;
+        }
+        if (!is_image_name(path))
+          continue;
+        if (event->mask & (IN_DELETE | IN_MOVED_FROM))
+          pending.erase(path);
+        else
+          touch(path, (event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) != 0);
+      }
+    }
+  }
+
+  // Record write activity on path. A write after a close means the file is being written again.
+  void Watcher::touch(const fs::path& path, bool closed) {
+    pending[path] = Pending{ Clock::now(), closed };
+  }
+
+  // Milliseconds until the next closed file settles, -1 (wait for events) if there is none
+  int Watcher::next_timeout() const {
+    Clock::time_point now = Clock::now();
+    int timeout = -1;
+    for (const auto& [path, file] : pending) {
+      if (!file.closed)
+        continue;
+      auto remaining = std::chrono::ceil<std::chrono::milliseconds>(file.last_event + options.settle - now).count();
+      int milliseconds = int(std::max<std::int64_t>(0, remaining));
+      timeout = timeout < 0 ? milliseconds : std::min(timeout, milliseconds);
+    }
+    return timeout;
+  }
+
+  // Report ready files to on_file until stop() is called
+  void Watcher::run(const FileCallback& on_file) {
+    if (inotify_fd < 0 || wake_fd < 0)
+      return;
+    while (true) {
+      pollfd fds[2] = { { inotify_fd, POLLIN, 0 }, { wake_fd, POLLIN, 0 } };
+      if (poll(fds, 2, next_timeout()) < 0 && errno != EINTR) {
+        std::cerr << "Failed to wait for file events: " << std::strerror(errno) << std::endl;
+        return;
+      }
+      if (fds[1].revents & POLLIN)
+        return;
+      if (fds[0].revents & POLLIN)
+        read_events();
+
+      Clock::time_point now = Clock::now();
+      for (auto iter = pending.begin(); iter != pending.end();) {
+        if (!iter->second.closed || now - iter->second.last_event < options.settle) {
+          ++iter;
+          continue;
+        }
+        fs::path path = iter->first;
+        iter = pending.erase(iter);
+        on_file(path);
+      }
+    }
+  }
+
+  // Make run() return after the current callback
+  void Watcher::stop() {
+    if (wake_fd < 0)
+      return;
+    // write() is async-signal-safe, so this may run in a signal handler
+    std::uint64_t one = 1;
+    ssize_t written = write(wake_fd, &one, sizeof(one));
+    (void)written;
+  }
+
+} // namespace Watch
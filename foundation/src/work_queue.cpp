@@ -0,0 +1,375 @@
+#include "include/work_queue.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <climits>
+#include <csignal>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_set>
+
+namespace Shard {
+  using std::size_t;
+  using std::string;
+
+  namespace {
+    constexpr char PLAN_HEADER[] = "chromaedit-queue 1";
+
+    string get_host_name() {
+      char name[HOST_NAME_MAX + 1] = {};
+      if (::gethostname(name, sizeof(name) - 1) != 0)
+        return "localhost";
+      return name;
+    }
+
+    // Write all of text to fd, which may take several writes
+    bool write_all(int fd, std::string_view text) {
+      while (!text.empty()) {
+        ssize_t count = ::write(fd, text.data(), text.size());
+        if (count < 0 && errno == EINTR)
+          continue;
+        if (count <= 0)
+          return false;
+        text.remove_prefix(size_t(count));
+      }
+      return true;
+    }
+
+    std::optional<string> read_file(const fs::path& path) {
+      std::ifstream file(path, std::ios::binary);
+      if (!file)
+        return std::nullopt;
+      std::ostringstream content;
+      content << file.rdbuf();
+      return content.str();
+    }
+
+    std::optional<size_t> parse_number(std::string_view text) {
+      size_t value;
+      auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), value);
+      if (error != std::errc() || end != text.data() + text.size())
+        return std::nullopt;
+      return value;
+    }
+
+    // The text of a plan listing files in chunks of chunk_size. File names holding a newline
+    // can't be listed and are left out.
+    string format_plan(const std::vector<fs::path>& files, size_t chunk_size) {
+      string plan = string(PLAN_HEADER) + " " + std::to_string(chunk_size) + "\n";
+      for (const fs::path& file : files) {
+        const string& name = file.native();
+        if (name.find('\n') != string::npos) {
+          std::cerr << "Skipping file with a newline in its name: " << file << std::endl;
+          continue;
+        }
+        plan += name;
+        plan += '\n';
+      }
+      return plan;
+    }
+  } // namespace
+
+  WorkQueue::WorkQueue(const fs::path& directory, const FileLister& list_files, const Options& options)
+    : directory(directory), options(options), host(get_host_name()) {
+    owner = host + " " + std::to_string(::getpid());
+    open = open_plan(list_files);
+    if (!open)
+      return;
+    known_done.assign(chunk_count(), false);
+    // Workers start looking in different places, so they don't all race for the same chunks
+    cursor = chunk_count() == 0 ? 0 : std::hash<string>{}(owner) % chunk_count();
+    renewer = std::thread(&WorkQueue::renew_claims, this);
+  }
+
+  WorkQueue::~WorkQueue() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      closing = true;
+      wake.notify_all();
+    }
+    if (renewer.joinable())
+      renewer.join();
+    // Give up unfinished chunks by making their claims look expired to everyone
+    std::lock_guard<std::mutex> lock(mutex);
+    while (!held.empty()) {
+      const timespec epoch[2] = { { 0, 0 }, { 0, 0 } };
+      ::futimens(held.begin()->second.claim_fd, epoch);
+      release(held.begin()->first, false);
+    }
+  }
+
+  bool WorkQueue::is_open() const {
+    return open;
+  }
+
+  const std::vector<fs::path>& WorkQueue::files() const {
+    return plan;
+  }
+
+  size_t WorkQueue::chunk_count() const {
+    return (plan.size() + options.chunk_size - 1) / options.chunk_size;
+  }
+
+  // Read the plan, writing it first if no worker did. The plan is written to a file of our own and
+  // hard-linked into place, which fails if another worker linked theirs first.
+  bool WorkQueue::open_plan(const FileLister& list_files) {
+    std::error_code error;
+    for (const char* subdirectory : { "claims", "progress", "done" })
+      fs::create_directories(directory / subdirectory, error);
+    if (error) {
+      std::cerr << "Failed to create work queue: " << directory << ": " << error.message() << std::endl;
+      return false;
+    }
+
+    const fs::path plan_path = directory / "plan";
+    if (!fs::exists(plan_path, error)) {
+      if (options.chunk_size == 0)
+        options.chunk_size = 1;
+      fs::path temporary = directory / ("plan." + host + "." + std::to_string(::getpid()) + ".tmp");
+      int fd = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+      bool written = fd >= 0 && write_all(fd, format_plan(list_files(), options.chunk_size)) && ::fsync(fd) == 0;
+      if (fd >= 0)
+        ::close(fd);
+      bool linked = written && (::link(temporary.c_str(), plan_path.c_str()) == 0 || errno == EEXIST);
+      ::unlink(temporary.c_str());
+      if (!linked) {
+        std::cerr << "Failed to write work queue plan: " << plan_path << std::endl;
+        return false;
+      }
+    }
+
+    std::ifstream file(plan_path);
+    string line;
+    if (!std::getline(file, line) || !line.starts_with(PLAN_HEADER)) {
+      std::cerr << "Invalid work queue plan: " << plan_path << std::endl;
+      return false;
+    }
+    std::optional<size_t> chunk_size = parse_number(std::string_view(line).substr(sizeof(PLAN_HEADER)));
+    if (!chunk_size || *chunk_size == 0) {
+      std::cerr << "Invalid work queue plan: " << plan_path << std::endl;
+      return false;
+    }
+    options.chunk_size = *chunk_size;
+    while (std::getline(file, line))
+      plan.emplace_back(line);
+    return true;
+  }
+
+  bool WorkQueue::is_done(size_t chunk) {
+    std::error_code error;
+    return fs::exists(directory / "done" / std::to_string(chunk), error);
+  }
+
+  // A claim is stale if its owner is a process of this host that is gone, or if it was not renewed
+  // for a lease. A claim that can't be read yet was just created, or its owner died creating it.
+  bool WorkQueue::is_stale(const fs::path& claim_path) const {
+    struct stat info;
+    if (::stat(claim_path.c_str(), &info) != 0)
+      return false;
+    std::optional<string> content = read_file(claim_path);
+    if (content) {
+      size_t space = content->rfind(' ');
+      std::optional<size_t> pid;
+      if (space != string::npos && content->ends_with('\n'))
+        pid = parse_number(std::string_view(*content).substr(space + 1, content->size() - space - 2));
+      if (pid && content->compare(0, space, host) == 0 && ::kill(pid_t(*pid), 0) != 0 && errno == ESRCH)
+        return true;
+    }
+    auto modified = std::chrono::seconds(info.st_mtim.tv_sec) + std::chrono::nanoseconds(info.st_mtim.tv_nsec);
+    auto now = std::chrono::system_clock::now().time_since_epoch();
+    return now - modified > options.lease;
+  }
+
+  // The files of chunk that nobody recorded as completed. A line torn by a crash is ignored.
+  std::vector<size_t> WorkQueue::pending_files(size_t chunk) const {
+    size_t first = chunk * options.chunk_size;
+    size_t last = std::min(plan.size(), first + options.chunk_size);
+    std::unordered_set<size_t> completed;
+    std::optional<string> content = read_file(directory / "progress" / std::to_string(chunk));
+    std::string_view lines = content ? std::string_view(*content) : std::string_view();
+    for (size_t end; (end = lines.find('\n')) != std::string_view::npos; lines.remove_prefix(end + 1)) {
+      std::string_view line = lines.substr(0, end);
+      size_t space = line.find(' ');
+      if (space == std::string_view::npos)
+        continue;
+      std::optional<size_t> file = parse_number(line.substr(0, space));
+      std::string_view outcome = line.substr(space + 1);
+      if (file && (outcome == "ok" || outcome == "failed"))
+        completed.insert(*file);
+    }
+    std::vector<size_t> pending;
+    for (size_t file = first; file < last; file++) {
+      if (!completed.contains(file))
+        pending.push_back(file);
+    }
+    return pending;
+  }
+
+  // Try to claim chunk, taking it over from its owner if the claim is stale
+  WorkQueue::ClaimResult WorkQueue::try_claim(size_t chunk) {
+    if (is_done(chunk))
+      return ClaimResult::DONE;
+    const fs::path claims = directory / "claims";
+    for (size_t generation = 0;; generation++) {
+      fs::path claim_path = claims / (std::to_string(chunk) + "." + std::to_string(generation));
+      int claim_fd = ::open(claim_path.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+      if (claim_fd < 0) {
+        if (errno != EEXIST) {
+          std::cerr << "Failed to claim work queue chunk: " << claim_path << ": " << std::strerror(errno) << std::endl;
+          return ClaimResult::ERROR;
+        }
+        std::error_code error;
+        fs::path next = claims / (std::to_string(chunk) + "." + std::to_string(generation + 1));
+        if (!fs::exists(next, error) && !is_stale(claim_path))
+          return ClaimResult::HELD;
+        continue;
+      }
+
+      // The previous owner may have finished the chunk since we looked
+      if (!write_all(claim_fd, owner + "\n") || is_done(chunk)) {
+        ::close(claim_fd);
+        ::unlink(claim_path.c_str());
+        return is_done(chunk) ? ClaimResult::DONE : ClaimResult::ERROR;
+      }
+      fs::path progress_path = directory / "progress" / std::to_string(chunk);
+      int progress_fd = ::open(progress_path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+      if (progress_fd < 0) {
+        std::cerr << "Failed to open work queue progress: " << progress_path << std::endl;
+        ::close(claim_fd);
+        ::unlink(claim_path.c_str());
+        return ClaimResult::ERROR;
+      }
+      // Start on a line of our own after a torn one
+      struct stat info;
+      char last = '\n';
+      if (::fstat(progress_fd, &info) == 0 && info.st_size > 0) {
+        int reader = ::open(progress_path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (reader >= 0) {
+          if (::pread(reader, &last, 1, info.st_size - 1) != 1)
+            last = '\n';
+          ::close(reader);
+        }
+      }
+      if (last != '\n')
+        write_all(progress_fd, "\n");
+      std::lock_guard<std::mutex> lock(mutex);
+      held[chunk] = Held{ claim_fd, progress_fd, claim_path };
+      return ClaimResult::CLAIMED;
+    }
+  }
+
+  // Claim the next chunk to process, waiting on chunks held by others
+  std::optional<Chunk> WorkQueue::claim() {
+    std::lock_guard<std::mutex> claim_lock(claim_mutex);
+    if (!open)
+      return std::nullopt;
+    const size_t count = chunk_count();
+    auto poll_interval = std::clamp(options.lease / 4, std::chrono::milliseconds(10), std::chrono::milliseconds(1000));
+    while (true) {
+      bool waiting = false;
+      for (size_t step = 0; step < count; step++) {
+        if (stopped)
+          return std::nullopt;
+        size_t chunk = (cursor + step) % count;
+        if (known_done[chunk])
+          continue;
+        {
+          std::lock_guard<std::mutex> lock(mutex);
+          if (held.contains(chunk))
+            continue;
+        }
+        switch (try_claim(chunk)) {
+        case ClaimResult::CLAIMED:
+          cursor = chunk + 1;
+          return Chunk{ chunk, pending_files(chunk) };
+        case ClaimResult::DONE:
+          known_done[chunk] = true;
+          break;
+        case ClaimResult::HELD:
+          waiting = true;
+          break;
+        case ClaimResult::ERROR:
+          return std::nullopt;
+        }
+      }
+      if (!waiting)
+        return std::nullopt;
+      std::unique_lock<std::mutex> lock(mutex);
+      if (wake.wait_for(lock, poll_interval, [this] { return stopped.load(); }))
+        return std::nullopt;
+    }
+  }
+
+  // Append the outcome of file to the progress of chunk, in a single write
+  bool WorkQueue::complete(size_t chunk, size_t file, bool success) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto iter = held.find(chunk);
+    if (iter == held.end())
+      return false;
+    string line = std::to_string(file) + (success ? " ok\n" : " failed\n");
+    return ::write(iter->second.progress_fd, line.data(), line.size()) == ssize_t(line.size());
+  }
+
+  // Flush the progress of chunk, then mark it done and drop the claim
+  bool WorkQueue::finish(size_t chunk) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto iter = held.find(chunk);
+    if (iter == held.end())
+      return false;
+    fs::path done_path = directory / "done" / std::to_string(chunk);
+    bool synced = ::fsync(iter->second.progress_fd) == 0;
+    int fd = synced ? ::open(done_path.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644) : -1;
+    if (fd < 0) {
+      std::cerr << "Failed to mark work queue chunk done: " << done_path << std::endl;
+      return false;
+    }
+    ::close(fd);
+    release(chunk, true);
+    return true;
+  }
+
+  // Only sets a flag, so it can be called from a signal handler. A waiting claim() notices it at
+  // its next poll.
+  void WorkQueue::stop() {
+    stopped = true;
+  }
+
+  Progress WorkQueue::progress() {
+    std::lock_guard<std::mutex> claim_lock(claim_mutex);
+    size_t done = 0;
+    for (size_t chunk = 0; chunk < known_done.size(); chunk++) {
+      if (!known_done[chunk] && is_done(chunk))
+        known_done[chunk] = true;
+      done += known_done[chunk] ? 1 : 0;
+    }
+    return Progress{ chunk_count(), done, plan.size() };
+  }
+
+  // Close what we hold of chunk. Called with mutex held.
+  void WorkQueue::release(size_t chunk, bool remove_claim) {
+    auto iter = held.find(chunk);
+    if (iter == held.end())
+      return;
+    ::close(iter->second.progress_fd);
+    ::close(iter->second.claim_fd);
+    if (remove_claim)
+      ::unlink(iter->second.claim_path.c_str());
+    held.erase(iter);
+  }
+
+  // Touch every held claim a few times per lease, until the queue is destroyed
+  void WorkQueue::renew_claims() {
+    auto interval = std::max(options.lease / 4, std::chrono::milliseconds(1));
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!wake.wait_for(lock, interval, [this] { return closing; })) {
+      for (const auto& [chunk, claim] : held)
+        ::futimens(claim.claim_fd, nullptr);
+    }
+  }
+
+} // namespace Shard
@@ -0,0 +1,181 @@
+#include "include/archive.hpp"
+#include <gtest/gtest.h>
+#include <opencv2/opencv.hpp>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <string>
+
+namespace fs = std::filesystem;
+using std::string;
+using std::vector;
+using namespace Archive;
+
+class ArchiveTest : public ::testing::Test {
+public:
+  const fs::path DIST_DIR = fs::current_path() / "dist";
+
+  static std::span<const std::byte> bytes_of(const string& text) {
+    return std::as_bytes(std::span(text));
+  }
+
+  static vector<uchar> encode(const string& extension, int width, int height) {
+    cv::Mat image(height, width, CV_8UC3);
+    cv::randu(image, cv::Scalar::all(0), cv::Scalar::all(255));
+    vector<uchar> encoded;
+    cv::imencode(extension, image, encoded);
+    return encoded;
+  }
+
+  // Every member of an archive by name
+  static std::map<string, string> read_all(const fs::path& path) {
+    std::map<string, string> contents;
+    Source source(path);
+    vector<std::byte> buffer;
+    for (const auto& member : source.members()) {
+      std::optional<std::span<const std::byte>> bytes = source.read(member, buffer);
+      contents[member.name] = bytes ? string(reinterpret_cast<const char*>(bytes->data()), bytes->size()) : "<damaged>";
+    }
+    return contents;
+  }
+
+protected:
+  void SetUp() override { fs::create_directory(DIST_DIR); }
+
+  void TearDown() override { fs::remove_all(DIST_DIR); }
+};
+
+TEST_F(ArchiveTest, FormatOf) {
+  EXPECT_EQ(Format::TAR, format_of("shots.tar"));
+  EXPECT_EQ(Format::ZIP, format_of("/path/to/shots.ZIP"));
+  EXPECT_FALSE(format_of("shots.tar.gz").has_value());
+  EXPECT_FALSE(format_of("shot.png").has_value());
+}
+
+TEST_F(ArchiveTest, RoundTripsMembers) {
+  const std::map<string, string> contents{
+    { "shot.png", string(1000, 'p') },
+    { "nested/scan.bmp", string(5000, 'b') },  // Deflated in a zip
+    { string(120, 'd') + "/split.jpg", "fits a ustar prefix" },
+    { string(300, 'n') + ".png", "needs a long name record" },
+    { "notes.txt", "" },
+  };
+  for (const char* name : { "out.tar", "out.zip" }) {
+    {
+      Sink sink(DIST_DIR / name);
+      ASSERT_TRUE(sink.is_open());
+      for (const auto& [member, text] : contents)
+        EXPECT_TRUE(sink.add(member, bytes_of(text)));
+      ASSERT_TRUE(sink.close());
+    }
+    EXPECT_EQ(contents, read_all(DIST_DIR / name)) << name;
+
+    Source source(DIST_DIR / name);
+    ASSERT_TRUE(source.is_open());
+    EXPECT_EQ(4, source.image_members().size());
+  }
+}
+
+TEST_F(ArchiveTest, StoredMembersAreReadInPlace) {
+  {
+    Sink sink(DIST_DIR / "out.zip");
+    sink.add("shot.png", bytes_of("not compressed"));
+  }
+  Source source(DIST_DIR / "out.zip");
+  ASSERT_EQ(1, source.members().size());
+  vector<std::byte> buffer;
+  std::optional<std::span<const std::byte>> bytes = source.read(source.members()[0], buffer);
+  ASSERT_TRUE(bytes.has_value());
+  EXPECT_EQ(0, buffer.size());
+  EXPECT_EQ("not compressed", string(reinterpret_cast<const char*>(bytes->data()), bytes->size()));
+}
+
+TEST_F(ArchiveTest, RejectsDamagedArchives) {
+  EXPECT_FALSE(Source(DIST_DIR / "missing.tar").is_open());
+  std::ofstream(DIST_DIR / "garbage.zip") << "this is not a zip file";
+  EXPECT_FALSE(Source(DIST_DIR / "garbage.zip").is_open());
+  std::ofstream(DIST_DIR / "garbage.tar") << string(512, 'x');
+  EXPECT_FALSE(Source(DIST_DIR / "garbage.tar").is_open());
+}
+
+TEST_F(ArchiveTest, RejectsTruncatedZip64Locator) {
+  // A zip64 end record signature, a locator pointing at it and an end of central directory record
+  // whose count asks for zip64, in fewer bytes than the zip64 record itself takes
+  const unsigned char zip[] = {
+    0x50, 0x4B, 0x06, 0x06,
+    0x50, 0x4B, 0x06, 0x07, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0,
+    0x50, 0x4B, 0x05, 0x06, 0, 0, 0, 0, 0xFF, 0xFF, 0xFF, 0xFF, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  };
+  std::ofstream(DIST_DIR / "truncated.zip", std::ios::binary).write(reinterpret_cast<const char*>(zip), sizeof(zip));
+  EXPECT_FALSE(Source(DIST_DIR / "truncated.zip").is_open());
+}
+
+TEST_F(ArchiveTest, RejectsImpossibleMemberSizes) {
+  {
+    Sink sink(DIST_DIR / "in.zip");
+    sink.add("scan.bmp", bytes_of(string(5000, 'b')));
+  }
+  // Claim an uncompressed size deflate can't reach from the stored bytes
+  string zip;
+  {
+    std::ifstream file(DIST_DIR / "in.zip", std::ios::binary);
+    zip.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+  }
+  std::size_t central = zip.find("PK\x01\x02");
+  ASSERT_NE(string::npos, central);
+  zip.replace(central + 24, 4, "\xF0\xFF\xFF\xFF");
+  std::ofstream(DIST_DIR / "in.zip", std::ios::binary) << zip;
+
+  Source source(DIST_DIR / "in.zip");
+  ASSERT_TRUE(source.is_open());
+  ASSERT_EQ(1, source.members().size());
+  vector<std::byte> buffer;
+  EXPECT_FALSE(source.read(source.members()[0], buffer).has_value());
+  EXPECT_EQ(0, buffer.size());
+}
+
+TEST_F(ArchiveTest, CropArchiveWritesSquaresInOrder) {
+  vector<std::pair<string, vector<uchar>>> images{
+    { "a_lt.png", encode(".png", 120, 80) },
+    { "broken.png", vector<uchar>{ 1, 2, 3 } },
+    { "nested/b.jpg", encode(".jpg", 64, 96) },
+    { "c.tiff", encode(".tiff", 50, 70) },
+  };
+  {
+    Sink sink(DIST_DIR / "in.zip");
+    for (const auto& [name, encoded] : images)
+      sink.add(name, std::as_bytes(std::span(encoded)));
+    sink.add("readme.txt", bytes_of("skipped"));
+  }
+
+  vector<MemberStatus> reported;
+  vector<MemberStatus> statuses = crop_archive(DIST_DIR / "in.zip", DIST_DIR / "out" / "cropped.tar", 2,
+    [&](const MemberStatus& status) { reported.push_back(status); });
+  ASSERT_EQ(4, statuses.size());
+  ASSERT_EQ(4, reported.size());
+  for (std::size_t i = 0; i < statuses.size(); i++) {
+    EXPECT_EQ(statuses[i].name, reported[i].name);
+    EXPECT_EQ(statuses[i].status, reported[i].status);
+  }
+  EXPECT_EQ(ImageEditor::Status::SUCCESS, statuses[0].status);
+  EXPECT_EQ(ImageEditor::Status::FAILURE, statuses[1].status);
+  EXPECT_EQ(ImageEditor::Status::SUCCESS, statuses[2].status);
+  EXPECT_EQ(ImageEditor::Status::SUCCESS, statuses[3].status);
+
+  Source output(DIST_DIR / "out" / "cropped.tar");
+  ASSERT_TRUE(output.is_open());
+  ASSERT_EQ(3, output.members().size());
+  const vector<string> names{ "a_lt.png", "nested/b.jpg", "c.tiff" };
+  const vector<int> sides{ 80, 64, 50 };
+  vector<std::byte> buffer;
+  for (std::size_t i = 0; i < names.size(); i++) {
+    const Member& member = output.members()[i];
+    EXPECT_EQ(names[i], member.name);
+    std::optional<std::span<const std::byte>> bytes = output.read(member, buffer);
+    ASSERT_TRUE(bytes.has_value());
+    ImageEditor::Result<cv::Mat> square = ImageEditor::decode_image(*bytes, ImageEditor::ReadMode::UNCHANGED);
+    ASSERT_EQ(ImageEditor::Status::SUCCESS, square.status) << member.name;
+    EXPECT_EQ(cv::Size(sides[i], sides[i]), square.data.size()) << member.name;
+  }
+}
@@ -0,0 +1,99 @@
+#include "include/auto_pivot.hpp"
+#include "include/jpeg_crop.hpp"
+#include <gtest/gtest.h>
+#include <opencv2/opencv.hpp>
+#include <cstddef>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <vector>
+
+namespace fs = std::filesystem;
+using namespace ImageEditor;
+
+class AutoPivotTest : public ::testing::Test {
+public:
+  const fs::path DIST_DIR = fs::current_path() / "dist";
+  const fs::path OUT_DIR = DIST_DIR / "output";
+
+  // A flat gray image with a checkerboard over region. The cells are bigger than the preview scale,
+  // so the reduced preview keeps their edges.
+  cv::Mat make_image(int width, int height, const cv::Rect& region) {
+    cv::Mat image(height, width, CV_8UC3, cv::Scalar(128, 128, 128));
+    for (int y = region.y; y < region.y + region.height; y++)
+      for (int x = region.x; x < region.x + region.width; x++)
+        image.at<cv::Vec3b>(y, x) = ((x - region.x) / 20 + (y - region.y) / 20) % 2 == 0 ? cv::Vec3b(0, 0, 0) : cv::Vec3b(255, 255, 255);
+    return image;
+  }
+
+protected:
+  void SetUp() override { fs::create_directory(DIST_DIR); }
+
+  void TearDown() override { fs::remove_all(DIST_DIR); }
+};
+
+TEST_F(AutoPivotTest, ParsePivotSuffix) {
+  PivotRect pivot_rect = parse_pivot_suffix("shot_a");
+  EXPECT_EQ(HorizontalPivot::AUTO, pivot_rect.horizontal_pivot);
+  EXPECT_EQ(VerticalPivot::AUTO, pivot_rect.vertical_pivot);
+  EXPECT_TRUE(is_auto_pivot(pivot_rect));
+
+  pivot_rect = parse_pivot_suffix("shot_ab");
+  EXPECT_EQ(HorizontalPivot::AUTO, pivot_rect.horizontal_pivot);
+  EXPECT_EQ(VerticalPivot::BOTTOM, pivot_rect.vertical_pivot);
+  EXPECT_FALSE(is_auto_pivot(parse_pivot_suffix("shot_lt")));
+}
+
+TEST_F(AutoPivotTest, FlatImageStaysCentered) {
+  cv::Mat image(200, 800, CV_8UC3, cv::Scalar(128, 128, 128));
+  PivotRect pivot_rect = resolve_auto_pivot(image, image.cols, image.rows, PivotRect(HorizontalPivot::AUTO, VerticalPivot::AUTO));
+  EXPECT_FALSE(pivot_rect.auto_origin.has_value());
+  EXPECT_EQ(cv::Rect(300, 0, 200, 200), get_square_region(image, PivotRect(HorizontalPivot::AUTO, VerticalPivot::AUTO)));
+}
+
+TEST_F(AutoPivotTest, LandscapeFollowsContent) {
+  cv::Mat image = make_image(800, 200, cv::Rect(600, 0, 200, 200));
+  cv::Rect region = get_square_region(image, PivotRect(HorizontalPivot::AUTO, VerticalPivot::AUTO));
+  EXPECT_GE(region.x, 500);
+  EXPECT_EQ(0, region.y);
+  EXPECT_EQ(200, region.width);
+  EXPECT_EQ(200, region.height);
+
+  // Only the pivot along the long side is placed by the content
+  EXPECT_EQ(cv::Rect(300, 0, 200, 200), get_square_region(image, PivotRect(HorizontalPivot::CENTER, VerticalPivot::AUTO)));
+}
+
+TEST_F(AutoPivotTest, PortraitFollowsContent) {
+  cv::Mat image = make_image(200, 800, cv::Rect(0, 0, 200, 200));
+  cv::Rect region = get_square_region(image, PivotRect(HorizontalPivot::AUTO, VerticalPivot::AUTO));
+  EXPECT_EQ(0, region.x);
+  EXPECT_LE(region.y, 100);
+  EXPECT_EQ(200, region.height);
+}
+
+TEST_F(AutoPivotTest, JpegPreviewAgreesWithPixels) {
+  cv::Mat image = make_image(1600, 400, cv::Rect(1200, 0, 400, 400));
+  fs::path image_path = DIST_DIR / "wide.jpg";
+  ASSERT_TRUE(cv::imwrite(image_path.string(), image));
+  PivotRect pivot_rect(HorizontalPivot::AUTO, VerticalPivot::AUTO);
+
+  PivotRect from_pixels = resolve_auto_pivot(image, image.cols, image.rows, pivot_rect);
+  PivotRect from_file = resolve_auto_pivot(image_path, pivot_rect);
+  ASSERT_TRUE(from_pixels.auto_origin.has_value());
+  ASSERT_TRUE(from_file.auto_origin.has_value());
+  EXPECT_NEAR(from_pixels.auto_origin->x, from_file.auto_origin->x, 16);
+  EXPECT_GE(from_file.auto_origin->x, 1000);
+
+  std::ifstream file(image_path, std::ios::binary);
+  std::vector<char> bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+  PivotRect from_memory = resolve_auto_pivot(std::as_bytes(std::span(bytes)), pivot_rect);
+  ASSERT_TRUE(from_memory.auto_origin.has_value());
+  EXPECT_EQ(from_file.auto_origin->x, from_memory.auto_origin->x);
+
+  // The lossless crop keeps the square the preview picked
+  fs::path output_path = OUT_DIR / "wide.jpg";
+  ASSERT_TRUE(crop_square_jpeg(image_path, pivot_rect, output_path));
+  cv::Mat cropped = cv::imread(output_path.string());
+  ASSERT_EQ(400, cropped.cols);
+  EXPECT_LT(cv::norm(image(get_jpeg_square_region(1600, 400, 16, 16, from_file)), cropped, cv::NORM_L1) / cropped.total(), 24.0);
+}
@@ -0,0 +1,248 @@
+#include "include/batch.hpp"
+#include "include/manifest.hpp"
+#include <gtest/gtest.h>
+#include <opencv2/opencv.hpp>
+#include <filesystem>
+#include <optional>
+#include <chrono>
+#include <thread>
+
+namespace fs = std::filesystem;
+using std::vector;
+using namespace Batch;
+
+class BatchTest : public ::testing::Test {
+public:
+  const fs::path DIST_DIR = fs::current_path() / "dist";
+  const fs::path OUT_DIR = DIST_DIR / "output";
+
+  vector<fs::path> make_images(int count) {
+    vector<fs::path> files;
+    for (int i = 0; i < count; i++) {
+      fs::path file = DIST_DIR / ("image" + std::to_string(i) + (i % 2 ? "_lt.png" : "_rb.jpg"));
+      cv::Mat image(120 + i, 80 + 2 * i, CV_8UC3, cv::Scalar(rand() % 256, rand() % 256, rand() % 256));
+      if (!cv::imwrite(file.string(), image))
+        return {};
+      files.push_back(file);
+    }
+    return files;
+  }
+
+protected:
+  void SetUp() override { fs::create_directory(DIST_DIR); }
+
+  void TearDown() override { fs::remove_all(DIST_DIR); }
+};
+
+TEST_F(BatchTest, DefaultOptionsUseEveryCore) {
+  for (unsigned cores : { 1u, 2u, 8u, 32u }) {
+    Options options = default_options(cores);
+    EXPECT_GE(options.decode_workers, 1u);
+    EXPECT_GE(options.transform_workers, 1u);
+    EXPECT_GE(options.encode_workers, 1u);
+    EXPECT_EQ(std::max(cores, 3u), options.decode_workers + options.transform_workers + options.encode_workers);
+  }
+}
+
+TEST_F(BatchTest, MakeJobsParsesPivots) {
+  vector<Job> jobs = make_jobs({ DIST_DIR / "shot_lt.png", DIST_DIR / "shot.png" }, OUT_DIR);
+  ASSERT_EQ(2, jobs.size());
+  EXPECT_EQ(ImageEditor::HorizontalPivot::LEFT, jobs[0].pivot_rect.horizontal_pivot);
+  EXPECT_EQ(ImageEditor::VerticalPivot::TOP, jobs[0].pivot_rect.vertical_pivot);
+  EXPECT_EQ(OUT_DIR / "shot_lt.png", jobs[0].output);
+  EXPECT_EQ(ImageEditor::HorizontalPivot::CENTER, jobs[1].pivot_rect.horizontal_pivot);
+  EXPECT_EQ(ImageEditor::VerticalPivot::CENTER, jobs[1].pivot_rect.vertical_pivot);
+}
+
+TEST_F(BatchTest, RunCropsEveryFile) {
+  vector<fs::path> files = make_images(12);
+  ASSERT_EQ(12, files.size());
+
+  Options options{ 2, 1, 2, 2 };
+  std::size_t reported = 0;
+  vector<FileStatus> statuses = run(make_jobs(files, OUT_DIR), options, [&](const FileStatus&) { reported++; });
+
+  ASSERT_EQ(files.size(), statuses.size());
+  EXPECT_EQ(files.size(), reported);
+  for (std::size_t i = 0; i < files.size(); i++) {
+    EXPECT_EQ(i, statuses[i].index);
+    EXPECT_EQ(files[i], statuses[i].input);
+    EXPECT_EQ(ImageEditor::Status::SUCCESS, statuses[i].status);
+    EXPECT_EQ(Stage::DONE, statuses[i].stage);
+
+    cv::Mat output = cv::imread(statuses[i].output.string(), cv::IMREAD_UNCHANGED);
+    ASSERT_FALSE(output.empty());
+    EXPECT_EQ(output.cols, output.rows);
+  }
+}
+
+TEST_F(BatchTest, RunHashesInputsOnRequest) {
+  vector<fs::path> files = make_images(4);
+  ASSERT_EQ(4, files.size());
+
+  Options options{ 2, 1, 2, 2 };
+  for (const auto& status : run(make_jobs(files, OUT_DIR), options))
+    EXPECT_EQ(0, status.input_hash) << status.input;
+
+  options.hash_inputs = true;
+  for (const auto& status : run(make_jobs(files, OUT_DIR), options)) {
+    EXPECT_EQ(ImageEditor::Status::SUCCESS, status.status) << status.input;
+    EXPECT_EQ(Manifest::hash_file(status.input), status.input_hash) << status.input;
+  }
+}
+
+TEST_F(BatchTest, RunReportsFailingStage) {
+  vector<Job> jobs{ Job(DIST_DIR / "missing.png", PivotRect(), OUT_DIR / "missing.png") };
+  vector<FileStatus> statuses = run(jobs, Options{ 1, 1, 1, 1 });
+  ASSERT_EQ(1, statuses.size());
+  EXPECT_EQ(ImageEditor::Status::FAILURE, statuses[0].status);
+  EXPECT_EQ(Stage::DECODE, statuses[0].stage);
+}
+
+TEST_F(BatchTest, RunRoutesProbedFilesByTheirHeader) {
+  // A PNG without an extension and a JPEG named like a PNG
+  cv::imwrite((DIST_DIR / "plain_lt.png").string(), cv::Mat(60, 90, CV_8UC3, cv::Scalar(10, 20, 30)));
+  fs::rename(DIST_DIR / "plain_lt.png", DIST_DIR / "plain_lt");
+  cv::imwrite((DIST_DIR / "photo.jpg").string(), cv::Mat(40, 70, CV_8UC3, cv::Scalar(40, 50, 60)));
+  fs::rename(DIST_DIR / "photo.jpg", DIST_DIR / "photo.png");
+
+  vector<Job> jobs;
+  for (const fs::path& file : { DIST_DIR / "plain_lt", DIST_DIR / "photo.png" }) {
+    std::optional<Reader::ImageInfo> info = Reader::probe_image(file.string());
+    ASSERT_TRUE(info.has_value()) << file;
+    jobs.push_back(make_job(file, *info, OUT_DIR));
+  }
+  EXPECT_EQ(ImageEditor::HorizontalPivot::LEFT, jobs[0].pivot_rect.horizontal_pivot);
+  EXPECT_EQ(OUT_DIR / "plain_lt.png", jobs[0].output);
+  EXPECT_EQ(OUT_DIR / "photo.png", jobs[1].output);
+
+  vector<FileStatus> statuses = run(jobs, Options{ 1, 1, 1, 1 });
+  for (const auto& status : statuses) {
+    EXPECT_EQ(ImageEditor::Status::SUCCESS, status.status) << status.input;
+    cv::Mat output = cv::imread(status.output.string(), cv::IMREAD_UNCHANGED);
+    EXPECT_EQ(cv::Size(output.rows, output.rows), output.size()) << status.output;
+  }
+}
+
+TEST_F(BatchTest, RunTranscodesWithProfiles) {
+  cv::imwrite((DIST_DIR / "shot_lt.bmp").string(), cv::Mat(60, 90, CV_8UC3, cv::Scalar(10, 20, 30)));
+  cv::imwrite((DIST_DIR / "photo.jpg").string(), cv::Mat(40, 70, CV_8UC3, cv::Scalar(40, 50, 60)));
+
+  vector<Job> jobs;
+  for (const fs::path& file : { DIST_DIR / "shot_lt.bmp", DIST_DIR / "photo.jpg" }) {
+    std::optional<Reader::ImageInfo> info = Reader::probe_image(file.string());
+    ASSERT_TRUE(info.has_value()) << file;
+    jobs.push_back(make_job(file, *info, OUT_DIR, Reader::ImageType::PNG));
+  }
+  EXPECT_EQ(OUT_DIR / "shot_lt.png", jobs[0].output);
+  EXPECT_EQ(OUT_DIR / "photo.png", jobs[1].output);
+  jobs[1].profile = ImageEditor::EncodeProfile::FAST;
+
+  Options options{ 1, 1, 1, 1 };
+  options.encode_profile = ImageEditor::EncodeProfile::SMALL;
+  for (const auto& status : run(jobs, options)) {
+    EXPECT_EQ(ImageEditor::Status::SUCCESS, status.status) << status.input;
+    EXPECT_EQ(Reader::ImageType::PNG, Reader::probe_image(status.output.string())->type) << status.output;
+  }
+}
+
+TEST_F(BatchTest, RunStaysInsideMemoryBudget) {
+  vector<fs::path> files = make_images(12);
+  ASSERT_EQ(12, files.size());
+
+  // Room for two of the decoded images at a time
+  Options options{ 2, 1, 2, 2 };
+  options.memory_budget = 2 * 131 * 102 * 3;
+  Engine engine(options, [](const FileStatus& file_status) {
+    EXPECT_EQ(ImageEditor::Status::SUCCESS, file_status.status) << file_status.input;
+  });
+  for (const auto& job : make_jobs(files, OUT_DIR))
+    engine.submit(job);
+  engine.close();
+
+  MemoryStats stats = engine.memory_stats();
+  EXPECT_EQ(12u, stats.admitted);
+  EXPECT_LE(stats.peak_bytes, options.memory_budget);
+  EXPECT_GT(stats.peak_utilization(), 0);
+  EXPECT_LE(stats.mean_utilization(), 1.0);
+}
+
+TEST_F(BatchTest, SubmitAfterCloseIsRejected) {
+  Engine engine(Options{ 1, 1, 1, 1 });
+  engine.close();
+  EXPECT_FALSE(engine.submit(Job(DIST_DIR / "image.png")));
+}
+
+TEST(BoundedQueueTest, BlocksProducerUntilConsumed) {
+  BoundedQueue<int> queue(1);
+  ASSERT_TRUE(queue.push(1));
+  std::thread producer([&] { queue.push(2); queue.close(); });
+
+  EXPECT_EQ(1, queue.pop().value());
+  EXPECT_EQ(2, queue.pop().value());
+  producer.join();
+  EXPECT_FALSE(queue.pop().has_value());
+  EXPECT_FALSE(queue.push(3));
+}
+
+TEST(MemorySchedulerTest, AdmitsLargestThatFits) {
+  MemoryScheduler<char> scheduler(10, 8);
+  scheduler.push('a', 5);
+  scheduler.push('b', 1);
+  scheduler.push('c', 8);
+  scheduler.push('d', 3);
+
+  EXPECT_EQ('c', scheduler.pop().value());
+  // 'a' does not fit next to 'c', the slack goes to the largest that does
+  EXPECT_EQ('b', scheduler.pop().value());
+  scheduler.release(8);
+  EXPECT_EQ('a', scheduler.pop().value());
+  EXPECT_EQ('d', scheduler.pop().value());
+  scheduler.close();
+  EXPECT_FALSE(scheduler.pop().has_value());
+
+  MemoryStats stats = scheduler.stats();
+  EXPECT_EQ(10u, stats.budget_bytes);
+  EXPECT_EQ(9u, stats.peak_bytes);
+  EXPECT_EQ(4u, stats.admitted);
+  EXPECT_EQ(0u, stats.waits);
+}
+
+TEST(MemorySchedulerTest, WaitsForReleasedBytes) {
+  MemoryScheduler<int> scheduler(10, 4);
+  // Bigger than the budget, so it runs alone
+  scheduler.push(1, 50);
+  EXPECT_EQ(1, scheduler.pop().value());
+  scheduler.push(2, 1);
+
+  std::optional<int> second;
+  std::thread consumer([&] { second = scheduler.pop(); });
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  scheduler.release(50);
+  consumer.join();
+  EXPECT_EQ(2, second.value());
+  EXPECT_EQ(1u, scheduler.stats().waits);
+  EXPECT_GT(scheduler.stats().wait_seconds, 0);
+}
+
+TEST(MemorySchedulerTest, LargestIsNotStarved) {
+  MemoryScheduler<int> scheduler(10, 2);
+  scheduler.push(0, 5);
+  EXPECT_EQ(0, scheduler.pop().value());
+  // 8 does not fit next to 5, small items may pass it only twice (the capacity)
+  scheduler.push(8, 8);
+  scheduler.push(1, 1);
+  EXPECT_EQ(1, scheduler.pop().value());
+  scheduler.push(2, 1);
+  EXPECT_EQ(2, scheduler.pop().value());
+  scheduler.push(3, 1);
+
+  std::optional<int> next;
+  std::thread consumer([&] { next = scheduler.pop(); });
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  scheduler.release(5);
+  scheduler.release(1);
+  scheduler.release(1);
+  consumer.join();
+  EXPECT_EQ(8, next.value());
+}
@@ -0,0 +1,177 @@
+#include "include/color.hpp"
+#include "include/pipeline.hpp"
+#include "test/test_utils.hpp"
+#include <gtest/gtest.h>
+#include <opencv2/opencv.hpp>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+
+namespace fs = std::filesystem;
+using namespace ImageEditor;
+using TestUtils::make_image;
+
+class ColorTest : public ::testing::Test {
+public:
+  const fs::path DIST_DIR = fs::current_path() / "dist";
+
+  // A 3D table of the given size, each entry made by map from its RGB input in [0, 1]
+  template <typename Map>
+  void write_cube(const fs::path& cube_path, int size, Map map) {
+    std::ofstream file(cube_path);
+    file << "# Written by ColorTest\nTITLE \"test\"\nLUT_3D_SIZE " << size << "\n\n";
+    for (int b = 0; b < size; b++) {
+      for (int g = 0; g < size; g++) {
+        for (int r = 0; r < size; r++) {
+          cv::Vec3f rgb = map(cv::Vec3f(float(r), float(g), float(b)) / float(size - 1));
+          file << rgb[0] << " " << rgb[1] << " " << rgb[2] << "\n";
+        }
+      }
+    }
+  }
+
+protected:
+  void SetUp() override { fs::create_directory(DIST_DIR); }
+
+  void TearDown() override {
+    fs::remove_all(DIST_DIR);
+    set_simd_level(supported_simd_level());
+  }
+};
+
+TEST_F(ColorTest, IdentityChangesNothing) {
+  ColorGrade grade;
+  EXPECT_TRUE(grade.is_identity());
+  cv::Mat image = make_image(64, 48);
+  cv::Mat original = image.clone();
+  EXPECT_TRUE(grade.apply(image));
+  EXPECT_EQ(0, cv::norm(original, image, cv::NORM_INF));
+}
+
+TEST_F(ColorTest, AdjustmentsMatchTheirFormula) {
+  ColorAdjustment adjustment{ 0.1, 1.5, 1, 2.2 };
+  cv::Mat image(1, 256, CV_8UC3);
+  for (int v = 0; v < 256; v++)
+    image.at<cv::Vec3b>(0, v) = cv::Vec3b(uchar(v), uchar(255 - v), uchar(v / 2));
+  cv::Mat original = image.clone();
+  ASSERT_TRUE(ColorGrade(adjustment).apply(image));
+
+  for (int v = 0; v < 256; v++) {
+    for (int c = 0; c < 3; c++) {
+      double x = original.at<cv::Vec3b>(0, v)[c] / 255.0;
+      double y = std::pow(std::clamp((x + adjustment.brightness - 0.5) * adjustment.contrast + 0.5, 0.0, 1.0), 1 / adjustment.gamma);
+      EXPECT_NEAR(y * 255, image.at<cv::Vec3b>(0, v)[c], 1.0);
+    }
+  }
+}
+
+TEST_F(ColorTest, ZeroSaturationIsGray) {
+  cv::Mat image = make_image(100, 20, CV_8UC4);
+  cv::Mat original = image.clone();
+  ASSERT_TRUE(ColorGrade(ColorAdjustment{ .saturation = 0 }).apply(image));
+
+  cv::Mat gray;
+  cv::cvtColor(original, gray, cv::COLOR_BGRA2GRAY);
+  std::vector<cv::Mat> channels;
+  cv::split(image, channels);
+  for (int c = 0; c < 3; c++)
+    EXPECT_LE(cv::norm(gray, channels[c], cv::NORM_INF), 1);
+  // Alpha is kept
+  std::vector<cv::Mat> original_channels;
+  cv::split(original, original_channels);
+  EXPECT_EQ(0, cv::norm(original_channels[3], channels[3], cv::NORM_INF));
+}
+
+TEST_F(ColorTest, SimdLevelsAgree) {
+  ColorGrade grade(ColorAdjustment{ 0.05, 1.2, 1.3, 1.4 });
+  for (int type : { CV_8UC3, CV_16UC3, CV_16UC1 }) {
+    cv::Mat image = make_image(1001, 17, type);
+    set_simd_level(SimdLevel::SCALAR);
+    cv::Mat expected = image.clone();
+    ASSERT_TRUE(grade.apply(expected));
+    for (SimdLevel level : { SimdLevel::SSE, SimdLevel::AVX2 }) {
+      set_simd_level(level);
+      EXPECT_LE(simd_level(), supported_simd_level());
+      cv::Mat graded = image.clone();
+      ASSERT_TRUE(grade.apply(graded));
+      EXPECT_LE(cv::norm(expected, graded, cv::NORM_INF), CV_MAT_DEPTH(type) == CV_16U ? 2 : 1);
+    }
+  }
+}
+
+TEST_F(ColorTest, SixteenBitKeepsPrecision) {
+  cv::Mat image(1, 65536, CV_16UC1);
+  for (int v = 0; v < 65536; v++)
+    image.at<ushort>(0, v) = ushort(v);
+  ASSERT_TRUE(ColorGrade(ColorAdjustment{ .contrast = 0.5 }).apply(image));
+  // Halving the contrast of a ramp leaves 32768 distinct levels, more than 8 bits could hold
+  for (int v = 0; v < 65536; v += 997)
+    EXPECT_NEAR((v / 65535.0 - 0.5) * 0.5 * 65535 + 32767.5, image.at<ushort>(0, v), 2.0);
+}
+
+TEST_F(ColorTest, LoadsCubeFiles) {
+  fs::path cube_path = DIST_DIR / "identity.cube";
+  write_cube(cube_path, 17, [](cv::Vec3f rgb) { return rgb; });
+  Result<CubeLut> lut = load_cube(cube_path);
+  ASSERT_EQ(Status::SUCCESS, lut.status);
+  EXPECT_TRUE(lut.data.is_3d);
+  EXPECT_EQ(17, lut.data.size);
+  EXPECT_EQ(std::size_t(17 * 17 * 17 * 3), lut.data.table.size());
+
+  std::ofstream(DIST_DIR / "invert.cube") << "LUT_1D_SIZE 2\nDOMAIN_MIN 0 0 0\nDOMAIN_MAX 1 1 1\n1 1 1\n0 0 0\n";
+  Result<CubeLut> invert = load_cube(DIST_DIR / "invert.cube");
+  ASSERT_EQ(Status::SUCCESS, invert.status);
+  EXPECT_FALSE(invert.data.is_3d);
+
+  std::ofstream(DIST_DIR / "short.cube") << "LUT_3D_SIZE 2\n0 0 0\n1 1 1\n";
+  std::ofstream(DIST_DIR / "garbage.cube") << "LUT_3D_SIZE 2\n0 zero 0\n";
+  std::ofstream(DIST_DIR / "domain.cube") << "LUT_1D_SIZE 2\nDOMAIN_MIN 1 1 1\nDOMAIN_MAX 1 1 1\n0 0 0\n1 1 1\n";
+  EXPECT_EQ(Status::FAILURE, load_cube(DIST_DIR / "short.cube").status);
+  EXPECT_EQ(Status::FAILURE, load_cube(DIST_DIR / "garbage.cube").status);
+  EXPECT_EQ(Status::FAILURE, load_cube(DIST_DIR / "domain.cube").status);
+  EXPECT_EQ(Status::FAILURE, load_cube(DIST_DIR / "missing.cube").status);
+}
+
+TEST_F(ColorTest, AppliesLuts) {
+  fs::path identity_path = DIST_DIR / "identity.cube";
+  fs::path swap_path = DIST_DIR / "swap.cube";
+  write_cube(identity_path, 9, [](cv::Vec3f rgb) { return rgb; });
+  write_cube(swap_path, 2, [](cv::Vec3f rgb) { return cv::Vec3f(rgb[2], rgb[1], rgb[0]); });
+  cv::Mat image = make_image(300, 30);
+
+  cv::Mat graded = image.clone();
+  ASSERT_TRUE(ColorGrade(ColorAdjustment(), std::make_shared<CubeLut>(load_cube(identity_path).data)).apply(graded));
+  EXPECT_LE(cv::norm(image, graded, cv::NORM_INF), 1);
+
+  // Swapping red and blue turns BGR into RGB
+  graded = image.clone();
+  ASSERT_TRUE(ColorGrade(ColorAdjustment(), std::make_shared<CubeLut>(load_cube(swap_path).data)).apply(graded));
+  cv::Mat expected;
+  cv::cvtColor(image, expected, cv::COLOR_BGR2RGB);
+  EXPECT_LE(cv::norm(expected, graded, cv::NORM_INF), 1);
+}
+
+TEST_F(ColorTest, GradesInTheCropPass) {
+  cv::Mat image = make_image(300, 200);
+  fs::path input_path = DIST_DIR / "image.png";
+  cv::imwrite(input_path.string(), image);
+  ColorGrade grade(ColorAdjustment{ .brightness = -0.1, .saturation = 1.5 });
+
+  cv::Mat expected = image(cv::Rect(100, 0, 200, 200)).clone();
+  ASSERT_TRUE(grade.apply(expected));
+  Result<cv::Mat> piped = Pipeline(image).crop_square(PivotRect(HorizontalPivot::RIGHT)).color(grade).run();
+  ASSERT_EQ(Status::SUCCESS, piped.status);
+  EXPECT_EQ(0, cv::norm(expected, piped.data, cv::NORM_INF));
+
+  fs::path output_path = DIST_DIR / "graded.png";
+  crop_square(input_path, PivotRect(HorizontalPivot::RIGHT), output_path, grade);
+  cv::Mat written = cv::imread(output_path.string(), cv::IMREAD_UNCHANGED);
+  EXPECT_EQ(0, cv::norm(expected, written, cv::NORM_INF));
+}
+
+TEST_F(ColorTest, RejectsUnsupportedImages) {
+  ColorGrade grade(ColorAdjustment{ .contrast = 2 });
+  cv::Mat image(10, 10, CV_32FC3, cv::Scalar::all(0.5));
+  EXPECT_FALSE(grade.apply(image));
+  EXPECT_EQ(Status::FAILURE, Pipeline(image).color(grade).run().status);
+}
@@ -0,0 +1,62 @@
+#include "include/encode_profile.hpp"
+#include "include/image_editor.hpp"
+#include <gtest/gtest.h>
+#include <opencv2/opencv.hpp>
+#include <string>
+#include <vector>
+
+using std::string;
+using std::vector;
+using namespace ImageEditor;
+
+// A screenshot-like image: flat blocks with sharp edges, which the PNG profiles compress differently
+static cv::Mat make_screenshot(int width, int height) {
+  cv::RNG rng(7);
+  cv::Mat image(height, width, CV_8UC3, cv::Scalar(240, 240, 240));
+  for (int i = 0; i < 40; i++) {
+    cv::Point top_left(rng.uniform(0, width), rng.uniform(0, height));
+    cv::Point bottom_right(rng.uniform(0, width), rng.uniform(0, height));
+    cv::rectangle(image, top_left, bottom_right, cv::Scalar(rng.uniform(0, 256), rng.uniform(0, 256), rng.uniform(0, 256)), cv::FILLED);
+  }
+  return image;
+}
+
+TEST(EncodeProfileTest, ParseEncodeProfile) {
+  EXPECT_EQ(EncodeProfile::FAST, parse_encode_profile("fast"));
+  EXPECT_EQ(EncodeProfile::BALANCED, parse_encode_profile("balanced"));
+  EXPECT_EQ(EncodeProfile::SMALL, parse_encode_profile("small"));
+  EXPECT_FALSE(parse_encode_profile("tiny").has_value());
+  for (EncodeProfile profile : { EncodeProfile::FAST, EncodeProfile::BALANCED, EncodeProfile::SMALL })
+    EXPECT_EQ(profile, parse_encode_profile(get_encode_profile_name(profile)));
+}
+
+TEST(EncodeProfileTest, GetEncodeParams) {
+  EXPECT_TRUE(get_encode_params(".png", EncodeProfile::FAST).empty());
+  EXPECT_EQ(vector<int>({ cv::IMWRITE_PNG_COMPRESSION, 9, cv::IMWRITE_PNG_STRATEGY, cv::IMWRITE_PNG_STRATEGY_DEFAULT }),
+    get_encode_params("png", EncodeProfile::SMALL));
+  EXPECT_EQ(vector<int>({ cv::IMWRITE_JPEG_QUALITY, 95, cv::IMWRITE_JPEG_OPTIMIZE, 0, cv::IMWRITE_JPEG_PROGRESSIVE, 0 }),
+    get_encode_params(".JPG", EncodeProfile::FAST));
+  EXPECT_EQ(vector<int>({ cv::IMWRITE_WEBP_QUALITY, 101 }), get_encode_params(".webp", EncodeProfile::BALANCED));
+  EXPECT_TRUE(get_encode_params(".bmp", EncodeProfile::SMALL).empty());
+  EXPECT_TRUE(get_encode_params(".txt", EncodeProfile::SMALL).empty());
+}
+
+TEST(EncodeProfileTest, SmallerProfilesWriteFewerBytes) {
+  cv::Mat image = make_screenshot(640, 480);
+  for (const string extension : { ".png", ".jpg" }) {
+    Result<vector<uchar>> fast = encode_image(image, extension, EncodeProfile::FAST);
+    Result<vector<uchar>> balanced = encode_image(image, extension, EncodeProfile::BALANCED);
+    Result<vector<uchar>> small = encode_image(image, extension, EncodeProfile::SMALL);
+    ASSERT_EQ(Status::SUCCESS, fast.status) << extension;
+    ASSERT_EQ(Status::SUCCESS, balanced.status) << extension;
+    ASSERT_EQ(Status::SUCCESS, small.status) << extension;
+    EXPECT_LE(balanced.data.size(), fast.data.size()) << extension;
+    EXPECT_LE(small.data.size(), balanced.data.size()) << extension;
+    EXPECT_LT(small.data.size(), fast.data.size()) << extension;
+  }
+
+  // PNG profiles are lossless
+  Result<vector<uchar>> small = encode_image(image, ".png", EncodeProfile::SMALL);
+  cv::Mat decoded = cv::imdecode(small.data, cv::IMREAD_UNCHANGED);
+  EXPECT_EQ(0, cv::norm(image, decoded, cv::NORM_INF));
+}
@@ -1,9 +1,11 @@
 #include "include/image_editor.hpp"
+#include "include/mat_pool.hpp"
 #include <gtest/gtest.h>
 #include <opencv2/opencv.hpp>
 #include <fstream>
 #include<filesystem>
 #include <cstdlib>
+#include <span>
 
 namespace fs = std::filesystem;
 using std::vector;
@@ -144,4 +146,130 @@ TEST_F(ImageEditorTest, GetVerticalCropRegion) {
     EXPECT_EQ(rect_left.height, crop_size);
     EXPECT_EQ(rect_right.y, crop_size);
     EXPECT_EQ(rect_right.height, crop_size);
-}
\ No newline at end of file
+}
+
+// Test getting the square region for landscape and portrait images
+TEST_F(ImageEditorTest, GetSquareRegion) {
+    cv::Rect left = get_square_region(1920, 1080, PivotRect(HorizontalPivot::LEFT, VerticalPivot::TOP));
+    cv::Rect right = get_square_region(1920, 1080, PivotRect(HorizontalPivot::RIGHT, VerticalPivot::TOP));
+    cv::Rect bottom = get_square_region(1080, 1920, PivotRect(HorizontalPivot::CENTER, VerticalPivot::BOTTOM));
+
+    EXPECT_EQ(left, cv::Rect(0, 0, 1080, 1080));
+    EXPECT_EQ(right, cv::Rect(840, 0, 1080, 1080));
+    EXPECT_EQ(bottom, cv::Rect(0, 840, 1080, 1080));
+}
+
+// Test parsing pivots from a file name suffix
+TEST_F(ImageEditorTest, ParsePivotSuffix) {
+    PivotRect both = parse_pivot_suffix("screenshot_rb");
+    PivotRect horizontal_only = parse_pivot_suffix("screenshot_l");
+    PivotRect none = parse_pivot_suffix("screenshot");
+
+    EXPECT_EQ(both.horizontal_pivot, HorizontalPivot::RIGHT);
+    EXPECT_EQ(both.vertical_pivot, VerticalPivot::BOTTOM);
+    EXPECT_EQ(horizontal_only.horizontal_pivot, HorizontalPivot::LEFT);
+    EXPECT_EQ(horizontal_only.vertical_pivot, VerticalPivot::CENTER);
+    EXPECT_EQ(none.horizontal_pivot, HorizontalPivot::CENTER);
+    EXPECT_EQ(none.vertical_pivot, VerticalPivot::CENTER);
+}
+
+// Test cropping an image held in memory into a new buffer and into a caller-provided one
+TEST_F(ImageEditorTest, CropSquareBuffer) {
+    for (auto& _image : images) {
+        std::ifstream file(_image.path / _image.name, std::ios::binary);
+        vector<char> encoded((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        std::span<const std::byte> input = std::as_bytes(std::span(encoded));
+
+        Result<vector<uchar>> cropped = crop_square(input, PivotRect(HorizontalPivot::LEFT), ".png");
+        ASSERT_EQ(cropped.status, Status::SUCCESS);
+        cv::Mat decoded = cv::imdecode(cropped.data, cv::IMREAD_COLOR);
+        EXPECT_EQ(decoded.cols, std::min(_image.width, _image.height));
+        EXPECT_EQ(decoded.cols, decoded.rows);
+
+        vector<std::byte> output(cropped.data.size());
+        Result<std::size_t> written = crop_square(input, PivotRect(HorizontalPivot::LEFT), "png", std::span(output));
+        EXPECT_EQ(written.status, Status::SUCCESS);
+        EXPECT_EQ(written.data, cropped.data.size());
+
+        Result<std::size_t> too_small = crop_square(input, PivotRect(HorizontalPivot::LEFT), "png", std::span(output).first(10));
+        EXPECT_EQ(too_small.status, Status::FAILURE);
+        EXPECT_EQ(too_small.data, cropped.data.size());
+    }
+}
+
+// Test cropping a decoded image, which returns a view and copies no pixels
+TEST_F(ImageEditorTest, CropSquareMat) {
+    cv::Mat image(100, 300, CV_8UC3, cv::Scalar(0, 0, 255));
+    Result<cv::Mat> square = crop_square(image, PivotRect(HorizontalPivot::RIGHT));
+    ASSERT_EQ(square.status, Status::SUCCESS);
+    EXPECT_EQ(square.data.cols, 100);
+    EXPECT_EQ(square.data.rows, 100);
+    EXPECT_EQ(square.data.data, image.ptr(0, 200));
+
+    Result<vector<uchar>> encoded = crop_square(image, PivotRect(), "jpg");
+    EXPECT_EQ(encoded.status, Status::SUCCESS);
+    EXPECT_FALSE(encoded.data.empty());
+    EXPECT_EQ(crop_square(cv::Mat(), PivotRect()).status, Status::FAILURE);
+}
+
+// Test decoding invalid bytes and encoding to an unknown format
+TEST_F(ImageEditorTest, DecodeEncodeInvalid) {
+    vector<std::byte> junk(64, std::byte{ 7 });
+    EXPECT_EQ(decode_image(junk).status, Status::FAILURE);
+    EXPECT_EQ(decode_image(std::span<const std::byte>()).status, Status::FAILURE);
+    EXPECT_EQ(encode_image(cv::Mat(10, 10, CV_8UC3), ".unknown").status, Status::FAILURE);
+}
+
+// Test reading and saving through a workspace, which reuses its buffers between images
+TEST_F(ImageEditorTest, ReadSaveWithWorkspace) {
+    MatPool pool;
+    Workspace workspace{ &pool };
+    for (auto& _image : images) {
+        Result<cv::Mat> image = read_image(_image.path / _image.name, workspace);
+        ASSERT_EQ(image.status, Status::SUCCESS);
+        Result<cv::Mat> expected = read_image(_image.path / _image.name);
+        EXPECT_EQ(image.data.size(), expected.data.size());
+        EXPECT_EQ(cv::norm(image.data, expected.data, cv::NORM_INF), 0);
+
+        EXPECT_TRUE(save_image(image.data, OUT_DIR / _image.name, workspace));
+        Result<cv::Mat> saved = read_image(OUT_DIR / _image.name);
+        EXPECT_EQ(saved.status, Status::SUCCESS);
+        EXPECT_EQ(saved.data.size(), expected.data.size());
+    }
+    EXPECT_GT(pool.stats().allocations, 0);
+    EXPECT_EQ(read_image("invalid_path/test.jpg", workspace).status, Status::FAILURE);
+    EXPECT_FALSE(save_image(cv::Mat(10, 10, CV_8UC3), OUT_DIR / "image.unknown", workspace));
+}
+
+// Test that cropping keeps gray, alpha and 16-bit pixels where the output format can store them
+TEST_F(ImageEditorTest, CropSquareKeepsChannelsAndDepth) {
+    cv::Mat gray(40, 60, CV_8UC1, cv::Scalar(90));
+    cv::Mat bgra(40, 60, CV_8UC4, cv::Scalar(10, 20, 30, 128));
+    cv::Mat deep(40, 60, CV_16UC3, cv::Scalar(1000, 30000, 65535));
+    ASSERT_TRUE(save_image(gray, DIST_DIR / "gray.png"));
+    ASSERT_TRUE(save_image(bgra, DIST_DIR / "alpha.png"));
+    ASSERT_TRUE(save_image(deep, DIST_DIR / "deep.png"));
+
+    crop_square(DIST_DIR / "gray.png", PivotRect(), OUT_DIR / "gray.png");
+    crop_square(DIST_DIR / "alpha.png", PivotRect(), OUT_DIR / "alpha.png");
+    crop_square(DIST_DIR / "deep.png", PivotRect(), OUT_DIR / "deep.png");
+    crop_square(DIST_DIR / "alpha.png", PivotRect(), OUT_DIR / "alpha.jpg");
+    EXPECT_EQ(cv::imread((OUT_DIR / "gray.png").string(), cv::IMREAD_UNCHANGED).type(), CV_8UC1);
+    EXPECT_EQ(cv::imread((OUT_DIR / "alpha.png").string(), cv::IMREAD_UNCHANGED).type(), CV_8UC4);
+    EXPECT_EQ(cv::imread((OUT_DIR / "deep.png").string(), cv::IMREAD_UNCHANGED).type(), CV_16UC3);
+    EXPECT_EQ(cv::imread((OUT_DIR / "alpha.jpg").string(), cv::IMREAD_UNCHANGED).type(), CV_8UC3);
+
+    Result<cv::Mat> color = read_image(DIST_DIR / "deep.png");
+    EXPECT_EQ(color.data.type(), CV_8UC3);
+}
+
+// Test adapting pixels to what an output format can store
+TEST_F(ImageEditorTest, FitToFormat) {
+    cv::Mat deep(2, 2, CV_16UC4, cv::Scalar(257 * 10, 257 * 20, 257 * 30, 0));
+    cv::Mat jpeg = fit_to_format(deep, ".jpg");
+    ASSERT_EQ(jpeg.type(), CV_8UC3);
+    EXPECT_EQ(jpeg.at<cv::Vec3b>(0, 0)[2], 30);
+    EXPECT_EQ(fit_to_format(deep, "png").type(), CV_16UC4);
+    EXPECT_EQ(fit_to_format(cv::Mat(2, 2, CV_8UC4), "bmp").type(), CV_8UC3);
+    EXPECT_EQ(fit_to_format(cv::Mat(2, 2, CV_8UC1), "jpg").type(), CV_8UC1);
+}
@@ -0,0 +1,147 @@
+#include "include/jpeg_crop.hpp"
+#include <gtest/gtest.h>
+#include <opencv2/opencv.hpp>
+#include <filesystem>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+
+namespace fs = std::filesystem;
+using namespace ImageEditor;
+
+class JpegCropTest : public ::testing::Test {
+public:
+  const fs::path DIST_DIR = fs::current_path() / "dist";
+  const fs::path OUT_DIR = DIST_DIR / "output";
+
+  // A grayscale gradient, so every 8x8 block has different coefficients
+  fs::path make_jpeg(fs::path name, int width, int height) {
+    cv::Mat image(height, width, CV_8UC1);
+    for (int y = 0; y < height; y++)
+      for (int x = 0; x < width; x++)
+        image.at<uchar>(y, x) = static_cast<uchar>((x * 7 + y * 13) % 256);
+    fs::path file_path = DIST_DIR / name;
+    cv::imwrite(file_path.string(), image);
+    return file_path;
+  }
+
+protected:
+  void SetUp() override { fs::create_directory(DIST_DIR); }
+
+  void TearDown() override { fs::remove_all(DIST_DIR); }
+};
+
+TEST_F(JpegCropTest, IsJpegCrop) {
+  EXPECT_TRUE(is_jpeg_crop("a.jpg", "b.JPEG"));
+  EXPECT_FALSE(is_jpeg_crop("a.jpg", "b.png"));
+  EXPECT_FALSE(is_jpeg_crop("a.png", "b.jpg"));
+}
+
+TEST_F(JpegCropTest, SquareRegionSnapsToMcuGrid) {
+  EXPECT_EQ(cv::Rect(416, 0, 1080, 1080), get_jpeg_square_region(1920, 1080, 16, 16, PivotRect()));
+  EXPECT_EQ(cv::Rect(832, 0, 1080, 1080), get_jpeg_square_region(1920, 1080, 16, 16, PivotRect(HorizontalPivot::RIGHT)));
+  EXPECT_EQ(cv::Rect(0, 840, 1080, 1080), get_jpeg_square_region(1080, 1920, 8, 8, PivotRect(HorizontalPivot::LEFT, VerticalPivot::BOTTOM)));
+}
+
+TEST_F(JpegCropTest, CropIsLossless) {
+  fs::path input = make_jpeg("image.jpg", 643, 355);
+  fs::path output = OUT_DIR / "image.jpg";
+  PivotRect pivot_rect(HorizontalPivot::RIGHT, VerticalPivot::CENTER);
+  ASSERT_TRUE(crop_square_jpeg(input, pivot_rect, output));
+
+  cv::Mat original = cv::imread(input.string(), cv::IMREAD_GRAYSCALE);
+  cv::Mat cropped = cv::imread(output.string(), cv::IMREAD_GRAYSCALE);
+  ASSERT_FALSE(cropped.empty());
+  ASSERT_EQ(355, cropped.cols);
+  ASSERT_EQ(355, cropped.rows);
+
+  // Grayscale blocks decode independently, so the pixels must match exactly
+  cv::Rect region = get_jpeg_square_region(original.cols, original.rows, 8, 8, pivot_rect);
+  cv::Mat expected = original(region);
+  EXPECT_EQ(0, cv::countNonZero(expected != cropped));
+}
+
+TEST_F(JpegCropTest, CropSquareUsesLosslessPath) {
+  fs::path input = make_jpeg("image_l.jpeg", 300, 200);
+  crop_square(input, parse_pivot_suffix("image_l"), OUT_DIR / "image_l.jpeg");
+
+  cv::Mat cropped = cv::imread((OUT_DIR / "image_l.jpeg").string(), cv::IMREAD_GRAYSCALE);
+  ASSERT_FALSE(cropped.empty());
+  EXPECT_EQ(200, cropped.cols);
+  EXPECT_EQ(200, cropped.rows);
+}
+
+TEST_F(JpegCropTest, CropInPlace) {
+  fs::path input = make_jpeg("image.jpg", 643, 355);
+  cv::Mat original = cv::imread(input.string(), cv::IMREAD_GRAYSCALE);
+  PivotRect pivot_rect(HorizontalPivot::RIGHT, VerticalPivot::CENTER);
+  ASSERT_TRUE(crop_square_jpeg(input, pivot_rect, input));
+
+  cv::Mat cropped = cv::imread(input.string(), cv::IMREAD_GRAYSCALE);
+  cv::Mat expected = original(get_jpeg_square_region(original.cols, original.rows, 8, 8, pivot_rect));
+  ASSERT_EQ(expected.size(), cropped.size());
+  EXPECT_EQ(0, cv::countNonZero(expected != cropped));
+
+  // The public crop goes through the same path
+  fs::path other = make_jpeg("other_l.jpg", 300, 200);
+  crop_square(other, parse_pivot_suffix("other_l"), other);
+  EXPECT_EQ(cv::Size(200, 200), cv::imread(other.string(), cv::IMREAD_GRAYSCALE).size());
+
+  // Only the two images are left, no temporary files
+  EXPECT_EQ(2, std::distance(fs::directory_iterator(DIST_DIR), fs::directory_iterator()));
+}
+
+TEST_F(JpegCropTest, InvalidJpegLeavesNoOutput) {
+  fs::path input = DIST_DIR / "fake.jpg";
+  cv::imwrite((DIST_DIR / "fake.png").string(), cv::Mat(10, 10, CV_8UC1, cv::Scalar(0)));
+  fs::rename(DIST_DIR / "fake.png", input);
+
+  EXPECT_FALSE(crop_square_jpeg(input, PivotRect(), OUT_DIR / "fake.jpg"));
+  EXPECT_FALSE(fs::exists(OUT_DIR / "fake.jpg"));
+
+  // Nor does a failed crop onto the input remove it
+  EXPECT_FALSE(crop_square_jpeg(input, PivotRect(), input));
+  EXPECT_TRUE(fs::exists(input));
+}
+
+TEST_F(JpegCropTest, CropFromMemoryMatchesFile) {
+  fs::path input = make_jpeg("image.jpg", 300, 200);
+  fs::path output = OUT_DIR / "image.jpg";
+  ASSERT_TRUE(crop_square_jpeg(input, PivotRect(HorizontalPivot::RIGHT), output));
+
+  std::ifstream file(input, std::ios::binary);
+  std::vector<char> encoded((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+  Result<std::vector<uchar>> cropped = crop_square_jpeg(std::as_bytes(std::span(encoded)), PivotRect(HorizontalPivot::RIGHT));
+  ASSERT_EQ(Status::SUCCESS, cropped.status);
+
+  std::ifstream expected_file(output, std::ios::binary);
+  std::vector<uchar> expected((std::istreambuf_iterator<char>(expected_file)), std::istreambuf_iterator<char>());
+  EXPECT_EQ(expected, cropped.data);
+
+  std::vector<std::byte> junk(64, std::byte{ 1 });
+  EXPECT_EQ(Status::FAILURE, crop_square_jpeg(junk, PivotRect()).status);
+}
+
+TEST_F(JpegCropTest, CropFromMemoryIntoBuffer) {
+  fs::path input = make_jpeg("image.jpg", 300, 200);
+  std::ifstream file(input, std::ios::binary);
+  std::vector<char> encoded((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+  std::span<const std::byte> image = std::as_bytes(std::span(encoded));
+  std::optional<Reader::ImageInfo> info = Reader::probe_image(image);
+  ASSERT_TRUE(info.has_value());
+  Result<std::vector<uchar>> expected = crop_square_jpeg(image, *info, PivotRect(HorizontalPivot::RIGHT));
+  ASSERT_EQ(Status::SUCCESS, expected.status);
+
+  std::vector<std::byte> output(expected.data.size());
+  Result<std::size_t> written = crop_square_jpeg(image, *info, PivotRect(HorizontalPivot::RIGHT), std::span(output));
+  ASSERT_EQ(Status::SUCCESS, written.status);
+  ASSERT_EQ(expected.data.size(), written.data);
+  EXPECT_EQ(0, std::memcmp(expected.data.data(), output.data(), output.size()));
+
+  // Too small buffers report the size needed, whether they fill up early or late
+  for (std::size_t size : { std::size_t(0), std::size_t(10), output.size() - 1 }) {
+    Result<std::size_t> too_small = crop_square_jpeg(image, *info, PivotRect(HorizontalPivot::RIGHT), std::span(output).first(size));
+    EXPECT_EQ(Status::FAILURE, too_small.status) << size;
+    EXPECT_EQ(expected.data.size(), too_small.data) << size;
+  }
+}
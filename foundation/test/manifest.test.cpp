@@ -0,0 +1,178 @@
+#include "include/manifest.hpp"
+#include <gtest/gtest.h>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+
+namespace fs = std::filesystem;
+using namespace Manifest;
+using ImageEditor::HorizontalPivot;
+using ImageEditor::VerticalPivot;
+
+class ManifestTest : public ::testing::Test {
+public:
+  const fs::path DIST_DIR = fs::current_path() / "dist";
+  const fs::path MANIFEST = DIST_DIR / "manifest";
+  const fs::path INPUT = DIST_DIR / "image.png";
+  const fs::path OUTPUT = DIST_DIR / "output.png";
+
+  void write_file(const fs::path& path, const std::string& content) {
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file << content;
+  }
+
+protected:
+  void SetUp() override {
+    fs::create_directory(DIST_DIR);
+    write_file(INPUT, "input pixels");
+    write_file(OUTPUT, "output pixels");
+  }
+
+  void TearDown() override { fs::remove_all(DIST_DIR); }
+};
+
+TEST_F(ManifestTest, HashFile) {
+  write_file(DIST_DIR / "copy.png", "input pixels");
+  EXPECT_EQ(hash_file(INPUT), hash_file(DIST_DIR / "copy.png"));
+  EXPECT_NE(hash_file(INPUT), hash_file(OUTPUT));
+  EXPECT_EQ(0, hash_file(DIST_DIR / "missing.png"));
+}
+
+TEST_F(ManifestTest, MissingManifestIsEmpty) {
+  Index index;
+  EXPECT_TRUE(index.load(MANIFEST));
+  EXPECT_EQ(0, index.size());
+  EXPECT_FALSE(index.is_up_to_date(INPUT, PivotRect(), OUTPUT));
+}
+
+TEST_F(ManifestTest, InvalidManifestIsRejected) {
+  write_file(MANIFEST, "definitely not a manifest");
+  Index index;
+  EXPECT_FALSE(index.load(MANIFEST));
+  EXPECT_EQ(0, index.size());
+}
+
+TEST_F(ManifestTest, SaveAndLoadRoundTrip) {
+  PivotRect pivot_rect(HorizontalPivot::LEFT, VerticalPivot::BOTTOM);
+  {
+    Index index;
+    ASSERT_TRUE(index.load(MANIFEST));
+    ASSERT_TRUE(index.record(INPUT, pivot_rect, OUTPUT));
+    ASSERT_TRUE(index.save(MANIFEST));
+  }
+
+  Index index;
+  ASSERT_TRUE(index.load(MANIFEST));
+  ASSERT_EQ(1, index.size());
+  std::optional<Entry> entry = index.find(INPUT);
+  ASSERT_TRUE(entry.has_value());
+  EXPECT_EQ(OUTPUT, entry->output);
+  EXPECT_EQ(fs::file_size(INPUT), entry->size);
+  EXPECT_EQ(hash_file(INPUT), entry->hash);
+  EXPECT_EQ(HorizontalPivot::LEFT, entry->pivot_rect.horizontal_pivot);
+  EXPECT_EQ(VerticalPivot::BOTTOM, entry->pivot_rect.vertical_pivot);
+
+  EXPECT_TRUE(index.is_up_to_date(INPUT, pivot_rect, OUTPUT));
+  EXPECT_FALSE(index.is_up_to_date(INPUT, PivotRect(), OUTPUT));
+  EXPECT_FALSE(index.is_up_to_date(INPUT, pivot_rect, DIST_DIR / "elsewhere.png"));
+}
+
+TEST_F(ManifestTest, ChangesAreDetected) {
+  Index index;
+  ASSERT_TRUE(index.record(INPUT, PivotRect(), OUTPUT));
+
+  // Touching without changing the content is still up to date
+  fs::last_write_time(INPUT, fs::last_write_time(INPUT) + std::chrono::seconds(10));
+  EXPECT_TRUE(index.is_up_to_date(INPUT, PivotRect(), OUTPUT));
+
+  // Same size, different content
+  write_file(INPUT, "INPUT PIXELS");
+  fs::last_write_time(INPUT, fs::last_write_time(INPUT) + std::chrono::seconds(20));
+  EXPECT_FALSE(index.is_up_to_date(INPUT, PivotRect(), OUTPUT));
+
+  // A missing output has to be written again
+  ASSERT_TRUE(index.record(INPUT, PivotRect(), OUTPUT));
+  fs::remove(OUTPUT);
+  EXPECT_FALSE(index.is_up_to_date(INPUT, PivotRect(), OUTPUT));
+}
+
+TEST_F(ManifestTest, RecordWithKnownHash) {
+  Index index;
+  EXPECT_FALSE(index.record(INPUT, PivotRect(), OUTPUT, EncodeProfile::FAST, 0));
+  ASSERT_TRUE(index.record(INPUT, PivotRect(), OUTPUT, EncodeProfile::FAST, hash_file(INPUT)));
+  EXPECT_EQ(hash_file(INPUT), index.find(INPUT)->hash);
+
+  // Touched but not modified is still told apart by the hash
+  fs::last_write_time(INPUT, fs::last_write_time(INPUT) + std::chrono::seconds(10));
+  EXPECT_TRUE(index.is_up_to_date(INPUT, PivotRect(), OUTPUT));
+}
+
+TEST_F(ManifestTest, EncodeProfileChangesAreDetected) {
+  {
+    Index index;
+    ASSERT_TRUE(index.load(MANIFEST));
+    ASSERT_TRUE(index.record(INPUT, PivotRect(), OUTPUT, EncodeProfile::FAST));
+    ASSERT_TRUE(index.save(MANIFEST));
+  }
+
+  // A re-run with another profile encodes the file again, and records the new profile
+  Index index;
+  ASSERT_TRUE(index.load(MANIFEST));
+  EXPECT_EQ(EncodeProfile::FAST, index.find(INPUT)->profile);
+  EXPECT_TRUE(index.is_up_to_date(INPUT, PivotRect(), OUTPUT, EncodeProfile::FAST));
+  EXPECT_FALSE(index.is_up_to_date(INPUT, PivotRect(), OUTPUT, EncodeProfile::SMALL));
+  ASSERT_TRUE(index.record(INPUT, PivotRect(), OUTPUT, EncodeProfile::SMALL));
+  EXPECT_TRUE(index.is_up_to_date(INPUT, PivotRect(), OUTPUT, EncodeProfile::SMALL));
+  EXPECT_FALSE(index.is_up_to_date(INPUT, PivotRect(), OUTPUT, EncodeProfile::FAST));
+}
+
+TEST_F(ManifestTest, SaveMergesWithMappedEntries) {
+  std::vector<fs::path> inputs;
+  for (char name : { 'c', 'a', 'e' }) {
+    inputs.push_back(DIST_DIR / (std::string(1, name) + ".png"));
+    write_file(inputs.back(), std::string(3, name));
+  }
+  {
+    Index index;
+    index.record(inputs[0], PivotRect(), OUTPUT);
+    index.record(inputs[1], PivotRect(), OUTPUT);
+    ASSERT_TRUE(index.save(MANIFEST));
+  }
+  {
+    Index index;
+    ASSERT_TRUE(index.load(MANIFEST));
+    index.record(inputs[2], PivotRect(), OUTPUT);
+    index.record(inputs[0], PivotRect(HorizontalPivot::RIGHT), OUTPUT);
+    EXPECT_EQ(3, index.size());
+    ASSERT_TRUE(index.save(MANIFEST));
+  }
+
+  Index index;
+  ASSERT_TRUE(index.load(MANIFEST));
+  EXPECT_EQ(3, index.size());
+  for (const auto& input : inputs)
+    EXPECT_TRUE(index.find(input).has_value()) << input;
+  EXPECT_EQ(HorizontalPivot::RIGHT, index.find(inputs[0])->pivot_rect.horizontal_pivot);
+}
+
+TEST_F(ManifestTest, FailedSaveKeepsTheOldManifest) {
+  {
+    Index index;
+    ASSERT_TRUE(index.record(INPUT, PivotRect(), OUTPUT));
+    ASSERT_TRUE(index.save(MANIFEST));
+  }
+
+  // The temporary file can't be written, so the manifest must not be replaced
+  fs::path temporary = MANIFEST;
+  temporary += ".tmp";
+  fs::create_directory(temporary);
+  Index index;
+  ASSERT_TRUE(index.load(MANIFEST));
+  ASSERT_TRUE(index.record(DIST_DIR / "output.png", PivotRect(), OUTPUT));
+  EXPECT_FALSE(index.save(MANIFEST));
+
+  Index reloaded;
+  ASSERT_TRUE(reloaded.load(MANIFEST));
+  EXPECT_EQ(1, reloaded.size());
+  EXPECT_TRUE(reloaded.find(INPUT).has_value());
+}
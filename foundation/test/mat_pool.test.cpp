@@ -0,0 +1,72 @@
+#include "include/mat_pool.hpp"
+#include <gtest/gtest.h>
+#include <opencv2/opencv.hpp>
+
+using namespace ImageEditor;
+
+TEST(MatPoolTest, ReusesReleasedBuffers) {
+  MatPool pool;
+  uchar* first_data;
+  {
+    cv::Mat image;
+    image.allocator = &pool;
+    image.create(1080, 1920, CV_8UC3);
+    first_data = image.data;
+    EXPECT_EQ(1, pool.stats().allocations);
+    EXPECT_EQ(0, pool.stats().reused);
+    EXPECT_GE(pool.stats().in_use_bytes, image.total() * image.elemSize());
+  }
+  EXPECT_EQ(0, pool.stats().in_use_bytes);
+  EXPECT_GT(pool.stats().cached_bytes, 0);
+
+  cv::Mat image;
+  image.allocator = &pool;
+  image.create(1080, 1920, CV_8UC3);
+  EXPECT_EQ(first_data, image.data);
+  EXPECT_EQ(2, pool.stats().allocations);
+  EXPECT_EQ(1, pool.stats().reused);
+  EXPECT_EQ(0, pool.stats().cached_bytes);
+
+  // A different size needs a new buffer
+  cv::Mat other;
+  other.allocator = &pool;
+  other.create(100, 100, CV_8UC1);
+  EXPECT_NE(first_data, other.data);
+  EXPECT_EQ(1, pool.stats().reused);
+}
+
+TEST(MatPoolTest, CopiesShareTheBuffer) {
+  MatPool pool;
+  cv::Mat copy;
+  {
+    cv::Mat image;
+    image.allocator = &pool;
+    image.create(10, 10, CV_8UC1);
+    image = cv::Scalar(7);
+    copy = image(cv::Rect(2, 2, 4, 4));
+  }
+  // The view keeps the buffer alive
+  EXPECT_EQ(0, pool.stats().cached_bytes);
+  EXPECT_EQ(7, copy.at<uchar>(0, 0));
+  copy.release();
+  EXPECT_GT(pool.stats().cached_bytes, 0);
+}
+
+TEST(MatPoolTest, RespectsCacheLimit) {
+  MatPool pool(4096);
+  {
+    cv::Mat image;
+    image.allocator = &pool;
+    image.create(100, 100, CV_8UC3);
+  }
+  EXPECT_EQ(0, pool.stats().cached_bytes);
+
+  {
+    cv::Mat image;
+    image.allocator = &pool;
+    image.create(10, 10, CV_8UC1);
+  }
+  EXPECT_EQ(4096, pool.stats().cached_bytes);
+  pool.trim();
+  EXPECT_EQ(0, pool.stats().cached_bytes);
+}
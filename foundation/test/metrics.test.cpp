@@ -0,0 +1,105 @@
+#include "include/metrics.hpp"
+#include <gtest/gtest.h>
+#include <chrono>
+#include <cmath>
+#include <string>
+
+using namespace Metrics;
+using namespace std::chrono_literals;
+
+class MetricsTest : public ::testing::Test {
+protected:
+  void SetUp() override {
+    set_enabled(true);
+    reset();
+  }
+
+  void TearDown() override {
+    set_enabled(true);
+    reset();
+  }
+};
+
+TEST_F(MetricsTest, HistogramBuckets) {
+  Histogram histogram;
+  histogram.record(500ns);    // <= 1us
+  histogram.record(1us);      // <= 1us
+  histogram.record(3us);      // <= 4us
+  histogram.record(1ms);      // <= 1024us
+  histogram.record(3600s);    // Overflow
+  EXPECT_EQ(5, histogram.count());
+  EXPECT_EQ(2, histogram.bucket(0));
+  EXPECT_EQ(1, histogram.bucket(2));
+  EXPECT_EQ(1, histogram.bucket(10));
+  EXPECT_EQ(1, histogram.bucket(Histogram::BUCKETS - 1));
+  EXPECT_NEAR(3600.0010045, histogram.sum_seconds(), 1e-6);
+
+  EXPECT_DOUBLE_EQ(1e-6, histogram.quantile_seconds(0.4));
+  EXPECT_DOUBLE_EQ(1024e-6, histogram.quantile_seconds(0.8));
+  EXPECT_TRUE(std::isinf(histogram.quantile_seconds(1)));
+
+  histogram.reset();
+  EXPECT_EQ(0, histogram.count());
+  EXPECT_EQ(0, histogram.quantile_seconds(0.5));
+}
+
+TEST_F(MetricsTest, CountersAndFailures) {
+  add(Counter::BYTES_READ, 100);
+  add(Counter::BYTES_READ, 20);
+  add(Counter::PIXELS_PROCESSED, 64);
+  add_failure("image.PNG");
+  add_failure("dir/image.jpg");
+  add_failure("image.txt");
+  EXPECT_EQ(120, value(Counter::BYTES_READ));
+  EXPECT_EQ(0, value(Counter::BYTES_WRITTEN));
+  EXPECT_EQ(64, value(Counter::PIXELS_PROCESSED));
+  EXPECT_EQ(1, failures("png"));
+  EXPECT_EQ(1, failures("jpeg"));
+  EXPECT_EQ(1, failures("other"));
+  EXPECT_EQ(0, failures("gif"));
+}
+
+TEST_F(MetricsTest, ScopedTimer) {
+  {
+    ScopedTimer timer(Stage::DECODE);
+  }
+  EXPECT_EQ(1, histogram(Stage::DECODE).count());
+  EXPECT_EQ(0, histogram(Stage::ENCODE).count());
+}
+
+TEST_F(MetricsTest, Disabled) {
+  set_enabled(false);
+  {
+    ScopedTimer timer(Stage::SCAN);
+  }
+  add(Counter::FILES_SCANNED, 10);
+  add_failure("image.png");
+  EXPECT_EQ(0, histogram(Stage::SCAN).count());
+  EXPECT_EQ(0, value(Counter::FILES_SCANNED));
+  EXPECT_EQ(0, failures("png"));
+}
+
+TEST_F(MetricsTest, Json) {
+  record(Stage::ENCODE, 2us);
+  add(Counter::BYTES_WRITTEN, 42);
+  add_failure("image.webp");
+  std::string json = to_json();
+  EXPECT_EQ('{', json.front());
+  EXPECT_EQ('}', json.back());
+  EXPECT_NE(std::string::npos, json.find("\"encode\":{\"count\":1,"));
+  EXPECT_NE(std::string::npos, json.find("\"bytes_written\":42"));
+  EXPECT_NE(std::string::npos, json.find("\"webp\":1"));
+}
+
+TEST_F(MetricsTest, Prometheus) {
+  record(Stage::CROP, 2us);
+  record(Stage::CROP, 2ms);
+  add(Counter::PIXELS_PROCESSED, 7);
+  std::string text = to_prometheus();
+  EXPECT_NE(std::string::npos, text.find("# TYPE chromaedit_stage_duration_seconds histogram\n"));
+  EXPECT_NE(std::string::npos, text.find("chromaedit_stage_duration_seconds_bucket{stage=\"crop\",le=\"2e-06\"} 1\n"));
+  EXPECT_NE(std::string::npos, text.find("chromaedit_stage_duration_seconds_bucket{stage=\"crop\",le=\"+Inf\"} 2\n"));
+  EXPECT_NE(std::string::npos, text.find("chromaedit_stage_duration_seconds_count{stage=\"crop\"} 2\n"));
+  EXPECT_NE(std::string::npos, text.find("chromaedit_pixels_processed_total 7\n"));
+  EXPECT_NE(std::string::npos, text.find("chromaedit_failures_total{format=\"png\"} 0\n"));
+}
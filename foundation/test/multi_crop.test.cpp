@@ -0,0 +1,75 @@
+#include "include/multi_crop.hpp"
+#include <gtest/gtest.h>
+#include <opencv2/opencv.hpp>
+#include <filesystem>
+
+namespace fs = std::filesystem;
+using namespace ImageEditor;
+
+class MultiCropTest : public ::testing::Test {
+public:
+  const fs::path DIST_DIR = fs::current_path() / "dist";
+  const fs::path OUT_DIR = DIST_DIR / "output";
+
+  // A smooth gradient, so scaling from a pyramid level and from full resolution look alike
+  cv::Mat make_image(int width, int height) {
+    cv::Mat image(height, width, CV_8UC3);
+    for (int y = 0; y < height; y++)
+      for (int x = 0; x < width; x++)
+        image.at<cv::Vec3b>(y, x) = cv::Vec3b(uchar(x * 255 / width), uchar(y * 255 / height), 128);
+    return image;
+  }
+
+protected:
+  void SetUp() override { fs::create_directory(DIST_DIR); }
+
+  void TearDown() override { fs::remove_all(DIST_DIR); }
+};
+
+TEST_F(MultiCropTest, PyramidLevels) {
+  ImagePyramid pyramid(make_image(300, 101));
+  EXPECT_EQ(1, pyramid.built_levels());
+  EXPECT_EQ(cv::Size(150, 51), pyramid.level(1).size());
+  EXPECT_EQ(cv::Size(38, 13), pyramid.level(3).size());
+  EXPECT_EQ(4, pyramid.built_levels());
+  EXPECT_EQ(cv::Size(1, 1), pyramid.level(20).size());
+}
+
+TEST_F(MultiCropTest, ScaledMatchesFullResolution) {
+  cv::Mat image = make_image(800, 600);
+  ImagePyramid pyramid(image);
+  cv::Rect region(200, 0, 600, 600);
+
+  cv::Mat view = pyramid.scaled(region, 0);
+  EXPECT_EQ(image.ptr(0, 200), view.data);
+
+  for (int size : { 64, 150, 599, 700 }) {
+    cv::Mat scaled = pyramid.scaled(region, size);
+    cv::Mat expected;
+    cv::resize(image(region), expected, cv::Size(size, size), 0, 0, size < 600 ? cv::INTER_AREA : cv::INTER_LINEAR);
+    ASSERT_EQ(cv::Size(size, size), scaled.size());
+    EXPECT_LE(cv::norm(expected, scaled, cv::NORM_INF), 4) << size;
+  }
+  // 64 and 150 pixels were taken from levels 3 and 2
+  EXPECT_EQ(4, pyramid.built_levels());
+}
+
+TEST_F(MultiCropTest, CropSquares) {
+  fs::path input = DIST_DIR / "image.png";
+  cv::imwrite(input.string(), make_image(320, 200));
+  std::vector<OutputSpec> specs = {
+    OutputSpec(PivotRect(HorizontalPivot::LEFT), 0, OUT_DIR / "left.png"),
+    OutputSpec(PivotRect(HorizontalPivot::RIGHT), 64, OUT_DIR / "right.jpg"),
+    OutputSpec(PivotRect(), 32, OUT_DIR / "center.unknown"),
+  };
+  std::vector<Status> statuses = crop_squares(input, specs);
+  ASSERT_EQ(3, statuses.size());
+  EXPECT_EQ(Status::SUCCESS, statuses[0]);
+  EXPECT_EQ(Status::SUCCESS, statuses[1]);
+  EXPECT_EQ(Status::FAILURE, statuses[2]);
+  EXPECT_EQ(cv::Size(200, 200), cv::imread((OUT_DIR / "left.png").string()).size());
+  EXPECT_EQ(cv::Size(64, 64), cv::imread((OUT_DIR / "right.jpg").string()).size());
+
+  std::vector<Status> missing = crop_squares(DIST_DIR / "missing.png", specs);
+  EXPECT_EQ(std::vector<Status>(3, Status::FAILURE), missing);
+}
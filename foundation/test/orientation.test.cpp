@@ -0,0 +1,168 @@
+#include "include/orientation.hpp"
+#include "include/jpeg_crop.hpp"
+#include "include/multi_crop.hpp"
+#include "include/probe.hpp"
+#include "include/region_reader.hpp"
+#include <gtest/gtest.h>
+#include <opencv2/opencv.hpp>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <vector>
+
+namespace fs = std::filesystem;
+using namespace ImageEditor;
+
+class OrientationTest : public ::testing::Test {
+public:
+  const fs::path DIST_DIR = fs::current_path() / "dist";
+  const fs::path OUT_DIR = DIST_DIR / "output";
+
+  // A grayscale gradient JPEG of width x height stored pixels, shown with orientation
+  fs::path make_jpeg(fs::path name, int width, int height, int orientation) {
+    cv::Mat image(height, width, CV_8UC1);
+    for (int y = 0; y < height; y++)
+      for (int x = 0; x < width; x++)
+        image.at<uchar>(y, x) = static_cast<uchar>((x * 7 + y * 13) % 256);
+    std::vector<uchar> jpeg;
+    cv::imencode(".jpg", image, jpeg);
+
+    // An EXIF block with only the orientation tag, after the JFIF segment
+    const uchar exif[] = {
+      0xFF, 0xE1, 0, 34, 'E', 'x', 'i', 'f', 0, 0,
+      'I', 'I', 42, 0, 8, 0, 0, 0,
+      1, 0,
+      0x12, 0x01, 3, 0, 1, 0, 0, 0, uchar(orientation), 0, 0, 0,
+      0, 0, 0, 0,
+    };
+    std::size_t position = jpeg[3] == 0xE0 ? 4 + (jpeg[4] << 8 | jpeg[5]) : 2;
+    jpeg.insert(jpeg.begin() + position, std::begin(exif), std::end(exif));
+
+    fs::path file_path = DIST_DIR / name;
+    std::ofstream file(file_path, std::ios::binary);
+    file.write(reinterpret_cast<const char*>(jpeg.data()), std::streamsize(jpeg.size()));
+    return file_path;
+  }
+
+protected:
+  void SetUp() override { fs::create_directory(DIST_DIR); }
+
+  void TearDown() override { fs::remove_all(DIST_DIR); }
+};
+
+TEST_F(OrientationTest, MapRegions) {
+  EXPECT_EQ(cv::Size(3024, 4032), get_oriented_size(4032, 3024, 6));
+  EXPECT_EQ(cv::Size(4032, 3024), get_oriented_size(4032, 3024, 3));
+  EXPECT_EQ(cv::Rect(0, 20, 10, 10), to_stored_region(cv::Rect(0, 0, 10, 10), 40, 30, 6));
+  EXPECT_EQ(cv::Rect(30, 0, 10, 10), to_stored_region(cv::Rect(0, 0, 10, 10), 40, 30, 8));
+  EXPECT_EQ(cv::Rect(3, 5, 10, 20), to_stored_region(cv::Rect(3, 5, 10, 20), 40, 30, 1));
+
+  cv::Rect region(3, 5, 10, 20);
+  for (int orientation = 1; orientation <= 8; orientation++)
+    EXPECT_EQ(region, to_oriented_region(to_stored_region(region, 40, 30, orientation), 40, 30, orientation)) << orientation;
+}
+
+TEST_F(OrientationTest, OrientingTheSquareMatchesOrientingTheImage) {
+  cv::Mat stored(30, 40, CV_8UC1);
+  for (int y = 0; y < stored.rows; y++)
+    for (int x = 0; x < stored.cols; x++)
+      stored.at<uchar>(y, x) = static_cast<uchar>(y * 40 + x);
+
+  for (int orientation = 1; orientation <= 8; orientation++) {
+    cv::Mat oriented = apply_orientation(stored, orientation);
+    ASSERT_EQ(get_oriented_size(stored.cols, stored.rows, orientation), oriented.size()) << orientation;
+    for (PivotRect pivot_rect : { PivotRect(), PivotRect(HorizontalPivot::LEFT, VerticalPivot::TOP), PivotRect(HorizontalPivot::RIGHT, VerticalPivot::BOTTOM) }) {
+      cv::Mat expected = oriented(get_square_region(oriented.cols, oriented.rows, pivot_rect));
+      cv::Mat square = apply_orientation(stored(get_stored_square_region(stored, orientation, pivot_rect)), orientation);
+      ASSERT_EQ(expected.size(), square.size()) << orientation;
+      EXPECT_EQ(0, cv::norm(expected, square, cv::NORM_INF)) << orientation;
+    }
+  }
+
+  // Upright images are not copied
+  EXPECT_EQ(stored.data, apply_orientation(stored, 1).data);
+}
+
+TEST_F(OrientationTest, ProbeExifOrientation) {
+  fs::path image_path = make_jpeg("rotated.jpg", 96, 48, 6);
+  std::optional<Reader::ImageInfo> info = Reader::probe_image(image_path.string());
+  ASSERT_TRUE(info.has_value());
+  EXPECT_EQ(6, info->orientation);
+  EXPECT_EQ(96, info->width);
+  EXPECT_EQ(48, info->height);
+}
+
+TEST_F(OrientationTest, ReadSquareOfRotatedJpeg) {
+  fs::path image_path = make_jpeg("rotated.jpg", 96, 48, 6);
+  Result<cv::Mat> upright = read_image(image_path);
+  ASSERT_EQ(Status::SUCCESS, upright.status);
+  ASSERT_EQ(cv::Size(48, 96), upright.data.size());
+
+  for (VerticalPivot pivot : { VerticalPivot::TOP, VerticalPivot::BOTTOM }) {
+    PivotRect pivot_rect(HorizontalPivot::CENTER, pivot);
+    Result<cv::Mat> square = read_square(image_path, pivot_rect);
+    ASSERT_EQ(Status::SUCCESS, square.status);
+    cv::Mat expected = upright.data(get_square_region(upright.data, pivot_rect));
+    ASSERT_EQ(expected.size(), square.data.size());
+    EXPECT_EQ(0, cv::norm(expected, square.data, cv::NORM_INF));
+  }
+}
+
+TEST_F(OrientationTest, CropSquaresOfRotatedJpeg) {
+  fs::path image_path = make_jpeg("rotated.jpg", 96, 48, 8);
+  std::vector<OutputSpec> specs = { OutputSpec(PivotRect(HorizontalPivot::CENTER, VerticalPivot::TOP), 48, OUT_DIR / "top.png") };
+  std::vector<Status> statuses = crop_squares(image_path, specs);
+  ASSERT_EQ(Status::SUCCESS, statuses[0]);
+
+  Result<cv::Mat> upright = read_image(image_path, ReadMode::UNCHANGED);
+  cv::Mat expected = upright.data(cv::Rect(0, 0, 48, 48));
+  cv::Mat cropped = cv::imread((OUT_DIR / "top.png").string(), cv::IMREAD_UNCHANGED);
+  ASSERT_EQ(expected.size(), cropped.size());
+  EXPECT_EQ(0, cv::norm(expected, cropped, cv::NORM_INF));
+}
+
+TEST_F(OrientationTest, LosslessCropKeepsOrientation) {
+  fs::path image_path = make_jpeg("rotated.jpg", 96, 48, 6);
+  fs::path output_path = OUT_DIR / "bottom.jpg";
+  ASSERT_TRUE(crop_square_jpeg(image_path, PivotRect(HorizontalPivot::CENTER, VerticalPivot::BOTTOM), output_path));
+
+  std::optional<Reader::ImageInfo> info = Reader::probe_image(output_path.string());
+  ASSERT_TRUE(info.has_value());
+  EXPECT_EQ(6, info->orientation);
+
+  // The bottom of the upright image is on the right of the stored one, on the MCU grid
+  Result<cv::Mat> upright = read_image(image_path);
+  Result<cv::Mat> cropped = read_image(output_path);
+  ASSERT_EQ(Status::SUCCESS, cropped.status);
+  cv::Mat expected = upright.data(cv::Rect(0, 48, 48, 48));
+  ASSERT_EQ(expected.size(), cropped.data.size());
+  EXPECT_EQ(0, cv::norm(expected, cropped.data, cv::NORM_INF));
+}
+
+TEST_F(OrientationTest, LosslessCropWithProbedHeader) {
+  fs::path image_path = make_jpeg("rotated.jpg", 96, 48, 6);
+  std::optional<Reader::ImageInfo> info = Reader::probe_image(image_path.string());
+  ASSERT_TRUE(info.has_value());
+  PivotRect pivot_rect(HorizontalPivot::CENTER, VerticalPivot::BOTTOM);
+  ASSERT_TRUE(crop_square_jpeg(image_path, *info, pivot_rect, OUT_DIR / "probed.jpg"));
+  ASSERT_TRUE(crop_square_jpeg(image_path, pivot_rect, OUT_DIR / "bottom.jpg"));
+
+  // The header passed in gives the same crop as the one probed by crop_square_jpeg
+  Result<cv::Mat> probed = read_image(OUT_DIR / "probed.jpg");
+  Result<cv::Mat> expected = read_image(OUT_DIR / "bottom.jpg");
+  ASSERT_EQ(Status::SUCCESS, probed.status);
+  ASSERT_EQ(expected.data.size(), probed.data.size());
+  EXPECT_EQ(0, cv::norm(expected.data, probed.data, cv::NORM_INF));
+}
+
+TEST_F(OrientationTest, ReadImageFindsJpegsByTheirHeader) {
+  // A JPEG named like a PNG is still turned upright when its channels are kept
+  fs::path image_path = make_jpeg("rotated.png", 96, 48, 6);
+  Result<cv::Mat> upright = read_image(image_path, ReadMode::UNCHANGED);
+  ASSERT_EQ(Status::SUCCESS, upright.status);
+  EXPECT_EQ(cv::Size(48, 96), upright.data.size());
+
+  Result<cv::Mat> stored = read_stored_image(image_path, ReadMode::UNCHANGED);
+  ASSERT_EQ(Status::SUCCESS, stored.status);
+  EXPECT_EQ(cv::Size(96, 48), stored.data.size());
+}
@@ -0,0 +1,97 @@
+#include "include/pipeline.hpp"
+#include "include/region_reader.hpp"
+#include "test/test_utils.hpp"
+#include <gtest/gtest.h>
+#include <opencv2/opencv.hpp>
+#include <filesystem>
+
+namespace fs = std::filesystem;
+using namespace ImageEditor;
+using TestUtils::make_image;
+
+class PipelineTest : public ::testing::Test {
+public:
+  const fs::path DIST_DIR = fs::current_path() / "dist";
+
+  static std::array<uchar, 256> invert_table() {
+    std::array<uchar, 256> table;
+    for (int i = 0; i < 256; i++)
+      table[i] = uchar(255 - i);
+    return table;
+  }
+
+  static void halve(const uchar* src, uchar* dst, int pixels, int channels) {
+    for (int i = 0; i < pixels * channels; i++)
+      dst[i] = src[i] / 2;
+  }
+
+protected:
+  void SetUp() override { fs::create_directory(DIST_DIR); }
+
+  void TearDown() override { fs::remove_all(DIST_DIR); }
+};
+
+TEST_F(PipelineTest, CropsAreViews) {
+  cv::Mat image = make_image(400, 300);
+  Result<cv::Mat> result = Pipeline(image).crop(cv::Rect(100, 50, 250, 200)).crop_square(PivotRect(HorizontalPivot::RIGHT)).run();
+  ASSERT_EQ(Status::SUCCESS, result.status);
+  EXPECT_EQ(cv::Size(200, 200), result.data.size());
+  EXPECT_EQ(image.ptr(50, 150), result.data.data);
+}
+
+TEST_F(PipelineTest, FusedMapsMatchSeparatePasses) {
+  // Wider than one run of pixels, so rows are split between kernel calls
+  cv::Mat image = make_image(5000, 40);
+  cv::Mat original = image.clone();
+  std::array<uchar, 256> invert = invert_table();
+  cv::Rect region(10, 5, 4990, 30);
+  Result<cv::Mat> result = Pipeline(image).lut(invert).map(halve).crop(region).run();
+  ASSERT_EQ(Status::SUCCESS, result.status);
+
+  cv::Mat expected;
+  cv::LUT(image(region), cv::Mat(1, 256, CV_8U, invert.data()), expected);
+  for (int y = 0; y < expected.rows; y++)
+    halve(expected.ptr(y), expected.ptr(y), expected.cols, expected.channels());
+  EXPECT_EQ(0, cv::norm(expected, result.data, cv::NORM_INF));
+  // The caller's image is never written to
+  EXPECT_EQ(0, cv::norm(original, image, cv::NORM_INF));
+}
+
+TEST_F(PipelineTest, ConsecutiveResizesCollapse) {
+  cv::Mat image = make_image(640, 480);
+  Result<cv::Mat> result = Pipeline(image).resize(cv::Size(300, 300)).resize(cv::Size(64, 48)).run();
+  ASSERT_EQ(Status::SUCCESS, result.status);
+  cv::Mat expected;
+  cv::resize(image, expected, cv::Size(64, 48), 0, 0, cv::INTER_AREA);
+  EXPECT_EQ(0, cv::norm(expected, result.data, cv::NORM_INF));
+}
+
+TEST_F(PipelineTest, MapAfterResize) {
+  cv::Mat image = make_image(300, 200);
+  Result<cv::Mat> result = Pipeline(image).crop_square(PivotRect()).resize(cv::Size(50, 50)).map(halve).run();
+  ASSERT_EQ(Status::SUCCESS, result.status);
+  cv::Mat expected;
+  cv::resize(image(cv::Rect(50, 0, 200, 200)), expected, cv::Size(50, 50), 0, 0, cv::INTER_AREA);
+  for (int y = 0; y < expected.rows; y++)
+    halve(expected.ptr(y), expected.ptr(y), expected.cols, expected.channels());
+  EXPECT_EQ(0, cv::norm(expected, result.data, cv::NORM_INF));
+}
+
+TEST_F(PipelineTest, FileSourceReadsOnlyTheCrop) {
+  cv::Mat image = make_image(300, 100, CV_16UC3);
+  fs::path file_path = DIST_DIR / "image.png";
+  cv::imwrite(file_path.string(), image);
+  Result<cv::Mat> result = Pipeline(file_path).crop_square(PivotRect(HorizontalPivot::RIGHT)).run();
+  ASSERT_EQ(Status::SUCCESS, result.status);
+  Result<cv::Mat> expected = read_square(file_path, PivotRect(HorizontalPivot::RIGHT), ReadMode::UNCHANGED);
+  ASSERT_EQ(CV_16UC3, result.data.type());
+  EXPECT_EQ(0, cv::norm(expected.data, result.data, cv::NORM_INF));
+
+  EXPECT_EQ(Status::FAILURE, Pipeline(DIST_DIR / "missing.png").run().status);
+}
+
+TEST_F(PipelineTest, Failures) {
+  EXPECT_EQ(Status::FAILURE, Pipeline(cv::Mat()).crop_square(PivotRect()).run().status);
+  EXPECT_EQ(Status::FAILURE, Pipeline(make_image(10, 10)).crop(cv::Rect(5, 5, 10, 10)).run().status);
+  EXPECT_EQ(Status::FAILURE, Pipeline(make_image(10, 10, CV_16UC3)).map(halve).run().status);
+}
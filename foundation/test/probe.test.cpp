@@ -0,0 +1,135 @@
+#include "include/probe.hpp"
+#include <gtest/gtest.h>
+#include <opencv2/opencv.hpp>
+#include <filesystem>
+#include <fstream>
+#include <map>
+
+namespace fs = std::filesystem;
+using std::string;
+using std::vector;
+using Reader::ImageInfo;
+using Reader::ImageType;
+
+class ProbeTest : public ::testing::Test {
+public:
+  const fs::path DIST_DIR = fs::current_path() / "dist";
+
+  fs::path make_image(fs::path name, int width, int height, int type) {
+    fs::path file_path = DIST_DIR / name;
+    cv::Mat image(height, width, type, cv::Scalar(rand() % 256, rand() % 256, rand() % 256, 255));
+    cv::imwrite(file_path.string(), image);
+    return file_path;
+  }
+
+protected:
+  void SetUp() override { fs::create_directory(DIST_DIR); }
+
+  void TearDown() override { fs::remove_all(DIST_DIR); }
+};
+
+TEST_F(ProbeTest, ProbeMatchesDecodedImage) {
+  vector<std::pair<fs::path, ImageType>> images{
+    { "image.png", ImageType::PNG },
+    { "image.jpg", ImageType::JPEG },
+    { "image.bmp", ImageType::BMP },
+    { "image.tiff", ImageType::TIFF },
+    { "image.webp", ImageType::WEBP },
+  };
+  for (int type : { CV_8UC1, CV_8UC3 }) {
+    for (const auto& [name, image_type] : images) {
+      fs::path file_path = make_image(name, 321, 123, type);
+      std::optional<ImageInfo> info = Reader::probe_image(file_path.string());
+      ASSERT_TRUE(info.has_value()) << file_path;
+      EXPECT_EQ(image_type, info->type);
+      EXPECT_EQ(321, info->width);
+      EXPECT_EQ(123, info->height);
+      EXPECT_EQ(8, info->depth);
+
+      cv::Mat decoded = cv::imread(file_path.string(), cv::IMREAD_UNCHANGED);
+      // WebP has no grayscale mode, it always stores color
+      if (image_type != ImageType::WEBP)
+        EXPECT_EQ(decoded.channels(), info->channels) << file_path;
+    }
+  }
+}
+
+TEST_F(ProbeTest, ProbeSixteenBitAndAlpha) {
+  std::optional<ImageInfo> deep = Reader::probe_image(make_image("deep.png", 10, 20, CV_16UC1).string());
+  ASSERT_TRUE(deep.has_value());
+  EXPECT_EQ(16, deep->depth);
+  EXPECT_EQ(1, deep->channels);
+
+  std::optional<ImageInfo> alpha = Reader::probe_image(make_image("alpha.png", 10, 20, CV_8UC4).string());
+  ASSERT_TRUE(alpha.has_value());
+  EXPECT_EQ(4, alpha->channels);
+}
+
+TEST_F(ProbeTest, ProbeIgnoresExtension) {
+  fs::path file_path = make_image("image.png", 64, 32, CV_8UC3);
+  fs::rename(file_path, DIST_DIR / "image.jpg");
+  std::optional<ImageInfo> info = Reader::probe_image((DIST_DIR / "image.jpg").string());
+  ASSERT_TRUE(info.has_value());
+  EXPECT_EQ(ImageType::PNG, info->type);
+}
+
+TEST_F(ProbeTest, ProbeBuffer) {
+  vector<uchar> encoded;
+  cv::imencode(".jpg", cv::Mat(48, 96, CV_8UC3, cv::Scalar(1, 2, 3)), encoded);
+  std::span<const std::byte> bytes(reinterpret_cast<const std::byte*>(encoded.data()), encoded.size());
+
+  std::optional<ImageInfo> info = Reader::probe_image(bytes);
+  ASSERT_TRUE(info.has_value());
+  EXPECT_EQ(ImageType::JPEG, info->type);
+  EXPECT_EQ(96, info->width);
+  EXPECT_EQ(48, info->height);
+
+  // A truncated header is rejected instead of read past the end
+  EXPECT_FALSE(Reader::probe_image(bytes.first(10)).has_value());
+}
+
+TEST_F(ProbeTest, ProbeRejectsNonImages) {
+  std::ofstream(DIST_DIR / "document.txt") << "not an image at all";
+  EXPECT_FALSE(Reader::probe_image((DIST_DIR / "document.txt").string()).has_value());
+  EXPECT_FALSE(Reader::probe_image((DIST_DIR / "missing.png").string()).has_value());
+}
+
+TEST_F(ProbeTest, ProbeImagesInBatch) {
+  fs::create_directory(DIST_DIR / "nested");
+  vector<fs::path> paths{
+    make_image("a.png", 30, 20, CV_8UC3),
+    DIST_DIR / "missing.png",
+    make_image("b.jpg", 40, 10, CV_8UC3),
+    make_image(fs::path("nested") / "c.bmp", 5, 6, CV_8UC3),
+  };
+  vector<std::optional<ImageInfo>> infos = Reader::probe_images(paths);
+  ASSERT_EQ(paths.size(), infos.size());
+  ASSERT_TRUE(infos[0].has_value());
+  EXPECT_EQ(ImageType::PNG, infos[0]->type);
+  EXPECT_FALSE(infos[1].has_value());
+  ASSERT_TRUE(infos[2].has_value());
+  EXPECT_EQ(40, infos[2]->width);
+  ASSERT_TRUE(infos[3].has_value());
+  EXPECT_EQ(ImageType::BMP, infos[3]->type);
+}
+
+TEST_F(ProbeTest, ProbeImageFilesFindsImagesByContent) {
+  fs::create_directory(DIST_DIR / "nested");
+  fs::rename(make_image("plain.png", 12, 34, CV_8UC3), DIST_DIR / "plain");
+  fs::rename(make_image("mislabeled.png", 56, 78, CV_8UC1), DIST_DIR / "nested" / "mislabeled.jpg");
+  make_image(fs::path("nested") / "photo.jpg", 9, 9, CV_8UC3);
+  std::ofstream(DIST_DIR / "fake.png") << "not an image at all";
+  std::ofstream(DIST_DIR / "notes.txt") << "not an image either";
+
+  std::map<string, ImageInfo> found;
+  Reader::probe_image_files(DIST_DIR.string(), [&](const fs::path& path, const ImageInfo& info) {
+    found.emplace(path.filename().string(), info);
+  }, Reader::ScanOptions{ true, 2 });
+
+  ASSERT_EQ(3, found.size());
+  EXPECT_EQ(ImageType::PNG, found.at("plain").type);
+  EXPECT_EQ(34, found.at("plain").height);
+  EXPECT_EQ(ImageType::PNG, found.at("mislabeled.jpg").type);
+  EXPECT_EQ(1, found.at("mislabeled.jpg").channels);
+  EXPECT_EQ(ImageType::JPEG, found.at("photo.jpg").type);
+}
@@ -1,6 +1,7 @@
 #include "include/reader.hpp"
 #include <algorithm>
 #include <fstream>
+#include <mutex>
 #include <gtest/gtest.h>
 
 using std::string;
@@ -85,3 +86,76 @@ TEST_F(ReaderTest, GetFileName) {
     Reader::get_file_name(ReaderTest::DIST_DIR / "document.pdf"));
   ASSERT_EQ("", Reader::get_file_name(ReaderTest::DIST_DIR / "not_found.zip"));
 }
+
+TEST_F(ReaderTest, ScanImageFilesRecursive) {
+  fs::create_directories(ReaderTest::DIST_DIR / "nested" / "deeper");
+  fs::create_directories(ReaderTest::DIST_DIR / "folder.png");
+  make_file(ReaderTest::DIST_DIR / "nested", "inner.jpg");
+  make_file(ReaderTest::DIST_DIR / "nested" / "deeper", "deep.PNG");
+  make_file(ReaderTest::DIST_DIR / "nested" / "deeper", "notes.txt");
+
+  vector<fs::path> expected_image_paths{
+    ReaderTest::DIST_DIR / "image.bmp", ReaderTest::DIST_DIR / "image.gif",
+      ReaderTest::DIST_DIR / "image.jpg", ReaderTest::DIST_DIR / "image.png",
+      ReaderTest::DIST_DIR / "image.tiff", ReaderTest::DIST_DIR / "image.webp",
+      ReaderTest::DIST_DIR / "nested" / "inner.jpg",
+      ReaderTest::DIST_DIR / "nested" / "deeper" / "deep.PNG",
+  };
+
+  for (unsigned threads : { 1u, 4u }) {
+    vector<fs::path> image_paths;
+    Reader::scan_image_files(ReaderTest::DIST_DIR, [&](const fs::path& path) {
+      image_paths.push_back(path);
+    }, Reader::ScanOptions{ true, threads });
+
+    std::sort(expected_image_paths.begin(), expected_image_paths.end());
+    std::sort(image_paths.begin(), image_paths.end());
+    ASSERT_EQ(expected_image_paths, image_paths);
+  }
+}
+
+TEST_F(ReaderTest, ScanImageFilesNonRecursive) {
+  fs::create_directories(ReaderTest::DIST_DIR / "nested");
+  make_file(ReaderTest::DIST_DIR / "nested", "inner.jpg");
+
+  std::size_t count = 0;
+  Reader::scan_image_files(ReaderTest::DIST_DIR, [&](const fs::path&) { count++; }, Reader::ScanOptions{ false, 4 });
+  ASSERT_EQ(6, count);
+}
+
+TEST_F(ReaderTest, ScanMissingDirectory) {
+  std::size_t count = 0;
+  Reader::scan_image_files(ReaderTest::DIST_DIR / "missing", [&](const fs::path&) { count++; });
+  ASSERT_EQ(0, count);
+}
+
+TEST_F(ReaderTest, IsImageEntry) {
+  fs::create_directories(ReaderTest::DIST_DIR / "folder.png");
+  ASSERT_TRUE(Reader::is_image_entry(fs::directory_entry(ReaderTest::DIST_DIR / "image.jpg")));
+  ASSERT_FALSE(Reader::is_image_entry(fs::directory_entry(ReaderTest::DIST_DIR / "document.pdf")));
+  ASSERT_FALSE(Reader::is_image_entry(fs::directory_entry(ReaderTest::DIST_DIR / "folder.png")));
+}
+
+TEST_F(ReaderTest, WalkFilesIgnoresNames) {
+  fs::create_directories(ReaderTest::DIST_DIR / "nested");
+  for (int i = 0; i < 100; i++)
+    make_file(ReaderTest::DIST_DIR / "nested", "file" + std::to_string(i));
+
+  std::mutex mutex;
+  std::size_t count = 0;
+  std::size_t largest_batch = 0;
+  Reader::walk_files(ReaderTest::DIST_DIR, [&](const vector<fs::path>& files) {
+    std::lock_guard<std::mutex> lock(mutex);
+    count += files.size();
+    largest_batch = std::max(largest_batch, files.size());
+  }, Reader::ScanOptions{ true, 4 });
+  ASSERT_EQ(files.size() + 100, count);
+  ASSERT_LT(largest_batch, 100);
+}
+
+TEST_F(ReaderTest, GetTypeExtension) {
+  ASSERT_EQ("jpg", Reader::get_type_extension(Reader::ImageType::JPEG));
+  ASSERT_EQ("png", Reader::get_type_extension(Reader::ImageType::PNG));
+  for (const auto& [extension, type] : Reader::image_type_map)
+    ASSERT_EQ(type, Reader::image_type_map.at(Reader::get_type_extension(type)));
+}
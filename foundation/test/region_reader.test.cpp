@@ -0,0 +1,129 @@
+#include "include/region_reader.hpp"
+#include "test/test_utils.hpp"
+#include <gtest/gtest.h>
+#include <opencv2/opencv.hpp>
+#include <cstdio>
+#include <filesystem>
+#include <png.h>
+#include <vector>
+
+namespace fs = std::filesystem;
+using namespace ImageEditor;
+
+class RegionReaderTest : public ::testing::Test {
+public:
+  const fs::path DIST_DIR = fs::current_path() / "dist";
+
+  // Every pixel is different, so a misplaced region can't go unnoticed
+  fs::path make_image(fs::path name, int width, int height, int type) {
+    cv::Mat image(height, width, type);
+    for (int y = 0; y < height; y++) {
+      uchar* row = image.ptr(y);
+      for (int x = 0; x < width * image.channels(); x++)
+        row[x] = static_cast<uchar>((x * 3 + y * 5) % 256);
+    }
+    fs::path file_path = DIST_DIR / name;
+    cv::imwrite(file_path.string(), image);
+    return file_path;
+  }
+
+  // An 8-bit palette PNG with a tRNS chunk, the kind pngquant writes. cv::imwrite never writes
+  // palettes, so this goes through libpng.
+  fs::path make_palette_png(fs::path name, int width, int height) {
+    fs::path file_path = DIST_DIR / name;
+    std::FILE* file = std::fopen(file_path.c_str(), "wb");
+    png_structp png = png_create_write_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
+    png_infop info = png_create_info_struct(png);
+    png_init_io(png, file);
+    png_set_IHDR(png, info, png_uint_32(width), png_uint_32(height), 8, PNG_COLOR_TYPE_PALETTE, PNG_INTERLACE_NONE,
+      PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+    png_color palette[4] = { { 255, 0, 0 }, { 0, 255, 0 }, { 0, 0, 255 }, { 200, 100, 50 } };
+    png_byte alpha[2] = { 0, 128 };
+    png_set_PLTE(png, info, palette, 4);
+    png_set_tRNS(png, info, alpha, 2, nullptr);
+    png_write_info(png, info);
+    std::vector<png_byte> row(std::size_t(width), 0);
+    for (int y = 0; y < height; y++) {
+      for (int x = 0; x < width; x++)
+        row[std::size_t(x)] = png_byte((x + 2 * y) % 4);
+      png_write_row(png, row.data());
+    }
+    png_write_end(png, info);
+    png_destroy_write_struct(&png, &info);
+    std::fclose(file);
+    return file_path;
+  }
+
+protected:
+  void SetUp() override { fs::create_directory(DIST_DIR); }
+
+  void TearDown() override { fs::remove_all(DIST_DIR); }
+};
+
+TEST_F(RegionReaderTest, IsRegionInside) {
+  EXPECT_TRUE(is_region_inside(cv::Rect(0, 0, 10, 10), 10, 10));
+  EXPECT_FALSE(is_region_inside(cv::Rect(1, 0, 10, 10), 10, 10));
+  EXPECT_FALSE(is_region_inside(cv::Rect(-1, 0, 5, 5), 10, 10));
+  EXPECT_FALSE(is_region_inside(cv::Rect(0, 0, 0, 5), 10, 10));
+}
+
+TEST_F(RegionReaderTest, RegionMatchesFullDecode) {
+  cv::Rect region(37, 11, 50, 40);
+  for (fs::path name : { "image.png", "image.tiff", "image.bmp" }) {
+    for (int type : { CV_8UC1, CV_8UC3, CV_8UC4 }) {
+      fs::path file_path = make_image(name, 160, 90, type);
+      Result<cv::Mat> expected = read_image(file_path);
+      Result<cv::Mat> region_image = read_image_region(file_path, region);
+      ASSERT_EQ(Status::SUCCESS, region_image.status) << file_path;
+      ASSERT_EQ(region.size(), region_image.data.size());
+      ASSERT_EQ(expected.data.type(), region_image.data.type());
+      EXPECT_EQ(0, cv::norm(expected.data(region), region_image.data, cv::NORM_INF)) << file_path;
+    }
+  }
+}
+
+TEST_F(RegionReaderTest, RegionOutsideImageFails) {
+  fs::path file_path = make_image("image.png", 20, 20, CV_8UC3);
+  EXPECT_EQ(Status::FAILURE, read_image_region(file_path, cv::Rect(10, 10, 20, 20)).status);
+}
+
+TEST_F(RegionReaderTest, ReadSquare) {
+  fs::path file_path = make_image("image.png", 300, 100, CV_8UC3);
+  Result<cv::Mat> full = read_image(file_path);
+  Result<cv::Mat> square = read_square(file_path, PivotRect(HorizontalPivot::RIGHT));
+  ASSERT_EQ(Status::SUCCESS, square.status);
+  ASSERT_EQ(cv::Size(100, 100), square.data.size());
+  EXPECT_EQ(0, cv::norm(full.data(cv::Rect(200, 0, 100, 100)), square.data, cv::NORM_INF));
+
+  EXPECT_EQ(Status::FAILURE, read_square(DIST_DIR / "missing.png", PivotRect()).status);
+}
+
+TEST_F(RegionReaderTest, UnchangedRegionMatchesFullDecode) {
+  cv::Rect region(37, 11, 50, 40);
+  for (int type : { CV_8UC1, CV_8UC4, CV_16UC1, CV_16UC3, CV_16UC4 }) {
+    cv::Mat image = TestUtils::make_image(160, 90, type);
+    fs::path file_path = DIST_DIR / "image.png";
+    ASSERT_TRUE(cv::imwrite(file_path.string(), image));
+
+    cv::Mat expected = cv::imread(file_path.string(), cv::IMREAD_UNCHANGED);
+    Result<cv::Mat> region_image = read_image_region(file_path, region, ReadMode::UNCHANGED);
+    ASSERT_EQ(Status::SUCCESS, region_image.status);
+    ASSERT_EQ(type, region_image.data.type());
+    EXPECT_EQ(0, cv::norm(expected(region), region_image.data, cv::NORM_INF)) << type;
+  }
+}
+
+TEST_F(RegionReaderTest, PaletteWithTransparencyMatchesFullDecode) {
+  fs::path file_path = make_palette_png("palette.png", 37, 21);
+  cv::Rect region(5, 3, 17, 15);
+  for (ReadMode mode : { ReadMode::COLOR, ReadMode::UNCHANGED }) {
+    Result<cv::Mat> expected = read_image(file_path, mode);
+    Result<cv::Mat> region_image = read_image_region(file_path, region, mode);
+    ASSERT_EQ(Status::SUCCESS, region_image.status);
+    ASSERT_EQ(expected.data.type(), region_image.data.type());
+    ASSERT_EQ(region.size(), region_image.data.size());
+    EXPECT_EQ(0, cv::norm(expected.data(region), region_image.data, cv::NORM_INF));
+  }
+  EXPECT_EQ(CV_8UC3, read_image_region(file_path, region).data.type());
+  EXPECT_EQ(CV_8UC4, read_image_region(file_path, region, ReadMode::UNCHANGED).data.type());
+}
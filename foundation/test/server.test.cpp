@@ -0,0 +1,137 @@
+#include "include/server.hpp"
+#include <gtest/gtest.h>
+#include <opencv2/opencv.hpp>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <thread>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+using namespace Server;
+
+class ServerTest : public ::testing::Test {
+public:
+  const fs::path DIST_DIR = fs::current_path() / "dist";
+  // Socket paths are limited to about 100 bytes, so this one does not live in DIST_DIR
+  const fs::path SOCKET_PATH = fs::temp_directory_path() / ("chromaedit_test_" + std::to_string(getpid()) + ".sock");
+
+  fs::path make_image_file(const std::string& name, int width, int height) {
+    cv::Mat image(height, width, CV_8UC3);
+    cv::randu(image, cv::Scalar::all(0), cv::Scalar::all(255));
+    fs::path file_path = DIST_DIR / name;
+    cv::imwrite(file_path.string(), image);
+    return file_path;
+  }
+
+  static cv::Mat decode(const std::vector<uchar>& bytes) {
+    return cv::imdecode(bytes, cv::IMREAD_UNCHANGED);
+  }
+
+protected:
+  void SetUp() override { fs::create_directory(DIST_DIR); }
+
+  void TearDown() override { fs::remove_all(DIST_DIR); }
+};
+
+TEST_F(ServerTest, LruCacheEvictsLeastRecentlyUsed) {
+  LruCache<std::string, int> cache(10);
+  cache.put("a", 1, 4);
+  cache.put("b", 2, 4);
+  EXPECT_EQ(1, cache.get("a"));
+  // Over capacity, "b" was used least recently
+  cache.put("c", 3, 4);
+  EXPECT_FALSE(cache.get("b"));
+  EXPECT_EQ(3, cache.get("c"));
+  // Too big to store at all
+  cache.put("d", 4, 11);
+  EXPECT_FALSE(cache.get("d"));
+
+  auto stats = cache.stats();
+  EXPECT_EQ(2u, stats.hits);
+  EXPECT_EQ(2u, stats.misses);
+  EXPECT_EQ(1u, stats.evictions);
+  EXPECT_EQ(2u, stats.entries);
+  EXPECT_EQ(8u, stats.bytes);
+}
+
+TEST_F(ServerTest, CachesResultsAndImages) {
+  fs::path file_path = make_image_file("image.png", 300, 200);
+  CropService service;
+  Request request{ file_path, {}, ImageEditor::PivotRect(ImageEditor::HorizontalPivot::LEFT), 0, "png" };
+
+  Result<Encoded> first = service.crop(request);
+  ASSERT_EQ(Status::SUCCESS, first.status);
+  cv::Mat expected = cv::imread(file_path.string(), cv::IMREAD_UNCHANGED)(cv::Rect(0, 0, 200, 200));
+  EXPECT_EQ(0, cv::norm(expected, decode(*first.data), cv::NORM_INF));
+
+  // The same request is answered from the result cache with the same bytes
+  Result<Encoded> second = service.crop(request);
+  ASSERT_EQ(Status::SUCCESS, second.status);
+  EXPECT_EQ(first.data, second.data);
+
+  // New parameters on the same content reuse the decoded image, whether it comes as a path or as bytes
+  Request resized{ "", {}, ImageEditor::PivotRect(), 64, ".jpg" };
+  std::ifstream file(file_path, std::ios::binary);
+  resized.bytes.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+  Result<Encoded> third = service.crop(resized);
+  ASSERT_EQ(Status::SUCCESS, third.status);
+  EXPECT_EQ(cv::Size(64, 64), decode(*third.data).size());
+
+  Stats stats = service.stats();
+  EXPECT_EQ(3u, stats.requests);
+  EXPECT_EQ(1u, stats.results.hits);
+  EXPECT_EQ(2u, stats.results.misses);
+  EXPECT_EQ(1u, stats.images.hits);
+  EXPECT_EQ(1u, stats.images.misses);
+  EXPECT_DOUBLE_EQ(1.0 / 3, stats.result_hit_ratio());
+  EXPECT_GT(stats.p99_seconds, 0);
+
+  EXPECT_EQ(Status::FAILURE, service.crop(Request{ DIST_DIR / "missing.png" }).status);
+  EXPECT_EQ(1u, service.stats().failures);
+}
+
+TEST_F(ServerTest, ChangedFilesAreHashedAgain) {
+  fs::path file_path = make_image_file("image.png", 120, 80);
+  CropService service;
+  Request request{ file_path, {}, ImageEditor::PivotRect(), 0, "png" };
+  ASSERT_EQ(Status::SUCCESS, service.crop(request).status);
+
+  cv::imwrite(file_path.string(), cv::Mat(90, 150, CV_8UC3, cv::Scalar(1, 2, 3)));
+  Result<Encoded> changed = service.crop(request);
+  ASSERT_EQ(Status::SUCCESS, changed.status);
+  EXPECT_EQ(cv::Size(90, 90), decode(*changed.data).size());
+  EXPECT_EQ(0u, service.stats().results.hits);
+}
+
+TEST_F(ServerTest, ServesOverUnixSocket) {
+  fs::path file_path = make_image_file("image.png", 200, 100);
+  CropService service;
+  SocketServer server(SOCKET_PATH, service);
+  ASSERT_TRUE(server.is_open());
+  // No ASSERTs until the server thread is joined
+  std::thread thread([&] { server.run(); });
+
+  {
+    Client client(SOCKET_PATH);
+    EXPECT_TRUE(client.is_open());
+    Request request{ file_path, {}, ImageEditor::PivotRect(ImageEditor::HorizontalPivot::RIGHT), 50, "png" };
+    for (int i = 0; i < 3; i++) {
+      Result<std::vector<uchar>> reply = client.crop(request);
+      EXPECT_EQ(Status::SUCCESS, reply.status);
+      EXPECT_EQ(cv::Size(50, 50), decode(reply.data).size());
+    }
+    EXPECT_EQ(Status::FAILURE, client.crop(Request{ DIST_DIR / "missing.png" }).status);
+    // The connection survives a failed crop
+    Result<std::string> stats = client.stats();
+    EXPECT_EQ(Status::SUCCESS, stats.status);
+    EXPECT_NE(std::string::npos, stats.data.find("\"result_cache\":{\"hits\":2,"));
+  }
+
+  // A client that stays connected does not keep the server from stopping
+  Client idle(SOCKET_PATH);
+  EXPECT_TRUE(idle.is_open());
+  server.stop();
+  thread.join();
+  EXPECT_EQ(4u, service.stats().requests);
+}
@@ -0,0 +1,97 @@
+#include "include/stream_crop.hpp"
+#include "include/region_reader.hpp"
+#include "test/test_utils.hpp"
+#include <gtest/gtest.h>
+#include <opencv2/opencv.hpp>
+#include <filesystem>
+#include <iterator>
+
+namespace fs = std::filesystem;
+using namespace ImageEditor;
+
+class StreamCropTest : public ::testing::Test {
+public:
+  const fs::path DIST_DIR = fs::current_path() / "dist";
+  const fs::path OUT_DIR = DIST_DIR / "output";
+
+  fs::path make_png(fs::path name, int width, int height, int type) {
+    fs::path file_path = DIST_DIR / name;
+    cv::imwrite(file_path.string(), TestUtils::make_image(width, height, type));
+    return file_path;
+  }
+
+protected:
+  void SetUp() override { fs::create_directory(DIST_DIR); }
+
+  void TearDown() override { fs::remove_all(DIST_DIR); }
+};
+
+TEST_F(StreamCropTest, MatchesInMemoryCrop) {
+  PivotRect pivot_rect(HorizontalPivot::RIGHT, VerticalPivot::CENTER);
+  for (int type : { CV_8UC1, CV_8UC3, CV_8UC4, CV_16UC3 }) {
+    fs::path input = make_png("image.png", 331, 157, type);
+    fs::path output = OUT_DIR / "image.png";
+    // A budget of a few rows, so the square goes through many bands
+    ASSERT_TRUE(crop_square_streaming(input, pivot_rect, output, 8 * 1024));
+
+    Result<cv::Mat> expected = read_square(input, pivot_rect, ReadMode::UNCHANGED);
+    cv::Mat cropped = cv::imread(output.string(), cv::IMREAD_UNCHANGED);
+    ASSERT_EQ(type, cropped.type());
+    ASSERT_EQ(expected.data.size(), cropped.size());
+    EXPECT_EQ(0, cv::norm(expected.data, cropped, cv::NORM_INF)) << type;
+  }
+}
+
+TEST_F(StreamCropTest, StreamsToJpeg) {
+  fs::path input = make_png("image.png", 200, 120, CV_16UC4);
+  fs::path output = OUT_DIR / "image.jpg";
+  ASSERT_TRUE(crop_square_streaming(input, PivotRect(), output, 16 * 1024));
+  cv::Mat cropped = cv::imread(output.string(), cv::IMREAD_UNCHANGED);
+  EXPECT_EQ(CV_8UC3, cropped.type());
+  EXPECT_EQ(cv::Size(120, 120), cropped.size());
+}
+
+TEST_F(StreamCropTest, FailsWithoutLeavingOutput) {
+  fs::path input = make_png("image.png", 200, 120, CV_8UC3);
+  fs::path output = OUT_DIR / "image.png";
+  EXPECT_FALSE(crop_square_streaming(input, PivotRect(), output, 100));
+  EXPECT_FALSE(fs::exists(output));
+
+  fs::resize_file(input, fs::file_size(input) / 2);
+  EXPECT_FALSE(crop_square_streaming(input, PivotRect(), output));
+  EXPECT_FALSE(fs::exists(output));
+
+  EXPECT_FALSE(crop_square_streaming(input, PivotRect(), OUT_DIR / "image.bmp"));
+
+  // A failed crop onto its input leaves the input as it was
+  std::uintmax_t size = fs::file_size(input);
+  EXPECT_FALSE(crop_square_streaming(input, PivotRect(), input));
+  EXPECT_EQ(size, fs::file_size(input));
+}
+
+TEST_F(StreamCropTest, CropInPlace) {
+  fs::path input = make_png("image.png", 331, 157, CV_8UC3);
+  PivotRect pivot_rect(HorizontalPivot::RIGHT);
+  Result<cv::Mat> expected = read_square(input, pivot_rect, ReadMode::UNCHANGED);
+  ASSERT_EQ(Status::SUCCESS, expected.status);
+
+  ASSERT_TRUE(crop_square_streaming(input, pivot_rect, input, 8 * 1024));
+  cv::Mat cropped = cv::imread(input.string(), cv::IMREAD_UNCHANGED);
+  ASSERT_EQ(expected.data.size(), cropped.size());
+  EXPECT_EQ(0, cv::norm(expected.data, cropped, cv::NORM_INF));
+  EXPECT_EQ(1, std::distance(fs::directory_iterator(DIST_DIR), fs::directory_iterator()));
+}
+
+TEST_F(StreamCropTest, ShouldStreamCrop) {
+  fs::path input = make_png("image.png", 64, 64, CV_8UC3);
+  EXPECT_FALSE(should_stream_crop(input, OUT_DIR / "image.png"));
+  EXPECT_FALSE(should_stream_crop(DIST_DIR / "missing.png", OUT_DIR / "image.png"));
+
+  // 20000 x 20000 RGB is about 1.2 GB decoded, well over STREAMING_THRESHOLD
+  Reader::ImageInfo info{ Reader::ImageType::PNG, 20000, 20000, 3, 8 };
+  EXPECT_TRUE(should_stream_crop(info, OUT_DIR / "image.png"));
+  EXPECT_TRUE(should_stream_crop(info, OUT_DIR / "image.jpg"));
+  EXPECT_FALSE(should_stream_crop(info, OUT_DIR / "image.bmp"));
+  EXPECT_FALSE(should_stream_crop(Reader::ImageInfo{ Reader::ImageType::PNG, 64, 64, 3, 8 }, OUT_DIR / "image.png"));
+  EXPECT_FALSE(should_stream_crop(Reader::ImageInfo{ Reader::ImageType::BMP, 20000, 20000, 3, 8 }, OUT_DIR / "image.png"));
+}
@@ -0,0 +1,17 @@
+#ifndef TEST_UTILS_HPP
+#define TEST_UTILS_HPP
+
+#include <opencv2/opencv.hpp>
+
+namespace TestUtils {
+
+  // A width x height image of type filled with uniform noise over the whole range of its depth
+  inline cv::Mat make_image(int width, int height, int type = CV_8UC3) {
+    cv::Mat image(height, width, type);
+    cv::randu(image, cv::Scalar::all(0), cv::Scalar::all(CV_MAT_DEPTH(type) == CV_16U ? 65535 : 255));
+    return image;
+  }
+
+} // namespace TestUtils
+
+#endif // TEST_UTILS_HPP
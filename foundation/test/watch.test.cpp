@@ -0,0 +1,88 @@
+#include "include/watch.hpp"
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <thread>
+
+namespace fs = std::filesystem;
+using namespace Watch;
+
+class WatchTest : public ::testing::Test {
+public:
+  const fs::path DIST_DIR = fs::current_path() / "dist";
+  const Options OPTIONS{ std::chrono::milliseconds(50), true };
+
+  // Run watcher on its own thread until stop_after has passed, collecting the reported files
+  // relative to DIST_DIR
+  std::vector<std::string> watch(Watcher& watcher, const std::function<void()>& write_files,
+    std::chrono::milliseconds stop_after = std::chrono::milliseconds(400)) {
+    std::mutex mutex;
+    std::vector<std::string> files;
+    std::thread thread([&] {
+      watcher.run([&](const fs::path& file) {
+        std::lock_guard<std::mutex> lock(mutex);
+        files.push_back(file.lexically_relative(DIST_DIR).string());
+      });
+    });
+    write_files();
+    std::this_thread::sleep_for(stop_after);
+    watcher.stop();
+    thread.join();
+    std::sort(files.begin(), files.end());
+    return files;
+  }
+
+protected:
+  void SetUp() override { fs::create_directory(DIST_DIR); }
+
+  void TearDown() override { fs::remove_all(DIST_DIR); }
+};
+
+TEST_F(WatchTest, ReportsWrittenAndMovedImages) {
+  fs::create_directory(DIST_DIR / "sub");
+  std::ofstream(DIST_DIR / "before.png") << "old";
+  Watcher watcher({ DIST_DIR }, OPTIONS);
+  ASSERT_TRUE(watcher.is_open());
+  std::vector<std::string> files = watch(watcher, [&] {
+    std::ofstream(DIST_DIR / "a.png") << "png";
+    std::ofstream(DIST_DIR / "notes.txt") << "text";
+    std::ofstream(DIST_DIR / "sub" / "b.jpg") << "jpg";
+    // Written under a temporary name and renamed, as most downloaders do
+    std::ofstream(DIST_DIR / "c.part") << "webp";
+    fs::rename(DIST_DIR / "c.part", DIST_DIR / "c.webp");
+  });
+  EXPECT_EQ(std::vector<std::string>({ "a.png", "c.webp", "sub/b.jpg" }), files);
+}
+
+TEST_F(WatchTest, DebouncesFilesWrittenInSeveralPasses) {
+  Watcher watcher({ DIST_DIR }, OPTIONS);
+  std::vector<std::string> files = watch(watcher, [&] {
+    for (int i = 0; i < 5; i++) {
+      std::ofstream(DIST_DIR / "slow.png", std::ios::app) << "part";
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+  });
+  EXPECT_EQ(std::vector<std::string>({ "slow.png" }), files);
+}
+
+TEST_F(WatchTest, WatchesNewDirectories) {
+  Watcher watcher({ DIST_DIR }, OPTIONS);
+  std::vector<std::string> files = watch(watcher, [&] {
+    // The first file can land before the new directories are watched, the scan on adding them catches it
+    fs::create_directories(DIST_DIR / "new" / "deeper");
+    std::ofstream(DIST_DIR / "new" / "deeper" / "first.png") << "png";
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    std::ofstream(DIST_DIR / "new" / "deeper" / "second.png") << "png";
+  });
+  EXPECT_EQ(std::vector<std::string>({ "new/deeper/first.png", "new/deeper/second.png" }), files);
+}
+
+TEST_F(WatchTest, StopsBeforeRunAndOnMissingDirectories) {
+  Watcher watcher({ DIST_DIR / "missing" }, OPTIONS);
+  EXPECT_FALSE(watcher.is_open());
+  // A stop that comes first makes run return right away
+  watcher.stop();
+  watcher.run([](const fs::path&) { FAIL(); });
+}
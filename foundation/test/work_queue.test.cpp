@@ -0,0 +1,126 @@
+#include "include/work_queue.hpp"
+#include <gtest/gtest.h>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+using std::string;
+using std::vector;
+using namespace Shard;
+
+class WorkQueueTest : public ::testing::Test {
+public:
+  const fs::path DIST_DIR = fs::current_path() / "dist";
+  const fs::path QUEUE_DIR = DIST_DIR / "queue";
+
+  static vector<fs::path> make_files(std::size_t count) {
+    vector<fs::path> files;
+    for (std::size_t i = 0; i < count; i++)
+      files.push_back("/images/" + std::to_string(i) + ".png");
+    return files;
+  }
+
+  // Run worker processes against the queue, each recording the plan indices it processed in its
+  // own file. Returns how many times every file was processed.
+  vector<int> run_workers(int workers, std::size_t file_count, std::size_t chunk_size) {
+    vector<pid_t> children;
+    for (int worker = 0; worker < workers; worker++) {
+      pid_t pid = ::fork();
+      if (pid == 0) {
+        WorkQueue queue(QUEUE_DIR, [&] { return make_files(file_count); }, Options{ chunk_size });
+        std::ofstream log(DIST_DIR / ("worker" + std::to_string(worker)));
+        while (std::optional<Chunk> chunk = queue.claim()) {
+          for (std::size_t file : chunk->pending) {
+            log << file << std::endl;
+            queue.complete(chunk->index, file, true);
+          }
+          queue.finish(chunk->index);
+        }
+        log.close();
+        ::_exit(queue.is_open() ? 0 : 1);
+      }
+      children.push_back(pid);
+    }
+    for (pid_t pid : children) {
+      int status = 0;
+      ::waitpid(pid, &status, 0);
+      EXPECT_TRUE(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    }
+
+    vector<int> processed(file_count, 0);
+    for (int worker = 0; worker < workers; worker++) {
+      std::ifstream log(DIST_DIR / ("worker" + std::to_string(worker)));
+      for (std::size_t file; log >> file;)
+        processed.at(file)++;
+    }
+    return processed;
+  }
+
+protected:
+  void SetUp() override { fs::create_directory(DIST_DIR); }
+
+  void TearDown() override { fs::remove_all(DIST_DIR); }
+};
+
+TEST_F(WorkQueueTest, WorkersProcessEveryFileOnce) {
+  vector<int> processed = run_workers(4, 1000, 7);
+  EXPECT_EQ(vector<int>(1000, 1), processed);
+
+  WorkQueue queue(QUEUE_DIR, [] { return vector<fs::path>(); });
+  Progress progress = queue.progress();
+  EXPECT_EQ(143, progress.chunks);
+  EXPECT_EQ(143, progress.done_chunks);
+  EXPECT_EQ(1000, progress.files);
+}
+
+TEST_F(WorkQueueTest, OnlyTheFirstPlanIsKept) {
+  WorkQueue first(QUEUE_DIR, [] { return make_files(10); }, Options{ 4 });
+  bool listed = false;
+  WorkQueue second(QUEUE_DIR, [&] { listed = true; return make_files(3); }, Options{ 2 });
+  ASSERT_TRUE(second.is_open());
+  EXPECT_FALSE(listed);
+  EXPECT_EQ(make_files(10), second.files());
+  EXPECT_EQ(3, second.chunk_count());
+}
+
+TEST_F(WorkQueueTest, ResumesAfterACrash) {
+  pid_t pid = ::fork();
+  if (pid == 0) {
+    WorkQueue queue(QUEUE_DIR, [] { return make_files(4); }, Options{ 4 });
+    std::optional<Chunk> chunk = queue.claim();
+    queue.complete(chunk->index, chunk->pending[0], true);
+    queue.complete(chunk->index, chunk->pending[1], false);
+    ::_exit(0);  // Crash: the claim is left behind and the chunk is not finished
+  }
+  ::waitpid(pid, nullptr, 0);
+
+  // The owner is gone, so its claim is taken over without waiting for the lease
+  WorkQueue queue(QUEUE_DIR, [] { return make_files(4); });
+  std::optional<Chunk> chunk = queue.claim();
+  ASSERT_TRUE(chunk.has_value());
+  EXPECT_EQ(0, chunk->index);
+  EXPECT_EQ(vector<std::size_t>({ 2, 3 }), chunk->pending);
+  EXPECT_TRUE(queue.finish(chunk->index));
+  EXPECT_FALSE(queue.claim().has_value());
+}
+
+TEST_F(WorkQueueTest, WaitsForTheLeaseOfOtherHosts) {
+  WorkQueue queue(QUEUE_DIR, [] { return make_files(2); }, Options{ 2, std::chrono::milliseconds(300) });
+  std::ofstream(QUEUE_DIR / "claims" / "0.0") << "other-host 1\n";
+
+  auto start = std::chrono::steady_clock::now();
+  std::optional<Chunk> chunk = queue.claim();
+  ASSERT_TRUE(chunk.has_value());
+  EXPECT_GE(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(250));
+  EXPECT_TRUE(fs::exists(QUEUE_DIR / "claims" / "0.1"));
+  EXPECT_EQ(vector<std::size_t>({ 0, 1 }), chunk->pending);
+}
+
+TEST_F(WorkQueueTest, StopEndsClaims) {
+  WorkQueue queue(QUEUE_DIR, [] { return make_files(2); });
+  queue.stop();
+  EXPECT_FALSE(queue.claim().has_value());
+}